@@ -31,29 +31,59 @@
 #endif /* HAVE_CONFIG_H */
 
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <string.h>
 #include <stdlib.h>
 
+#include <sys/stat.h>
+
 #include "geh.h"
 #include "dir.h"
+#include "dir_read.h"
 #include "file_multi.h"
+#include "file_filter.h"
+#include "file_ident.h"
 #include "file_queue.h"
+#include "file_sniff.h"
 
 static void dir_scan_worker (gpointer data);
-static void dir_scan_recursive (struct dir_scan *ds,
-                                const gchar *path, gint levels);
+static gpointer dir_scan_walk (gpointer data);
+static struct dir_scan_dir *dir_scan_take (struct dir_scan_walker *walker);
+static void dir_scan_queue_dir (struct dir_scan_walker *walker,
+                                gchar *path, gint depth,
+                                struct dir_index *index);
+static void dir_scan_read (struct dir_scan_walker *walker,
+                           struct dir_scan_dir *dir);
+static void dir_scan_dir_free (struct dir_scan_dir *dir);
+static void dir_scan_read_entry (gpointer data, struct dir_read_entry *de);
+static void dir_scan_replay_entry (gpointer data, const gchar *name,
+                                   gboolean is_dir,
+                                   struct dir_index_ident *id);
+static void dir_scan_add_entry (struct dir_scan_list *list,
+                                const gchar *name, gboolean is_dir,
+                                off_t size, time_t mtime,
+                                guint64 dev, guint64 ino);
+static gchar *dir_scan_key (const gchar *name);
+static gint dir_scan_entry_cmp (gconstpointer a, gconstpointer b);
+static void dir_scan_heap_down (struct dir_scan_entry *heap, guint n,
+                                guint pos);
+static void dir_scan_push_sorted (struct dir_scan *ds, GArray *files,
+                                  GPtrArray *names, GArray *idents);
+static void dir_scan_push_ordered (struct dir_scan *ds, GArray *files);
 
 /**
  * Starts directory scanning thread.
  *
  * @param queue file_queue to push scanned files onto.
  * @param files NULL terminated list of files.
+ * @param watch struct dir_watch to add scanned directories to, or NULL.
  * @param file_count_inc File count callback.
  * @param file_count_inc_data File count callback data.
  * @return Pointer to struct dir_scan doing the work.
  */
 struct dir_scan*
 dir_scan_start (struct file_queue *queue, gchar **files,
+                struct dir_watch *watch,
                 void (*file_count_inc)(gpointer, gint),
                 gpointer file_count_inc_data)
 {
@@ -68,8 +98,15 @@ dir_scan_start (struct file_queue *queue, gchar **files,
     /* Init */
     ds->queue = queue;
     ds->files = files;
+    ds->watch = watch;
     ds->file_count_inc = file_count_inc;
     ds->file_count_inc_data = file_count_inc_data;
+    ds->walkers = NULL;
+    ds->walkers_count = 0;
+    ds->pending = 0;
+    g_mutex_init (&ds->idle_mutex);
+    g_cond_init (&ds->idle_cond);
+    g_mutex_init (&ds->push_mutex);
     ds->stop = FALSE;
 
     /* Start worker thread scanning directories and files */
@@ -95,6 +132,9 @@ dir_scan_stop (struct dir_scan *ds)
     g_thread_join (ds->thread_work);
 
     /* Free resources */
+    g_mutex_clear (&ds->idle_mutex);
+    g_cond_clear (&ds->idle_cond);
+    g_mutex_clear (&ds->push_mutex);
     g_free (ds);
 }
 
@@ -106,82 +146,593 @@ dir_scan_stop (struct dir_scan *ds)
 void
 dir_scan_worker (gpointer data)
 {
-    gint i;
+    guint i;
+    gint dirs = 0;
+    gchar *owner;
+    GSList *indexes = NULL, *it;
+    struct dir_index *index;
+    struct file_multi *file;
     struct dir_scan *ds = (struct dir_scan*) data;
 
+    /* Create walkers, the first one is run by this thread. */
+    ds->walkers_count = CLAMP (g_get_num_processors (),
+                               DIR_SCAN_THREADS_MIN, DIR_SCAN_THREADS_MAX);
+    ds->walkers = g_malloc (sizeof (struct dir_scan_walker)
+                            * ds->walkers_count);
+    for (i = 0; i < ds->walkers_count; i++) {
+        ds->walkers[i].ds = ds;
+        ds->walkers[i].id = i;
+        ds->walkers[i].thread = NULL;
+        g_queue_init (&ds->walkers[i].dirs);
+        g_mutex_init (&ds->walkers[i].dirs_mutex);
+    }
+
     for (i = 0; ! ds->stop && ds->files[i] != NULL; i++) {
         if (g_file_test (ds->files[i], G_FILE_TEST_IS_DIR)) {
             if (options.recursive) {
-                dir_scan_recursive (ds, ds->files[i], options.levels);
+                /* Spread directories given as arguments over walkers,
+                   each tree has its own index. */
+                index = dir_index_open (ds->files[i], ! options.rescan);
+                indexes = g_slist_prepend (indexes, index);
+                dir_scan_queue_dir (&ds->walkers[dirs++ % ds->walkers_count],
+                                    g_strdup (ds->files[i]), 0, index);
             }
         } else {
-            file_queue_push (ds->queue, file_multi_open (ds->files[i]));
+            /* Same file given twice, or also found in a directory. */
+            file = file_multi_open (ds->files[i]);
+            owner = file_multi_need_fetch (file)
+                ? NULL : file_ident_claim_path (ds->files[i]);
+            if (! owner
+                && (file_multi_need_fetch (file)
+                    || (file_sniff_maybe_image (file_multi_get_type (file))
+                        && file_filter_file (file)))) {
+                file_queue_push (ds->queue, file);
+            } else {
+                /* Not an image, filtered or duplicate, counted in total
+                   by main. */
+                g_free (owner);
+                file_multi_close (file);
+                ds->file_count_inc (ds->file_count_inc_data, -1);
+            }
         }
     }
 
+    /* Walk directories in parallel */
+    if (dirs > 0) {
+        for (i = 1; i < ds->walkers_count; i++) {
+            ds->walkers[i].thread =
+                g_thread_new ("dir_scan_walk", &dir_scan_walk,
+                              &ds->walkers[i]);
+        }
+        dir_scan_walk (&ds->walkers[0]);
+        for (i = 1; i < ds->walkers_count; i++) {
+            g_thread_join (ds->walkers[i].thread);
+        }
+    }
+
+    /* Cleanup walkers, directories are left only when stopped. */
+    for (i = 0; i < ds->walkers_count; i++) {
+        g_queue_foreach (&ds->walkers[i].dirs, (GFunc) &dir_scan_dir_free,
+                         NULL);
+        g_queue_clear (&ds->walkers[i].dirs);
+        g_mutex_clear (&ds->walkers[i].dirs_mutex);
+    }
+    g_free (ds->walkers);
+    ds->walkers = NULL;
+
+    /* Save indexes, an interrupted scan has not seen all directories. */
+    for (it = indexes; it != NULL; it = g_slist_next (it)) {
+        dir_index_close ((struct dir_index*) it->data, ! ds->stop);
+    }
+    g_slist_free (indexes);
+
     /* Signal directory scanning done */
     file_queue_done (ds->queue);
 }
 
 /**
- * Scans path recursive going max levels down
+ * Directory scanning thread, scans directories from its own queue and
+ * steals from other walkers when it runs out. Finishes when there are no
+ * directories queued or being scanned.
+ *
+ * @param data Pointer to struct dir_scan_walker.
+ * @return NULL
+ */
+gpointer
+dir_scan_walk (gpointer data)
+{
+    struct dir_scan_dir *dir;
+    struct dir_scan_walker *walker = (struct dir_scan_walker*) data;
+    struct dir_scan *ds = walker->ds;
+
+    while (! ds->stop) {
+        dir = dir_scan_take (walker);
+        if (dir) {
+            dir_scan_read (walker, dir);
+            dir_scan_dir_free (dir);
+
+            /* Last directory done, wake idle walkers so they finish */
+            if (g_atomic_int_dec_and_test (&ds->pending)) {
+                g_mutex_lock (&ds->idle_mutex);
+                g_cond_broadcast (&ds->idle_cond);
+                g_mutex_unlock (&ds->idle_mutex);
+            }
+
+        } else if (g_atomic_int_get (&ds->pending) == 0) {
+            break;
+
+        } else {
+            /* Others are still scanning and might queue more, wait. */
+            g_mutex_lock (&ds->idle_mutex);
+            if (g_atomic_int_get (&ds->pending) > 0) {
+                g_cond_wait_until (&ds->idle_cond, &ds->idle_mutex,
+                                   g_get_monotonic_time ()
+                                   + DIR_SCAN_IDLE_WAIT);
+            }
+            g_mutex_unlock (&ds->idle_mutex);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Takes directory to scan, from the walkers own queue or the oldest from
+ * another walker.
  *
- * @param ds struct dir_scan to append on.
- * @param path Path to start scanning
- * @param levels max levels down, -1 is limitless
+ * @param walker struct dir_scan_walker to take directory for.
+ * @return Pointer to struct dir_scan_dir, NULL if no work was found.
+ */
+struct dir_scan_dir*
+dir_scan_take (struct dir_scan_walker *walker)
+{
+    guint i;
+    struct dir_scan_dir *dir;
+    struct dir_scan_walker *victim;
+    struct dir_scan *ds = walker->ds;
+
+    /* Own queue, oldest first when scanning breadth first unless the
+       frontier has grown too large, then depth first until it shrinks
+       as depth first keeps the queue short. */
+    g_mutex_lock (&walker->dirs_mutex);
+    if (options.breadth_first
+        && (g_atomic_int_get (&ds->pending) < DIR_SCAN_FRONTIER_MAX)) {
+        dir = g_queue_pop_head (&walker->dirs);
+    } else {
+        dir = g_queue_pop_tail (&walker->dirs);
+    }
+    g_mutex_unlock (&walker->dirs_mutex);
+
+    /* Steal oldest, closest to the top and most likely to be large. */
+    for (i = 1; ! dir && i < ds->walkers_count; i++) {
+        victim = &ds->walkers[(walker->id + i) % ds->walkers_count];
+        g_mutex_lock (&victim->dirs_mutex);
+        dir = g_queue_pop_head (&victim->dirs);
+        g_mutex_unlock (&victim->dirs_mutex);
+    }
+
+    return dir;
+}
+
+/**
+ * Queues directory for scanning on walker.
+ *
+ * @param walker struct dir_scan_walker to queue directory on.
+ * @param path Path to directory, owned by the queue.
+ * @param depth Depth of directory.
+ * @param index Index of tree directory belongs to.
  */
 void
-dir_scan_recursive (struct dir_scan *ds, const gchar *path, gint levels)
+dir_scan_queue_dir (struct dir_scan_walker *walker, gchar *path, gint depth,
+                    struct dir_index *index)
 {
-    gchar *file;
-    guint added = 0;
-    const gchar *name;
-    GDir *dir;
-    GList *list = NULL, *it;
+    struct dir_scan_dir *dir;
 
-    /* Check that path is a directory */
-    if (! g_file_test (path, G_FILE_TEST_IS_DIR)) {
-        g_warning ("%s is not a valid directory", path);
-        return;
+    dir = g_malloc (sizeof (struct dir_scan_dir));
+    dir->path = path;
+    dir->depth = depth;
+    dir->index = index;
+
+    /* Count before queueing so pending never drops to zero early. */
+    g_atomic_int_inc (&walker->ds->pending);
+
+    g_mutex_lock (&walker->dirs_mutex);
+    g_queue_push_tail (&walker->dirs, dir);
+    g_mutex_unlock (&walker->dirs_mutex);
+
+    g_mutex_lock (&walker->ds->idle_mutex);
+    g_cond_signal (&walker->ds->idle_cond);
+    g_mutex_unlock (&walker->ds->idle_mutex);
+}
+
+/**
+ * Frees struct dir_scan_dir.
+ *
+ * @param dir struct dir_scan_dir to free.
+ */
+void
+dir_scan_dir_free (struct dir_scan_dir *dir)
+{
+    g_free (dir->path);
+    g_free (dir);
+}
+
+/**
+ * Collects directory entry into files or directories to scan.
+ *
+ * @param data Pointer to struct dir_scan_list.
+ * @param de Directory entry.
+ */
+void
+dir_scan_read_entry (gpointer data, struct dir_read_entry *de)
+{
+    if (de->type != DIR_READ_TYPE_OTHER) {
+        dir_scan_add_entry ((struct dir_scan_list*) data, de->name,
+                            de->type == DIR_READ_TYPE_DIR,
+                            de->size, de->mtime, de->dev, de->ino);
     }
+}
 
-    /* Open directory */
-    dir = g_dir_open (path, 0, NULL);
-    if (!dir) {
-        g_warning ("unable to open %s as directory", path);
+/**
+ * Collects directory entry replayed from index.
+ *
+ * @param data Pointer to struct dir_scan_list.
+ * @param name Name of entry.
+ * @param is_dir TRUE if entry is a directory.
+ * @param id Identity of file, claimed as when read. NULL for
+ *           directories.
+ */
+void
+dir_scan_replay_entry (gpointer data, const gchar *name, gboolean is_dir,
+                       struct dir_index_ident *id)
+{
+    gchar *path;
+    guint64 dev = 0, ino = 0;
+    struct stat buf;
+    struct dir_scan_list *list = (struct dir_scan_list*) data;
+
+    if (id && id->ino) {
+        dev = id->dev;
+        ino = id->ino;
+    } else if (id) {
+        /* On another device when stored, stat'ed as that device number
+           is not kept. */
+        path = g_build_filename (list->dir->path, name, NULL);
+        if (! g_stat (path, &buf)) {
+            dev = buf.st_dev;
+            ino = buf.st_ino;
+        }
+        g_free (path);
+    }
+
+    dir_scan_add_entry (list, name, is_dir, -1, -1, dev, ino);
+}
+
+/**
+ * Adds entry to files or directories of list.
+ *
+ * @param list struct dir_scan_list to add entry to.
+ * @param name Name of entry.
+ * @param is_dir TRUE if entry is a directory.
+ * @param size Size of file, -1 if not known.
+ * @param mtime Mtime of file, -1 if not known.
+ * @param dev Device of file, 0 if on the device of the directory.
+ * @param ino Inode of file, 0 if not known.
+ */
+void
+dir_scan_add_entry (struct dir_scan_list *list, const gchar *name,
+                    gboolean is_dir, off_t size, time_t mtime,
+                    guint64 dev, guint64 ino)
+{
+    gchar *path, *owner;
+    struct dir_scan_entry entry;
+
+    /* Filtered on name, nothing more than the directory entry needed. */
+    if (! is_dir && ! file_filter_name (name)) {
         return;
     }
 
-    /* Scan directory, store files for sorting later on. */
-    while (! ds->stop && (name = g_dir_read_name (dir)) != NULL) {
-        file = g_build_filename (path, name, NULL);
-        if (g_file_test (file, G_FILE_TEST_IS_DIR)) {
-            dir_scan_recursive (ds, file,
-                                (levels == -1) ? levels : levels - 1);
+    path = g_build_filename (list->dir->path, name, NULL);
+
+    /* Hard links and files seen through another path are shown once,
+       directories are checked when read. */
+    if (! is_dir && ino != 0) {
+        owner = file_ident_claim (path, dev ? dev : list->dev, ino);
+        if (owner) {
+            list->dups++;
+            g_free (owner);
+            g_free (path);
+            return;
+        }
+    }
+
+    /* Stored relative to the directory, device numbers can change
+       between boots. Files on other devices are stored without
+       identity and stat'ed when replayed. */
+    entry.id.dev = 0;
+    entry.id.ino = (dev == 0 || dev == list->dev) ? ino : 0;
+    if (is_dir) {
+        entry.data = path;
+    } else {
+        entry.data = file_multi_open (path);
+        file_multi_set_stat ((struct file_multi*) entry.data, size, mtime);
+        g_free (path);
+
+        /* Skip files excluded on size or mtime, dimensions only read
+           the image header. Files that are not images by content are
+           dropped by the thumbnail job reading them anyway, every file
+           stays in the index. */
+        if (! file_filter_stat ((struct file_multi*) entry.data)
+            || ! file_filter_image ((struct file_multi*) entry.data)) {
+            file_multi_close ((struct file_multi*) entry.data);
+            return;
+        }
+    }
+
+    /* Replayed entries are stored sorted, no key needed. */
+    entry.key = list->sorted ? NULL : dir_scan_key (name);
+    g_array_append_val (is_dir ? list->dirs : list->files, entry);
+}
+
+/**
+ * Creates sort key for file name, ordering numbers by value so IMG_9
+ * comes before IMG_10.
+ *
+ * @param name File name to create key for.
+ * @return Key to compare with strcmp, free with g_free.
+ */
+gchar*
+dir_scan_key (const gchar *name)
+{
+    /* Names not valid in UTF-8 are sorted bytewise. */
+    if (g_utf8_validate (name, -1, NULL)) {
+        return g_utf8_collate_key_for_filename (name, -1);
+    } else {
+        return g_strdup (name);
+    }
+}
+
+/**
+ * Compares keys of two struct dir_scan_entry.
+ */
+gint
+dir_scan_entry_cmp (gconstpointer a, gconstpointer b)
+{
+    return strcmp (((const struct dir_scan_entry*) a)->key,
+                   ((const struct dir_scan_entry*) b)->key);
+}
+
+/**
+ * Moves entry at pos down the min heap of n entries until in place.
+ *
+ * @param heap Entries, heap ordered on key.
+ * @param n Number of entries in heap.
+ * @param pos Position of entry to move.
+ */
+void
+dir_scan_heap_down (struct dir_scan_entry *heap, guint n, guint pos)
+{
+    guint child;
+    struct dir_scan_entry entry = heap[pos];
+
+    while ((child = pos * 2 + 1) < n) {
+        if ((child + 1 < n)
+            && (dir_scan_entry_cmp (&heap[child + 1], &heap[child]) < 0)) {
+            child++;
+        }
+        if (dir_scan_entry_cmp (&heap[child], &entry) >= 0) {
+            break;
+        }
+        heap[pos] = heap[child];
+        pos = child;
+    }
+    heap[pos] = entry;
+}
+
+/**
+ * Pushes files onto the file queue in sorted order, DIR_SCAN_CHUNK at a
+ * time. Files are taken off a heap so the first chunk is pushed without
+ * waiting for the whole directory to be sorted.
+ *
+ * @param ds struct dir_scan pushing files.
+ * @param files struct dir_scan_entry for files, emptied.
+ * @param names If not NULL, names of files are added in pushed order.
+ * @param idents If not NULL, struct dir_index_ident of files are added in
+ *               pushed order.
+ */
+void
+dir_scan_push_sorted (struct dir_scan *ds, GArray *files, GPtrArray *names,
+                      GArray *idents)
+{
+    gint i;
+    guint n = files->len, added = 0;
+    struct dir_scan_entry *heap = (struct dir_scan_entry*) files->data;
+    struct dir_scan_entry entry;
+
+    for (i = (gint) (n / 2) - 1; i >= 0; i--) {
+        dir_scan_heap_down (heap, n, i);
+    }
+
+    while (n > 0) {
+        entry = heap[0];
+        heap[0] = heap[--n];
+        dir_scan_heap_down (heap, n, 0);
+
+        if (names) {
+            g_ptr_array_add (names,
+                             g_path_get_basename (file_multi_get_path (
+                                 (struct file_multi*) entry.data)));
+            g_array_append_val (idents, entry.id);
+        }
+
+        if (ds->stop) {
+            file_multi_close ((struct file_multi*) entry.data);
         } else {
-            list = g_list_insert_sorted (list, (gpointer) file,
-                                         (GCompareFunc) &strcmp);
+            file_queue_push (ds->queue, (struct file_multi*) entry.data);
+            added++;
+        }
+        g_free (entry.key);
+
+        /* Add to total number of items (progress bar) */
+        if ((added == DIR_SCAN_CHUNK) || ((n == 0) && (added > 0))) {
+            ds->file_count_inc (ds->file_count_inc_data, added);
+            added = 0;
         }
     }
-    g_dir_close (dir);
+    g_array_set_size (files, 0);
+}
 
-    /* Scan files. */
-    for (it = g_list_first (list); it != NULL; it = g_list_next (it)) {
-        name = (const char*) it->data;
-        if (g_file_test (name, G_FILE_TEST_IS_REGULAR)) {
-            file_queue_push (ds->queue, file_multi_open (name));
+/**
+ * Pushes files already in order onto the file queue.
+ *
+ * @param ds struct dir_scan pushing files.
+ * @param files struct dir_scan_entry for files, emptied.
+ */
+void
+dir_scan_push_ordered (struct dir_scan *ds, GArray *files)
+{
+    guint i, added = 0;
+    struct file_multi *file;
+
+    for (i = 0; i < files->len; i++) {
+        file = g_array_index (files, struct dir_scan_entry, i).data;
+        if (ds->stop) {
+            file_multi_close (file);
+        } else {
+            file_queue_push (ds->queue, file);
             added++;
         }
+
+        /* Add to total number of items (progress bar) */
+        if ((added == DIR_SCAN_CHUNK)
+            || ((i + 1 == files->len) && (added > 0))) {
+            ds->file_count_inc (ds->file_count_inc_data, added);
+            added = 0;
+        }
     }
+    g_array_set_size (files, 0);
+}
 
-    /* Add to total number of items (progress bar) */
-    if (added > 0) {
-        ds->file_count_inc (ds->file_count_inc_data, added);
+/**
+ * Scans single directory, pushes its files sorted onto the file queue
+ * and queues sub-directories on the walker unless max levels reached.
+ * Directories unchanged since last scan are replayed from the index.
+ *
+ * @param walker struct dir_scan_walker scanning.
+ * @param dir Directory to scan.
+ */
+void
+dir_scan_read (struct dir_scan_walker *walker, struct dir_scan_dir *dir)
+{
+    gint i;
+    gchar *owner;
+    gboolean stamped, store;
+    GPtrArray *names_files = NULL, *names_dirs = NULL;
+    GArray *idents = NULL;
+    struct dir_index_stamp stamp;
+    struct dir_scan_list list;
+    struct dir_scan_entry *entry;
+    struct dir_scan *ds = walker->ds;
+
+    /* Stat before reading, a change while reading then shows up as
+       changed on the next scan. */
+    list.dev = 0;
+    stamped = dir_index_stat (dir->path, &stamp, &list.dev);
+
+    /* Directory already scanned through another path, a symlink loop,
+       bind mount or repeated argument. */
+    if (stamped) {
+        owner = file_ident_claim (dir->path, list.dev, stamp.ino);
+        if (owner) {
+            g_free (owner);
+            return;
+        }
     }
 
-    /* Cleanup */
-    for (it = g_list_first (list); it != NULL; it = g_list_next (it)) {
-        free (it->data);
+    list.dir = dir;
+    list.files = g_array_new (FALSE, FALSE, sizeof (struct dir_scan_entry));
+    list.dirs = g_array_new (FALSE, FALSE, sizeof (struct dir_scan_entry));
+    list.dups = 0;
+
+    /* Watch before reading, files created while reading are then
+       either read or seen by the watch. */
+    if (ds->watch) {
+        dir_watch_add (ds->watch, dir->path);
     }
-    g_list_free (list);
+
+    list.sorted = stamped
+        && dir_index_replay (dir->index, dir->path, &stamp,
+                             &dir_scan_replay_entry, &list);
+    /* Filtered scans would leave files out of the index. */
+    store = stamped && ! list.sorted && ! file_filter_active ();
+
+    /* Scan directory, entry types come from the directory listing so
+       only entries of unknown type are stat'ed. */
+    if (! list.sorted
+        && ! dir_read (dir->path, &dir_scan_read_entry, &list, &ds->stop)) {
+        g_warning ("unable to open %s as directory", dir->path);
+        store = FALSE;
+    }
+
+    /* Which path owns a file depends on scan order, read directories
+       with files left out again next time. */
+    if (list.dups > 0) {
+        store = FALSE;
+    }
+
+    if (store) {
+        names_files = g_ptr_array_new_with_free_func (&g_free);
+        idents = g_array_new (FALSE, FALSE, sizeof (struct dir_index_ident));
+        names_dirs = g_ptr_array_new_with_free_func (&g_free);
+    }
+
+    if (! list.sorted) {
+        g_array_sort (list.dirs, &dir_scan_entry_cmp);
+    }
+    for (i = 0; store && i < (gint) list.dirs->len; i++) {
+        entry = &g_array_index (list.dirs, struct dir_scan_entry, i);
+        g_ptr_array_add (names_dirs,
+                         g_path_get_basename ((gchar*) entry->data));
+    }
+
+    /* Queue sub-directories so they are taken in sorted order, depth
+       first takes the newest directory first. */
+    for (i = 0; i < (gint) list.dirs->len; i++) {
+        entry = &g_array_index (list.dirs, struct dir_scan_entry,
+                                options.breadth_first
+                                ? i : (gint) list.dirs->len - 1 - i);
+
+        /* levels counts directories below the one given, -1 is
+           limitless. Deeper directories are still indexed. */
+        if ((options.levels < 0) || (dir->depth < options.levels)) {
+            dir_scan_queue_dir (walker, (gchar*) entry->data,
+                                dir->depth + 1, dir->index);
+        } else {
+            g_free (entry->data);
+        }
+        g_free (entry->key);
+    }
+    g_array_free (list.dirs, TRUE);
+
+    /* Push files, keeping the files of this directory together in the
+       queue even when other walkers push at the same time. */
+    g_mutex_lock (&ds->push_mutex);
+    if (list.sorted) {
+        dir_scan_push_ordered (ds, list.files);
+    } else {
+        dir_scan_push_sorted (ds, list.files, names_files, idents);
+    }
+    g_mutex_unlock (&ds->push_mutex);
+
+    if (store) {
+        if (! ds->stop) {
+            dir_index_store (dir->index, dir->path, &stamp,
+                             names_files, idents, names_dirs);
+        }
+        g_ptr_array_free (names_files, TRUE);
+        g_array_free (idents, TRUE);
+        g_ptr_array_free (names_dirs, TRUE);
+    }
+
+    g_array_free (list.files, TRUE);
 }
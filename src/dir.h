@@ -35,23 +35,93 @@
 
 #include <glib.h>
 
+#include "dir_index.h"
+#include "dir_watch.h"
 #include "file_queue.h"
 
+/** Minimum number of directory scanning threads, scanning is mostly
+    waiting on I/O so use more threads than cores on small machines. */
+#define DIR_SCAN_THREADS_MIN 4
+/** Maximum number of directory scanning threads. */
+#define DIR_SCAN_THREADS_MAX 32
+/** Microseconds an idle scanning thread waits before looking for work. */
+#define DIR_SCAN_IDLE_WAIT 10000
+/** Number of queued directories at which breadth first scanning turns
+    depth first until the queue has shrunk. */
+#define DIR_SCAN_FRONTIER_MAX 8192
+/** Number of sorted files pushed to the file queue at a time. */
+#define DIR_SCAN_CHUNK 256
+
+/**
+ * Directory entry with precomputed sort key.
+ */
+struct dir_scan_entry {
+    gchar *key; /**< Collation key, compared with strcmp. */
+    gpointer data; /**< struct file_multi for files, path for directories. */
+    struct dir_index_ident id; /**< Identity of file, kept in the index. */
+};
+
+/**
+ * Entries collected while reading a single directory.
+ */
+struct dir_scan_list {
+    struct dir_scan_dir *dir; /**< Directory being read. */
+    GArray *files; /**< struct dir_scan_entry for files in directory. */
+    GArray *dirs; /**< struct dir_scan_entry for sub-directories. */
+    gboolean sorted; /**< TRUE if entries are already sorted. */
+    guint64 dev; /**< Device of directory. */
+    guint dups; /**< Files left out as seen through another path. */
+};
+
+/**
+ * Directory waiting to be scanned.
+ */
+struct dir_scan_dir {
+    gchar *path; /**< Path to directory. */
+    gint depth; /**< Depth below the directory given as argument. */
+    struct dir_index *index; /**< Index of tree directory belongs to. */
+};
+
+/**
+ * Directory scanning thread with its own queue of directories, other
+ * threads steal from the queue when they run out of work.
+ */
+struct dir_scan_walker {
+    struct dir_scan *ds; /**< Dir scanner the thread belongs to. */
+    guint id; /**< Index in dir scanner walkers. */
+    GThread *thread; /**< Thread, NULL for the main worker thread. */
+
+    GQueue dirs; /**< Directories to scan, struct dir_scan_dir. */
+    GMutex dirs_mutex; /**< Lock for dirs. */
+};
+
 /**
  * Dir scanner structure, holds thread info etc.
  */
 struct dir_scan {
     struct file_queue *queue; /**< File queue for work thread. */
+    struct dir_watch *watch; /**< Watch for scanned directories or NULL. */
     gchar **files; /**< NULL terminated list of files/directories. */
 
     void (*file_count_inc)(gpointer, gint); /**< File count callback. */
     gpointer file_count_inc_data; /**< Data for count callback. */
 
     GThread *thread_work; /**< Worker thread */
+
+    struct dir_scan_walker *walkers; /**< Directory scanning threads. */
+    guint walkers_count; /**< Number of directory scanning threads. */
+    gint pending; /**< Directories queued or being scanned. */
+
+    GMutex idle_mutex; /**< Lock for idle_cond. */
+    GCond idle_cond; /**< Signalled when directories are queued. */
+
+    GMutex push_mutex; /**< Keeps files of a directory together. */
+
     gboolean stop; /**< Stop flag */
 };
 
 extern struct dir_scan *dir_scan_start (struct file_queue *queue, gchar **files,
+                                        struct dir_watch *watch,
                                         void (*file_count_inc) (gpointer,
                                                                 gint),
                                         gpointer file_count_inc_data);
@@ -0,0 +1,419 @@
+/*
+ * Copyright © 2006-2009 Claes Nästén <me@pekdon.net>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Persistent directory index.
+ *
+ * The index for a directory tree is kept in a single file with a header
+ * line followed by one record per directory. All fields are terminated
+ * by NUL so any file name can be stored:
+ *
+ *   path ino mtime mtime_nsec ctime ctime_nsec files dirs
+ *   (file dev:ino)... dir...
+ *
+ * Only names and the identity of files are stored, file size and mtime
+ * can change without the directory changing and are stat'ed when
+ * needed. The identity does not change while the name is linked, its
+ * device is 0 for the device of the directory as device numbers can
+ * change between boots.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "dir_index.h"
+
+static gboolean dir_index_load (struct dir_index *index);
+static gchar *dir_index_field (gchar **pos, gchar *end);
+static void dir_index_dir_free (struct dir_index_dir *dir);
+static void dir_index_seen_free (struct dir_index_dir *dir);
+static void dir_index_save (struct dir_index *index);
+
+/**
+ * Opens directory index for directory tree.
+ *
+ * @param root Path to top directory of tree.
+ * @param load If FALSE, start from an empty index.
+ * @return Pointer to struct dir_index.
+ */
+struct dir_index*
+dir_index_open (const gchar *root, gboolean load)
+{
+    gchar *real, *md5;
+    struct dir_index *index;
+
+    g_assert (root);
+
+    index = g_malloc (sizeof (struct dir_index));
+
+    /* Name index after canonical path so ./ and ../x/ finds the same. */
+    real = realpath (root, NULL);
+    md5 = g_compute_checksum_for_string (G_CHECKSUM_MD5,
+                                         real ? real : root, -1);
+    index->path = g_build_filename (g_get_user_cache_dir (),
+                                    DIR_INDEX_PATH, md5, NULL);
+    free (real);
+    g_free (md5);
+
+    index->data = NULL;
+    index->dirs = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                         (GDestroyNotify) &dir_index_dir_free);
+    index->seen = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                         (GDestroyNotify) &dir_index_seen_free);
+    g_mutex_init (&index->mutex);
+    index->started = g_get_real_time () / G_USEC_PER_SEC;
+
+    if (load && ! dir_index_load (index)) {
+        g_hash_table_remove_all (index->dirs);
+    }
+
+    return index;
+}
+
+/**
+ * Closes directory index, optionally saving directories seen.
+ *
+ * @param index struct dir_index to close.
+ * @param save If TRUE, replace index file with directories seen.
+ */
+void
+dir_index_close (struct dir_index *index, gboolean save)
+{
+    g_assert (index);
+
+    if (save) {
+        dir_index_save (index);
+    }
+
+    g_hash_table_destroy (index->seen);
+    g_hash_table_destroy (index->dirs);
+    g_mutex_clear (&index->mutex);
+    g_free (index->data);
+    g_free (index->path);
+    g_free (index);
+}
+
+/**
+ * Gets state of directory used to validate index.
+ *
+ * @param path Path to directory.
+ * @param stamp struct dir_index_stamp to fill in.
+ * @param dev Set to device of directory, not part of the stamp as device
+ *            numbers can change between boots.
+ * @return TRUE if directory could be stat'ed, else FALSE.
+ */
+gboolean
+dir_index_stat (const gchar *path, struct dir_index_stamp *stamp,
+                guint64 *dev)
+{
+    struct stat buf;
+
+    g_assert (path);
+    g_assert (stamp);
+
+    if (g_stat (path, &buf)) {
+        return FALSE;
+    }
+
+    *dev = buf.st_dev;
+    stamp->ino = buf.st_ino;
+    stamp->mtime = buf.st_mtim.tv_sec;
+    stamp->mtime_nsec = buf.st_mtim.tv_nsec;
+    stamp->ctime = buf.st_ctim.tv_sec;
+    stamp->ctime_nsec = buf.st_ctim.tv_nsec;
+
+    return TRUE;
+}
+
+/**
+ * Replays directory from index if it has not changed since indexed.
+ * Entries are given in the order they were stored, files first.
+ *
+ * @param index struct dir_index to look in.
+ * @param path Path to directory.
+ * @param stamp Current state of directory.
+ * @param entry Callback called with name, TRUE for directories and the
+ *              identity of files.
+ * @param entry_data Data passed to entry callback.
+ * @return TRUE if directory was replayed, else FALSE.
+ */
+gboolean
+dir_index_replay (struct dir_index *index, const gchar *path,
+                  struct dir_index_stamp *stamp,
+                  void (*entry)(gpointer, const gchar*, gboolean,
+                                struct dir_index_ident*),
+                  gpointer entry_data)
+{
+    guint i;
+    gchar *name, *ident;
+    struct dir_index_dir *dir;
+    struct dir_index_ident id;
+
+    g_assert (index);
+    g_assert (path);
+    g_assert (stamp);
+    g_assert (entry);
+
+    /* Loaded directories are only read during the scan. */
+    dir = g_hash_table_lookup (index->dirs, path);
+    if (! dir || memcmp (&dir->stamp, stamp, sizeof (*stamp))) {
+        return FALSE;
+    }
+
+    g_mutex_lock (&index->mutex);
+    g_hash_table_replace (index->seen, dir->path, dir);
+    g_mutex_unlock (&index->mutex);
+
+    name = dir->names;
+    for (i = 0; i < dir->files_count; i++) {
+        ident = name + strlen (name) + 1;
+        id.dev = g_ascii_strtoull (ident, &ident, 10);
+        id.ino = (*ident == ':') ? g_ascii_strtoull (ident + 1, NULL, 10) : 0;
+        entry (entry_data, name, FALSE, &id);
+        name = ident + strlen (ident) + 1;
+    }
+    for (i = 0; i < dir->dirs_count; i++) {
+        entry (entry_data, name, TRUE, NULL);
+        name += strlen (name) + 1;
+    }
+
+    return TRUE;
+}
+
+/**
+ * Stores directory in index.
+ *
+ * @param index struct dir_index to store directory in.
+ * @param path Path to directory.
+ * @param stamp State of directory before it was read.
+ * @param files Names of files in directory, in order to replay them.
+ * @param idents struct dir_index_ident of files, in the order of files.
+ * @param dirs Names of sub-directories, in order to replay them.
+ */
+void
+dir_index_store (struct dir_index *index, const gchar *path,
+                 struct dir_index_stamp *stamp,
+                 GPtrArray *files, GArray *idents, GPtrArray *dirs)
+{
+    guint i;
+    GString *names;
+    struct dir_index_dir *dir;
+    struct dir_index_ident *id;
+
+    g_assert (index);
+    g_assert (path);
+    g_assert (stamp);
+
+    /* Changed too close to being read, a change after reading could
+       leave the timestamps unchanged. */
+    if ((stamp->mtime >= index->started - DIR_INDEX_RACY)
+        || (stamp->ctime >= index->started - DIR_INDEX_RACY)) {
+        return;
+    }
+
+    names = g_string_new (NULL);
+    for (i = 0; i < files->len; i++) {
+        id = &g_array_index (idents, struct dir_index_ident, i);
+        g_string_append_len (names, g_ptr_array_index (files, i),
+                             strlen (g_ptr_array_index (files, i)) + 1);
+        g_string_append_printf (names, "%" G_GUINT64_FORMAT ":%"
+                                G_GUINT64_FORMAT "%c", id->dev, id->ino,
+                                '\0');
+    }
+    for (i = 0; i < dirs->len; i++) {
+        g_string_append_len (names, g_ptr_array_index (dirs, i),
+                             strlen (g_ptr_array_index (dirs, i)) + 1);
+    }
+
+    dir = g_malloc (sizeof (struct dir_index_dir));
+    dir->path = g_strdup (path);
+    dir->stamp = *stamp;
+    dir->files_count = files->len;
+    dir->dirs_count = dirs->len;
+    dir->names_len = names->len;
+    dir->names = g_string_free (names, FALSE);
+    dir->owned = TRUE;
+
+    g_mutex_lock (&index->mutex);
+    g_hash_table_replace (index->seen, dir->path, dir);
+    g_mutex_unlock (&index->mutex);
+}
+
+/**
+ * Loads index file, entries point into the loaded data.
+ *
+ * @param index struct dir_index to load.
+ * @return TRUE if loaded, FALSE if missing or corrupt.
+ */
+gboolean
+dir_index_load (struct dir_index *index)
+{
+    guint i;
+    gsize len;
+    gchar *pos, *end, *field[8];
+    struct dir_index_dir *dir;
+
+    if (! g_file_get_contents (index->path, &index->data, &len, NULL)) {
+        return FALSE;
+    }
+    if ((len < strlen (DIR_INDEX_MAGIC))
+        || strncmp (index->data, DIR_INDEX_MAGIC, strlen (DIR_INDEX_MAGIC))) {
+        return FALSE;
+    }
+
+    pos = index->data + strlen (DIR_INDEX_MAGIC);
+    end = index->data + len;
+    while (pos < end) {
+        for (i = 0; i < G_N_ELEMENTS (field); i++) {
+            if ((field[i] = dir_index_field (&pos, end)) == NULL) {
+                return FALSE;
+            }
+        }
+
+        dir = g_malloc (sizeof (struct dir_index_dir));
+        dir->path = field[0];
+        dir->stamp.ino = g_ascii_strtoull (field[1], NULL, 10);
+        dir->stamp.mtime = g_ascii_strtoll (field[2], NULL, 10);
+        dir->stamp.mtime_nsec = g_ascii_strtoll (field[3], NULL, 10);
+        dir->stamp.ctime = g_ascii_strtoll (field[4], NULL, 10);
+        dir->stamp.ctime_nsec = g_ascii_strtoll (field[5], NULL, 10);
+        dir->files_count = g_ascii_strtoull (field[6], NULL, 10);
+        dir->dirs_count = g_ascii_strtoull (field[7], NULL, 10);
+        dir->names = pos;
+        dir->owned = FALSE;
+        g_hash_table_replace (index->dirs, dir->path, dir);
+
+        /* Files are followed by their identity */
+        for (i = 0; i < dir->files_count * 2 + dir->dirs_count; i++) {
+            if (dir_index_field (&pos, end) == NULL) {
+                return FALSE;
+            }
+        }
+        dir->names_len = pos - dir->names;
+    }
+
+    return TRUE;
+}
+
+/**
+ * Gets NUL terminated field and moves past it.
+ *
+ * @param pos Position to read field from, updated.
+ * @param end End of data.
+ * @return Field, NULL if not terminated before end.
+ */
+gchar*
+dir_index_field (gchar **pos, gchar *end)
+{
+    gchar *field = *pos, *nul;
+
+    nul = memchr (field, '\0', end - field);
+    if (! nul) {
+        return NULL;
+    }
+    *pos = nul + 1;
+
+    return field;
+}
+
+/**
+ * Saves directories seen during scan, replacing the index file.
+ *
+ * @param index struct dir_index to save.
+ */
+void
+dir_index_save (struct dir_index *index)
+{
+    gchar *dir_path;
+    GString *data;
+    GHashTableIter it;
+    struct dir_index_dir *dir;
+
+    data = g_string_new (DIR_INDEX_MAGIC);
+    g_hash_table_iter_init (&it, index->seen);
+    while (g_hash_table_iter_next (&it, NULL, (gpointer*) &dir)) {
+        g_string_append_printf (data, "%s%c%" G_GUINT64_FORMAT "%c"
+                                "%" G_GINT64_FORMAT "%c%" G_GINT64_FORMAT "%c"
+                                "%" G_GINT64_FORMAT "%c%" G_GINT64_FORMAT "%c"
+                                "%u%c%u%c",
+                                dir->path, '\0', dir->stamp.ino, '\0',
+                                dir->stamp.mtime, '\0',
+                                dir->stamp.mtime_nsec, '\0',
+                                dir->stamp.ctime, '\0',
+                                dir->stamp.ctime_nsec, '\0',
+                                dir->files_count, '\0',
+                                dir->dirs_count, '\0');
+        g_string_append_len (data, dir->names, dir->names_len);
+    }
+
+    /* Written to temporary file and renamed, never leaves a partial
+       index behind. */
+    dir_path = g_path_get_dirname (index->path);
+    if (g_mkdir_with_parents (dir_path, 0700) == -1
+        || ! g_file_set_contents (index->path, data->str, data->len, NULL)) {
+        g_warning ("unable to save directory index %s", index->path);
+    }
+    g_free (dir_path);
+
+    g_string_free (data, TRUE);
+}
+
+/**
+ * Frees struct dir_index_dir.
+ *
+ * @param dir struct dir_index_dir to free.
+ */
+void
+dir_index_dir_free (struct dir_index_dir *dir)
+{
+    if (dir->owned) {
+        g_free (dir->path);
+        g_free (dir->names);
+    }
+    g_free (dir);
+}
+
+/**
+ * Frees struct dir_index_dir created during scan, loaded directories are
+ * freed with the index.
+ *
+ * @param dir struct dir_index_dir to free.
+ */
+void
+dir_index_seen_free (struct dir_index_dir *dir)
+{
+    if (dir->owned) {
+        dir_index_dir_free (dir);
+    }
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright © 2006-2009 Claes Nästén <me@pekdon.net>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/**
+ * Persistent directory index, remembers the contents of scanned
+ * directories so unchanged directories do not have to be read again.
+ */
+
+#ifndef _DIR_INDEX_H_
+#define _DIR_INDEX_H_
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <glib.h>
+
+/** Directory, relative to the user cache directory, indexes are kept in. */
+#define DIR_INDEX_PATH "geh/dirindex"
+/** First line of index file, changed when the format changes. */
+#define DIR_INDEX_MAGIC "geh-dirindex 4\n"
+/** Directories modified less than this many seconds before being read are
+    not indexed as further changes within the same second go unnoticed. */
+#define DIR_INDEX_RACY 2
+
+/**
+ * Directory state used to validate index entries.
+ */
+struct dir_index_stamp {
+    guint64 ino; /**< Inode of directory. */
+    gint64 mtime; /**< Modification time, seconds. */
+    gint64 mtime_nsec; /**< Modification time, nanoseconds. */
+    gint64 ctime; /**< Status change time, seconds. */
+    gint64 ctime_nsec; /**< Status change time, nanoseconds. */
+};
+
+/**
+ * Identity of indexed file, a file reached through several paths is
+ * only shown at the path claiming it first.
+ */
+struct dir_index_ident {
+    guint64 dev; /**< Device of file, 0 if on the device of the
+                      directory. */
+    guint64 ino; /**< Inode of file, 0 if not known. */
+};
+
+/**
+ * Indexed directory.
+ */
+struct dir_index_dir {
+    gchar *path; /**< Path to directory. */
+    struct dir_index_stamp stamp; /**< State when directory was read. */
+    guint files_count; /**< Number of files, names come first. */
+    guint dirs_count; /**< Number of sub-directories. */
+    gchar *names; /**< NUL separated file names, each followed by its
+                       identity, then directories. */
+    gsize names_len; /**< Length of names including NUL bytes. */
+    gboolean owned; /**< TRUE if path and names are allocated. */
+};
+
+/**
+ * Directory index for directory tree.
+ */
+struct dir_index {
+    gchar *path; /**< Path to index file. */
+    gchar *data; /**< Contents of index file, loaded entries point here. */
+    GHashTable *dirs; /**< Directories from index file, key is path. */
+    GHashTable *seen; /**< Directories valid after this scan. */
+    GMutex mutex; /**< Protects seen. */
+    gint64 started; /**< Time scan started, seconds. */
+};
+
+extern struct dir_index *dir_index_open (const gchar *root, gboolean load);
+extern void dir_index_close (struct dir_index *index, gboolean save);
+
+extern gboolean dir_index_stat (const gchar *path,
+                                struct dir_index_stamp *stamp,
+                                guint64 *dev);
+extern gboolean dir_index_replay (struct dir_index *index, const gchar *path,
+                                  struct dir_index_stamp *stamp,
+                                  void (*entry)(gpointer, const gchar*,
+                                                gboolean,
+                                                struct dir_index_ident*),
+                                  gpointer entry_data);
+extern void dir_index_store (struct dir_index *index, const gchar *path,
+                             struct dir_index_stamp *stamp,
+                             GPtrArray *files, GArray *idents,
+                             GPtrArray *dirs);
+
+#endif /* _DIR_INDEX_H_ */
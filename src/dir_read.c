@@ -0,0 +1,289 @@
+/*
+ * Copyright © 2006-2009 Claes Nästén <me@pekdon.net>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Directory reading routines.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <errno.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif /* __linux__ */
+
+#include "dir_read.h"
+#include "file_io.h"
+
+#if defined(__linux__) && defined(SYS_getdents64)
+#define DIR_READ_GETDENTS
+/** Entry type waiting for the stat batch of its buffer. */
+#define DIR_READ_TYPE_STAT G_MAXUINT
+#endif /* __linux__ && SYS_getdents64 */
+
+#ifdef DIR_READ_GETDENTS
+/**
+ * Directory entry as returned by getdents64, not exported by libc.
+ */
+struct dir_read_dirent64 {
+    guint64 d_ino;
+    gint64 d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static gboolean dir_read_getdents (const gchar *path,
+                                   void (*entry)(gpointer,
+                                                 struct dir_read_entry*),
+                                   gpointer entry_data, gboolean *stop);
+static void dir_read_stat_fill (struct dir_read_entry *de,
+                                struct file_io_stat *st);
+#endif /* DIR_READ_GETDENTS */
+
+static gboolean dir_read_gdir (const gchar *path,
+                               void (*entry)(gpointer, struct dir_read_entry*),
+                               gpointer entry_data, gboolean *stop);
+
+/**
+ * Reads directory calling entry for every entry except . and .., the
+ * type of the entry is taken from the directory listing when available
+ * and only entries with unknown type or symlinks are stat'ed.
+ *
+ * @param path Path to directory to read.
+ * @param entry Callback called for every entry.
+ * @param entry_data Data passed to entry callback.
+ * @param stop Pointer to stop flag, reading stops when set to TRUE.
+ * @return TRUE if directory could be read, else FALSE.
+ */
+gboolean
+dir_read (const gchar *path,
+          void (*entry)(gpointer, struct dir_read_entry*),
+          gpointer entry_data, gboolean *stop)
+{
+    g_assert (path);
+    g_assert (entry);
+    g_assert (stop);
+
+#ifdef DIR_READ_GETDENTS
+    return dir_read_getdents (path, entry, entry_data, stop);
+#else /* ! DIR_READ_GETDENTS */
+    return dir_read_gdir (path, entry, entry_data, stop);
+#endif /* DIR_READ_GETDENTS */
+}
+
+#ifdef DIR_READ_GETDENTS
+/**
+ * Reads directory using getdents64, falls back to GDir if the syscall
+ * is not available. Entries needing a stat are stat'ed in one batch for
+ * every buffer read.
+ *
+ * @see dir_read
+ */
+gboolean
+dir_read_getdents (const gchar *path,
+                   void (*entry)(gpointer, struct dir_read_entry*),
+                   gpointer entry_data, gboolean *stop)
+{
+    int fd;
+    long len, pos;
+    guint i, stat_count;
+    gchar *buf;
+    GArray *entries, *stats;
+    struct dir_read_entry de;
+    struct dir_read_dirent64 *dent;
+    struct file_io_stat st;
+
+    fd = open (path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return FALSE;
+    }
+
+    buf = g_malloc (DIR_READ_BUF);
+    entries = g_array_new (FALSE, FALSE, sizeof (struct dir_read_entry));
+    stats = g_array_new (FALSE, FALSE, sizeof (struct file_io_stat));
+    while (! *stop
+           && (len = syscall (SYS_getdents64, fd, buf, DIR_READ_BUF)) > 0) {
+        for (pos = 0; pos < len; pos += dent->d_reclen) {
+            dent = (struct dir_read_dirent64*) (buf + pos);
+
+            /* Skip . and .. */
+            if (dent->d_name[0] == '.'
+                && (dent->d_name[1] == '\0'
+                    || (dent->d_name[1] == '.' && dent->d_name[2] == '\0'))) {
+                continue;
+            }
+
+            de.name = dent->d_name;
+            de.size = -1;
+            de.mtime = -1;
+            de.dev = 0;
+            de.ino = dent->d_ino;
+
+            switch (dent->d_type) {
+            case DT_REG:
+                de.type = DIR_READ_TYPE_FILE;
+                break;
+            case DT_DIR:
+                de.type = DIR_READ_TYPE_DIR;
+                break;
+            case DT_LNK:
+            case DT_UNKNOWN:
+                /* Type depends on target or the file system does not
+                   fill in d_type, stat it with the rest of the buffer. */
+                st.name = dent->d_name;
+                g_array_append_val (stats, st);
+                de.type = DIR_READ_TYPE_STAT;
+                break;
+            default:
+                de.type = DIR_READ_TYPE_OTHER;
+                break;
+            }
+
+            g_array_append_val (entries, de);
+        }
+
+        /* Names point into buf, stat before reading the next buffer. */
+        if (stats->len > 0) {
+            file_io_statat (fd, (struct file_io_stat*) stats->data,
+                            stats->len);
+        }
+
+        stat_count = 0;
+        for (i = 0; ! *stop && i < entries->len; i++) {
+            if (g_array_index (entries, struct dir_read_entry, i).type
+                == DIR_READ_TYPE_STAT) {
+                dir_read_stat_fill (&g_array_index (entries,
+                                                    struct dir_read_entry, i),
+                                    &g_array_index (stats,
+                                                    struct file_io_stat,
+                                                    stat_count++));
+            }
+            entry (entry_data,
+                   &g_array_index (entries, struct dir_read_entry, i));
+        }
+
+        g_array_set_size (entries, 0);
+        g_array_set_size (stats, 0);
+    }
+    g_array_free (entries, TRUE);
+    g_array_free (stats, TRUE);
+    g_free (buf);
+    close (fd);
+
+    /* getdents64 not available, kernel emulation etc. */
+    if (len == -1 && errno == ENOSYS) {
+        return dir_read_gdir (path, entry, entry_data, stop);
+    }
+
+    return len != -1;
+}
+
+/**
+ * Fills in type, size and mtime of entry from stat result.
+ *
+ * @param de Entry to fill in.
+ * @param st Result of stat'ing entry, symlinks followed.
+ */
+void
+dir_read_stat_fill (struct dir_read_entry *de, struct file_io_stat *st)
+{
+    if (st->ok) {
+        de->dev = st->dev;
+        de->ino = st->ino;
+    }
+
+    if (! st->ok) {
+        de->type = DIR_READ_TYPE_OTHER;
+    } else if (S_ISREG (st->mode)) {
+        de->type = DIR_READ_TYPE_FILE;
+        de->size = st->size;
+        de->mtime = st->mtime;
+    } else if (S_ISDIR (st->mode)) {
+        de->type = DIR_READ_TYPE_DIR;
+    } else {
+        de->type = DIR_READ_TYPE_OTHER;
+    }
+}
+#endif /* DIR_READ_GETDENTS */
+
+/**
+ * Reads directory using GDir, stat'ing every entry.
+ *
+ * @see dir_read
+ */
+gboolean
+dir_read_gdir (const gchar *path,
+               void (*entry)(gpointer, struct dir_read_entry*),
+               gpointer entry_data, gboolean *stop)
+{
+    GDir *dir;
+    gchar *file;
+    struct stat buf;
+    struct dir_read_entry de;
+
+    dir = g_dir_open (path, 0, NULL);
+    if (! dir) {
+        return FALSE;
+    }
+
+    while (! *stop && (de.name = g_dir_read_name (dir)) != NULL) {
+        de.type = DIR_READ_TYPE_OTHER;
+        de.size = -1;
+        de.mtime = -1;
+        de.dev = 0;
+        de.ino = 0;
+
+        file = g_build_filename (path, de.name, NULL);
+        if (! g_stat (file, &buf)) {
+            de.dev = buf.st_dev;
+            de.ino = buf.st_ino;
+            if (S_ISREG (buf.st_mode)) {
+                de.type = DIR_READ_TYPE_FILE;
+                de.size = buf.st_size;
+                de.mtime = buf.st_mtime;
+            } else if (S_ISDIR (buf.st_mode)) {
+                de.type = DIR_READ_TYPE_DIR;
+            }
+        }
+        g_free (file);
+
+        entry (entry_data, &de);
+    }
+    g_dir_close (dir);
+
+    return TRUE;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright © 2006-2009 Claes Nästén <me@pekdon.net>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/**
+ * Directory reading, lists entries with their type without stat'ing
+ * every entry where the system supports it.
+ */
+
+#ifndef _DIR_READ_H_
+#define _DIR_READ_H_
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <glib.h>
+
+#include <sys/types.h>
+
+#define DIR_READ_TYPE_OTHER 0
+#define DIR_READ_TYPE_FILE 1
+#define DIR_READ_TYPE_DIR 2
+
+/** Size of buffer directory entries are read into. */
+#define DIR_READ_BUF 65536
+
+/**
+ * Directory entry.
+ */
+struct dir_read_entry {
+    const gchar *name; /**< Name of entry, only valid during callback. */
+    guint type; /**< DIR_READ_TYPE_ of entry, symlinks are followed. */
+    off_t size; /**< Size of entry, -1 means not yet checked. */
+    time_t mtime; /**< Mtime of entry, -1 means not yet checked. */
+    guint64 dev; /**< Device of entry, 0 if on the device of the
+                      directory. */
+    guint64 ino; /**< Inode of entry, 0 if not known. */
+};
+
+extern gboolean dir_read (const gchar *path,
+                          void (*entry)(gpointer, struct dir_read_entry*),
+                          gpointer entry_data, gboolean *stop);
+
+#endif /* _DIR_READ_H_ */
@@ -0,0 +1,589 @@
+/*
+ * Copyright © 2006-2009 Claes Nästén <me@pekdon.net>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Watching of scanned directories for changes.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <glib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <glib/gstdio.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#define DIR_WATCH_INOTIFY
+#endif /* __linux__ */
+
+#include "geh.h"
+#include "dir_read.h"
+#include "dir_watch.h"
+#include "file_fetch.h"
+#include "file_filter.h"
+#include "file_ident.h"
+#include "file_multi.h"
+#include "file_queue.h"
+#include "file_sniff.h"
+#include "ui_window.h"
+
+#ifdef DIR_WATCH_INOTIFY
+/** Events watched for on directories. */
+#define DIR_WATCH_MASK (IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO \
+                        | IN_MOVED_FROM | IN_DELETE | IN_DELETE_SELF \
+                        | IN_ONLYDIR | IN_EXCL_UNLINK)
+
+/**
+ * Directory being added to the watch.
+ */
+struct dir_watch_tree {
+    struct dir_watch *watch; /**< Watch adding directory. */
+    const gchar *path; /**< Path to directory. */
+    GHashTable *watched; /**< Directories watched before reading again,
+                              NULL if not reading again. */
+};
+
+static gpointer dir_watch_worker (gpointer data);
+static void dir_watch_read (struct dir_watch *watch);
+static void dir_watch_handle (struct dir_watch *watch,
+                              struct inotify_event *ev);
+static void dir_watch_change (struct dir_watch *watch, gchar *path,
+                              gboolean removed);
+static gint dir_watch_timeout (struct dir_watch *watch);
+static void dir_watch_flush (struct dir_watch *watch);
+static void dir_watch_add_tree (struct dir_watch *watch, const gchar *path);
+static void dir_watch_add_tree_entry (gpointer data,
+                                      struct dir_read_entry *de);
+static void dir_watch_rescan (struct dir_watch *watch);
+static void dir_watch_rescan_entry (gpointer data,
+                                    struct dir_read_entry *de);
+static void dir_watch_remove_tree (struct dir_watch *watch,
+                                   const gchar *path);
+#endif /* DIR_WATCH_INOTIFY */
+
+/**
+ * Starts watching for changes, directories are added with dir_watch_add.
+ * The watch owns a reference to the queue until stopped as files can be
+ * pushed at any time.
+ *
+ * @param queue file_queue to push changed and created files onto.
+ * @param file_fetch struct file_fetch to remove deleted files from.
+ * @return Pointer to struct dir_watch.
+ */
+struct dir_watch*
+dir_watch_start (struct file_queue *queue, struct file_fetch *file_fetch)
+{
+    struct dir_watch *watch;
+
+    g_assert (queue);
+    g_assert (file_fetch);
+
+    watch = g_malloc (sizeof (struct dir_watch));
+    watch->queue = queue;
+    watch->file_fetch = file_fetch;
+    watch->dirs = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                         NULL, &g_free);
+    g_mutex_init (&watch->dirs_mutex);
+    watch->events = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                           &g_free, &g_free);
+    watch->thread = NULL;
+    watch->stop = FALSE;
+
+#ifdef DIR_WATCH_INOTIFY
+    watch->fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->fd == -1) {
+        g_warning ("unable to watch directories: %s", g_strerror (errno));
+    } else {
+        watch->thread = g_thread_new ("dir_watch", &dir_watch_worker, watch);
+    }
+#else /* ! DIR_WATCH_INOTIFY */
+    watch->fd = -1;
+    g_warning ("watching directories not supported on this system");
+#endif /* DIR_WATCH_INOTIFY */
+
+    return watch;
+}
+
+/**
+ * Stops watching and frees resources.
+ *
+ * @param watch struct dir_watch to stop and free.
+ */
+void
+dir_watch_stop (struct dir_watch *watch)
+{
+    g_assert (watch);
+
+    /* No locking, should be safe. */
+    watch->stop = TRUE;
+
+    if (watch->thread) {
+        g_thread_join (watch->thread);
+    }
+    if (watch->fd != -1) {
+        close (watch->fd);
+    }
+
+    /* No more files will be pushed */
+    file_queue_done (watch->queue);
+
+    g_hash_table_destroy (watch->events);
+    g_hash_table_destroy (watch->dirs);
+    g_mutex_clear (&watch->dirs_mutex);
+    g_free (watch);
+}
+
+/**
+ * Adds directory to the watch, called by the directory scanner before
+ * reading the directory so files created while reading are not missed.
+ *
+ * @param watch struct dir_watch to add directory to.
+ * @param path Path to directory.
+ */
+void
+dir_watch_add (struct dir_watch *watch, const gchar *path)
+{
+#ifdef DIR_WATCH_INOTIFY
+    int wd;
+
+    g_assert (watch);
+    g_assert (path);
+
+    if (watch->fd == -1) {
+        return;
+    }
+
+    wd = inotify_add_watch (watch->fd, path, DIR_WATCH_MASK);
+    if (wd == -1) {
+        g_warning ("unable to watch %s: %s", path, g_strerror (errno));
+        return;
+    }
+
+    /* Same directory through another path gives the same descriptor,
+       the last path wins. */
+    g_mutex_lock (&watch->dirs_mutex);
+    g_hash_table_replace (watch->dirs, GINT_TO_POINTER (wd), g_strdup (path));
+    g_mutex_unlock (&watch->dirs_mutex);
+#endif /* DIR_WATCH_INOTIFY */
+}
+
+#ifdef DIR_WATCH_INOTIFY
+/**
+ * Thread reading events and acting on changes once files have settled.
+ *
+ * @param data Pointer to struct dir_watch.
+ * @return NULL
+ */
+gpointer
+dir_watch_worker (gpointer data)
+{
+    struct pollfd pfd;
+    struct dir_watch *watch = (struct dir_watch*) data;
+
+    pfd.fd = watch->fd;
+    pfd.events = POLLIN;
+
+    while (! watch->stop) {
+        if (poll (&pfd, 1, dir_watch_timeout (watch)) > 0) {
+            dir_watch_read (watch);
+        }
+        dir_watch_flush (watch);
+    }
+
+    return NULL;
+}
+
+/**
+ * Reads and handles all available events.
+ *
+ * @param watch struct dir_watch to read events for.
+ */
+void
+dir_watch_read (struct dir_watch *watch)
+{
+    ssize_t len, pos;
+    struct inotify_event *ev;
+    gchar buf[DIR_WATCH_BUF]
+        __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+
+    while ((len = read (watch->fd, buf, sizeof (buf))) > 0) {
+        for (pos = 0; pos < len;
+             pos += sizeof (struct inotify_event) + ev->len) {
+            ev = (struct inotify_event*) (buf + pos);
+            dir_watch_handle (watch, ev);
+        }
+    }
+
+    if (len == -1 && errno != EAGAIN && errno != EINTR) {
+        g_warning ("failed to read directory changes: %s",
+                   g_strerror (errno));
+    }
+}
+
+/**
+ * Handles single event, changes to files are delayed until the file has
+ * settled and directories are added or removed directly.
+ *
+ * @param watch struct dir_watch event was read on.
+ * @param ev Event to handle.
+ */
+void
+dir_watch_handle (struct dir_watch *watch, struct inotify_event *ev)
+{
+    gchar *dir, *path;
+
+    if (ev->mask & IN_Q_OVERFLOW) {
+        g_warning ("too many directory changes, reading directories again");
+        dir_watch_rescan (watch);
+        return;
+    }
+
+    g_mutex_lock (&watch->dirs_mutex);
+    if (ev->mask & IN_IGNORED) {
+        /* Watch removed, directory deleted or unmounted. */
+        g_hash_table_remove (watch->dirs, GINT_TO_POINTER (ev->wd));
+        dir = NULL;
+    } else {
+        dir = g_strdup (g_hash_table_lookup (watch->dirs,
+                                             GINT_TO_POINTER (ev->wd)));
+    }
+    g_mutex_unlock (&watch->dirs_mutex);
+
+    if (! dir) {
+        return;
+    }
+
+    if (ev->len == 0) {
+        /* Event on the directory itself */
+        if (ev->mask & IN_DELETE_SELF) {
+            file_fetch_remove (watch->file_fetch, dir, TRUE);
+        }
+
+    } else {
+        path = g_build_filename (dir, ev->name, NULL);
+        if (! (ev->mask & IN_ISDIR)) {
+            dir_watch_change (watch, path,
+                              ev->mask & (IN_DELETE | IN_MOVED_FROM));
+            path = NULL;
+
+        } else if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+            if (options.recursive) {
+                dir_watch_add_tree (watch, path);
+            }
+
+        } else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+            dir_watch_remove_tree (watch, path);
+            file_fetch_remove (watch->file_fetch, path, TRUE);
+        }
+        g_free (path);
+    }
+
+    g_free (dir);
+}
+
+/**
+ * Records change to file, acted on when the file has not changed for
+ * DIR_WATCH_DEBOUNCE milliseconds.
+ *
+ * @param watch struct dir_watch to record change on.
+ * @param path Path to file, owned by the watch.
+ * @param removed TRUE if the file was removed.
+ */
+void
+dir_watch_change (struct dir_watch *watch, gchar *path, gboolean removed)
+{
+    struct dir_watch_event *event;
+
+    /* Given up directly, a renamed file is created under its new name
+       and that change can be acted on first. */
+    if (removed) {
+        file_ident_release (path, FALSE);
+    }
+
+    event = g_malloc (sizeof (struct dir_watch_event));
+    event->deadline = g_get_monotonic_time () + DIR_WATCH_DEBOUNCE * 1000;
+    event->removed = removed;
+
+    g_hash_table_replace (watch->events, path, event);
+}
+
+/**
+ * Gets milliseconds to wait for events before the next change is due.
+ *
+ * @param watch struct dir_watch to get timeout for.
+ * @return Milliseconds to wait, at most DIR_WATCH_POLL.
+ */
+gint
+dir_watch_timeout (struct dir_watch *watch)
+{
+    gint64 now, timeout = DIR_WATCH_POLL;
+    GHashTableIter it;
+    struct dir_watch_event *event;
+
+    now = g_get_monotonic_time ();
+    g_hash_table_iter_init (&it, watch->events);
+    while (g_hash_table_iter_next (&it, NULL, (gpointer*) &event)) {
+        timeout = MIN (timeout, (event->deadline - now) / 1000 + 1);
+    }
+
+    return MAX (timeout, 0);
+}
+
+/**
+ * Acts on changes to files that have settled. Thumbnails of changed
+ * files already shown are generated again, created files are pushed
+ * onto the queue for the fetcher to add.
+ *
+ * @param watch struct dir_watch to act on changes for.
+ */
+void
+dir_watch_flush (struct dir_watch *watch)
+{
+    guint type;
+    gint64 now;
+    gchar *path, *owner;
+    GHashTableIter it;
+    struct dir_watch_event *event;
+    struct file_multi *file;
+
+    now = g_get_monotonic_time ();
+    g_hash_table_iter_init (&it, watch->events);
+    while (! watch->stop
+           && g_hash_table_iter_next (&it, (gpointer*) &path,
+                                      (gpointer*) &event)) {
+        if (event->deadline > now) {
+            continue;
+        }
+
+        /* Removed, no longer an image or filtered out */
+        type = FILE_SNIFF_OTHER;
+        if (! event->removed && g_file_test (path, G_FILE_TEST_IS_REGULAR)) {
+            type = file_sniff_path (path);
+        }
+
+        file = NULL;
+        if (file_sniff_maybe_image (type)) {
+            /* Change seen through another path updates the thumbnail
+               of the path the file was first seen at. */
+            owner = file_ident_claim_path (path);
+            file = file_multi_open (owner ? owner : path);
+            g_free (owner);
+            file_multi_set_type (file, type);
+            if (! file_filter_file (file)) {
+                file_multi_close (file);
+                file = NULL;
+            }
+        }
+
+        if (file && file_fetch_refresh (watch->file_fetch,
+                                        file_multi_get_path (file))) {
+            /* Shown already, its job reads the file again */
+            file_multi_close (file);
+        } else if (file) {
+            ui_window_progress_add (watch->file_fetch->ui, 1);
+            file_queue_push (watch->queue, file);
+        } else {
+            file_fetch_remove (watch->file_fetch, path, FALSE);
+        }
+
+        g_hash_table_iter_remove (&it);
+    }
+}
+
+/**
+ * Adds directory created in watched directory, and any directories
+ * below, treating all files in it as created.
+ *
+ * @param watch struct dir_watch to add directory to.
+ * @param path Path to directory.
+ */
+void
+dir_watch_add_tree (struct dir_watch *watch, const gchar *path)
+{
+    gchar *owner;
+    struct dir_watch_tree tree;
+
+    /* Already watched through another path, or a symlink loop. */
+    owner = file_ident_claim_path (path);
+    if (owner) {
+        g_free (owner);
+        return;
+    }
+
+    tree.watch = watch;
+    tree.path = path;
+    tree.watched = NULL;
+
+    /* Watch before reading, files created meanwhile are seen either
+       way. */
+    dir_watch_add (watch, path);
+    dir_read (path, &dir_watch_add_tree_entry, &tree, &watch->stop);
+}
+
+/**
+ * Adds entry in directory created in watched directory.
+ *
+ * @param data Pointer to struct dir_watch_tree.
+ * @param de Directory entry.
+ */
+void
+dir_watch_add_tree_entry (gpointer data, struct dir_read_entry *de)
+{
+    struct dir_watch_tree *tree = (struct dir_watch_tree*) data;
+
+    if (de->type == DIR_READ_TYPE_FILE) {
+        dir_watch_change (tree->watch,
+                          g_build_filename (tree->path, de->name, NULL),
+                          FALSE);
+    } else if (de->type == DIR_READ_TYPE_DIR) {
+        gchar *path = g_build_filename (tree->path, de->name, NULL);
+        dir_watch_add_tree (tree->watch, path);
+        g_free (path);
+    }
+}
+
+/**
+ * Stops watching directory and directories below it, used when moved
+ * away as the watch would follow the directory.
+ *
+ * @param watch struct dir_watch to remove directories from.
+ * @param path Path to directory.
+ */
+void
+dir_watch_remove_tree (struct dir_watch *watch, const gchar *path)
+{
+    gsize len = strlen (path);
+    gchar *dir;
+    gpointer wd;
+    GHashTableIter it;
+
+    g_mutex_lock (&watch->dirs_mutex);
+    g_hash_table_iter_init (&it, watch->dirs);
+    while (g_hash_table_iter_next (&it, &wd, (gpointer*) &dir)) {
+        if (! strncmp (dir, path, len)
+            && (dir[len] == '\0' || dir[len] == G_DIR_SEPARATOR)) {
+            inotify_rm_watch (watch->fd, GPOINTER_TO_INT (wd));
+            g_hash_table_iter_remove (&it);
+        }
+    }
+    g_mutex_unlock (&watch->dirs_mutex);
+}
+
+/**
+ * Reads all watched directories again after events were lost. Files
+ * not shown or changed since are treated as changed, shown files that
+ * are gone as removed.
+ *
+ * @param watch struct dir_watch to read directories for.
+ */
+void
+dir_watch_rescan (struct dir_watch *watch)
+{
+    gchar *dir;
+    GList *dirs, *paths, *it;
+    GHashTable *watched;
+    GHashTableIter iter;
+    struct dir_watch_tree tree;
+
+    /* Copied, directories are read without the lock and directories
+       created meanwhile are added. */
+    watched = g_hash_table_new_full (g_str_hash, g_str_equal, &g_free, NULL);
+    g_mutex_lock (&watch->dirs_mutex);
+    g_hash_table_iter_init (&iter, watch->dirs);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer*) &dir)) {
+        /* Compared with the directory of shown files, as given it can
+           end in a separator. */
+        dir = g_strdup (dir);
+        if (strlen (dir) > 1 && g_str_has_suffix (dir, G_DIR_SEPARATOR_S)) {
+            dir[strlen (dir) - 1] = '\0';
+        }
+        g_hash_table_add (watched, dir);
+    }
+    g_mutex_unlock (&watch->dirs_mutex);
+
+    tree.watch = watch;
+    tree.watched = watched;
+    dirs = g_hash_table_get_keys (watched);
+    for (it = dirs; it && ! watch->stop; it = it->next) {
+        tree.path = (const gchar*) it->data;
+        dir_read (tree.path, &dir_watch_rescan_entry, &tree, &watch->stop);
+    }
+    g_list_free (dirs);
+
+    paths = file_fetch_get_paths (watch->file_fetch);
+    for (it = paths; it; it = it->next) {
+        dir = g_path_get_dirname ((const gchar*) it->data);
+        if (g_hash_table_contains (watched, dir)
+            && ! g_file_test ((const gchar*) it->data, G_FILE_TEST_EXISTS)) {
+            dir_watch_change (watch, (gchar*) it->data, TRUE);
+            it->data = NULL;
+        }
+        g_free (dir);
+    }
+    g_list_free_full (paths, &g_free);
+
+    g_hash_table_destroy (watched);
+}
+
+/**
+ * Checks entry in watched directory read again, changed if not shown
+ * with the same size and mtime.
+ *
+ * @param data Pointer to struct dir_watch_tree.
+ * @param de Directory entry.
+ */
+void
+dir_watch_rescan_entry (gpointer data, struct dir_read_entry *de)
+{
+    gchar *path;
+    struct stat buf;
+    struct dir_watch_tree *tree = (struct dir_watch_tree*) data;
+
+    path = g_build_filename (tree->path, de->name, NULL);
+    if (de->type == DIR_READ_TYPE_FILE) {
+        if ((de->size == -1 || de->mtime == -1) && ! g_stat (path, &buf)) {
+            de->size = buf.st_size;
+            de->mtime = buf.st_mtime;
+        }
+        if (! file_fetch_is_current (tree->watch->file_fetch, path,
+                                     de->size, de->mtime)) {
+            dir_watch_change (tree->watch, path, FALSE);
+            path = NULL;
+        }
+
+    } else if (de->type == DIR_READ_TYPE_DIR && options.recursive
+               && ! g_hash_table_contains (tree->watched, path)) {
+        /* Created while events were lost */
+        dir_watch_add_tree (tree->watch, path);
+    }
+    g_free (path);
+}
+#endif /* DIR_WATCH_INOTIFY */
@@ -0,0 +1,80 @@
+/*
+ * Copyright © 2006-2009 Claes Nästén <me@pekdon.net>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/**
+ * Watching of scanned directories for changes.
+ */
+
+#ifndef _DIR_WATCH_H_
+#define _DIR_WATCH_H_
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <glib.h>
+
+#include "file_fetch.h"
+#include "file_queue.h"
+
+/** Milliseconds a file must be left alone before a change is acted on. */
+#define DIR_WATCH_DEBOUNCE 500
+/** Milliseconds between checks of the stop flag. */
+#define DIR_WATCH_POLL 250
+/** Size of buffer inotify events are read into. */
+#define DIR_WATCH_BUF 16384
+
+/**
+ * Change to file waiting for the file to settle.
+ */
+struct dir_watch_event {
+    gint64 deadline; /**< Monotonic time change is acted on. */
+    gboolean removed; /**< TRUE if file was removed, else changed. */
+};
+
+/**
+ * Directory watcher.
+ */
+struct dir_watch {
+    struct file_queue *queue; /**< Queue changed files are pushed onto. */
+    struct file_fetch *file_fetch; /**< File fetch removed files are
+                                        removed from. */
+
+    int fd; /**< inotify file descriptor, -1 if not available. */
+    GHashTable *dirs; /**< Watched directories, key is watch descriptor. */
+    GMutex dirs_mutex; /**< Mutex for dirs. */
+    GHashTable *events; /**< Pending struct dir_watch_event by path. */
+
+    GThread *thread; /**< Thread reading events. */
+    gboolean stop; /**< Stop flag. */
+};
+
+extern struct dir_watch *dir_watch_start (struct file_queue *queue,
+                                          struct file_fetch *file_fetch);
+extern void dir_watch_stop (struct dir_watch *watch);
+
+extern void dir_watch_add (struct dir_watch *watch, const gchar *path);
+
+#endif /* _DIR_WATCH_H_ */
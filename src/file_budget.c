@@ -0,0 +1,268 @@
+/*
+ * Copyright © 2006-2009 Claes Nästén <me@pekdon.net>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Memory budget shared by the stages of the pipeline. Producers acquire
+ * memory before handing work downstream and wait while the budget is
+ * used up, which in turn makes the stages before them wait. Thumbnails
+ * already shown are asked to spill to make room.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <glib.h>
+
+#include "file_budget.h"
+
+static gsize file_budget_over (gsize bytes);
+
+/** Budget in bytes, 0 means unlimited. */
+static gsize limit = 0;
+/** Bytes used by each stage. */
+static gsize used[FILE_BUDGET_STAGES];
+/** Bytes used by all stages. */
+static gsize used_total = 0;
+/** Set when stopping, acquiring no longer waits. */
+static gboolean stopped = FALSE;
+/** Callback freeing memory held by shown thumbnails, NULL if none. */
+static void (*spill) (gpointer, gsize) = NULL;
+/** Data for spill callback. */
+static gpointer spill_data = NULL;
+/** Lock for usage, acquired from all pipeline threads. */
+static GMutex budget_mutex;
+/** Signalled when memory is released. */
+static GCond budget_cond;
+
+/**
+ * Sets up budget, called before the pipeline starts.
+ *
+ * @param budget Budget in bytes, 0 means unlimited.
+ */
+void
+file_budget_init (gsize budget)
+{
+    guint i;
+
+    limit = budget;
+    for (i = 0; i < FILE_BUDGET_STAGES; i++) {
+        used[i] = 0;
+    }
+    used_total = 0;
+    stopped = FALSE;
+}
+
+/**
+ * Frees budget.
+ */
+void
+file_budget_free (void)
+{
+    spill = NULL;
+    spill_data = NULL;
+}
+
+/**
+ * Stops waiting for memory, threads waiting in file_budget_acquire
+ * return so the pipeline can be shut down.
+ */
+void
+file_budget_stop (void)
+{
+    g_mutex_lock (&budget_mutex);
+    stopped = TRUE;
+    g_cond_broadcast (&budget_cond);
+    g_mutex_unlock (&budget_mutex);
+}
+
+/**
+ * Sets callback asked to free memory when the budget is used up, called
+ * without any lock held.
+ *
+ * @param spill_fn Callback getting number of bytes to free, NULL to unset.
+ * @param data Data for callback.
+ */
+void
+file_budget_set_spill (void (*spill_fn) (gpointer, gsize), gpointer data)
+{
+    g_mutex_lock (&budget_mutex);
+    spill = spill_fn;
+    spill_data = data;
+    g_mutex_unlock (&budget_mutex);
+}
+
+/**
+ * Acquires memory for stage, waits until it fits in the budget. A stage
+ * not using any memory never waits so every stage can make progress.
+ *
+ * @param stage FILE_BUDGET_ stage acquiring memory.
+ * @param bytes Number of bytes to acquire.
+ */
+void
+file_budget_acquire (guint stage, gsize bytes)
+{
+    gsize over;
+    void (*spill_fn) (gpointer, gsize);
+    gpointer data;
+
+    g_assert (stage < FILE_BUDGET_STAGES);
+
+    g_mutex_lock (&budget_mutex);
+    while (! stopped && used[stage] > 0
+           && (over = file_budget_over (bytes)) > 0) {
+        /* Ask shown thumbnails to make room before waiting, stages
+           downstream release memory as they finish. */
+        spill_fn = spill;
+        data = spill_data;
+        if (spill_fn) {
+            g_mutex_unlock (&budget_mutex);
+            spill_fn (data, over);
+            g_mutex_lock (&budget_mutex);
+            if (stopped || used[stage] == 0 || file_budget_over (bytes) == 0) {
+                break;
+            }
+        }
+        g_cond_wait (&budget_cond, &budget_mutex);
+    }
+    used[stage] += bytes;
+    used_total += bytes;
+    g_mutex_unlock (&budget_mutex);
+}
+
+/**
+ * Charges memory to stage without waiting, shown thumbnails are asked to
+ * spill if it does not fit in the budget.
+ *
+ * @param stage FILE_BUDGET_ stage charging memory.
+ * @param bytes Number of bytes to charge.
+ */
+void
+file_budget_charge (guint stage, gsize bytes)
+{
+    gsize over;
+    void (*spill_fn) (gpointer, gsize);
+    gpointer data;
+
+    g_assert (stage < FILE_BUDGET_STAGES);
+
+    g_mutex_lock (&budget_mutex);
+    used[stage] += bytes;
+    used_total += bytes;
+    over = file_budget_over (0);
+    spill_fn = spill;
+    data = spill_data;
+    g_mutex_unlock (&budget_mutex);
+
+    if (over > 0 && spill_fn) {
+        spill_fn (data, over);
+    }
+}
+
+/**
+ * Releases memory previously acquired or charged for stage.
+ *
+ * @param stage FILE_BUDGET_ stage releasing memory.
+ * @param bytes Number of bytes to release.
+ */
+void
+file_budget_release (guint stage, gsize bytes)
+{
+    g_assert (stage < FILE_BUDGET_STAGES);
+
+    if (bytes == 0) {
+        return;
+    }
+
+    g_mutex_lock (&budget_mutex);
+    g_assert (used[stage] >= bytes);
+    used[stage] -= bytes;
+    used_total -= bytes;
+    g_cond_broadcast (&budget_cond);
+    g_mutex_unlock (&budget_mutex);
+}
+
+/**
+ * Returns memory used by all stages.
+ *
+ * @return Number of bytes used.
+ */
+gsize
+file_budget_get_used (void)
+{
+    gsize bytes;
+
+    g_mutex_lock (&budget_mutex);
+    bytes = used_total;
+    g_mutex_unlock (&budget_mutex);
+
+    return bytes;
+}
+
+/**
+ * Returns memory used by stage.
+ *
+ * @param stage FILE_BUDGET_ stage.
+ * @return Number of bytes used.
+ */
+gsize
+file_budget_get_stage (guint stage)
+{
+    gsize bytes;
+
+    g_assert (stage < FILE_BUDGET_STAGES);
+
+    g_mutex_lock (&budget_mutex);
+    bytes = used[stage];
+    g_mutex_unlock (&budget_mutex);
+
+    return bytes;
+}
+
+/**
+ * Returns the budget.
+ *
+ * @return Budget in bytes, 0 means unlimited.
+ */
+gsize
+file_budget_get_limit (void)
+{
+    return limit;
+}
+
+/**
+ * Returns how far over budget acquiring bytes would go, called with
+ * budget_mutex held.
+ *
+ * @param bytes Number of bytes to acquire.
+ * @return Number of bytes over budget, 0 if it fits.
+ */
+gsize
+file_budget_over (gsize bytes)
+{
+    if (limit == 0 || used_total + bytes <= limit) {
+        return 0;
+    }
+    return used_total + bytes - limit;
+}
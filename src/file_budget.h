@@ -0,0 +1,64 @@
+/*
+ * Copyright © 2006-2009 Claes Nästén <me@pekdon.net>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Memory budget shared by the stages of the pipeline.
+ */
+
+#ifndef _FILE_BUDGET_H_
+#define _FILE_BUDGET_H_
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <glib.h>
+
+/** Thumbnail jobs waiting to be decoded, charged their thumbnail size. */
+#define FILE_BUDGET_QUEUE 0
+/** Images being decoded, charged their decoded size. */
+#define FILE_BUDGET_DECODE 1
+/** Thumbnails shown in the thumbnail view. */
+#define FILE_BUDGET_THUMB 2
+/** Fetched files kept in memory. */
+#define FILE_BUDGET_FETCH 3
+/** Number of stages. */
+#define FILE_BUDGET_STAGES 4
+
+extern void file_budget_init (gsize limit);
+extern void file_budget_free (void);
+extern void file_budget_stop (void);
+
+extern void file_budget_set_spill (void (*spill) (gpointer, gsize),
+                                   gpointer spill_data);
+
+extern void file_budget_acquire (guint stage, gsize bytes);
+extern void file_budget_charge (guint stage, gsize bytes);
+extern void file_budget_release (guint stage, gsize bytes);
+
+extern gsize file_budget_get_used (void);
+extern gsize file_budget_get_stage (guint stage);
+extern gsize file_budget_get_limit (void);
+
+#endif /* _FILE_BUDGET_H_ */
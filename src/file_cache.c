@@ -0,0 +1,693 @@
+/*
+ * Copyright © 2006-2009 Claes Nästén <me@pekdon.net>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * On-disk cache of fetched files, bounded in size and revalidated with
+ * the validators sent with them. Files are named after the MD5 of their
+ * URL, least recently used files are evicted first. Files not fetched to
+ * the end are kept with a suffix so the next fetch can continue them.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "file_cache.h"
+#include "file_io.h"
+
+/**
+ * Cached file.
+ */
+struct file_cache_item {
+    gchar *name; /**< Name of file, MD5 of URL with suffix if partial. */
+    gsize size; /**< Size of file. */
+    time_t used; /**< Time file was last used, read from mtime. */
+    GList *link; /**< Link in items_used. */
+};
+
+/**
+ * File being written to the cache.
+ */
+struct file_cache_store {
+    gchar *url; /**< URL of file. */
+    gchar *etag; /**< ETag validator, NULL if none. */
+    gchar *last_modified; /**< Last-Modified validator, NULL if none. */
+    gchar *path; /**< Temporary file written to. */
+    gint fd; /**< Temporary file, -1 if writing failed. */
+    gsize size; /**< Bytes written. */
+};
+
+static struct file_cache_hit *file_cache_open (const gchar *url,
+                                               gboolean part);
+static gboolean file_cache_keep (struct file_cache_store *store,
+                                 const gchar *name);
+static gchar *file_cache_name (const gchar *url, gboolean part);
+static gchar *file_cache_path (const gchar *name, const gchar *suffix);
+static void file_cache_scan (void);
+static gint file_cache_item_cmp (gconstpointer a, gconstpointer b);
+static void file_cache_item_free (struct file_cache_item *item);
+static void file_cache_insert (const gchar *name, gsize size);
+static void file_cache_evict (void);
+static void file_cache_remove (const gchar *name);
+static void file_cache_unlink (const gchar *name);
+
+/** Cache directory, NULL if caching is disabled. */
+static gchar *dir = NULL;
+/** Size limit in bytes. */
+static gsize limit = 0;
+/** Bytes used by cached files. */
+static gsize used = 0;
+/** Cached files by name. */
+static GHashTable *items = NULL;
+/** Cached files, least recently used first. */
+static GQueue items_used = G_QUEUE_INIT;
+/** Lock for items, files are cached from all fetch threads. */
+static GMutex items_mutex;
+
+/**
+ * Sets up the cache, reading the files cached by earlier runs.
+ *
+ * @param size Size limit in bytes, 0 disables caching.
+ */
+void
+file_cache_init (gsize size)
+{
+    if (size == 0) {
+        return;
+    }
+
+    dir = g_build_filename (g_get_user_cache_dir (), FILE_CACHE_PATH, NULL);
+    if (g_mkdir_with_parents (dir, 0700) == -1) {
+        g_warning ("unable to create cache directory %s", dir);
+        g_free (dir);
+        dir = NULL;
+        return;
+    }
+
+    limit = size;
+    items = g_hash_table_new_full (&g_str_hash, &g_str_equal, NULL,
+                                   (GDestroyNotify) &file_cache_item_free);
+    file_cache_scan ();
+
+    /* The limit may have been lowered since */
+    g_mutex_lock (&items_mutex);
+    file_cache_evict ();
+    g_mutex_unlock (&items_mutex);
+}
+
+/**
+ * Frees the cache, cached files are kept for the next run.
+ */
+void
+file_cache_free (void)
+{
+    if (dir) {
+        g_queue_clear (&items_used);
+        g_hash_table_destroy (items);
+        g_free (dir);
+        items = NULL;
+        dir = NULL;
+        used = 0;
+    }
+}
+
+/**
+ * Looks up cached file for URL, files without validators are not kept
+ * as they can not be revalidated.
+ *
+ * @param url URL of file.
+ * @return struct file_cache_hit, NULL if not cached.
+ */
+struct file_cache_hit*
+file_cache_lookup (const gchar *url)
+{
+    return file_cache_open (url, FALSE);
+}
+
+/**
+ * Looks up start of file for URL kept when fetching it failed part way.
+ *
+ * @param url URL of file.
+ * @return struct file_cache_hit, NULL if none.
+ */
+struct file_cache_hit*
+file_cache_lookup_part (const gchar *url)
+{
+    return file_cache_open (url, TRUE);
+}
+
+/**
+ * Removes start of file for URL, used when it can not be continued.
+ *
+ * @param url URL of file.
+ */
+void
+file_cache_forget_part (const gchar *url)
+{
+    gchar *name;
+
+    if (! dir) {
+        return;
+    }
+
+    name = file_cache_name (url, TRUE);
+    file_cache_remove (name);
+    g_free (name);
+}
+
+/**
+ * Opens cached file for URL and reads its validators.
+ *
+ * @param url URL of file.
+ * @param part TRUE to open the start of file kept, else the whole file.
+ * @return struct file_cache_hit, NULL if not cached.
+ */
+struct file_cache_hit*
+file_cache_open (const gchar *url, gboolean part)
+{
+    gint fd;
+    struct stat buf;
+    gchar *name, *path, *meta, *meta_url;
+    GKeyFile *key_file;
+    struct file_cache_item *item;
+    struct file_cache_hit *hit = NULL;
+
+    if (! dir) {
+        return NULL;
+    }
+
+    name = file_cache_name (url, part);
+
+    /* Most recently used last */
+    g_mutex_lock (&items_mutex);
+    item = g_hash_table_lookup (items, name);
+    if (item) {
+        g_queue_unlink (&items_used, item->link);
+        g_queue_push_tail_link (&items_used, item->link);
+    }
+    g_mutex_unlock (&items_mutex);
+
+    if (! item) {
+        g_free (name);
+        return NULL;
+    }
+
+    path = file_cache_path (name, NULL);
+    meta = file_cache_path (name, FILE_CACHE_META);
+
+    /* Open file before reading its validators, an evicted file stays
+       readable while open. */
+    fd = g_open (path, O_RDONLY | O_CLOEXEC, 0);
+    key_file = g_key_file_new ();
+    if ((fd != -1) && ! fstat (fd, &buf)
+        && g_key_file_load_from_file (key_file, meta, G_KEY_FILE_NONE,
+                                      NULL)) {
+        meta_url = g_key_file_get_string (key_file, FILE_CACHE_GROUP,
+                                          "url", NULL);
+        if (meta_url && ! strcmp (meta_url, url)) {
+            hit = g_malloc (sizeof (struct file_cache_hit));
+            hit->fd = fd;
+            hit->size = buf.st_size;
+            hit->etag = g_key_file_get_string (key_file, FILE_CACHE_GROUP,
+                                               "etag", NULL);
+            hit->last_modified = g_key_file_get_string (key_file,
+                                                        FILE_CACHE_GROUP,
+                                                        "last-modified",
+                                                        NULL);
+            if (! hit->etag && ! hit->last_modified) {
+                file_cache_hit_free (hit);
+                hit = NULL;
+                fd = -1;
+            }
+        }
+        g_free (meta_url);
+    }
+    g_key_file_free (key_file);
+
+    if (hit) {
+        /* Keep order of use for the next run */
+        g_utime (path, NULL);
+    } else if (fd != -1) {
+        close (fd);
+    }
+
+    g_free (meta);
+    g_free (path);
+    g_free (name);
+
+    return hit;
+}
+
+/**
+ * Reads all of cached file.
+ *
+ * @param hit struct file_cache_hit to read.
+ * @param chunk Called with data as it is read, return FALSE to stop.
+ * @param chunk_data Data passed to chunk.
+ * @return TRUE if all of file was read and passed, else FALSE.
+ */
+gboolean
+file_cache_hit_read (struct file_cache_hit *hit,
+                     gboolean (*chunk)(gpointer, const guchar*, gsize),
+                     gpointer chunk_data)
+{
+    ssize_t len;
+    guchar *buf;
+    gboolean status = TRUE;
+
+    buf = g_malloc (FILE_IO_CHUNK);
+    while (status && (len = read (hit->fd, buf, FILE_IO_CHUNK)) != 0) {
+        if (len == -1) {
+            status = (errno == EINTR);
+        } else {
+            status = chunk (chunk_data, buf, len);
+        }
+    }
+    g_free (buf);
+
+    return status;
+}
+
+/**
+ * Frees cached file found, closing it.
+ *
+ * @param hit struct file_cache_hit to free.
+ */
+void
+file_cache_hit_free (struct file_cache_hit *hit)
+{
+    if (hit->fd != -1) {
+        close (hit->fd);
+    }
+    g_free (hit->etag);
+    g_free (hit->last_modified);
+    g_free (hit);
+}
+
+/**
+ * Starts writing file to the cache, the file replaces any cached file
+ * for the URL when finished.
+ *
+ * @param url URL of file.
+ * @param etag ETag validator, NULL if none.
+ * @param last_modified Last-Modified validator, NULL if none.
+ * @return struct file_cache_store, NULL if not cached.
+ */
+struct file_cache_store*
+file_cache_store_new (const gchar *url, const gchar *etag,
+                      const gchar *last_modified)
+{
+    gint fd;
+    gchar *path;
+    struct file_cache_store *store;
+
+    if (! dir || (! etag && ! last_modified)) {
+        return NULL;
+    }
+
+    path = g_build_filename (dir, FILE_CACHE_TMP "XXXXXX", NULL);
+    fd = g_mkstemp (path);
+    if (fd == -1) {
+        g_free (path);
+        return NULL;
+    }
+
+    store = g_malloc (sizeof (struct file_cache_store));
+    store->url = g_strdup (url);
+    store->etag = g_strdup (etag);
+    store->last_modified = g_strdup (last_modified);
+    store->path = path;
+    store->fd = fd;
+    store->size = 0;
+
+    return store;
+}
+
+/**
+ * Writes more of file to the cache, files larger than the cache are
+ * dropped.
+ *
+ * @param store struct file_cache_store to write to.
+ * @param buf Data of file.
+ * @param len Length of data.
+ */
+void
+file_cache_store_write (struct file_cache_store *store,
+                        const guchar *buf, gsize len)
+{
+    ssize_t written;
+
+    if (store->fd == -1) {
+        return;
+    }
+
+    store->size += len;
+    while (len > 0 && store->size <= limit) {
+        written = write (store->fd, buf, len);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        buf += written;
+        len -= written;
+    }
+
+    if (len > 0) {
+        close (store->fd);
+        store->fd = -1;
+    }
+}
+
+/**
+ * Finishes writing file to the cache, replacing the start of it kept
+ * before if any.
+ *
+ * @param store struct file_cache_store to finish, freed.
+ * @param commit TRUE if all of the file was written, else what was
+ *               written is kept to be continued.
+ */
+void
+file_cache_store_finish (struct file_cache_store *store, gboolean commit)
+{
+    gchar *name, *part;
+    gboolean status;
+
+    if (store->fd != -1) {
+        status = (close (store->fd) == 0) && (commit || store->size > 0);
+    } else {
+        status = FALSE;
+    }
+
+    name = file_cache_name (store->url, FALSE);
+    part = file_cache_name (store->url, TRUE);
+
+    if (status) {
+        status = file_cache_keep (store, commit ? name : part);
+    }
+    if (status && commit) {
+        file_cache_remove (part);
+    }
+    if (! status) {
+        g_unlink (store->path);
+    }
+
+    g_free (part);
+    g_free (name);
+    g_free (store->url);
+    g_free (store->etag);
+    g_free (store->last_modified);
+    g_free (store->path);
+    g_free (store);
+}
+
+/**
+ * Moves written file into the cache.
+ *
+ * @param store struct file_cache_store written, closed.
+ * @param name Name of cached file.
+ * @return TRUE if the file was moved, else FALSE.
+ */
+gboolean
+file_cache_keep (struct file_cache_store *store, const gchar *name)
+{
+    gchar *path, *meta, *data;
+    gsize len;
+    gboolean status;
+    GKeyFile *key_file;
+
+    path = file_cache_path (name, NULL);
+    meta = file_cache_path (name, FILE_CACHE_META);
+
+    key_file = g_key_file_new ();
+    g_key_file_set_string (key_file, FILE_CACHE_GROUP, "url", store->url);
+    if (store->etag) {
+        g_key_file_set_string (key_file, FILE_CACHE_GROUP, "etag",
+                               store->etag);
+    }
+    if (store->last_modified) {
+        g_key_file_set_string (key_file, FILE_CACHE_GROUP,
+                               "last-modified", store->last_modified);
+    }
+    data = g_key_file_to_data (key_file, &len, NULL);
+    g_key_file_free (key_file);
+
+    /* Validators of the replaced file must not be used with the new
+       one, the meta file is removed first and written last. */
+    g_unlink (meta);
+    status = (g_rename (store->path, path) == 0)
+        && g_file_set_contents (meta, data, len, NULL);
+    g_free (data);
+
+    if (status) {
+        g_mutex_lock (&items_mutex);
+        file_cache_insert (name, store->size);
+        file_cache_evict ();
+        g_mutex_unlock (&items_mutex);
+    }
+
+    g_free (meta);
+    g_free (path);
+
+    return status;
+}
+
+/**
+ * Returns name of cached file for URL.
+ *
+ * @param url URL of file.
+ * @param part TRUE for the name of the start of file kept.
+ * @return MD5 of URL, with suffix if part is set, needs freeing.
+ */
+gchar*
+file_cache_name (const gchar *url, gboolean part)
+{
+    gchar *name, *full;
+
+    name = g_compute_checksum_for_string (G_CHECKSUM_MD5, url, -1);
+    if (! part) {
+        return name;
+    }
+
+    full = g_strconcat (name, FILE_CACHE_PART, NULL);
+    g_free (name);
+
+    return full;
+}
+
+/**
+ * Returns path to file in the cache directory.
+ *
+ * @param name Name of cached file.
+ * @param suffix Suffix appended to name, NULL if none.
+ * @return Path, needs freeing.
+ */
+gchar*
+file_cache_path (const gchar *name, const gchar *suffix)
+{
+    gchar *path, *full;
+
+    path = g_build_filename (dir, name, NULL);
+    if (! suffix) {
+        return path;
+    }
+
+    full = g_strconcat (path, suffix, NULL);
+    g_free (path);
+
+    return full;
+}
+
+/**
+ * Reads files cached by earlier runs, ordered by their mtime. Files
+ * left over from interrupted writes are removed.
+ */
+void
+file_cache_scan (void)
+{
+    gchar *path;
+    const gchar *name;
+    GDir *gdir;
+    GList *it, *found = NULL;
+    struct stat buf;
+    struct file_cache_item *item;
+
+    gdir = g_dir_open (dir, 0, NULL);
+    if (! gdir) {
+        return;
+    }
+
+    while ((name = g_dir_read_name (gdir)) != NULL) {
+        path = g_build_filename (dir, name, NULL);
+        if (g_str_has_prefix (name, FILE_CACHE_TMP)) {
+            g_unlink (path);
+        } else if (! g_str_has_suffix (name, FILE_CACHE_META)
+                   && ! g_stat (path, &buf) && S_ISREG (buf.st_mode)) {
+            item = g_malloc (sizeof (struct file_cache_item));
+            item->name = g_strdup (name);
+            item->size = buf.st_size;
+            item->used = buf.st_mtime;
+            found = g_list_prepend (found, item);
+        }
+        g_free (path);
+    }
+    g_dir_close (gdir);
+
+    found = g_list_sort (found, &file_cache_item_cmp);
+    for (it = found; it; it = it->next) {
+        item = (struct file_cache_item*) it->data;
+        g_queue_push_tail (&items_used, item);
+        item->link = g_queue_peek_tail_link (&items_used);
+        g_hash_table_insert (items, item->name, item);
+        used += item->size;
+    }
+    g_list_free (found);
+}
+
+/**
+ * Compares cached files by time of use.
+ *
+ * @param a struct file_cache_item.
+ * @param b struct file_cache_item.
+ * @return Less than, equal to or greater than 0 if a is used before, at
+ *         the same time or after b.
+ */
+gint
+file_cache_item_cmp (gconstpointer a, gconstpointer b)
+{
+    time_t used_a = ((const struct file_cache_item*) a)->used;
+    time_t used_b = ((const struct file_cache_item*) b)->used;
+
+    return (used_a > used_b) - (used_a < used_b);
+}
+
+/**
+ * Frees cached file entry.
+ *
+ * @param item struct file_cache_item to free.
+ */
+void
+file_cache_item_free (struct file_cache_item *item)
+{
+    g_free (item->name);
+    g_free (item);
+}
+
+/**
+ * Adds or replaces cached file as the most recently used one. Called
+ * with items_mutex held.
+ *
+ * @param name Name of file.
+ * @param size Size of file.
+ */
+void
+file_cache_insert (const gchar *name, gsize size)
+{
+    struct file_cache_item *item;
+
+    item = g_hash_table_lookup (items, name);
+    if (item) {
+        used -= item->size;
+        g_queue_unlink (&items_used, item->link);
+        g_queue_push_tail_link (&items_used, item->link);
+    } else {
+        item = g_malloc (sizeof (struct file_cache_item));
+        item->name = g_strdup (name);
+        g_queue_push_tail (&items_used, item);
+        item->link = g_queue_peek_tail_link (&items_used);
+        g_hash_table_insert (items, item->name, item);
+    }
+    item->size = size;
+    item->used = time (NULL);
+    used += size;
+}
+
+/**
+ * Removes least recently used files until the cache fits its limit.
+ * Called with items_mutex held.
+ */
+void
+file_cache_evict (void)
+{
+    struct file_cache_item *item;
+
+    while ((used > limit)
+           && (item = g_queue_pop_head (&items_used)) != NULL) {
+        used -= item->size;
+        file_cache_unlink (item->name);
+        g_hash_table_remove (items, item->name);
+    }
+}
+
+/**
+ * Removes cached file if any.
+ *
+ * @param name Name of file.
+ */
+void
+file_cache_remove (const gchar *name)
+{
+    struct file_cache_item *item;
+
+    g_mutex_lock (&items_mutex);
+    item = g_hash_table_lookup (items, name);
+    if (item) {
+        used -= item->size;
+        g_queue_delete_link (&items_used, item->link);
+        g_hash_table_remove (items, name);
+        file_cache_unlink (name);
+    }
+    g_mutex_unlock (&items_mutex);
+}
+
+/**
+ * Removes cached file and its meta file.
+ *
+ * @param name Name of file.
+ */
+void
+file_cache_unlink (const gchar *name)
+{
+    gchar *path;
+
+    path = file_cache_path (name, FILE_CACHE_META);
+    g_unlink (path);
+    g_free (path);
+
+    path = file_cache_path (name, NULL);
+    g_unlink (path);
+    g_free (path);
+}
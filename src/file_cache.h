@@ -0,0 +1,83 @@
+/*
+ * Copyright © 2006-2009 Claes Nästén <me@pekdon.net>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * On-disk cache of fetched files, bounded in size and revalidated with
+ * the validators sent with them.
+ */
+
+#ifndef _FILE_CACHE_H_
+#define _FILE_CACHE_H_
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <glib.h>
+
+/** Directory below the user cache directory holding fetched files. */
+#define FILE_CACHE_PATH "geh/fetch"
+/** Suffix of the file holding URL and validators of a cached file. */
+#define FILE_CACHE_META ".meta"
+/** Suffix of a file fetched in part, continued by the next fetch. */
+#define FILE_CACHE_PART ".part"
+/** Prefix of files being written, left over ones are removed. */
+#define FILE_CACHE_TMP "tmp-"
+/** Group in the meta file. */
+#define FILE_CACHE_GROUP "fetch"
+
+/**
+ * Cached file found for URL.
+ */
+struct file_cache_hit {
+    gint fd; /**< Cached file, stays readable if evicted. */
+    gsize size; /**< Size of file. */
+    gchar *etag; /**< ETag validator, NULL if none. */
+    gchar *last_modified; /**< Last-Modified validator, NULL if none. */
+};
+
+struct file_cache_store;
+
+extern void file_cache_init (gsize limit);
+extern void file_cache_free (void);
+
+extern struct file_cache_hit *file_cache_lookup (const gchar *url);
+extern struct file_cache_hit *file_cache_lookup_part (const gchar *url);
+extern void file_cache_forget_part (const gchar *url);
+extern gboolean file_cache_hit_read (struct file_cache_hit *hit,
+                                     gboolean (*chunk)(gpointer,
+                                                       const guchar*, gsize),
+                                     gpointer chunk_data);
+extern void file_cache_hit_free (struct file_cache_hit *hit);
+
+extern struct file_cache_store *file_cache_store_new (const gchar *url,
+                                                      const gchar *etag,
+                                                      const gchar
+                                                      *last_modified);
+extern void file_cache_store_write (struct file_cache_store *store,
+                                    const guchar *buf, gsize len);
+extern void file_cache_store_finish (struct file_cache_store *store,
+                                     gboolean commit);
+
+#endif /* _FILE_CACHE_H_ */
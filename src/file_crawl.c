@@ -0,0 +1,385 @@
+/*
+ * Copyright © 2006-2009 Claes Nästén <me@pekdon.net>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Crawling of pages: depth and host rules for following links, the set
+ * of URLs seen and link lists cached between runs. The seen set only
+ * keeps a 64-bit hash of each URL so that it stays small with millions
+ * of URLs, a collision makes a URL skipped.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <glib.h>
+#include <string.h>
+
+#include "geh.h"
+#include "file_crawl.h"
+#include "file_multi.h"
+#include "file_net.h"
+
+static guint64 file_crawl_hash (const gchar *url);
+static gboolean file_crawl_seen_insert (guint64 *set, gsize size,
+                                        guint64 hash);
+static void file_crawl_seen_grow (void);
+static gchar *file_crawl_path (const gchar *url);
+static GList *file_crawl_list_get (GKeyFile *key_file, const gchar *key);
+static void file_crawl_list_set (GKeyFile *key_file, const gchar *key,
+                                 GList *list);
+
+/** Hashes of URLs seen, open addressing with 0 marking a free slot. */
+static guint64 *seen = NULL;
+/** Number of slots in seen. */
+static gsize seen_size = 0;
+/** Number of slots used in seen. */
+static gsize seen_used = 0;
+/** Lock for seen, links are enqueued from all fetch threads. */
+static GMutex seen_mutex;
+
+/** Link list directory, NULL if caching is disabled. */
+static gchar *dir = NULL;
+
+/**
+ * Sets up the seen set and the link list cache.
+ *
+ * @param cache TRUE to cache link lists of pages between runs.
+ */
+void
+file_crawl_init (gboolean cache)
+{
+    seen_size = FILE_CRAWL_SEEN_SIZE;
+    seen_used = 0;
+    seen = g_malloc0 (seen_size * sizeof (seen[0]));
+
+    if (! cache) {
+        return;
+    }
+
+    dir = g_build_filename (g_get_user_cache_dir (), FILE_CRAWL_PATH, NULL);
+    if (g_mkdir_with_parents (dir, 0700) == -1) {
+        g_warning ("unable to create cache directory %s", dir);
+        g_free (dir);
+        dir = NULL;
+    }
+}
+
+/**
+ * Frees the seen set, link lists are kept for the next run.
+ */
+void
+file_crawl_free (void)
+{
+    g_free (seen);
+    seen = NULL;
+    seen_size = 0;
+    seen_used = 0;
+
+    g_free (dir);
+    dir = NULL;
+}
+
+/**
+ * Checks if URL was seen before and marks it seen.
+ *
+ * @param url URL to check.
+ * @return TRUE if seen before, else FALSE.
+ */
+gboolean
+file_crawl_seen (const gchar *url)
+{
+    gboolean found;
+
+    g_mutex_lock (&seen_mutex);
+    found = file_crawl_seen_insert (seen, seen_size, file_crawl_hash (url));
+    if (! found && (++seen_used * 2 > seen_size)) {
+        file_crawl_seen_grow ();
+    }
+    g_mutex_unlock (&seen_mutex);
+
+    return found;
+}
+
+/**
+ * Checks if link from page to another page is followed, pages are only
+ * followed below the crawl depth and on the host of the page unless any
+ * host is allowed.
+ *
+ * @param page Page the link is on.
+ * @param url URL of the linked page.
+ * @return TRUE if the page is to be fetched, else FALSE.
+ */
+gboolean
+file_crawl_follow (struct file_multi *page, const gchar *url)
+{
+    gboolean follow;
+    gchar *host, *page_host;
+
+    if ((gint) file_multi_get_depth (page) >= options.crawl_depth) {
+        return FALSE;
+    }
+    if (options.crawl_any_host) {
+        return TRUE;
+    }
+
+    host = file_net_host (url);
+    page_host = file_net_host (file_multi_get_path (page));
+    follow = host && page_host && ! strcmp (host, page_host);
+    g_free (host);
+    g_free (page_host);
+
+    return follow;
+}
+
+/**
+ * Looks up link list cached for page, the validators it was saved with
+ * are set on page so that it is only fetched if it changed since.
+ *
+ * @param page Page to look up.
+ * @param images Set to list of image URLs, needs freeing.
+ * @param pages Set to list of page URLs, needs freeing.
+ * @return TRUE if a link list with validators is cached, else FALSE.
+ */
+gboolean
+file_crawl_lookup (struct file_multi *page, GList **images, GList **pages)
+{
+    gchar *path, *url, *etag;
+    gint64 mtime = -1;
+    gboolean status = FALSE;
+    GKeyFile *key_file;
+
+    if (! dir) {
+        return FALSE;
+    }
+
+    path = file_crawl_path (file_multi_get_path (page));
+    key_file = g_key_file_new ();
+    if (g_key_file_load_from_file (key_file, path, G_KEY_FILE_NONE, NULL)) {
+        /* Names are hashes, make sure it is the same page */
+        url = g_key_file_get_string (key_file, FILE_CRAWL_GROUP, "url",
+                                     NULL);
+        etag = g_key_file_get_string (key_file, FILE_CRAWL_GROUP, "etag",
+                                      NULL);
+        if (g_key_file_has_key (key_file, FILE_CRAWL_GROUP, "mtime", NULL)) {
+            mtime = g_key_file_get_int64 (key_file, FILE_CRAWL_GROUP,
+                                          "mtime", NULL);
+        }
+
+        status = url && ! strcmp (url, file_multi_get_path (page))
+            && (etag || (mtime != -1));
+        if (status) {
+            file_multi_set_validators (page, etag, mtime);
+            *images = file_crawl_list_get (key_file, "images");
+            *pages = file_crawl_list_get (key_file, "pages");
+        }
+
+        g_free (url);
+        g_free (etag);
+    }
+    g_key_file_free (key_file);
+    g_free (path);
+
+    return status;
+}
+
+/**
+ * Caches link list of page, pages without validators are not cached as
+ * there is no telling if they changed.
+ *
+ * @param page Page links were extracted from.
+ * @param images List of image URLs.
+ * @param pages List of page URLs.
+ */
+void
+file_crawl_save (struct file_multi *page, GList *images, GList *pages)
+{
+    gchar *path, *data;
+    gsize len;
+    GKeyFile *key_file;
+
+    if (! dir || ((file_multi_get_mtime (page) == -1)
+                  && ! file_multi_get_etag (page))) {
+        return;
+    }
+
+    key_file = g_key_file_new ();
+    g_key_file_set_string (key_file, FILE_CRAWL_GROUP, "url",
+                           file_multi_get_path (page));
+    if (file_multi_get_etag (page)) {
+        g_key_file_set_string (key_file, FILE_CRAWL_GROUP, "etag",
+                               file_multi_get_etag (page));
+    }
+    if (file_multi_get_mtime (page) != -1) {
+        g_key_file_set_int64 (key_file, FILE_CRAWL_GROUP, "mtime",
+                              file_multi_get_mtime (page));
+    }
+    file_crawl_list_set (key_file, "images", images);
+    file_crawl_list_set (key_file, "pages", pages);
+    data = g_key_file_to_data (key_file, &len, NULL);
+    g_key_file_free (key_file);
+
+    path = file_crawl_path (file_multi_get_path (page));
+    if (! g_file_set_contents (path, data, len, NULL)) {
+        g_warning ("failed to save links of %s", file_multi_get_path (page));
+    }
+    g_free (path);
+    g_free (data);
+}
+
+/**
+ * Hashes URL with 64-bit FNV-1a, never returns 0 as it marks a free
+ * slot.
+ *
+ * @param url URL to hash.
+ * @return Hash of URL.
+ */
+guint64
+file_crawl_hash (const gchar *url)
+{
+    guint64 hash = G_GUINT64_CONSTANT (14695981039346656037);
+
+    for (; *url; url++) {
+        hash ^= (guchar) *url;
+        hash *= G_GUINT64_CONSTANT (1099511628211);
+    }
+
+    return hash ? hash : 1;
+}
+
+/**
+ * Inserts hash into set unless already there.
+ *
+ * @param set Set to insert into.
+ * @param size Number of slots in set, a power of two.
+ * @param hash Hash to insert.
+ * @return TRUE if hash was already in set, else FALSE.
+ */
+gboolean
+file_crawl_seen_insert (guint64 *set, gsize size, guint64 hash)
+{
+    gsize i;
+
+    for (i = hash & (size - 1); set[i]; i = (i + 1) & (size - 1)) {
+        if (set[i] == hash) {
+            return TRUE;
+        }
+    }
+    set[i] = hash;
+
+    return FALSE;
+}
+
+/**
+ * Doubles the size of the seen set, called with seen_mutex held.
+ */
+void
+file_crawl_seen_grow (void)
+{
+    gsize i, size;
+    guint64 *set;
+
+    size = seen_size * 2;
+    set = g_malloc0 (size * sizeof (set[0]));
+    for (i = 0; i < seen_size; i++) {
+        if (seen[i]) {
+            file_crawl_seen_insert (set, size, seen[i]);
+        }
+    }
+
+    g_free (seen);
+    seen = set;
+    seen_size = size;
+}
+
+/**
+ * Returns path to link list of URL, named after its MD5.
+ *
+ * @param url URL of page.
+ * @return Path, needs freeing.
+ */
+gchar*
+file_crawl_path (const gchar *url)
+{
+    gchar *name, *path;
+
+    name = g_compute_checksum_for_string (G_CHECKSUM_MD5, url, -1);
+    path = g_build_filename (dir, name, NULL);
+    g_free (name);
+
+    return path;
+}
+
+/**
+ * Reads list of URLs from link list.
+ *
+ * @param key_file Link list.
+ * @param key Key of list.
+ * @return List of URLs, needs freeing, NULL if empty.
+ */
+GList*
+file_crawl_list_get (GKeyFile *key_file, const gchar *key)
+{
+    gsize i, len;
+    gchar **strs;
+    GList *list = NULL;
+
+    strs = g_key_file_get_string_list (key_file, FILE_CRAWL_GROUP, key,
+                                       &len, NULL);
+    if (! strs) {
+        return NULL;
+    }
+
+    /* Strings are taken over by the list */
+    for (i = len; i > 0; i--) {
+        list = g_list_prepend (list, strs[i - 1]);
+    }
+    g_free (strs);
+
+    return list;
+}
+
+/**
+ * Writes list of URLs to link list.
+ *
+ * @param key_file Link list.
+ * @param key Key of list.
+ * @param list List of URLs.
+ */
+void
+file_crawl_list_set (GKeyFile *key_file, const gchar *key, GList *list)
+{
+    guint i;
+    const gchar **strs;
+    GList *it;
+
+    strs = g_new (const gchar*, g_list_length (list) + 1);
+    for (i = 0, it = list; it; it = it->next) {
+        strs[i++] = (const gchar*) it->data;
+    }
+    strs[i] = NULL;
+
+    g_key_file_set_string_list (key_file, FILE_CRAWL_GROUP, key, strs, i);
+    g_free (strs);
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright © 2006-2009 Claes Nästén <me@pekdon.net>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Crawling of pages: depth and host rules for following links, the set
+ * of URLs seen and link lists cached between runs.
+ */
+
+#ifndef _FILE_CRAWL_H_
+#define _FILE_CRAWL_H_
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <glib.h>
+
+#include "file_multi.h"
+
+/** Directory below the user cache directory holding link lists. */
+#define FILE_CRAWL_PATH "geh/links"
+/** Group in the link list file. */
+#define FILE_CRAWL_GROUP "links"
+/** Initial number of slots in the seen set, must be a power of two. */
+#define FILE_CRAWL_SEEN_SIZE 4096
+
+extern void file_crawl_init (gboolean cache);
+extern void file_crawl_free (void);
+
+extern gboolean file_crawl_seen (const gchar *url);
+extern gboolean file_crawl_follow (struct file_multi *page,
+                                   const gchar *url);
+
+extern gboolean file_crawl_lookup (struct file_multi *page,
+                                   GList **images, GList **pages);
+extern void file_crawl_save (struct file_multi *page,
+                             GList *images, GList *pages);
+
+#endif /* _FILE_CRAWL_H_ */
@@ -34,22 +34,123 @@
 #include <string.h>
 
 #include "geh.h"
+#include "file_budget.h"
+#include "file_crawl.h"
 #include "file_multi.h"
+#include "file_net.h"
 #include "file_fetch.h"
 #include "file_fetch_img.h"
+#include "file_filter.h"
+#include "file_ident.h"
 #include "file_queue.h"
+#include "file_sniff.h"
+#include "file_url.h"
 #include "thumb.h"
 #include "ui_window.h"
-#include "util.h"
 
-#define IMAGE_EXT "bmp", "gif", "jpg", "jpeg", "png", "svg", "tiff", "xpm", NULL
+#define FILE_FETCH_THUMB_QUEUED 0
+#define FILE_FETCH_THUMB_RUNNING 1
+#define FILE_FETCH_THUMB_DONE 2
+
+/** Microseconds between updates of images decoded while fetching. */
+#define FILE_FETCH_STREAM_INTERVAL 250000
+
+/**
+ * Thumbnail job, generated on the thumbnail thread pool. Jobs are kept
+ * after being done so the thumbnail can be spilled and generated again,
+ * and when watching for changes so the row can be updated or removed.
+ */
+struct file_fetch_thumb {
+    struct file_multi *file; /**< File to generate thumbnail for. */
+    GtkTreeIter row; /**< Row reserved for the thumbnail in the view. */
+    GList *link; /**< Link in thumb_jobs. */
+    GList *urgent_link; /**< Link in thumb_urgent, NULL if not ranked. */
+    guint state; /**< FILE_FETCH_THUMB_ state of job. */
+    gboolean refresh; /**< Set when generating again after a change. */
+    gboolean again; /**< Generate again when done, changed while running. */
+    gboolean removed; /**< File removed, remove row when done. */
+    gboolean restore; /**< Generating again after being spilled. */
+    gboolean live; /**< Row of stdin that frames still follow, kept
+                        running. */
+    gsize queued; /**< Bytes acquired from the budget while queued. */
+    GdkPixbuf *thumb; /**< Thumbnail shown in the row, NULL if spilled. */
+    GList *shown_link; /**< Link in thumb_shown, NULL if not shown. */
+};
+
+/**
+ * Thumbnail spilled from its row.
+ */
+struct file_fetch_spilled {
+    GtkTreeIter row; /**< Row showing the thumbnail. */
+    GdkPixbuf *thumb; /**< Thumbnail to replace with the placeholder. */
+};
+
+/**
+ * Remote file decoded as it is fetched, the thumbnail and first image
+ * are shown while loading.
+ */
+struct file_fetch_stream {
+    struct file_fetch *file_fetch; /**< Fetch the file belongs to. */
+    struct file_multi *file; /**< File being fetched. */
+    guchar head[FILE_SNIFF_SIZE]; /**< Start of file, used to detect
+                                       type. */
+    gsize head_len; /**< Bytes in head. */
+    guint type; /**< FILE_SNIFF_ type of file, FILE_SNIFF_UNCHECKED until
+                     head is filled. */
+    struct file_fetch_thumb *job; /**< Job with row for the thumbnail,
+                                       NULL if not decoding. */
+    struct thumb_stream *thumb; /**< Thumbnail being decoded. */
+    struct thumb_stream *preview; /**< Full size image being decoded, NULL
+                                       if not shown. */
+    struct file_multi *replace; /**< Frame of stdin shown the image
+                                     replaces when done, NULL if none. */
+    struct file_fetch_thumb *recycle; /**< Row of the last frame of stdin
+                                           the frame takes over, NULL if
+                                           none. */
+    gint64 shown; /**< Monotonic time images were last shown. */
+};
 
 static gpointer file_fetch_worker (gpointer data);
+static void file_fetch_schedule (struct file_fetch *file_fetch,
+                                 struct file_multi *file);
+static void file_fetch_dispatch (gpointer data);
 static void file_fetch_file (gpointer data, gpointer user_data);
+static void file_fetch_load (gpointer data, struct file_multi *file);
+static void file_fetch_load_file (struct file_fetch *file_fetch,
+                                  struct file_multi *file);
+static gboolean file_fetch_stream_write (gpointer data, const guchar *buf,
+                                         gsize len);
+static void file_fetch_stream_start (struct file_fetch_stream *stream);
+static gboolean file_fetch_stream_finish (struct file_fetch_stream *stream,
+                                          gboolean status);
+static void file_fetch_frames (struct file_fetch *file_fetch,
+                               struct file_multi *file,
+                               struct file_fetch_thumb *job);
 static guint file_fetch_enqueue_images (struct file_fetch *file_fetch,
-                                        GList *images);
+                                        struct file_multi *page,
+                                        GList *images, GList *pages);
 static void file_fetch_progress (struct file_fetch *file_fetch,
-                                 struct file_multi *file, gboolean status);
+                                 struct file_multi *file);
+static struct file_fetch_thumb *file_fetch_thumb_new (struct file_fetch
+                                                      *file_fetch,
+                                                      struct file_multi *file,
+                                                      gboolean queue);
+static void file_fetch_thumb (gpointer data, gpointer user_data);
+static struct file_fetch_thumb *file_fetch_thumb_take (struct file_fetch
+                                                       *file_fetch);
+static void file_fetch_thumb_rank (gpointer data, GList *files);
+static void file_fetch_thumb_queue (struct file_fetch *file_fetch,
+                                    struct file_fetch_thumb *job);
+static void file_fetch_thumb_finish (struct file_fetch *file_fetch,
+                                     struct file_fetch_thumb *job,
+                                     GdkPixbuf *thumb);
+static GList *file_fetch_remove_job (struct file_fetch *file_fetch,
+                                     struct file_fetch_thumb *job,
+                                     GList *done);
+static void file_fetch_thumb_forget (struct file_fetch *file_fetch,
+                                     struct file_fetch_thumb *job);
+static void file_fetch_thumb_spill (gpointer data, gsize bytes);
+static gsize file_fetch_thumb_bytes (GdkPixbuf *thumb);
 
 /**
  * Starts fetching of files.
@@ -72,8 +173,42 @@ file_fetch_start (struct file_queue *queue, GList *file_list,
     file_fetch->hash = g_hash_table_new (g_str_hash, g_str_equal);
     g_mutex_init(&file_fetch->hash_mutex);
 
+    /* Files waiting for a transfer slot, each host is served in turn
+       when a slot is given back. */
+    file_fetch->hosts = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                               &g_free,
+                                               (GDestroyNotify) &g_queue_free);
+    g_queue_init (&file_fetch->hosts_waiting);
+    g_mutex_init (&file_fetch->hosts_mutex);
+
+    file_fetch->first = TRUE;
+    file_fetch->frame = NULL;
     file_fetch->stop = FALSE;
 
+    /* Jobs are kept in separate queues so that the thumbnail threads can
+       pick the ones the user is looking at first, the pool only carries
+       one token per pending job. */
+    g_queue_init (&file_fetch->thumb_jobs);
+    g_queue_init (&file_fetch->thumb_urgent);
+    file_fetch->thumb_pending = g_hash_table_new (g_direct_hash,
+                                                  g_direct_equal);
+    file_fetch->thumbs = options.watch
+        ? g_hash_table_new_full (g_str_hash, g_str_equal, NULL, &g_free)
+        : NULL;
+    g_queue_init (&file_fetch->thumb_shown);
+    file_fetch->thumb_done = g_hash_table_new (g_direct_hash, g_direct_equal);
+    g_mutex_init (&file_fetch->thumb_mutex);
+    ui_window_set_priority_callback (ui, &file_fetch_thumb_rank, file_fetch);
+    ui_window_set_load_callback (ui, &file_fetch_load, file_fetch);
+    file_budget_set_spill (&file_fetch_thumb_spill, file_fetch);
+
+    /* Create thread pool for thumbnail generation, decoding and scaling
+       is CPU bound so use all available cores. */
+    file_fetch->thumb_pool = g_thread_pool_new ((GFunc) &file_fetch_thumb,
+                                                file_fetch /* user data */,
+                                                g_get_num_processors (),
+                                                FALSE /* exclusive */, NULL);
+
     /* Start worker thread which starts thread pool */
     file_fetch->thread =
         g_thread_new ("file_fetch_worker", (GThreadFunc) &file_fetch_worker, file_fetch);
@@ -89,10 +224,20 @@ file_fetch_start (struct file_queue *queue, GList *file_list,
 void
 file_fetch_stop (struct file_fetch *file_fetch)
 {
+    GHashTableIter iter;
+    struct file_fetch_thumb *job;
+
     g_assert (file_fetch);
 
-    /* No locking, should be safe. */
+    /* No locking, should be safe. Taken with hosts_mutex so no waiting
+       file is dispatched once stopping. */
+    g_mutex_lock (&file_fetch->hosts_mutex);
     file_fetch->stop = TRUE;
+    g_mutex_unlock (&file_fetch->hosts_mutex);
+    ui_window_set_load_callback (file_fetch->ui, NULL, NULL);
+
+    /* Transfers in progress return at once. */
+    file_net_stop ();
 
     /* Join worker thread */
     g_thread_join (file_fetch->thread);
@@ -100,10 +245,222 @@ file_fetch_stop (struct file_fetch *file_fetch)
     /* Stop fetching threads */
     g_thread_pool_free (file_fetch->pool,
                         TRUE /* immediate */, TRUE /* wait */);
+    file_net_slot_notify (NULL, NULL);
+
+    /* Stop thumbnail threads, pending jobs see the stop flag and only
+       release their resources. */
+    g_thread_pool_free (file_fetch->thumb_pool,
+                        FALSE /* immediate */, TRUE /* wait */);
+    ui_window_set_priority_callback (file_fetch->ui, NULL, NULL);
+    file_budget_set_spill (NULL, NULL);
+
+    /* Free done jobs, jobs kept for watching are freed with the table. */
+    g_hash_table_iter_init (&iter, file_fetch->thumb_done);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer*) &job)) {
+        if (job->thumb) {
+            g_object_unref (job->thumb);
+        }
+        if (! file_fetch->thumbs) {
+            g_free (job);
+        }
+    }
+    g_hash_table_destroy (file_fetch->thumb_done);
+    g_queue_clear (&file_fetch->thumb_shown);
 
     /* Free resources */
     g_hash_table_destroy (file_fetch->hash);
     g_mutex_clear (&file_fetch->hash_mutex);
+    g_queue_clear (&file_fetch->hosts_waiting);
+    g_hash_table_destroy (file_fetch->hosts);
+    g_mutex_clear (&file_fetch->hosts_mutex);
+    g_hash_table_destroy (file_fetch->thumb_pending);
+    if (file_fetch->thumbs) {
+        g_hash_table_destroy (file_fetch->thumbs);
+    }
+    g_mutex_clear (&file_fetch->thumb_mutex);
+}
+
+/**
+ * Removes thumbnails for file, or all files below path if it is a
+ * directory. Used when watching for changes.
+ *
+ * @param file_fetch struct file_fetch to remove thumbnails from.
+ * @param path Path to removed file or directory.
+ * @param tree TRUE if path is a directory, else only path is looked up.
+ */
+void
+file_fetch_remove (struct file_fetch *file_fetch, const gchar *path,
+                   gboolean tree)
+{
+    gsize len;
+    const gchar *key;
+    GList *done = NULL, *it;
+    GHashTableIter iter;
+    struct file_fetch_thumb *job;
+
+    g_assert (file_fetch);
+    g_assert (path);
+
+    /* Inodes of removed files are reused, forget them. */
+    file_ident_release (path, tree);
+
+    if (! file_fetch->thumbs) {
+        return;
+    }
+
+    g_mutex_lock (&file_fetch->thumb_mutex);
+    if (tree) {
+        len = strlen (path);
+        g_hash_table_iter_init (&iter, file_fetch->thumbs);
+        while (g_hash_table_iter_next (&iter, (gpointer*) &key,
+                                       (gpointer*) &job)) {
+            if (! strncmp (key, path, len)
+                && (key[len] == '\0' || key[len] == G_DIR_SEPARATOR)) {
+                g_hash_table_iter_steal (&iter);
+                done = file_fetch_remove_job (file_fetch, job, done);
+            }
+        }
+
+    } else {
+        job = g_hash_table_lookup (file_fetch->thumbs, path);
+        if (job) {
+            g_hash_table_steal (file_fetch->thumbs, path);
+            done = file_fetch_remove_job (file_fetch, job, done);
+        }
+    }
+    g_mutex_unlock (&file_fetch->thumb_mutex);
+
+    for (it = done; it; it = it->next) {
+        job = (struct file_fetch_thumb*) it->data;
+        ui_window_remove_thumbnail (file_fetch->ui, &job->row);
+        g_free (job);
+    }
+    g_list_free (done);
+}
+
+/**
+ * Forgets job of removed file, taken out of thumbs. Called with
+ * thumb_mutex held.
+ *
+ * @param file_fetch struct file_fetch job belongs to.
+ * @param job Job of removed file.
+ * @param done List of done jobs to remove the row of.
+ * @return done, with job prepended if its row is to be removed.
+ */
+GList*
+file_fetch_remove_job (struct file_fetch *file_fetch,
+                       struct file_fetch_thumb *job, GList *done)
+{
+    /* Jobs not done remove the row themselves when finished. */
+    file_fetch_thumb_forget (file_fetch, job);
+    if (job->state == FILE_FETCH_THUMB_DONE) {
+        return g_list_prepend (done, job);
+    }
+    job->removed = TRUE;
+    return done;
+}
+
+/**
+ * Generates thumbnail of known file again after it changed, the row of
+ * the file is updated. Used when watching for changes.
+ *
+ * @param file_fetch struct file_fetch showing the file.
+ * @param path Path to changed file.
+ * @return TRUE if the file is known, else FALSE.
+ */
+gboolean
+file_fetch_refresh (struct file_fetch *file_fetch, const gchar *path)
+{
+    struct file_fetch_thumb *job;
+
+    g_assert (file_fetch);
+    g_assert (path);
+
+    if (! file_fetch->thumbs) {
+        return FALSE;
+    }
+
+    g_mutex_lock (&file_fetch->thumb_mutex);
+    job = g_hash_table_lookup (file_fetch->thumbs, path);
+    if (job) {
+        file_multi_set_stat (job->file, -1, -1);
+        file_multi_set_type (job->file, FILE_SNIFF_UNCHECKED);
+        if (job->state == FILE_FETCH_THUMB_RUNNING) {
+            job->again = TRUE;
+        } else if (job->state == FILE_FETCH_THUMB_DONE) {
+            job->refresh = TRUE;
+            file_fetch_thumb_queue (file_fetch, job);
+        }
+    }
+    g_mutex_unlock (&file_fetch->thumb_mutex);
+
+    return job != NULL;
+}
+
+/**
+ * Checks if file is shown with the given size and mtime. Used when
+ * watching for changes to find files changed while events were lost.
+ *
+ * @param file_fetch struct file_fetch showing files.
+ * @param path Path to file.
+ * @param size Size of file on disk.
+ * @param mtime Mtime of file on disk.
+ * @return TRUE if shown and not changed, else FALSE.
+ */
+gboolean
+file_fetch_is_current (struct file_fetch *file_fetch, const gchar *path,
+                       off_t size, time_t mtime)
+{
+    gboolean current = FALSE;
+    struct file_fetch_thumb *job;
+
+    g_assert (file_fetch);
+    g_assert (path);
+
+    if (! file_fetch->thumbs) {
+        return FALSE;
+    }
+
+    g_mutex_lock (&file_fetch->thumb_mutex);
+    job = g_hash_table_lookup (file_fetch->thumbs, path);
+    /* Not checked yet counts as changed, the getters would stat the
+       file with the lock held. */
+    if (job && job->file->size != -1 && job->file->mtime != -1) {
+        current = job->file->size == size && job->file->mtime == mtime;
+    }
+    g_mutex_unlock (&file_fetch->thumb_mutex);
+
+    return current;
+}
+
+/**
+ * Returns paths of the files shown. Used when watching for changes to
+ * find files removed while events were lost.
+ *
+ * @param file_fetch struct file_fetch showing files.
+ * @return GList of paths, free with g_list_free_full and g_free.
+ */
+GList*
+file_fetch_get_paths (struct file_fetch *file_fetch)
+{
+    const gchar *path;
+    GList *paths = NULL;
+    GHashTableIter iter;
+
+    g_assert (file_fetch);
+
+    if (! file_fetch->thumbs) {
+        return NULL;
+    }
+
+    g_mutex_lock (&file_fetch->thumb_mutex);
+    g_hash_table_iter_init (&iter, file_fetch->thumbs);
+    while (g_hash_table_iter_next (&iter, (gpointer*) &path, NULL)) {
+        paths = g_list_prepend (paths, g_strdup (path));
+    }
+    g_mutex_unlock (&file_fetch->thumb_mutex);
+
+    return paths;
 }
 
 /**
@@ -120,11 +477,13 @@ file_fetch_worker (gpointer data)
 
     g_assert (file_fetch);
 
-    /* Create thread pool for fetching */
+    /* Create thread pool for fetching, files are only pushed when a
+       transfer slot is taken so there is a thread for each slot. */
     file_fetch->pool = g_thread_pool_new ((GFunc) &file_fetch_file,
                                           data /* user data */,
-                                          3 /* max threads */,
+                                          MAX (options.connections, 1),
                                           FALSE /* exclusive */, NULL);
+    file_net_slot_notify (&file_fetch_dispatch, file_fetch);
 
     /* Go through list of files and fetch */
     while (! file_fetch->stop
@@ -134,15 +493,15 @@ file_fetch_worker (gpointer data)
             if (! g_hash_table_lookup (file_fetch->hash,
                                        file_multi_get_path (file))) {
                 /* Fetch file if needed */
-                g_thread_pool_push (file_fetch->pool, (gpointer) file, NULL);
+                file_fetch_schedule (file_fetch, file);
             }
             g_mutex_unlock (&file_fetch->hash_mutex);
 
         } else {
-            /* Do not always use the thread pool as it might block if mixing
-               files to fetch and files not needed to be fetched. */
-            file_fetch_progress (file_fetch, file, TRUE);
-            file_queue_done (file_fetch->queue);
+            /* Do not use the fetch thread pool as it might block if mixing
+               files to fetch and files not needed to be fetched, the
+               thumbnail job signals done to the queue when finished. */
+            file_fetch_progress (file_fetch, file);
         }
     }
 
@@ -152,6 +511,82 @@ file_fetch_worker (gpointer data)
     return NULL;  
 }
 
+/**
+ * Pushes file to the fetch thread pool if a transfer slot is free for
+ * its host, else it waits for one behind the files of the same host.
+ * Called with hash_mutex held when scanning.
+ *
+ * @param file_fetch struct file_fetch fetching.
+ * @param file File to fetch.
+ */
+void
+file_fetch_schedule (struct file_fetch *file_fetch, struct file_multi *file)
+{
+    gchar *host;
+    GQueue *waiting;
+
+    /* Standard input and inline data take no slot */
+    host = file_net_host (file_multi_get_path (file));
+    if (! host) {
+        g_thread_pool_push (file_fetch->pool, (gpointer) file, NULL);
+        return;
+    }
+
+    g_mutex_lock (&file_fetch->hosts_mutex);
+    waiting = g_hash_table_lookup (file_fetch->hosts, host);
+    if (! waiting && file_net_slot_take (host)) {
+        g_thread_pool_push (file_fetch->pool, (gpointer) file, NULL);
+        g_free (host);
+    } else {
+        if (! waiting) {
+            waiting = g_queue_new ();
+            g_hash_table_insert (file_fetch->hosts, host, waiting);
+            g_queue_push_tail (&file_fetch->hosts_waiting, host);
+        } else {
+            g_free (host);
+        }
+        g_queue_push_tail (waiting, file);
+    }
+    g_mutex_unlock (&file_fetch->hosts_mutex);
+}
+
+/**
+ * Pushes next waiting file to the fetch thread pool, called when a
+ * transfer slot is given back. Hosts are tried in turn so that a host
+ * at its limit does not hold back the others.
+ *
+ * @param data Pointer to struct file_fetch.
+ */
+void
+file_fetch_dispatch (gpointer data)
+{
+    guint i, n;
+    gchar *host;
+    GQueue *waiting;
+    struct file_fetch *file_fetch = (struct file_fetch*) data;
+
+    g_mutex_lock (&file_fetch->hosts_mutex);
+    n = file_fetch->stop ? 0 : g_queue_get_length (&file_fetch->hosts_waiting);
+    for (i = 0; i < n; i++) {
+        host = g_queue_pop_head (&file_fetch->hosts_waiting);
+        if (! file_net_slot_take (host)) {
+            g_queue_push_tail (&file_fetch->hosts_waiting, host);
+            continue;
+        }
+
+        waiting = g_hash_table_lookup (file_fetch->hosts, host);
+        g_thread_pool_push (file_fetch->pool, g_queue_pop_head (waiting),
+                            NULL);
+        if (g_queue_is_empty (waiting)) {
+            g_hash_table_remove (file_fetch->hosts, host);
+        } else {
+            g_queue_push_tail (&file_fetch->hosts_waiting, host);
+        }
+        break;
+    }
+    g_mutex_unlock (&file_fetch->hosts_mutex);
+}
+
 /**
  * Fetch next file in queue.
  *
@@ -161,13 +596,26 @@ file_fetch_worker (gpointer data)
 void
 file_fetch_file (gpointer data, gpointer user_data)
 {
-    gboolean status;
+    gboolean status, cached, links = FALSE, queued = FALSE, frames = FALSE;
+    guint type;
     guint images_added, images_total, images_total_before;
-    GList *images;
+    gint width, height;
+    gchar *host;
+    GList *images = NULL, *pages = NULL;
 
     /* Get file */
     struct file_fetch *file_fetch = (struct file_fetch*) user_data;
     struct file_multi *file = (struct file_multi*) data;
+    struct file_fetch_stream stream;
+
+    /* Opened with the body not fetched, already counted. */
+    if (file_multi_is_deferred (file)) {
+        file_fetch_load_file (file_fetch, file);
+        return;
+    }
+
+    /* Slot taken when scheduled, given back once transferred. */
+    host = file_net_host (file_multi_get_path (file));
 
     /* Check total image count */
     images_total = ui_window_progress_get_total (file_fetch->ui);
@@ -186,33 +634,107 @@ file_fetch_file (gpointer data, gpointer user_data)
 
     /* File was already fetched, skip */
     if (file) {
-        /* Fetch the file */
-        status = file_multi_fetch (file, &file_fetch->stop);
-        if (status) {
-            /* Successfully fetched file */
-            if (file_multi_get_ext (file)
-                && util_str_in (file_multi_get_ext (file), TRUE /* casei */,
-                                IMAGE_EXT)) {
-                file_fetch_progress (file_fetch, file, status);
+        /* Remote files with a cached thumbnail or link list are only
+           fetched if they changed since. */
+        cached = host && thumb_cache_lookup (file, options.thumb_size,
+                                             &width, &height);
+        if (host && ! cached) {
+            links = file_crawl_lookup (file, &images, &pages);
+        }
+
+        /* Fetch the file, images are decoded as the data arrives */
+        memset (&stream, 0, sizeof (stream));
+        stream.file_fetch = file_fetch;
+        stream.file = file;
+        stream.type = FILE_SNIFF_UNCHECKED;
+        status = file_multi_fetch (file, &file_fetch_stream_write, &stream,
+                                   &file_fetch->stop);
+        if (host) {
+            file_net_slot_give (host);
+            g_free (host);
+            host = NULL;
+        }
+        if (stream.job) {
+            /* Row reserved while fetching, counted as progress when
+               finished. */
+            if (! file_fetch_stream_finish (&stream, status)) {
+                images_total -= 1;
+            }
 
+        } else if (status && file_multi_is_deferred (file) && links) {
+            /* Page not changed, links are taken from the cached list */
+            images_added = file_fetch_enqueue_images (file_fetch, file,
+                                                      images, pages);
+            images_total += images_added - 1;
+            links = FALSE;
+
+        } else if (status && file_multi_is_deferred (file)) {
+            /* Not changed, the thumbnail job loads the cached thumbnail
+               and the body is fetched when the image is opened. */
+            if (cached
+                && file_filter_name (file_multi_get_name (file))
+                && file_filter_stat (file)
+                && file_filter_dims (width, height)) {
+                file_fetch_progress (file_fetch, file);
+                queued = TRUE;
             } else {
-                /* Extract image links from file (expected to be
-                   non-binary) */
-                images = file_fetch_img_extract_links (file);
-                if (images) {
-                    images_added = file_fetch_enqueue_images (file_fetch,
-                                                              images);
-                    images_total += images_added - 1;
-                    g_list_free (images);
+                images_total -= 1;
+            }
 
+        } else if (status) {
+            /* Successfully fetched file, images and unknown binary
+               data are left to the image loaders and markup is scanned
+               for links. */
+            type = file_multi_get_type (file);
+            if (file_sniff_maybe_image (type)) {
+                if (file_filter_file (file)) {
+                    file_fetch_progress (file_fetch, file);
+                    queued = TRUE;
                 } else {
+                    file_multi_close_tmp (file);
                     images_total -= 1;
                 }
+
+            } else if ((type == FILE_SNIFF_HTML)
+                       || (type == FILE_SNIFF_TEXT)) {
+                /* Changed since cached, links are extracted again */
+                if (links) {
+                    g_list_free_full (images, &g_free);
+                    g_list_free_full (pages, &g_free);
+                    links = FALSE;
+                }
+
+                /* Extract image links from file, linked pages are kept
+                   with the list but only followed when crawling. */
+                images = file_fetch_img_extract_links (file, &pages);
+                file_crawl_save (file, images, pages);
+                file_multi_close_tmp (file);
+                images_added = file_fetch_enqueue_images (file_fetch, file,
+                                                          images, pages);
+                images_total += images_added - 1;
+
+            } else {
+                /* Neither image nor links to images */
+                file_multi_close_tmp (file);
+                images_total -= 1;
             }
         } else {
             /* Failed to fetch, reduce number of files. */
             images_total -= 1;
         }
+
+        if (links) {
+            g_list_free_full (images, &g_free);
+            g_list_free_full (pages, &g_free);
+        }
+
+        frames = status && file_multi_is_stream (file);
+    }
+
+    /* Already fetched */
+    if (host) {
+        file_net_slot_give (host);
+        g_free (host);
     }
 
     /* Set total number of images */
@@ -222,70 +744,760 @@ file_fetch_file (gpointer data, gpointer user_data)
                                      0 /* count */, TRUE /* lock */);
     }
 
-    file_queue_done (file_fetch->queue);
+    /* Frames piped to stdin are read one after the other */
+    if (frames) {
+        file_fetch_frames (file_fetch, file, stream.job);
+    }
+
+    /* Thumbnail job signals done when queued */
+    if (! queued) {
+        file_queue_done (file_fetch->queue);
+    }
 }
 
 /**
- * Enqueue images on work queue, filter already fetched images first.
+ * Loads body of file opened before it was fetched, called from the UI
+ * with GDK locked.
+ *
+ * @param data Pointer to struct file_fetch.
+ * @param file File to load.
+ */
+void
+file_fetch_load (gpointer data, struct file_multi *file)
+{
+    struct file_fetch *file_fetch = (struct file_fetch*) data;
+
+    if (! file_fetch->stop && file_multi_load_deferred (file)) {
+        file_fetch_schedule (file_fetch, file);
+    }
+}
+
+/**
+ * Fetches body of file opened before it was fetched and shows it if it
+ * is still the current image, run on the fetch thread pool.
+ *
+ * @param file_fetch struct file_fetch fetching.
+ * @param file File to load.
+ */
+void
+file_fetch_load_file (struct file_fetch *file_fetch, struct file_multi *file)
+{
+    gboolean status;
+    gchar *host;
+
+    status = file_multi_fetch (file, NULL, NULL, &file_fetch->stop);
+
+    host = file_net_host (file_multi_get_path (file));
+    file_net_slot_give (host);
+    g_free (host);
+
+    if (! status) {
+        g_warning ("failed to load %s", file_multi_get_path (file));
+        return;
+    }
+
+    /* Read again from disk when memory is short */
+    if (file_budget_get_limit ()
+        && (file_budget_get_used () > file_budget_get_limit ())) {
+        file_multi_store (file);
+    }
+
+    ui_window_reload_image (file_fetch->ui, file);
+}
+
+/**
+ * Passes data of fetched file to the decoders, started once the type of
+ * the file is known.
+ *
+ * @param data Pointer to struct file_fetch_stream.
+ * @param buf Data received.
+ * @param len Length of data.
+ * @return TRUE to continue fetching, FALSE if stopped.
+ */
+gboolean
+file_fetch_stream_write (gpointer data, const guchar *buf, gsize len)
+{
+    gsize head;
+    gint64 now;
+    GdkPixbuf *pix;
+    struct file_fetch_stream *stream = (struct file_fetch_stream*) data;
+
+    /* Collect start of file to detect its type */
+    if (stream->type == FILE_SNIFF_UNCHECKED) {
+        head = MIN (len, FILE_SNIFF_SIZE - stream->head_len);
+        memcpy (stream->head + stream->head_len, buf, head);
+        stream->head_len += head;
+        buf += head;
+        len -= head;
+
+        if (stream->head_len == FILE_SNIFF_SIZE) {
+            file_fetch_stream_start (stream);
+        }
+    }
+
+    if (! stream->job) {
+        return ! stream->file_fetch->stop;
+    }
+
+    /* Decoding errors are reported when finishing */
+    thumb_stream_write (stream->thumb, buf, len);
+    if (stream->preview) {
+        thumb_stream_write (stream->preview, buf, len);
+    }
+
+    /* Show what is decoded so far */
+    now = g_get_monotonic_time ();
+    if (now - stream->shown >= FILE_FETCH_STREAM_INTERVAL) {
+        stream->shown = now;
+
+        pix = thumb_stream_peek (stream->thumb);
+        if (pix) {
+            ui_window_set_thumbnail (stream->file_fetch->ui,
+                                     &stream->job->row, pix);
+            g_object_unref (pix);
+        }
+        /* Frames replace the last one only once complete */
+        if (stream->preview && ! stream->replace) {
+            pix = thumb_stream_peek (stream->preview);
+            if (pix) {
+                ui_window_set_preview (stream->file_fetch->ui,
+                                       stream->file, NULL, pix);
+            }
+        }
+    }
+
+    return ! stream->file_fetch->stop;
+}
+
+/**
+ * Detects type of file being fetched from its start, images passing the
+ * name filter get a row and are decoded while fetched. The first image
+ * is decoded at full size as well when showing single images, so are
+ * frames of stdin following a frame shown.
+ *
+ * @param stream struct file_fetch_stream with head filled in.
+ */
+void
+file_fetch_stream_start (struct file_fetch_stream *stream)
+{
+    struct file_fetch *file_fetch = stream->file_fetch;
+
+    stream->type = file_sniff_data (stream->head, stream->head_len);
+    if (! file_sniff_maybe_image (stream->type)
+        || ! file_filter_name (file_multi_get_name (stream->file))) {
+        return;
+    }
+
+    /* Frames of stdin take over the row of the last one, it is kept
+       running until no frames follow. */
+    if (stream->recycle) {
+        stream->job = stream->recycle;
+    } else {
+        stream->job = file_fetch_thumb_new (file_fetch, stream->file,
+                                            FALSE /* queue */);
+    }
+    stream->job->live = file_multi_is_stream (stream->file);
+    stream->thumb = thumb_stream_new (stream->type, options.thumb_size,
+                                      TRUE /* wait */);
+    thumb_stream_write (stream->thumb, stream->head, stream->head_len);
+
+    if (ui_window_get_mode (file_fetch->ui) == UI_WINDOW_MODE_THUMB) {
+        return;
+    }
+
+    /* Frames of stdin follow the last one while it is shown */
+    if (file_multi_is_stream (stream->file) && file_fetch->frame) {
+        stream->replace = file_fetch->frame;
+    }
+    if (stream->replace
+        || g_atomic_int_compare_and_exchange (&file_fetch->first,
+                                              TRUE, FALSE)) {
+        /* Fed on this thread after the thumbnail, which holds budget */
+        stream->preview = thumb_stream_new (stream->type, 0 /* side */,
+                                            FALSE /* wait */);
+        thumb_stream_write (stream->preview, stream->head, stream->head_len);
+    }
+}
+
+/**
+ * Finishes decoding when the file is fetched and fills in the row, the
+ * row is given back if the file failed or is filtered out. Frames of
+ * stdin failing keep the row of the last frame.
+ *
+ * @param stream struct file_fetch_stream to finish, job is set to NULL
+ *               if the row is given back.
+ * @param status TRUE if the file was fetched.
+ * @return TRUE if the thumbnail was added, else FALSE.
+ */
+gboolean
+file_fetch_stream_finish (struct file_fetch_stream *stream, gboolean status)
+{
+    gboolean shown;
+    GdkPixbuf *thumb, *pix;
+    struct file_fetch *file_fetch = stream->file_fetch;
+    struct file_multi *file = stream->file;
+
+    /* Remaining filters need all of the file */
+    status = status && file_filter_file (file);
+
+    if (stream->preview) {
+        pix = thumb_stream_finish (stream->preview, status ? file : NULL,
+                                   FALSE /* cache */);
+        if (pix) {
+            shown = ui_window_set_preview (file_fetch->ui, file,
+                                           stream->replace, pix);
+            if (file_multi_is_stream (file)) {
+                file_fetch->frame = shown ? file : NULL;
+            }
+        }
+    }
+
+    thumb = thumb_stream_finish (stream->thumb, status ? file : NULL,
+                                 TRUE /* cache */);
+    if (! thumb && stream->recycle) {
+        return FALSE;
+    }
+    if (thumb) {
+        ui_window_set_thumbnail (file_fetch->ui, &stream->job->row, thumb);
+    }
+    file_fetch_thumb_finish (file_fetch, stream->job, thumb);
+    if (! thumb) {
+        stream->job = NULL;
+    }
+
+    if (! status) {
+        file_multi_close_tmp (file);
+        return FALSE;
+    }
+
+    /* Read again from disk when memory is short, stdin holds one frame
+       and is not written to disk. */
+    if (file_budget_get_limit ()
+        && (file_budget_get_used () > file_budget_get_limit ())
+        && ! file_multi_is_stream (file)) {
+        file_multi_store (file);
+    }
+
+    /* Frames taking over a row are not counted again */
+    if (! stream->recycle) {
+        ui_window_progress_progress (file_fetch->ui,
+                                     1 /* count */, TRUE /* lock */);
+    }
+
+    return TRUE;
+}
+
+/**
+ * Reads the frames following the first on stdin. Each frame takes over
+ * the file and row of the last one and replaces it in the image shown,
+ * so a stream of frames holds no more than the frame shown and the one
+ * being read.
+ *
+ * @param file_fetch struct file_fetch fetching.
+ * @param file File of stdin, the first frame is fetched.
+ * @param job Row of the first frame kept running, NULL if it has none.
+ */
+void
+file_fetch_frames (struct file_fetch *file_fetch, struct file_multi *file,
+                   struct file_fetch_thumb *job)
+{
+    gboolean status = TRUE;
+    struct file_fetch_stream stream;
+
+    while (status && ! file_fetch->stop && file_multi_next_frame (file)) {
+        memset (&stream, 0, sizeof (stream));
+        stream.file_fetch = file_fetch;
+        stream.file = file;
+        stream.type = FILE_SNIFF_UNCHECKED;
+        stream.recycle = job;
+        status = file_multi_fetch (file, &file_fetch_stream_write, &stream,
+                                   &file_fetch->stop);
+
+        if (stream.job) {
+            /* First frame with a row is a new image */
+            if (! job) {
+                ui_window_progress_add (file_fetch->ui, 1);
+            }
+            file_fetch_stream_finish (&stream, status);
+            job = stream.job;
+        } else if (! job) {
+            /* Not an image, nothing shows it */
+            file_multi_close_tmp (file);
+        }
+    }
+
+    /* Left to the thumbnail jobs like any other row */
+    if (job) {
+        g_mutex_lock (&file_fetch->thumb_mutex);
+        job->live = FALSE;
+        job->state = FILE_FETCH_THUMB_DONE;
+        g_mutex_unlock (&file_fetch->thumb_mutex);
+    }
+}
+
+/**
+ * Enqueue images and pages linked from page on work queue as the page
+ * is parsed, filter already fetched or queued URLs first. URLs are
+ * compared in canonical form so each file is fetched once however it
+ * is linked. Pages are only queued if the crawl rules follow them.
  *
  * @param file_fetch struct file_fetch to enqueu images for.
- * @param images GList of gchar URLs.
- * @return Number of images added to the queue.
+ * @param page Page links were found on.
+ * @param images GList of gchar URLs, freed.
+ * @param pages GList of gchar URLs, freed.
+ * @return Number of images and pages added to the queue.
  */
 guint
-file_fetch_enqueue_images (struct file_fetch *file_fetch, GList *images)
+file_fetch_enqueue_images (struct file_fetch *file_fetch,
+                           struct file_multi *page,
+                           GList *images, GList *pages)
 {
-    GList *it;
+    gboolean is_page = FALSE;
+    gchar *url;
+    GList *it, *links, *files = NULL;
     guint added = 0;
+    struct file_multi *file;
 
     g_assert (file_fetch);
 
-    /* Lock hash table, enqueue go through the list of images and move all
-       entries not in the hash table. */
+    /* Lock hash table, enqueue go through the list of links and move all
+       entries not in the hash table or seen before. Pages follow the
+       images. */
+    links = g_list_concat (images, pages);
     g_mutex_lock (&file_fetch->hash_mutex);
-    for (it = images; it; it = it->next) {
-        if (! g_hash_table_lookup (file_fetch->hash, (gchar*) it->data)) {
-            file_queue_push (file_fetch->queue,
-                             file_multi_open ((gchar*) it->data));
+    for (it = links; it; it = it->next) {
+        /* Cached link lists may be saved under other strip rules, the
+           canonical URL is the key. Inline data and local files are
+           keys as they are. */
+        url = file_url_canonical ((gchar*) it->data);
+        if (url) {
+            g_free (it->data);
+        } else {
+            url = (gchar*) it->data;
+        }
+        is_page = is_page || (it == pages);
+        if ((! is_page || file_crawl_follow (page, url))
+            && ! g_hash_table_lookup (file_fetch->hash, url)
+            && ! file_crawl_seen (url)) {
+            file = file_multi_open (url);
+            file_multi_set_depth (file, file_multi_get_depth (page) + 1);
+            files = g_list_prepend (files, file);
             added++;
         }
-        g_free (it->data);
+        g_free (url);
     }
     g_mutex_unlock (&file_fetch->hash_mutex);
+    g_list_free (links);
+
+    /* Push without holding the hash lock, pushing waits when the queue is
+       full and the worker emptying it needs the lock. */
+    files = g_list_reverse (files);
+    for (it = files; it; it = it->next) {
+        file_queue_push (file_fetch->queue, (struct file_multi*) it->data);
+    }
+    g_list_free (files);
 
     return added;
 }
 
 
 /**
- * Signals progress of fetched files.
+ * Signals progress of fetched files, reserves a row in the thumbnail
+ * view and queues generation of the thumbnail. Rows are reserved in the
+ * order files are progressed so the view keeps the scan order even
+ * though thumbnails are generated in parallel.
  *
  * @param file_fetch File fetch to progress.
  * @param file Pointer to file_multi progressed.
- * @param status Status of the progress.
  */
 void
-file_fetch_progress (struct file_fetch *file_fetch,
-                     struct file_multi *file, gboolean status)
+file_fetch_progress (struct file_fetch *file_fetch, struct file_multi *file)
 {
-    static gboolean first = TRUE;
-
-    GdkPixbuf *thumb;
-
-    if (first
-        && (ui_window_get_mode (file_fetch->ui) != UI_WINDOW_MODE_THUMB)) {
-        first = FALSE;
+    /* Known file changed, generate thumbnail again for the existing row
+       instead of adding a new one. */
+    if (file_fetch_refresh (file_fetch, file_multi_get_path (file))) {
+        ui_window_progress_add (file_fetch->ui, -1);
+        file_queue_done (file_fetch->queue);
+        return;
+    }
 
+    /* Scanned files are classified by the thumbnail job, only the
+       first image shown is checked here. */
+    if ((ui_window_get_mode (file_fetch->ui) != UI_WINDOW_MODE_THUMB)
+        && g_atomic_int_get (&file_fetch->first)
+        && file_sniff_maybe_image (file_multi_get_type (file))
+        && g_atomic_int_compare_and_exchange (&file_fetch->first,
+                                              TRUE, FALSE)) {
         /* Single file mode, set image */
         ui_window_set_image (file_fetch->ui, file,
                              file_fetch->ui->zoom_fit, TRUE /* lock */);
     }
 
     /* Always add thumbnail version so switching of modes is possible. */
-    thumb =  thumb_get (file, options.thumb_size, TRUE);
+    file_fetch_thumb_new (file_fetch, file, TRUE /* queue */);
+}
+
+/**
+ * Creates thumbnail job and reserves its row. Queued jobs hold memory
+ * for their thumbnail, waiting for it here makes the scanner wait in
+ * turn when the queue is full.
+ *
+ * @param file_fetch struct file_fetch to add job to.
+ * @param file File to generate thumbnail for.
+ * @param queue TRUE to queue the job, else it is left running for the
+ *              caller to finish.
+ * @return New job, NULL if queued as it can be done already.
+ */
+struct file_fetch_thumb*
+file_fetch_thumb_new (struct file_fetch *file_fetch, struct file_multi *file,
+                      gboolean queue)
+{
+    struct file_fetch_thumb *job;
+
+    job = g_malloc (sizeof (struct file_fetch_thumb));
+    job->file = file;
+    job->urgent_link = NULL;
+    job->refresh = FALSE;
+    job->again = FALSE;
+    job->removed = FALSE;
+    job->restore = FALSE;
+    job->live = FALSE;
+    job->thumb = NULL;
+    job->shown_link = NULL;
+    job->queued = 0;
+    if (queue) {
+        job->queued = (gsize) options.thumb_size * options.thumb_size * 4;
+        file_budget_acquire (FILE_BUDGET_QUEUE, job->queued);
+    }
+    ui_window_add_thumbnail (file_fetch->ui, file, NULL, &job->row);
+
+    g_mutex_lock (&file_fetch->thumb_mutex);
+    if (file_fetch->thumbs) {
+        g_hash_table_insert (file_fetch->thumbs,
+                             (gpointer) file_multi_get_path (file), job);
+    }
+    if (queue) {
+        file_fetch_thumb_queue (file_fetch, job);
+        job = NULL;
+    } else {
+        job->state = FILE_FETCH_THUMB_RUNNING;
+    }
+    g_mutex_unlock (&file_fetch->thumb_mutex);
+
+    return job;
+}
+
+/**
+ * Queues thumbnail job, called with thumb_mutex held.
+ *
+ * @param file_fetch struct file_fetch to queue job on.
+ * @param job Job to queue.
+ */
+void
+file_fetch_thumb_queue (struct file_fetch *file_fetch,
+                        struct file_fetch_thumb *job)
+{
+    job->state = FILE_FETCH_THUMB_QUEUED;
+    g_queue_push_tail (&file_fetch->thumb_jobs, job);
+    job->link = g_queue_peek_tail_link (&file_fetch->thumb_jobs);
+    g_hash_table_insert (file_fetch->thumb_pending, job->file, job);
+
+    g_thread_pool_push (file_fetch->thumb_pool, job, NULL);
+}
+
+/**
+ * Generates thumbnail for file and fills in the row reserved for it,
+ * run on the thumbnail thread pool.
+ *
+ * @param data Token pushed with the job, not used as the job with the
+ *             highest priority is taken instead.
+ * @param user_data Pointer to struct file_fetch.
+ */
+void
+file_fetch_thumb (gpointer data, gpointer user_data)
+{
+    gboolean refresh, restore, kept;
+    GdkPixbuf *thumb = NULL;
+
+    struct file_fetch *file_fetch = (struct file_fetch*) user_data;
+    struct file_fetch_thumb *job = file_fetch_thumb_take (file_fetch);
+
+    /* Only the first generation counts as progress. */
+    refresh = job->refresh;
+    restore = job->restore;
+    job->restore = FALSE;
+
+    /* Decoding acquires its own memory. */
+    file_budget_release (FILE_BUDGET_QUEUE, job->queued);
+    job->queued = 0;
+
+    if (file_fetch->stop) {
+        /* Jobs kept for watching or done before are freed when
+           stopping. */
+        g_mutex_lock (&file_fetch->thumb_mutex);
+        kept = g_hash_table_lookup (file_fetch->thumb_done, job->file) != NULL;
+        g_mutex_unlock (&file_fetch->thumb_mutex);
+        if ((! file_fetch->thumbs || job->removed) && ! kept) {
+            g_free (job);
+        }
+
+    } else {
+        if (! job->removed) {
+            thumb = thumb_get (job->file, options.thumb_size, TRUE,
+                               &file_fetch->stop);
+        }
+        if (thumb) {
+            ui_window_set_thumbnail (file_fetch->ui, &job->row, thumb);
+
+            /* Changed on disk, show the new version. */
+            if (refresh && ! restore) {
+                ui_window_reload_image (file_fetch->ui, job->file);
+            }
+        }
+        file_fetch_thumb_finish (file_fetch, job, thumb);
+
+        if (! refresh) {
+            ui_window_progress_progress (file_fetch->ui,
+                                         1 /* count */, TRUE /* lock */);
+        }
+    }
+
+    if (! refresh) {
+        file_queue_done (file_fetch->queue);
+    }
+}
+
+/**
+ * Finishes thumbnail job, removes the row if the file was removed or is
+ * not an image and queues the job again if the file changed while the
+ * thumbnail was generated.
+ *
+ * @param file_fetch struct file_fetch job belongs to.
+ * @param job Job to finish, can be freed.
+ * @param thumb Generated thumbnail, reference is taken over, NULL if none.
+ */
+void
+file_fetch_thumb_finish (struct file_fetch *file_fetch,
+                         struct file_fetch_thumb *job, GdkPixbuf *thumb)
+{
+    gsize bytes = 0;
+
+    /* Charge before the job is shown, charging can spill it. */
     if (thumb) {
-        ui_window_add_thumbnail (file_fetch->ui, file, thumb);
+        bytes = file_fetch_thumb_bytes (thumb);
+        file_budget_charge (FILE_BUDGET_THUMB, bytes);
+    }
+
+    g_mutex_lock (&file_fetch->thumb_mutex);
+
+    if (job->removed || ! thumb) {
+        /* Removed jobs are already gone from the table */
+        if (file_fetch->thumbs && ! job->removed) {
+            g_hash_table_steal (file_fetch->thumbs,
+                                file_multi_get_path (job->file));
+        }
+        file_fetch_thumb_forget (file_fetch, job);
+        g_mutex_unlock (&file_fetch->thumb_mutex);
+
+        if (thumb) {
+            file_budget_release (FILE_BUDGET_THUMB, bytes);
+            g_object_unref (thumb);
+        }
+
+        /* Not an image or removed, give the row back */
+        ui_window_remove_thumbnail (file_fetch->ui, &job->row);
+        g_free (job);
+        return;
+    }
+
+    /* Replace previous thumbnail, most recently shown last. */
+    if (job->thumb) {
+        g_queue_delete_link (&file_fetch->thumb_shown, job->shown_link);
+        file_budget_release (FILE_BUDGET_THUMB,
+                             file_fetch_thumb_bytes (job->thumb));
+        g_object_unref (job->thumb);
+    }
+    job->thumb = thumb;
+    g_queue_push_tail (&file_fetch->thumb_shown, job);
+    job->shown_link = g_queue_peek_tail_link (&file_fetch->thumb_shown);
+    g_hash_table_insert (file_fetch->thumb_done, job->file, job);
+
+    if (job->live) {
+        /* Next frame of stdin follows, not ranked meanwhile */
+    } else if (job->again) {
+        job->again = FALSE;
+        job->refresh = TRUE;
+        file_fetch_thumb_queue (file_fetch, job);
+    } else {
+        job->state = FILE_FETCH_THUMB_DONE;
+    }
+
+    g_mutex_unlock (&file_fetch->thumb_mutex);
+}
+
+/**
+ * Forgets done job, releasing its thumbnail. Called with thumb_mutex
+ * held.
+ *
+ * @param file_fetch struct file_fetch job belongs to.
+ * @param job Job to forget.
+ */
+void
+file_fetch_thumb_forget (struct file_fetch *file_fetch,
+                         struct file_fetch_thumb *job)
+{
+    g_hash_table_remove (file_fetch->thumb_done, job->file);
+    if (job->thumb) {
+        g_queue_delete_link (&file_fetch->thumb_shown, job->shown_link);
+        job->shown_link = NULL;
+        file_budget_release (FILE_BUDGET_THUMB,
+                             file_fetch_thumb_bytes (job->thumb));
+        g_object_unref (job->thumb);
+        job->thumb = NULL;
+    }
+}
+
+/**
+ * Spills thumbnails shown the longest without being ranked, their rows
+ * get the placeholder until ranked again. Called by the budget when it
+ * is used up.
+ *
+ * @param data Pointer to struct file_fetch.
+ * @param bytes Number of bytes to free.
+ */
+void
+file_fetch_thumb_spill (gpointer data, gsize bytes)
+{
+    guint i;
+    gsize freed = 0;
+    GArray *spilled;
+    struct file_fetch_spilled *it;
+    struct file_fetch_thumb *job;
+    struct file_fetch *file_fetch = (struct file_fetch*) data;
+
+    spilled = g_array_new (FALSE, FALSE, sizeof (struct file_fetch_spilled));
+
+    g_mutex_lock (&file_fetch->thumb_mutex);
+    while (freed < bytes
+           && (job = g_queue_pop_head (&file_fetch->thumb_shown)) != NULL) {
+        job->shown_link = NULL;
+        g_array_set_size (spilled, spilled->len + 1);
+        it = &g_array_index (spilled, struct file_fetch_spilled,
+                             spilled->len - 1);
+        it->row = job->row;
+        it->thumb = job->thumb;
+        job->thumb = NULL;
+        freed += file_fetch_thumb_bytes (it->thumb);
+    }
+    g_mutex_unlock (&file_fetch->thumb_mutex);
+
+    /* Rows can not be updated with thumb_mutex held, the UI ranks with
+       the GDK lock held. */
+    for (i = 0; i < spilled->len; i++) {
+        it = &g_array_index (spilled, struct file_fetch_spilled, i);
+        ui_window_spill_thumbnail (file_fetch->ui, &it->row, it->thumb);
+        g_object_unref (it->thumb);
+    }
+    g_array_free (spilled, TRUE);
+
+    file_budget_release (FILE_BUDGET_THUMB, freed);
+}
+
+/**
+ * Returns memory used by thumbnail.
+ *
+ * @param thumb GdkPixbuf to get size of.
+ * @return Number of bytes.
+ */
+gsize
+file_fetch_thumb_bytes (GdkPixbuf *thumb)
+{
+    return (gsize) gdk_pixbuf_get_rowstride (thumb)
+        * gdk_pixbuf_get_height (thumb);
+}
+
+/**
+ * Takes the pending thumbnail job with the highest priority, ranked jobs
+ * first and then in scan order.
+ *
+ * @param file_fetch struct file_fetch to take job from.
+ * @return Pointer to struct file_fetch_thumb.
+ */
+struct file_fetch_thumb*
+file_fetch_thumb_take (struct file_fetch *file_fetch)
+{
+    struct file_fetch_thumb *job;
+
+    g_mutex_lock (&file_fetch->thumb_mutex);
+
+    /* There is one pool token for every job in thumb_jobs so there is
+       always a job to take. */
+    if (! g_queue_is_empty (&file_fetch->thumb_urgent)) {
+        job = g_queue_pop_head (&file_fetch->thumb_urgent);
+        job->urgent_link = NULL;
+        g_queue_delete_link (&file_fetch->thumb_jobs, job->link);
+    } else {
+        job = g_queue_pop_head (&file_fetch->thumb_jobs);
     }
-    ui_window_progress_progress (file_fetch->ui,
-                                 1 /* count */, TRUE /* lock */);
+    job->link = NULL;
+    job->state = FILE_FETCH_THUMB_RUNNING;
+
+    g_hash_table_remove (file_fetch->thumb_pending, job->file);
+
+    g_mutex_unlock (&file_fetch->thumb_mutex);
+
+    return job;
+}
+
+/**
+ * Re-ranks pending thumbnail jobs, called by the UI when the visible
+ * items or the current image changes.
+ *
+ * @param data Pointer to struct file_fetch.
+ * @param files GList of struct file_multi in priority order.
+ */
+void
+file_fetch_thumb_rank (gpointer data, GList *files)
+{
+    GList *it;
+    struct file_fetch_thumb *job;
+    struct file_fetch *file_fetch = (struct file_fetch*) data;
+
+    g_mutex_lock (&file_fetch->thumb_mutex);
+
+    /* Drop previous ranking */
+    for (it = file_fetch->thumb_urgent.head; it; it = it->next) {
+        ((struct file_fetch_thumb*) it->data)->urgent_link = NULL;
+    }
+    g_queue_clear (&file_fetch->thumb_urgent);
+
+    /* Rank jobs still pending, spilled ones are generated again and
+       shown ones are kept the longest. */
+    for (it = files; it; it = it->next) {
+        job = g_hash_table_lookup (file_fetch->thumb_pending, it->data);
+        if (! job) {
+            job = g_hash_table_lookup (file_fetch->thumb_done, it->data);
+            if (! job || job->state != FILE_FETCH_THUMB_DONE) {
+                continue;
+            }
+
+            if (job->thumb) {
+                g_queue_unlink (&file_fetch->thumb_shown, job->shown_link);
+                g_queue_push_tail_link (&file_fetch->thumb_shown,
+                                        job->shown_link);
+                continue;
+            }
+
+            job->refresh = TRUE;
+            job->restore = TRUE;
+            file_fetch_thumb_queue (file_fetch, job);
+        }
+
+        if (! job->urgent_link) {
+            g_queue_push_tail (&file_fetch->thumb_urgent, job);
+            job->urgent_link = g_queue_peek_tail_link (&file_fetch->thumb_urgent);
+        }
+    }
+
+    g_mutex_unlock (&file_fetch->thumb_mutex);
 }
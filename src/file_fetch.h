@@ -47,10 +47,29 @@ struct file_fetch {
 
     GThread *thread; /**< Worker thread pushing files onto thread pool. */
     GThreadPool *pool; /**< Thread pool fetching files. */
+    GThreadPool *thumb_pool; /**< Thread pool generating thumbnails. */
+    GQueue thumb_jobs; /**< Pending thumbnail jobs in scan order. */
+    GQueue thumb_urgent; /**< Pending jobs ranked ahead of the rest. */
+    GHashTable *thumb_pending; /**< Pending jobs by struct file_multi. */
+    GHashTable *thumbs; /**< Jobs by path, kept when watching for
+                             changes, else NULL. */
+    GHashTable *thumb_done; /**< Done jobs with a thumbnail by struct
+                                 file_multi. */
+    GQueue thumb_shown; /**< Jobs with thumbnail shown, least recently
+                             ranked first. */
+    GMutex thumb_mutex; /**< Mutex for thumbnail job queues. */
 
     GHashTable *hash; /**< Hash table of fetched files. */
     GMutex hash_mutex; /**< Mutex for hash. */
 
+    GHashTable *hosts; /**< Files waiting for a transfer slot, GQueue by
+                            host. */
+    GQueue hosts_waiting; /**< Hosts with files waiting, served in turn. */
+    GMutex hosts_mutex; /**< Mutex for hosts. */
+
+    gint first; /**< Set while the first image is still to be shown. */
+    struct file_multi *frame; /**< Last frame of stdin shown, the next
+                                   one replaces it. NULL if not shown. */
     gboolean stop; /**< Stop flag. */
 };
 
@@ -60,4 +79,13 @@ extern struct file_fetch *file_fetch_start (struct file_queue *queue,
 
 extern void file_fetch_stop (struct file_fetch *file_fetch);
 
+extern void file_fetch_remove (struct file_fetch *file_fetch,
+                               const gchar *path, gboolean tree);
+extern gboolean file_fetch_refresh (struct file_fetch *file_fetch,
+                                    const gchar *path);
+extern gboolean file_fetch_is_current (struct file_fetch *file_fetch,
+                                       const gchar *path, off_t size,
+                                       time_t mtime);
+extern GList *file_fetch_get_paths (struct file_fetch *file_fetch);
+
 #endif /* _FILE_FETCH_H_ */
@@ -23,222 +23,451 @@
  */
 
 /**
- * Routines for extracting image links from html documents.
+ * Routines for extracting image links from html documents. Documents
+ * are scanned in place, from memory when fetched or mapped from disk,
+ * tag starts are found with memchr and attributes are matched without
+ * copying. Only the links found are allocated.
  */
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif /* HAVE_CONFIG_H */
 
-#include <glib/gstdio.h>
-#include <ctype.h>
 #include <string.h>
 
 #include "file_fetch_img.h"
 #include "file_multi.h"
+#include "file_url.h"
 #include "util.h"
 
-static gchar *file_fetch_img_build_url (const gchar *site, const gchar *dir,
-                                        const gchar *src);
-static gchar *file_fetch_img_get_img (GString *buf);
-static gchar *file_fetch_img_get_site (const gchar *uri);
-static gchar *file_fetch_img_get_dir (const gchar *uri);
+#define FILE_FETCH_IMG_TAG_OTHER 0
+#define FILE_FETCH_IMG_TAG_IMG 1
+#define FILE_FETCH_IMG_TAG_SOURCE 2
+#define FILE_FETCH_IMG_TAG_A 3
+#define FILE_FETCH_IMG_TAG_BASE 4
 
 /**
- * Extract urls for images in file (html).
+ * Document being scanned for links.
+ */
+struct file_fetch_img_scan {
+    gchar *base; /**< URL links are relative to. */
+    gboolean local; /**< Document is a local file, may link local files. */
+    GList *images; /**< Image URLs found, in reverse order. */
+    GList *pages; /**< Page URLs found, in reverse order. */
+    gboolean want_pages; /**< Collect pages. */
+};
+
+static const gchar *file_fetch_img_scan_tag (struct file_fetch_img_scan
+                                             *scan,
+                                             const gchar *it,
+                                             const gchar *end);
+static const gchar *file_fetch_img_skip (const gchar *it, const gchar *end,
+                                         const gchar *close);
+static void file_fetch_img_attr (struct file_fetch_img_scan *scan,
+                                 guint tag, const gchar *name,
+                                 gsize name_len, const gchar *value,
+                                 gsize value_len);
+static void file_fetch_img_add (struct file_fetch_img_scan *scan,
+                                const gchar *value, gsize len,
+                                gboolean anchor);
+static void file_fetch_img_srcset (struct file_fetch_img_scan *scan,
+                                   const gchar *value, gsize len);
+static gboolean file_fetch_img_is (const gchar *str, gsize len,
+                                   const gchar *name);
+
+static gboolean file_fetch_img_is_image (const gchar *url);
+
+/**
+ * Extract urls for images in file (html). Images are taken from <img>
+ * and <source> tags, including srcset, data-src and inline data: URIs,
+ * and from <a> tags linking to files named as images. Links are
+ * resolved against the URL of the file, or its <base>.
  *
  * @param file struct file_multi to extract links from.
+ * @param pages Set to GList of URLs of pages linked with <a> tags, NULL
+ *              if not wanted.
  * @return GList containing list of URLs, NULL if none.
  */
 GList*
-file_fetch_img_extract_links (struct file_multi *file)
+file_fetch_img_extract_links (struct file_multi *file, GList **pages)
 {
-    gint c;
-    gchar *img, *img_url, *site, *dir;
-    FILE *fd;
-    GList *urls = NULL;
-    GString *buf;
+    const gchar *it, *end;
+    GBytes *data;
+    GError *err = NULL;
+    GMappedFile *mapped = NULL;
+    struct file_fetch_img_scan scan;
 
     g_assert (file);
 
-    /* Open input */
-    fd = g_fopen (file_multi_get_path (file), "r");
-    if (! fd) {
-        g_warning ("unable to open %s for reading", file_multi_get_path (file));
-        return NULL;
-    }
-
-    /* Get base and relative paths */
-    site = file_fetch_img_get_site (file_multi_get_uri (file));
-    dir = file_fetch_img_get_dir (file_multi_get_uri (file));
-
-    /* Read input */
-    while ((c = fgetc (fd)) != EOF) {
-        /* < I M G , start of image tag */
-        if (c == '<'
-            && (toupper(fgetc(fd)) == 'I')
-            && (toupper(fgetc(fd)) == 'M')
-            && (toupper(fgetc(fd)) == 'G')) {
-            /* Create buffer starting with <img */
-            buf = g_string_new ("<img");
-
-            /* Read to end of tag */
-            while ((c = fgetc(fd)) != EOF) {
-                buf = g_string_append_c (buf, (gchar) c);
-
-                if (c == '>') {
-                    break;
-                }
-            }
-
-            /* Get image from buffer */
-            img = file_fetch_img_get_img (buf);
-            if (img) {
-                img_url = file_fetch_img_build_url (site, dir, img);
-                urls = g_list_append (urls, img_url);
-                g_free (img);
-            }
+    if (pages) {
+        *pages = NULL;
+    }
 
-            /* Clean up */
-            g_string_free (buf, TRUE /* free_segment */);
+    /* Fetched pages are read from memory, others are mapped */
+    data = file_multi_get_data (file);
+    if (! data) {
+        mapped = g_mapped_file_new (file_multi_get_path (file), FALSE, &err);
+        if (! mapped) {
+            g_warning ("unable to open %s for reading: %s",
+                       file_multi_get_path (file), err->message);
+            g_error_free (err);
+            return NULL;
         }
+        data = g_mapped_file_get_bytes (mapped);
+    }
+
+    /* Links are relative to the document unless it has a <base> */
+    scan.base = g_strdup (file_multi_get_uri (file));
+    scan.local = ! g_ascii_strncasecmp (scan.base, "file:", 5);
+    scan.images = NULL;
+    scan.pages = NULL;
+    scan.want_pages = pages != NULL;
+
+    /* Scan from tag start to tag start */
+    it = g_bytes_get_data (data, NULL);
+    end = it + g_bytes_get_size (data);
+    while (it && (it = memchr (it, '<', end - it)) != NULL) {
+        it = file_fetch_img_scan_tag (&scan, it + 1, end);
     }
 
     /* Cleanup */
-    fclose (fd);
-    g_free (site);
-    g_free (dir);
+    g_bytes_unref (data);
+    if (mapped) {
+        g_mapped_file_unref (mapped);
+    }
+    g_free (scan.base);
+    if (pages) {
+        *pages = g_list_reverse (scan.pages);
+    }
 
-    return urls;
+    return g_list_reverse (scan.images);
 }
 
 /**
- * Builds complete url for src value.
+ * Scans tag for links, comments and the content of script and style
+ * elements are skipped.
  *
- * @param site Site img link was extracted from.
- * @param dir Directory in site link was extracted from.
- * @param src img link to build full URL for.
- * @return Complete URL for src value.
+ * @param scan Document being scanned.
+ * @param it Start of tag name, after <.
+ * @param end End of document.
+ * @return Position after the tag, NULL at end of document.
  */
-gchar*
-file_fetch_img_build_url (const gchar *site, const gchar *dir, const gchar *src)
+const gchar*
+file_fetch_img_scan_tag (struct file_fetch_img_scan *scan, const gchar *it,
+                         const gchar *end)
 {
-    gchar *img_url;
-
-    if (src[0] == '/') {
-        /* Absolute URL on site */
-        img_url = g_strjoin(NULL, site, src, NULL);
+    guint tag;
+    gchar quote;
+    gsize len;
+    const gchar *name, *value;
 
-    } else if ((util_stripos (src, "http://") == src)
-               ||(util_stripos (src, "https://") == src)) {
-        /* Absolute URL, just copy */
-        img_url = g_strdup (src);
+    if ((end - it >= 3) && ! memcmp (it, "!--", 3)) {
+        return file_fetch_img_skip (it + 3, end, "-->");
+    }
 
+    name = it;
+    while ((it < end) && g_ascii_isalnum (*it)) {
+        it++;
+    }
+    len = it - name;
+    if (file_fetch_img_is (name, len, "img")) {
+        tag = FILE_FETCH_IMG_TAG_IMG;
+    } else if (file_fetch_img_is (name, len, "source")) {
+        tag = FILE_FETCH_IMG_TAG_SOURCE;
+    } else if (file_fetch_img_is (name, len, "a")) {
+        tag = FILE_FETCH_IMG_TAG_A;
+    } else if (file_fetch_img_is (name, len, "base")) {
+        tag = FILE_FETCH_IMG_TAG_BASE;
+    } else if (file_fetch_img_is (name, len, "script")) {
+        return file_fetch_img_skip (it, end, "</script");
+    } else if (file_fetch_img_is (name, len, "style")) {
+        return file_fetch_img_skip (it, end, "</style");
     } else {
-        /* Relative path */
-        img_url = g_strjoin (NULL, site, "/", dir, "/", src, NULL);
+        /* Attributes of other tags are not looked at */
+        return it;
+    }
+
+    /* Attributes, name=value with the value optionally quoted */
+    while (it < end) {
+        while ((it < end) && (g_ascii_isspace (*it) || (*it == '/'))) {
+            it++;
+        }
+        if ((it == end) || (*it == '>') || (*it == '<')) {
+            break;
+        }
+
+        name = it;
+        while ((it < end) && ! g_ascii_isspace (*it) && (*it != '=')
+               && (*it != '>') && (*it != '/')) {
+            it++;
+        }
+        len = it - name;
+
+        while ((it < end) && g_ascii_isspace (*it)) {
+            it++;
+        }
+        if ((it == end) || (*it != '=')) {
+            continue;
+        }
+        it++;
+        while ((it < end) && g_ascii_isspace (*it)) {
+            it++;
+        }
+        if (it == end) {
+            break;
+        }
+
+        if ((*it == '"') || (*it == '\'')) {
+            quote = *it++;
+            value = it;
+            it = memchr (it, quote, end - it);
+            if (! it) {
+                return NULL;
+            }
+            file_fetch_img_attr (scan, tag, name, len, value, it - value);
+            it++;
+        } else {
+            value = it;
+            while ((it < end) && ! g_ascii_isspace (*it) && (*it != '>')) {
+                it++;
+            }
+            file_fetch_img_attr (scan, tag, name, len, value, it - value);
+        }
     }
 
-    return img_url;
+    return it;
 }
 
 /**
- * Gets single image from <img ... > tag.
+ * Skips to after closing string, matched ignoring case.
  *
- * @param buf GString buffer reprsenting <img ... > tag.
- * @return Content of src in img tag, NULL on error.
+ * @param it Position to search from.
+ * @param end End of document.
+ * @param close Closing string, starting with a character that is not a
+ *              letter.
+ * @return Position after closing string, NULL if not found.
  */
-gchar*
-file_fetch_img_get_img (GString *buf)
+const gchar*
+file_fetch_img_skip (const gchar *it, const gchar *end, const gchar *close)
 {
-    gchar *img = NULL;
-    guint len;
-    const gchar *start, *end, *end_str;
-
-    /* Get src tag */
-    start = util_stripos (buf->str, "src=");
-    if (start) {
-        /* Skip src= */
-        start += 4;
-
-        /* Check separator of tag */
-        if (start[0] == '\'') {
-            start++;
-            end_str = "'";
-        } else if (start[0] == '"') {
-            start++;
-            end_str = "\"";
-        } else {
-            end_str = " ";
-        }
+    gsize len = strlen (close);
 
-        /* Get end of value */
-        end = strstr (start, end_str);
-        if (! end) {
-            /* Did not find end, broken tag or ended with > */
-            end = buf->str + buf->len - 1;
+    while ((it = memchr (it, close[0], end - it)) != NULL) {
+        if ((end - it >= (gssize) len)
+            && ! g_ascii_strncasecmp (it, close, len)) {
+            return it + len;
         }
-
-        /* Extract src value */
-        len = (end - start) / sizeof (end[0]);
-        img = g_malloc (sizeof(gchar) * len);
-        img = g_strndup (start, len);
+        it++;
     }
 
-    return img;
+    return NULL;
 }
 
 /**
- * Builds base (host) value of URL.
+ * Collects link from attribute of tag.
  *
- * @param uri Uri to build value from.
- * @return Full URI.
+ * @param scan Document being scanned.
+ * @param tag FILE_FETCH_IMG_TAG_ tag the attribute is in.
+ * @param name Name of attribute, not terminated.
+ * @param name_len Length of name.
+ * @param value Value of attribute, not terminated.
+ * @param value_len Length of value.
  */
-gchar*
-file_fetch_img_get_site (const gchar *uri)
+void
+file_fetch_img_attr (struct file_fetch_img_scan *scan, guint tag,
+                     const gchar *name, gsize name_len, const gchar *value,
+                     gsize value_len)
 {
-    gchar *base;
-    const gchar *end;
+    gchar *href, *base;
 
-    /* Skip http(s):// */
-    end = uri + 8;
+    if (tag == FILE_FETCH_IMG_TAG_A) {
+        if (file_fetch_img_is (name, name_len, "href")) {
+            file_fetch_img_add (scan, value, value_len, TRUE);
+        }
+    } else if (tag == FILE_FETCH_IMG_TAG_BASE) {
+        if (file_fetch_img_is (name, name_len, "href")) {
+            href = g_strstrip (g_strndup (value, value_len));
+            base = file_url_resolve (scan->base, href);
+            if (base) {
+                g_free (scan->base);
+                scan->base = base;
+            }
+            g_free (href);
+        }
+    } else if (file_fetch_img_is (name, name_len, "src")
+               || file_fetch_img_is (name, name_len, "data-src")) {
+        file_fetch_img_add (scan, value, value_len, FALSE);
+    } else if (file_fetch_img_is (name, name_len, "srcset")
+               || file_fetch_img_is (name, name_len, "data-srcset")) {
+        file_fetch_img_srcset (scan, value, value_len);
+    }
+}
 
-    /* Find first /, if it does not exist assume complete string */
-    end = strchr (end, '/');
-    if (end) {
-        base = g_strndup (uri, (end - uri) / sizeof (uri[0]));
-    } else {
-        base = g_strdup (uri);
+/**
+ * Adds link to the images or pages found, &amp; in the link is
+ * unescaped and the link resolved to a canonical URL. Links that do not
+ * resolve to a URL that can be fetched are skipped, as are links to
+ * local files from pages that are not local.
+ *
+ * @param scan Document being scanned.
+ * @param value Link, not terminated.
+ * @param len Length of link.
+ * @param anchor TRUE if linked with <a>, only links named as images
+ *               are images then.
+ */
+void
+file_fetch_img_add (struct file_fetch_img_scan *scan, const gchar *value,
+                    gsize len, gboolean anchor)
+{
+    gchar *src, *out, *url;
+    const gchar *in;
+
+    while ((len > 0) && g_ascii_isspace (*value)) {
+        value++;
+        len--;
+    }
+    while ((len > 0) && g_ascii_isspace (value[len - 1])) {
+        len--;
+    }
+    if (len == 0) {
+        return;
     }
 
-    return base;
+    src = g_malloc (len + 1);
+    for (in = value, out = src; in < value + len; out++) {
+        *out = *in;
+        in += ((*in == '&') && (value + len - in >= 5)
+               && ! memcmp (in, "&amp;", 5)) ? 5 : 1;
+    }
+    *out = '\0';
+
+    /* Inline data is an image as is, it can be large */
+    if (! g_ascii_strncasecmp (src, "data:", 5)) {
+        scan->images = g_list_prepend (scan->images, src);
+        return;
+    }
+
+    url = file_url_resolve (scan->base, src);
+    g_free (src);
+    if (url && ! g_ascii_strncasecmp (url, "file:", 5)) {
+        src = url;
+        url = scan->local ? g_filename_from_uri (src, NULL, NULL) : NULL;
+        g_free (src);
+    }
+    if (! url) {
+        return;
+    }
+
+    if (! anchor || file_fetch_img_is_image (url)) {
+        scan->images = g_list_prepend (scan->images, url);
+    } else if (scan->want_pages) {
+        scan->pages = g_list_prepend (scan->pages, url);
+    } else {
+        g_free (url);
+    }
 }
 
 /**
- * Builds relative value of URL (current dir)
+ * Adds the largest candidate of srcset, the full size image is wanted.
  *
- * @param uri Uri to build value from.
- * @return Full URI.
+ * @param scan Document being scanned.
+ * @param value List of candidates "url [descriptor], ...".
+ * @param len Length of value.
  */
-gchar*
-file_fetch_img_get_dir (const gchar *uri)
+void
+file_fetch_img_srcset (struct file_fetch_img_scan *scan, const gchar *value,
+                       gsize len)
 {
-    gchar *dir;
-    const gchar *begin, *end;
-
-    /* Find first / skipping http(s)://, if it does not exist assume
-       empty string */
-    begin = strchr (uri + 8, '/');
-    if (begin) {
-        end = strrchr (begin + 1, '/');
-        if (end) {
-            dir = g_strndup (begin + 1, (end - begin - 1) / sizeof (begin[0]));
+    guint size, best_size = 0;
+    const gchar *it, *end = value + len, *url, *url_end;
+    const gchar *best = NULL, *best_end = NULL;
+
+    for (it = value; it < end; ) {
+        while ((it < end) && (g_ascii_isspace (*it) || (*it == ','))) {
+            it++;
+        }
+        url = it;
+        while ((it < end) && ! g_ascii_isspace (*it)) {
+            it++;
+        }
+        url_end = it;
+
+        /* Descriptor such as 640w or 2x, candidates without one are 1x.
+           A comma ending the URL ends the candidate. */
+        size = 1;
+        if ((url_end > url) && (url_end[-1] == ',')) {
+            while ((url_end > url) && (url_end[-1] == ',')) {
+                url_end--;
+            }
         } else {
-            dir = g_strdup ("");
+            while ((it < end) && g_ascii_isspace (*it)) {
+                it++;
+            }
+            if ((it < end) && g_ascii_isdigit (*it)) {
+                for (size = 0; (it < end) && g_ascii_isdigit (*it); it++) {
+                    size = size * 10 + (*it - '0');
+                }
+            }
+            while ((it < end) && (*it != ',')) {
+                it++;
+            }
+        }
+        if (url_end == url) {
+            continue;
+        }
+
+        if (! best || (size > best_size)) {
+            best_size = size;
+            best = url;
+            best_end = url_end;
         }
-    } else {
-        dir = g_strdup ("");
     }
 
-    return dir;
+    if (best) {
+        file_fetch_img_add (scan, best, best_end - best, FALSE);
+    }
+}
+
+/**
+ * Checks string, not terminated, against name ignoring case.
+ *
+ * @param str String to check.
+ * @param len Length of str.
+ * @param name Lower case name.
+ * @return TRUE if str is name, else FALSE.
+ */
+gboolean
+file_fetch_img_is (const gchar *str, gsize len, const gchar *name)
+{
+    return (strlen (name) == len) && ! g_ascii_strncasecmp (str, name, len);
+}
+
+/**
+ * Checks if link is named as an image, such links from <a> tags often
+ * point to the full size version of a thumbnail.
+ *
+ * @param url Link to check.
+ * @return TRUE if url ends with an image extension, else FALSE.
+ */
+gboolean
+file_fetch_img_is_image (const gchar *url)
+{
+    gsize len;
+    gchar *ext;
+    gboolean status;
+    const gchar *dot;
+
+    /* Extension is at the end of the path, before any query */
+    len = strcspn (url, "?#");
+    dot = g_strrstr_len (url, len, ".");
+    if (! dot || memchr (dot, '/', len - (dot - url))) {
+        return FALSE;
+    }
+
+    ext = g_strndup (dot + 1, len - (dot - url) - 1);
+    status = util_str_in (ext, TRUE, "jpg", "jpeg", "png", "gif", "bmp",
+                          "tif", "tiff", "webp", NULL);
+    g_free (ext);
+
+    return status;
 }
@@ -37,6 +37,7 @@
 
 #include "file_multi.h"
 
-extern GList *file_fetch_img_extract_links (struct file_multi *file);
+extern GList *file_fetch_img_extract_links (struct file_multi *file,
+                                            GList **pages);
 
 #endif /* _FILE_FETCH_IMG_H_ */
@@ -0,0 +1,439 @@
+/*
+ * Copyright © 2006-2009 Claes Nästén <me@pekdon.net>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Filtering of files on name, size, mtime and image dimensions. Checks
+ * are ordered by cost so a file excluded by name is never stat'ed and a
+ * file excluded by size is never read.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <gtk/gtk.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "geh.h"
+#include "file_filter.h"
+#include "file_multi.h"
+
+static gboolean file_filter_parse_size (const gchar *str, gint64 *size);
+static gboolean file_filter_parse_time (const gchar *str, gint64 *time);
+static gboolean file_filter_parse_dim (const gchar *str,
+                                       gint *width, gint *height);
+static gboolean file_filter_data_info (GBytes *data,
+                                       gint *width, gint *height);
+static void file_filter_callback_size_prepared (GdkPixbufLoader *loader,
+                                                gint width, gint height,
+                                                gpointer user_data);
+
+/** Filter built from options, set up before scanning starts. */
+static struct file_filter filter = {
+    NULL, -1, -1, -1, -1, -1, -1, -1, -1
+};
+/** TRUE if any filter option is set. */
+static gboolean filter_active = FALSE;
+
+/** Bytes of fetched data written to the loader at a time when reading
+    image dimensions. */
+#define FILE_FILTER_INFO_CHUNK 4096
+
+/**
+ * Builds filter from options.
+ *
+ * @return TRUE on success, FALSE if an option is invalid.
+ */
+gboolean
+file_filter_init (void)
+{
+    guint i;
+    gchar *lower;
+
+    if (options.filter_names) {
+        filter.names = g_ptr_array_new_with_free_func (
+            (GDestroyNotify) &g_pattern_spec_free);
+        for (i = 0; options.filter_names[i] != NULL; i++) {
+            /* Names are matched ignoring case, *.jpg matches IMG.JPG */
+            lower = g_ascii_strdown (options.filter_names[i], -1);
+            g_ptr_array_add (filter.names, g_pattern_spec_new (lower));
+            g_free (lower);
+        }
+    }
+
+    if ((options.filter_size_min
+         && ! file_filter_parse_size (options.filter_size_min,
+                                      &filter.size_min))
+        || (options.filter_size_max
+            && ! file_filter_parse_size (options.filter_size_max,
+                                         &filter.size_max))
+        || (options.filter_newer
+            && ! file_filter_parse_time (options.filter_newer,
+                                         &filter.mtime_min))
+        || (options.filter_older
+            && ! file_filter_parse_time (options.filter_older,
+                                         &filter.mtime_max))
+        || (options.filter_dim_min
+            && ! file_filter_parse_dim (options.filter_dim_min,
+                                        &filter.width_min,
+                                        &filter.height_min))
+        || (options.filter_dim_max
+            && ! file_filter_parse_dim (options.filter_dim_max,
+                                        &filter.width_max,
+                                        &filter.height_max))) {
+        return FALSE;
+    }
+
+    filter_active = filter.names
+        || (filter.size_min != -1) || (filter.size_max != -1)
+        || (filter.mtime_min != -1) || (filter.mtime_max != -1)
+        || (filter.width_min != -1) || (filter.width_max != -1);
+
+    return TRUE;
+}
+
+/**
+ * Frees resources used by filter.
+ */
+void
+file_filter_free (void)
+{
+    if (filter.names) {
+        g_ptr_array_free (filter.names, TRUE);
+        filter.names = NULL;
+    }
+}
+
+/**
+ * Checks if any filter is set.
+ *
+ * @return TRUE if files can be excluded by the filter.
+ */
+gboolean
+file_filter_active (void)
+{
+    return filter_active;
+}
+
+/**
+ * Checks name against name patterns, needs only the directory entry.
+ *
+ * @param name Base name of file.
+ * @return TRUE if file is included.
+ */
+gboolean
+file_filter_name (const gchar *name)
+{
+    guint i;
+    gchar *lower;
+    gboolean match = FALSE;
+
+    if (! filter.names) {
+        return TRUE;
+    }
+
+    lower = g_ascii_strdown (name, -1);
+    for (i = 0; ! match && i < filter.names->len; i++) {
+        match = g_pattern_match_string (g_ptr_array_index (filter.names, i),
+                                        lower);
+    }
+    g_free (lower);
+
+    return match;
+}
+
+/**
+ * Checks size and mtime, stats the file unless already known.
+ *
+ * @param file struct file_multi to check.
+ * @return TRUE if file is included.
+ */
+gboolean
+file_filter_stat (struct file_multi *file)
+{
+    off_t size;
+    time_t mtime;
+
+    if ((filter.size_min != -1) || (filter.size_max != -1)) {
+        size = file_multi_get_size (file);
+        if ((size == -1)
+            || ((filter.size_min != -1) && (size < filter.size_min))
+            || ((filter.size_max != -1) && (size > filter.size_max))) {
+            return FALSE;
+        }
+    }
+
+    if ((filter.mtime_min != -1) || (filter.mtime_max != -1)) {
+        mtime = file_multi_get_mtime (file);
+        if ((mtime == -1)
+            || ((filter.mtime_min != -1) && (mtime < filter.mtime_min))
+            || ((filter.mtime_max != -1) && (mtime > filter.mtime_max))) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * Checks image dimensions, reads only the image header.
+ *
+ * @param file struct file_multi to check.
+ * @return TRUE if file is included.
+ */
+gboolean
+file_filter_image (struct file_multi *file)
+{
+    gint width, height;
+    gboolean status;
+    GBytes *data;
+
+    if ((filter.width_min == -1) && (filter.width_max == -1)) {
+        return TRUE;
+    }
+
+    /* Fetched files are kept in memory */
+    data = file_multi_get_data (file);
+    if (data) {
+        status = file_filter_data_info (data, &width, &height);
+        g_bytes_unref (data);
+    } else {
+        status = gdk_pixbuf_get_file_info (file_multi_get_path (file),
+                                           &width, &height) != NULL;
+    }
+    if (! status) {
+        return FALSE;
+    }
+
+    return file_filter_dims (width, height);
+}
+
+/**
+ * Checks image dimensions already known, such as the ones saved with a
+ * cached thumbnail.
+ *
+ * @param width Width of image, -1 if not known.
+ * @param height Height of image, -1 if not known.
+ * @return TRUE if file is included.
+ */
+gboolean
+file_filter_dims (gint width, gint height)
+{
+    if ((filter.width_min == -1) && (filter.width_max == -1)) {
+        return TRUE;
+    }
+    if ((width == -1) || (height == -1)) {
+        return FALSE;
+    }
+
+    return ((filter.width_min == -1)
+            || ((width >= filter.width_min) && (height >= filter.height_min)))
+        && ((filter.width_max == -1)
+            || ((width <= filter.width_max) && (height <= filter.height_max)));
+}
+
+/**
+ * Gets image dimensions from data in memory, only the start of the
+ * data is read.
+ *
+ * @param data Image data.
+ * @param width Set to image width.
+ * @param height Set to image height.
+ * @return TRUE if the dimensions were read, else FALSE.
+ */
+gboolean
+file_filter_data_info (GBytes *data, gint *width, gint *height)
+{
+    gsize len, off;
+    gint size[2] = {-1, -1};
+    const guchar *buf;
+    GdkPixbufLoader *loader;
+
+    buf = g_bytes_get_data (data, &len);
+
+    loader = gdk_pixbuf_loader_new ();
+    g_signal_connect (G_OBJECT (loader), "size-prepared",
+                      G_CALLBACK (file_filter_callback_size_prepared), size);
+
+    for (off = 0; (off < len) && (size[0] == -1);
+         off += FILE_FILTER_INFO_CHUNK) {
+        if (! gdk_pixbuf_loader_write (loader, buf + off,
+                                       MIN (FILE_FILTER_INFO_CHUNK,
+                                            len - off), NULL)) {
+            break;
+        }
+    }
+    gdk_pixbuf_loader_close (loader, NULL);
+    g_object_unref (loader);
+
+    *width = size[0];
+    *height = size[1];
+
+    return size[0] != -1;
+}
+
+/**
+ * Callback storing the image dimensions when known.
+ *
+ * @param loader Loader used to signal.
+ * @param width Width of image being loaded.
+ * @param height Height of image being loaded.
+ * @param user_data Array of two gint, set to width and height.
+ */
+void
+file_filter_callback_size_prepared (GdkPixbufLoader *loader,
+                                    gint width, gint height,
+                                    gpointer user_data)
+{
+    gint *size = (gint*) user_data;
+
+    size[0] = width;
+    size[1] = height;
+}
+
+/**
+ * Checks file against all filters.
+ *
+ * @param file struct file_multi to check, must be local or fetched.
+ * @return TRUE if file is included.
+ */
+gboolean
+file_filter_file (struct file_multi *file)
+{
+    return file_filter_name (file_multi_get_name (file))
+        && file_filter_stat (file)
+        && file_filter_image (file);
+}
+
+/**
+ * Parses size, number of bytes optionally followed by k, M or G.
+ *
+ * @param str String to parse.
+ * @param size Set to size in bytes.
+ * @return TRUE on success, else FALSE.
+ */
+gboolean
+file_filter_parse_size (const gchar *str, gint64 *size)
+{
+    gchar *end;
+
+    *size = g_ascii_strtoll (str, &end, 10);
+    if (end != str) {
+        switch (g_ascii_tolower (*end)) {
+        case 'g':
+            *size *= 1024;
+            /* fall through */
+        case 'm':
+            *size *= 1024;
+            /* fall through */
+        case 'k':
+            *size *= 1024;
+            end++;
+            break;
+        }
+    }
+
+    if ((end == str) || (*end != '\0') || (*size < 0)) {
+        g_warning ("invalid size %s, expected number optionally followed "
+                   "by k, M or G", str);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/**
+ * Parses time, either YYYY-MM-DD or an age given as number followed by
+ * s, m, h, d or w.
+ *
+ * @param str String to parse.
+ * @param time Set to unix time.
+ * @return TRUE on success, else FALSE.
+ */
+gboolean
+file_filter_parse_time (const gchar *str, gint64 *time)
+{
+    gint year, month, day;
+    gint64 age;
+    gchar *end;
+    GDateTime *date;
+
+    if (sscanf (str, "%4d-%2d-%2d", &year, &month, &day) == 3) {
+        date = g_date_time_new_local (year, month, day, 0, 0, 0);
+        if (date) {
+            *time = g_date_time_to_unix (date);
+            g_date_time_unref (date);
+            return TRUE;
+        }
+
+    } else {
+        age = g_ascii_strtoll (str, &end, 10);
+        if ((end != str) && (age >= 0) && (end[0] != '\0')
+            && (end[1] == '\0') && strchr ("smhdw", end[0])) {
+            switch (end[0]) {
+            case 'w':
+                age *= 7;
+                /* fall through */
+            case 'd':
+                age *= 24;
+                /* fall through */
+            case 'h':
+                age *= 60;
+                /* fall through */
+            case 'm':
+                age *= 60;
+                break;
+            }
+            *time = g_get_real_time () / G_USEC_PER_SEC - age;
+            return TRUE;
+        }
+    }
+
+    g_warning ("invalid time %s, expected YYYY-MM-DD or age such as 7d",
+               str);
+    return FALSE;
+}
+
+/**
+ * Parses dimensions given as WIDTHxHEIGHT.
+ *
+ * @param str String to parse.
+ * @param width Set to width.
+ * @param height Set to height.
+ * @return TRUE on success, else FALSE.
+ */
+gboolean
+file_filter_parse_dim (const gchar *str, gint *width, gint *height)
+{
+    gchar end;
+
+    if ((sscanf (str, "%dx%d%c", width, height, &end) != 2)
+        || (*width < 0) || (*height < 0)) {
+        g_warning ("invalid dimensions %s, expected WIDTHxHEIGHT", str);
+        return FALSE;
+    }
+
+    return TRUE;
+}
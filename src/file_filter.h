@@ -0,0 +1,68 @@
+/*
+ * Copyright © 2006-2009 Claes Nästén <me@pekdon.net>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/**
+ * Filtering of files on name, size, mtime and image dimensions before
+ * they are queued.
+ */
+
+#ifndef _FILE_FILTER_H_
+#define _FILE_FILTER_H_
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <glib.h>
+
+#include "file_multi.h"
+
+/**
+ * Parsed filter options, limits set to -1 are not checked.
+ */
+struct file_filter {
+    GPtrArray *names; /**< GPatternSpec for lower case names, NULL if
+                           any name matches. */
+    gint64 size_min; /**< Minimum size in bytes. */
+    gint64 size_max; /**< Maximum size in bytes. */
+    gint64 mtime_min; /**< Oldest mtime, unix time. */
+    gint64 mtime_max; /**< Newest mtime, unix time. */
+    gint width_min; /**< Minimum width in pixels. */
+    gint height_min; /**< Minimum height in pixels. */
+    gint width_max; /**< Maximum width in pixels. */
+    gint height_max; /**< Maximum height in pixels. */
+};
+
+extern gboolean file_filter_init (void);
+extern void file_filter_free (void);
+extern gboolean file_filter_active (void);
+
+extern gboolean file_filter_name (const gchar *name);
+extern gboolean file_filter_stat (struct file_multi *file);
+extern gboolean file_filter_image (struct file_multi *file);
+extern gboolean file_filter_dims (gint width, gint height);
+extern gboolean file_filter_file (struct file_multi *file);
+
+#endif /* _FILE_FILTER_H_ */
@@ -0,0 +1,228 @@
+/*
+ * Copyright © 2006-2009 Claes Nästén <me@pekdon.net>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * File identity index. Hard links, symlinks, bind mounts and repeated
+ * arguments lead to the same (device, inode), only the first path seen
+ * is used.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "file_ident.h"
+
+static guint file_ident_hash (gconstpointer key);
+static gboolean file_ident_equal (gconstpointer a, gconstpointer b);
+static void file_ident_destroy (struct file_ident *ident);
+
+/** Identities by device and inode, owns nothing. */
+static GHashTable *idents = NULL;
+/** Identities by path, owns the struct file_ident. */
+static GHashTable *paths = NULL;
+/** Lock for idents and paths, claimed from all scanning threads. */
+static GMutex idents_mutex;
+
+/**
+ * Creates empty identity index, called before scanning starts.
+ */
+void
+file_ident_init (void)
+{
+    idents = g_hash_table_new (&file_ident_hash, &file_ident_equal);
+    paths = g_hash_table_new_full (&g_str_hash, &g_str_equal, NULL,
+                                   (GDestroyNotify) &file_ident_destroy);
+}
+
+/**
+ * Frees identity index.
+ */
+void
+file_ident_free (void)
+{
+    if (idents) {
+        g_hash_table_destroy (idents);
+        g_hash_table_destroy (paths);
+        idents = NULL;
+        paths = NULL;
+    }
+}
+
+/**
+ * Claims identity for path. The first path claiming an identity owns it,
+ * claiming again with the same path succeeds so changed files can be
+ * claimed again. A path claiming a new identity, replaced by a new file,
+ * gives up its previous one.
+ *
+ * @param path Path to file or directory.
+ * @param dev Device of file.
+ * @param ino Inode of file.
+ * @return NULL if path owns the identity, else copy of the owning path
+ *         to free with g_free.
+ */
+gchar*
+file_ident_claim (const gchar *path, guint64 dev, guint64 ino)
+{
+    gchar *owner = NULL;
+    struct file_ident key, *ident;
+
+    g_assert (path);
+    g_assert (idents);
+
+    key.dev = dev;
+    key.ino = ino;
+
+    g_mutex_lock (&idents_mutex);
+    ident = g_hash_table_lookup (idents, &key);
+    if (ident) {
+        if (strcmp (ident->path, path)) {
+            owner = g_strdup (ident->path);
+        }
+
+    } else {
+        /* Replaces previous identity of path, if any. */
+        ident = g_hash_table_lookup (paths, path);
+        if (ident) {
+            g_hash_table_remove (idents, ident);
+            g_hash_table_remove (paths, path);
+        }
+
+        ident = g_malloc (sizeof (struct file_ident));
+        ident->dev = dev;
+        ident->ino = ino;
+        ident->path = g_strdup (path);
+        g_hash_table_insert (paths, ident->path, ident);
+        g_hash_table_insert (idents, ident, ident);
+    }
+    g_mutex_unlock (&idents_mutex);
+
+    return owner;
+}
+
+/**
+ * Claims identity for path, stat'ing it to get device and inode.
+ *
+ * @param path Path to file or directory, symlinks are followed.
+ * @return NULL if path owns the identity or could not be stat'ed, else
+ *         copy of the owning path to free with g_free.
+ */
+gchar*
+file_ident_claim_path (const gchar *path)
+{
+    struct stat buf;
+
+    if (g_stat (path, &buf)) {
+        return NULL;
+    }
+
+    return file_ident_claim (path, buf.st_dev, buf.st_ino);
+}
+
+/**
+ * Releases identity owned by path, or by paths below it if it is a
+ * directory. Used when files are removed so a reused inode is not taken
+ * for the removed file.
+ *
+ * @param path Path to removed file or directory.
+ * @param tree TRUE if path is a directory, else only path is looked up.
+ */
+void
+file_ident_release (const gchar *path, gboolean tree)
+{
+    gsize len;
+    GHashTableIter iter;
+    struct file_ident *ident;
+
+    g_assert (path);
+
+    if (! idents) {
+        return;
+    }
+
+    g_mutex_lock (&idents_mutex);
+    if (tree) {
+        len = strlen (path);
+        g_hash_table_iter_init (&iter, paths);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer*) &ident)) {
+            if (! strncmp (ident->path, path, len)
+                && (ident->path[len] == '\0'
+                    || ident->path[len] == G_DIR_SEPARATOR)) {
+                g_hash_table_remove (idents, ident);
+                g_hash_table_iter_remove (&iter);
+            }
+        }
+
+    } else {
+        ident = g_hash_table_lookup (paths, path);
+        if (ident) {
+            g_hash_table_remove (idents, ident);
+            g_hash_table_remove (paths, path);
+        }
+    }
+    g_mutex_unlock (&idents_mutex);
+}
+
+/**
+ * Hashes device and inode of struct file_ident.
+ */
+guint
+file_ident_hash (gconstpointer key)
+{
+    const struct file_ident *ident = (const struct file_ident*) key;
+
+    return (guint) (ident->ino ^ (ident->ino >> 32))
+        ^ (guint) (ident->dev * 2654435761u);
+}
+
+/**
+ * Compares device and inode of two struct file_ident.
+ */
+gboolean
+file_ident_equal (gconstpointer a, gconstpointer b)
+{
+    const struct file_ident *ia = (const struct file_ident*) a;
+    const struct file_ident *ib = (const struct file_ident*) b;
+
+    return (ia->dev == ib->dev) && (ia->ino == ib->ino);
+}
+
+/**
+ * Frees struct file_ident.
+ *
+ * @param ident struct file_ident to free.
+ */
+void
+file_ident_destroy (struct file_ident *ident)
+{
+    g_free (ident->path);
+    g_free (ident);
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright © 2006-2009 Claes Nästén <me@pekdon.net>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * File identity index, tells files and directories reached through
+ * several paths apart by device and inode.
+ */
+
+#ifndef _FILE_IDENT_H_
+#define _FILE_IDENT_H_
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <glib.h>
+
+/**
+ * Identity of file, first path seen for it.
+ */
+struct file_ident {
+    guint64 dev; /**< Device file is on. */
+    guint64 ino; /**< Inode of file. */
+    gchar *path; /**< First path file was seen at. */
+};
+
+extern void file_ident_init (void);
+extern void file_ident_free (void);
+
+extern gchar *file_ident_claim (const gchar *path, guint64 dev, guint64 ino);
+extern gchar *file_ident_claim_path (const gchar *path);
+extern void file_ident_release (const gchar *path, gboolean tree);
+
+#endif /* _FILE_IDENT_H_ */
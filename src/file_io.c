@@ -0,0 +1,763 @@
+/*
+ * Copyright © 2006-2009 Claes Nästén <me@pekdon.net>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Batched file I/O routines.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* statx */
+#endif /* _GNU_SOURCE */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#endif /* __linux__ */
+
+#include "file_io.h"
+
+#if defined(__linux__) && defined(SYS_io_uring_setup) && defined(STATX_TYPE)
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#ifdef IORING_FEAT_RW_CUR_POS /* statx, openat and read ops, Linux 5.6 */
+#define FILE_IO_URING
+#endif /* IORING_FEAT_RW_CUR_POS */
+#endif /* __has_include(<linux/io_uring.h>) */
+#endif /* __has_include */
+#endif /* __linux__ && SYS_io_uring_setup && STATX_TYPE */
+
+#ifdef FILE_IO_URING
+/**
+ * io_uring instance, each thread has its own as rings are not thread
+ * safe. Requests are queued and submitted together when waiting for a
+ * completion.
+ */
+struct file_io_ring {
+    int fd; /**< Ring file descriptor. */
+
+    unsigned *sq_head; /**< Submission queue head, moved by kernel. */
+    unsigned *sq_tail; /**< Submission queue tail, moved by us. */
+    unsigned *sq_mask; /**< Submission queue index mask. */
+    unsigned *sq_array; /**< Submission queue entry indexes. */
+    struct io_uring_sqe *sqes; /**< Submission queue entries. */
+
+    unsigned *cq_head; /**< Completion queue head, moved by us. */
+    unsigned *cq_tail; /**< Completion queue tail, moved by kernel. */
+    unsigned *cq_mask; /**< Completion queue index mask. */
+    struct io_uring_cqe *cqes; /**< Completion queue entries. */
+
+    gpointer sq_map; /**< Mapped submission queue ring. */
+    gsize sq_map_len; /**< Length of sq_map. */
+    gpointer cq_map; /**< Mapped completion ring, same as sq_map if the
+                          kernel maps both at once. */
+    gsize cq_map_len; /**< Length of cq_map. */
+    gsize sqes_len; /**< Length of sqes. */
+
+    guint queued; /**< Requests queued but not yet submitted. */
+    guint inflight; /**< Requests queued or submitted, not completed. */
+};
+
+/**
+ * Read request of a file chunk, re-submitted on short reads.
+ */
+struct file_io_chunk {
+    guchar *buf; /**< Buffer of FILE_IO_CHUNK bytes. */
+    off_t offset; /**< Offset of chunk in file. */
+    gsize len; /**< Bytes requested. */
+    gsize got; /**< Bytes read so far. */
+    gboolean done; /**< Set when read completed. */
+};
+
+static struct file_io_ring *file_io_ring_get (void);
+static struct file_io_ring *file_io_ring_new (void);
+static void file_io_ring_free (struct file_io_ring *ring);
+static gboolean file_io_ring_probe (struct file_io_ring *ring);
+static struct io_uring_sqe *file_io_ring_sqe (struct file_io_ring *ring);
+static void file_io_ring_push (struct file_io_ring *ring);
+static void file_io_ring_enter (struct file_io_ring *ring, guint wait);
+static gboolean file_io_ring_complete (struct file_io_ring *ring,
+                                       guint64 *user_data, gint *res);
+
+static void file_io_statat_uring (struct file_io_ring *ring, int dir_fd,
+                                  struct file_io_stat *st, guint n);
+static void file_io_stat_fill (struct file_io_stat *st,
+                               const struct statx *stx);
+static gboolean file_io_read_uring (struct file_io_ring *ring,
+                                    const gchar *path,
+                                    gboolean (*chunk)(gpointer,
+                                                      const guchar*, gsize),
+                                    gpointer chunk_data);
+static void file_io_read_submit (struct file_io_ring *ring, int fd,
+                                 struct file_io_chunk *chunks, guint index);
+
+/** Set while io_uring is to be used, cleared if it is unavailable. */
+static gint file_io_use_uring = FALSE;
+/** Ring of the calling thread, freed on thread exit. */
+static GPrivate file_io_ring_key =
+    G_PRIVATE_INIT ((GDestroyNotify) &file_io_ring_free);
+#endif /* FILE_IO_URING */
+
+static void file_io_statat_plain (int dir_fd, struct file_io_stat *st);
+static gboolean file_io_read_fd (int fd,
+                                 gboolean (*chunk)(gpointer, const guchar*,
+                                                   gsize),
+                                 gpointer chunk_data);
+
+/**
+ * Selects I/O engine, called once before any I/O is done.
+ *
+ * @param uring TRUE to use io_uring where available, FALSE to use plain
+ *              system calls.
+ */
+void
+file_io_init (gboolean uring)
+{
+#ifdef FILE_IO_URING
+    g_atomic_int_set (&file_io_use_uring, uring);
+#endif /* FILE_IO_URING */
+}
+
+/**
+ * Stats names relative to directory, following symlinks. With io_uring
+ * up to FILE_IO_ENTRIES requests are kept in flight.
+ *
+ * @param dir_fd Directory file descriptor.
+ * @param st Array of n stat requests, name must be set.
+ * @param n Number of requests.
+ */
+void
+file_io_statat (int dir_fd, struct file_io_stat *st, guint n)
+{
+    guint i;
+#ifdef FILE_IO_URING
+    struct file_io_ring *ring;
+#endif /* FILE_IO_URING */
+
+    for (i = 0; i < n; i++) {
+        st[i].ok = FALSE;
+        st[i].mode = 0;
+        st[i].size = -1;
+        st[i].mtime = -1;
+        st[i].dev = 0;
+        st[i].ino = 0;
+    }
+
+#ifdef FILE_IO_URING
+    ring = file_io_ring_get ();
+    if (ring) {
+        file_io_statat_uring (ring, dir_fd, st, n);
+        return;
+    }
+#endif /* FILE_IO_URING */
+
+    for (i = 0; i < n; i++) {
+        file_io_statat_plain (dir_fd, &st[i]);
+    }
+}
+
+/**
+ * Reads all of file, passing the data in order to chunk. With io_uring
+ * the file is opened and stat'ed in one batch and up to FILE_IO_DEPTH
+ * reads are kept in flight.
+ *
+ * @param path Path to file to read.
+ * @param chunk Called with data as it is read, return FALSE to stop.
+ * @param chunk_data Data passed to chunk.
+ * @return TRUE if all of file was read and passed, else FALSE.
+ */
+gboolean
+file_io_read (const gchar *path,
+              gboolean (*chunk)(gpointer, const guchar*, gsize),
+              gpointer chunk_data)
+{
+    int fd;
+#ifdef FILE_IO_URING
+    struct file_io_ring *ring;
+#endif /* FILE_IO_URING */
+
+    g_assert (path);
+    g_assert (chunk);
+
+#ifdef FILE_IO_URING
+    ring = file_io_ring_get ();
+    if (ring) {
+        return file_io_read_uring (ring, path, chunk, chunk_data);
+    }
+#endif /* FILE_IO_URING */
+
+    fd = g_open (path, O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1) {
+        return FALSE;
+    }
+
+    return file_io_read_fd (fd, chunk, chunk_data);
+}
+
+/**
+ * Stats name relative to directory with plain system calls.
+ *
+ * @param dir_fd Directory file descriptor.
+ * @param st Stat request.
+ */
+void
+file_io_statat_plain (int dir_fd, struct file_io_stat *st)
+{
+#ifdef STATX_TYPE
+    struct statx stx;
+
+    if (! statx (dir_fd, st->name, AT_NO_AUTOMOUNT,
+                 STATX_TYPE | STATX_SIZE | STATX_MTIME | STATX_INO, &stx)) {
+        st->ok = TRUE;
+        st->mode = stx.stx_mode;
+        st->dev = makedev (stx.stx_dev_major, stx.stx_dev_minor);
+        st->ino = stx.stx_ino;
+        if (stx.stx_mask & STATX_SIZE) {
+            st->size = stx.stx_size;
+        }
+        if (stx.stx_mask & STATX_MTIME) {
+            st->mtime = stx.stx_mtime.tv_sec;
+        }
+    }
+#else /* ! STATX_TYPE */
+    struct stat buf;
+
+    if (! fstatat (dir_fd, st->name, &buf, 0)) {
+        st->ok = TRUE;
+        st->mode = buf.st_mode;
+        st->dev = buf.st_dev;
+        st->ino = buf.st_ino;
+        st->size = buf.st_size;
+        st->mtime = buf.st_mtime;
+    }
+#endif /* STATX_TYPE */
+}
+
+/**
+ * Reads from file descriptor until end of file with plain system calls.
+ *
+ * @param fd File descriptor to read from, closed when done.
+ * @param chunk Called with data as it is read, return FALSE to stop.
+ * @param chunk_data Data passed to chunk.
+ * @return TRUE if all of file was read and passed, else FALSE.
+ */
+gboolean
+file_io_read_fd (int fd, gboolean (*chunk)(gpointer, const guchar*, gsize),
+                 gpointer chunk_data)
+{
+    ssize_t len;
+    guchar *buf;
+    gboolean status = TRUE;
+
+    buf = g_malloc (FILE_IO_CHUNK);
+    while (status && (len = read (fd, buf, FILE_IO_CHUNK)) != 0) {
+        if (len == -1) {
+            status = (errno == EINTR);
+        } else {
+            status = chunk (chunk_data, buf, len);
+        }
+    }
+    g_free (buf);
+    close (fd);
+
+    return status;
+}
+
+#ifdef FILE_IO_URING
+/**
+ * Returns ring of the calling thread, creating it on first use.
+ *
+ * @return Pointer to struct file_io_ring, NULL if io_uring is not used.
+ */
+struct file_io_ring*
+file_io_ring_get (void)
+{
+    struct file_io_ring *ring;
+
+    ring = g_private_get (&file_io_ring_key);
+    if (! ring && g_atomic_int_get (&file_io_use_uring)) {
+        ring = file_io_ring_new ();
+        if (ring) {
+            g_private_set (&file_io_ring_key, ring);
+        } else {
+            /* Not supported by kernel or denied, do not try again. */
+            g_atomic_int_set (&file_io_use_uring, FALSE);
+        }
+    }
+
+    return ring;
+}
+
+/**
+ * Creates and maps ring of FILE_IO_ENTRIES entries.
+ *
+ * @return Pointer to struct file_io_ring, NULL if io_uring is not
+ *         available or lacks the needed operations.
+ */
+struct file_io_ring*
+file_io_ring_new (void)
+{
+    int fd;
+    struct io_uring_params p;
+    struct file_io_ring *ring;
+
+    memset (&p, 0, sizeof (p));
+    fd = syscall (SYS_io_uring_setup, FILE_IO_ENTRIES, &p);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    ring = g_malloc0 (sizeof (struct file_io_ring));
+    ring->fd = fd;
+
+    ring->sq_map_len = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+    ring->cq_map_len = p.cq_off.cqes
+        + p.cq_entries * sizeof (struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->sq_map_len = ring->cq_map_len =
+            MAX (ring->sq_map_len, ring->cq_map_len);
+    }
+    ring->sqes_len = p.sq_entries * sizeof (struct io_uring_sqe);
+
+    ring->sq_map = mmap (NULL, ring->sq_map_len, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) {
+        ring->sq_map = NULL;
+        file_io_ring_free (ring);
+        return NULL;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_map = ring->sq_map;
+    } else {
+        ring->cq_map = mmap (NULL, ring->cq_map_len, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, fd,
+                             IORING_OFF_CQ_RING);
+        if (ring->cq_map == MAP_FAILED) {
+            ring->cq_map = NULL;
+            file_io_ring_free (ring);
+            return NULL;
+        }
+    }
+
+    ring->sqes = mmap (NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        file_io_ring_free (ring);
+        return NULL;
+    }
+
+    ring->sq_head = (unsigned*) ((gchar*) ring->sq_map + p.sq_off.head);
+    ring->sq_tail = (unsigned*) ((gchar*) ring->sq_map + p.sq_off.tail);
+    ring->sq_mask = (unsigned*) ((gchar*) ring->sq_map + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned*) ((gchar*) ring->sq_map + p.sq_off.array);
+    ring->cq_head = (unsigned*) ((gchar*) ring->cq_map + p.cq_off.head);
+    ring->cq_tail = (unsigned*) ((gchar*) ring->cq_map + p.cq_off.tail);
+    ring->cq_mask = (unsigned*) ((gchar*) ring->cq_map + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) ((gchar*) ring->cq_map
+                                         + p.cq_off.cqes);
+
+    if (! file_io_ring_probe (ring)) {
+        file_io_ring_free (ring);
+        return NULL;
+    }
+
+    return ring;
+}
+
+/**
+ * Unmaps and closes ring.
+ *
+ * @param ring struct file_io_ring to free.
+ */
+void
+file_io_ring_free (struct file_io_ring *ring)
+{
+    if (ring->sqes) {
+        munmap (ring->sqes, ring->sqes_len);
+    }
+    if (ring->cq_map && ring->cq_map != ring->sq_map) {
+        munmap (ring->cq_map, ring->cq_map_len);
+    }
+    if (ring->sq_map) {
+        munmap (ring->sq_map, ring->sq_map_len);
+    }
+    close (ring->fd);
+    g_free (ring);
+}
+
+/**
+ * Checks that the kernel supports the operations used.
+ *
+ * @param ring struct file_io_ring to probe.
+ * @return TRUE if statx, openat and read are supported.
+ */
+gboolean
+file_io_ring_probe (struct file_io_ring *ring)
+{
+    guint i;
+    gboolean status;
+    struct io_uring_probe *probe;
+    static const guint ops[] = { IORING_OP_STATX, IORING_OP_OPENAT,
+                                 IORING_OP_READ };
+
+    probe = g_malloc0 (sizeof (struct io_uring_probe)
+                       + 256 * sizeof (struct io_uring_probe_op));
+    status = ! syscall (SYS_io_uring_register, ring->fd,
+                        IORING_REGISTER_PROBE, probe, 256);
+    for (i = 0; status && i < G_N_ELEMENTS (ops); i++) {
+        status = (ops[i] <= probe->last_op)
+            && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    g_free (probe);
+
+    return status;
+}
+
+/**
+ * Returns cleared submission queue entry to fill in, callers keep at
+ * most FILE_IO_ENTRIES requests in flight so there is always room.
+ *
+ * @param ring struct file_io_ring to get entry from.
+ * @return Pointer to struct io_uring_sqe, queued by file_io_ring_push.
+ */
+struct io_uring_sqe*
+file_io_ring_sqe (struct file_io_ring *ring)
+{
+    unsigned idx = *ring->sq_tail & *ring->sq_mask;
+
+    g_assert (ring->inflight < FILE_IO_ENTRIES);
+
+    memset (&ring->sqes[idx], 0, sizeof (struct io_uring_sqe));
+    ring->sq_array[idx] = idx;
+
+    return &ring->sqes[idx];
+}
+
+/**
+ * Queues entry returned by file_io_ring_sqe, it is submitted on the next
+ * wait for completion.
+ *
+ * @param ring struct file_io_ring to queue on.
+ */
+void
+file_io_ring_push (struct file_io_ring *ring)
+{
+    __atomic_store_n (ring->sq_tail, *ring->sq_tail + 1, __ATOMIC_RELEASE);
+    ring->queued++;
+    ring->inflight++;
+}
+
+/**
+ * Submits queued requests and waits for completions.
+ *
+ * @param ring struct file_io_ring to submit on.
+ * @param wait Number of completions to wait for.
+ */
+void
+file_io_ring_enter (struct file_io_ring *ring, guint wait)
+{
+    long ret;
+
+    do {
+        ret = syscall (SYS_io_uring_enter, ring->fd, ring->queued, wait,
+                       wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (ret > 0) {
+            ring->queued -= ret;
+        }
+    } while (ret == -1
+             && (errno == EINTR || errno == EAGAIN || errno == EBUSY));
+
+    /* Requests are in flight and reference caller memory, there is no
+       way to recover without their completions. */
+    if (ret == -1) {
+        g_error ("io_uring_enter failed: %s", g_strerror (errno));
+    }
+}
+
+/**
+ * Takes next completion, submitting queued requests and waiting if none
+ * is available.
+ *
+ * @param ring struct file_io_ring to take completion from.
+ * @param user_data Set to user_data of completed request.
+ * @param res Set to result of completed request.
+ * @return TRUE if a completion was taken, FALSE if nothing is in flight.
+ */
+gboolean
+file_io_ring_complete (struct file_io_ring *ring, guint64 *user_data,
+                       gint *res)
+{
+    unsigned head;
+    struct io_uring_cqe *cqe;
+
+    if (ring->inflight == 0) {
+        return FALSE;
+    }
+
+    head = *ring->cq_head;
+    while (head == __atomic_load_n (ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        file_io_ring_enter (ring, 1);
+    }
+
+    cqe = &ring->cqes[head & *ring->cq_mask];
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n (ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    ring->inflight--;
+
+    return TRUE;
+}
+
+/**
+ * Stats names through io_uring, every request has a statx buffer slot
+ * that is reused once completed.
+ *
+ * @see file_io_statat
+ */
+void
+file_io_statat_uring (struct file_io_ring *ring, int dir_fd,
+                      struct file_io_stat *st, guint n)
+{
+    gint res;
+    guint i = 0, slot, slots_free;
+    guint slots[FILE_IO_ENTRIES];
+    guint64 user_data;
+    struct statx *stx;
+    struct io_uring_sqe *sqe;
+
+    stx = g_malloc (sizeof (struct statx) * FILE_IO_ENTRIES);
+    for (slots_free = 0; slots_free < FILE_IO_ENTRIES; slots_free++) {
+        slots[slots_free] = slots_free;
+    }
+
+    do {
+        /* Queue into free slots, all are submitted at once when waiting
+           for the first completion. */
+        while (i < n && slots_free > 0) {
+            slot = slots[--slots_free];
+
+            sqe = file_io_ring_sqe (ring);
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = dir_fd;
+            sqe->addr = (guint64) (guintptr) st[i].name;
+            sqe->len = STATX_TYPE | STATX_SIZE | STATX_MTIME | STATX_INO;
+            sqe->off = (guint64) (guintptr) &stx[slot];
+            sqe->statx_flags = AT_NO_AUTOMOUNT;
+            sqe->user_data = ((guint64) slot << 32) | i;
+            file_io_ring_push (ring);
+            i++;
+        }
+
+        if (! file_io_ring_complete (ring, &user_data, &res)) {
+            break;
+        }
+
+        slot = user_data >> 32;
+        if (res == 0) {
+            file_io_stat_fill (&st[user_data & G_MAXUINT32], &stx[slot]);
+        }
+        slots[slots_free++] = slot;
+    } while (i < n || ring->inflight > 0);
+
+    g_free (stx);
+}
+
+/**
+ * Fills in stat request from statx result.
+ *
+ * @param st Stat request to fill in.
+ * @param stx Result of statx.
+ */
+void
+file_io_stat_fill (struct file_io_stat *st, const struct statx *stx)
+{
+    st->ok = TRUE;
+    st->mode = stx->stx_mode;
+    st->dev = makedev (stx->stx_dev_major, stx->stx_dev_minor);
+    st->ino = stx->stx_ino;
+    if (stx->stx_mask & STATX_SIZE) {
+        st->size = stx->stx_size;
+    }
+    if (stx->stx_mask & STATX_MTIME) {
+        st->mtime = stx->stx_mtime.tv_sec;
+    }
+}
+
+/**
+ * Reads file through io_uring. Open and statx are submitted together,
+ * the size then decides how many reads to submit. Reads complete in any
+ * order but are passed on in file order.
+ *
+ * @see file_io_read
+ */
+gboolean
+file_io_read_uring (struct file_io_ring *ring, const gchar *path,
+                    gboolean (*chunk)(gpointer, const guchar*, gsize),
+                    gpointer chunk_data)
+{
+    int fd = -1;
+    gint res;
+    guint i, count, next = 0, pass = 0;
+    guint64 user_data;
+    gboolean status = TRUE, stat_ok = FALSE;
+    struct statx stx;
+    struct io_uring_sqe *sqe;
+    struct file_io_chunk chunks[FILE_IO_DEPTH], *c;
+
+    /* Open and stat in one submission */
+    sqe = file_io_ring_sqe (ring);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (guint64) (guintptr) path;
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    sqe->user_data = 0;
+    file_io_ring_push (ring);
+
+    sqe = file_io_ring_sqe (ring);
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (guint64) (guintptr) path;
+    sqe->len = STATX_TYPE | STATX_SIZE;
+    sqe->off = (guint64) (guintptr) &stx;
+    sqe->user_data = 1;
+    file_io_ring_push (ring);
+
+    while (file_io_ring_complete (ring, &user_data, &res)) {
+        if (user_data == 0) {
+            fd = res;
+        } else {
+            stat_ok = (res == 0) && S_ISREG (stx.stx_mode)
+                && (stx.stx_mask & STATX_SIZE);
+        }
+    }
+
+    if (fd < 0) {
+        return FALSE;
+    }
+
+    /* Size not known, read until end of file instead. */
+    if (! stat_ok) {
+        return file_io_read_fd (fd, chunk, chunk_data);
+    }
+
+    count = (stx.stx_size + FILE_IO_CHUNK - 1) / FILE_IO_CHUNK;
+    for (i = 0; i < FILE_IO_DEPTH; i++) {
+        chunks[i].buf = (i < count) ? g_malloc (FILE_IO_CHUNK) : NULL;
+    }
+
+    while (status && pass < count) {
+        /* Keep FILE_IO_DEPTH reads ahead of the data passed on */
+        while ((next < count) && (next - pass < FILE_IO_DEPTH)) {
+            c = &chunks[next % FILE_IO_DEPTH];
+            c->offset = (off_t) next * FILE_IO_CHUNK;
+            c->len = MIN (FILE_IO_CHUNK, stx.stx_size - c->offset);
+            c->got = 0;
+            c->done = FALSE;
+            file_io_read_submit (ring, fd, chunks, next);
+            next++;
+        }
+
+        file_io_ring_complete (ring, &user_data, &res);
+        c = &chunks[user_data % FILE_IO_DEPTH];
+        if (res > 0) {
+            c->got += res;
+            if (c->got < c->len) {
+                file_io_read_submit (ring, fd, chunks, user_data);
+            } else {
+                c->done = TRUE;
+            }
+        } else if (res == 0) {
+            /* File shrunk, short chunk ends it. */
+            c->done = TRUE;
+        } else if ((res == -EINTR) || (res == -EAGAIN)) {
+            file_io_read_submit (ring, fd, chunks, user_data);
+        } else {
+            status = FALSE;
+        }
+
+        /* Pass on completed chunks in order */
+        while (status && (pass < next)
+               && chunks[pass % FILE_IO_DEPTH].done) {
+            c = &chunks[pass % FILE_IO_DEPTH];
+            if (c->got > 0) {
+                status = chunk (chunk_data, c->buf, c->got);
+            }
+            pass = (c->got < c->len) ? count : pass + 1;
+        }
+    }
+
+    /* Reads still in flight on error or end write into the buffers. */
+    while (file_io_ring_complete (ring, &user_data, &res))
+        ;
+
+    for (i = 0; i < FILE_IO_DEPTH; i++) {
+        g_free (chunks[i].buf);
+    }
+    close (fd);
+
+    return status;
+}
+
+/**
+ * Queues read of the remaining part of a chunk.
+ *
+ * @param ring struct file_io_ring to queue on.
+ * @param fd File descriptor to read from.
+ * @param chunks Chunk buffers, FILE_IO_DEPTH entries.
+ * @param index Index of chunk in file.
+ */
+void
+file_io_read_submit (struct file_io_ring *ring, int fd,
+                     struct file_io_chunk *chunks, guint index)
+{
+    struct io_uring_sqe *sqe;
+    struct file_io_chunk *c = &chunks[index % FILE_IO_DEPTH];
+
+    sqe = file_io_ring_sqe (ring);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (guint64) (guintptr) (c->buf + c->got);
+    sqe->len = c->len - c->got;
+    sqe->off = c->offset + c->got;
+    sqe->user_data = index;
+    file_io_ring_push (ring);
+}
+#endif /* FILE_IO_URING */
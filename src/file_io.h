@@ -0,0 +1,70 @@
+/*
+ * Copyright © 2006-2009 Claes Nästén <me@pekdon.net>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Batched file I/O, statx, openat and read requests are submitted
+ * through io_uring where available with plain system calls as fallback.
+ */
+
+#ifndef _FILE_IO_H_
+#define _FILE_IO_H_
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <glib.h>
+
+#include <sys/types.h>
+
+/** Number of submission queue entries in the ring of each thread. */
+#define FILE_IO_ENTRIES 64
+/** Size of each read request. */
+#define FILE_IO_CHUNK 131072
+/** Number of read requests kept in flight for a single file. */
+#define FILE_IO_DEPTH 8
+
+/**
+ * Stat request, result of statting name relative to a directory.
+ */
+struct file_io_stat {
+    const gchar *name; /**< Name relative to directory, symlinks are
+                            followed. */
+    gboolean ok; /**< TRUE if stat succeeded. */
+    mode_t mode; /**< File type and mode. */
+    off_t size; /**< Size of file, -1 if not known. */
+    time_t mtime; /**< Mtime of file, -1 if not known. */
+    guint64 dev; /**< Device file is on. */
+    guint64 ino; /**< Inode of file. */
+};
+
+extern void file_io_init (gboolean uring);
+
+extern void file_io_statat (int dir_fd, struct file_io_stat *st, guint n);
+extern gboolean file_io_read (const gchar *path,
+                              gboolean (*chunk)(gpointer, const guchar*,
+                                                gsize),
+                              gpointer chunk_data);
+
+#endif /* _FILE_IO_H_ */
@@ -35,24 +35,62 @@
 #include <glib/gstdio.h>
 
 #include <sys/types.h>
-#include <sys/wait.h>
 #include <unistd.h>
 #include <string.h>
 #include <libgen.h>
+#include <errno.h>
+#include <poll.h>
 
+#include "file_budget.h"
+#include "file_io.h"
 #include "file_multi.h"
+#include "file_net.h"
+#include "file_sniff.h"
+#include "file_url.h"
 #include "util.h"
 
 #define BUF_STDIN 8192
-#define BUF_SAVE 8192
+#define FILE_MULTI_STDIN_POLL 100 /**< Milliseconds between checks of the
+                                       stop flag while stdin is idle. */
+#define FILE_MULTI_FRAME_SIG_PNG "\x89PNG\r\n\x1a\n"
 
-#define WGET_CHECK_INTERVAL 50000
-#define WGET_DIE_SIGNAL 9
-#define WGET_KILL_SIGNAL 15
-#define WGET_KILL_WAIT 500000
-#define WGET_SPAWN_FLAGS G_SPAWN_DO_NOT_REAP_CHILD|G_SPAWN_SEARCH_PATH|G_SPAWN_STDOUT_TO_DEV_NULL|G_SPAWN_STDERR_TO_DEV_NULL
+/**
+ * Fetch in progress, data is collected in memory.
+ */
+struct file_multi_fetch_data {
+    GByteArray *buf; /**< Data received so far. */
+    gboolean (*chunk)(gpointer, const guchar*, gsize); /**< Called with
+                                                            data received,
+                                                            NULL if none. */
+    gpointer chunk_data; /**< Data passed to chunk. */
+};
+
+/**
+ * Read in progress, data is passed on until stopped.
+ */
+struct file_multi_read_data {
+    gboolean (*chunk)(gpointer, const guchar*, gsize); /**< Called with
+                                                            data read. */
+    gpointer chunk_data; /**< Data passed to chunk. */
+    gboolean *stop; /**< Pointer to stop flag. */
+};
+
+/**
+ * Frame being split from standard input, scanning resumes where it
+ * stopped as more data is read.
+ */
+struct file_multi_frame {
+    gsize pos; /**< Offset of the next PNG chunk or JPEG marker. */
+    gboolean entropy; /**< JPEG scan data is being skipped from pos. */
+    gboolean open; /**< Not a PNG or JPEG, the frame lasts until end of
+                        input. */
+};
 
 static void file_multi_free_strings (struct file_multi *fm);
+static gboolean file_multi_save_write (gpointer data, const guchar *buf,
+                                       gsize len);
+static gboolean file_multi_read_chunk (gpointer data, const guchar *buf,
+                                       gsize len);
 
 static guint file_multi_get_method (const gchar *path);
 static gchar *file_multi_create_name (const gchar *path, guint method);
@@ -63,14 +101,36 @@ static gchar *file_multi_create_uri (const gchar *path, guint method);
 static gchar *file_multi_create_tmpname (void);
 
 static gboolean file_multi_fetch_stdin (struct file_multi *fm,
-                                        gboolean *stop);
-static gboolean file_multi_fetch_http (struct file_multi *fm,
-                                       gboolean *stop);
-static gboolean file_multi_fetch_ftp (struct file_multi *fm,
-                                      gboolean *stop);
-
-static gboolean file_multi_fetch_wget (struct file_multi *fm,
-                                       gboolean *stop);
+                                        gboolean (*chunk)(gpointer,
+                                                          const guchar*,
+                                                          gsize),
+                                        gpointer chunk_data, gboolean *stop);
+static gssize file_multi_stdin_read (guchar *buf, gsize len,
+                                     gboolean *stop);
+static gsize file_multi_frame_end (struct file_multi_frame *frame,
+                                   const guchar *buf, gsize len);
+static gboolean file_multi_fetch_net (struct file_multi *fm,
+                                      gboolean (*chunk)(gpointer,
+                                                        const guchar*, gsize),
+                                      gpointer chunk_data, gboolean *stop);
+static gboolean file_multi_fetch_write (gpointer data, const guchar *buf,
+                                        gsize len);
+static gboolean file_multi_fetch_data (struct file_multi *fm,
+                                       gboolean (*chunk)(gpointer,
+                                                         const guchar*,
+                                                         gsize),
+                                       gpointer chunk_data);
+
+/** Lock for data and path_tmp, fetched files are stored to disk while
+    read from other threads. */
+static GMutex data_mutex;
+
+/** Data read from stdin past the end of the last frame, NULL if none.
+    Frames are fetched one after the other, the next frame is only
+    fetched once the last one is. */
+static GByteArray *stdin_rest = NULL;
+/** End of stdin reached. */
+static gboolean stdin_eof = FALSE;
 
 /**
  * Open and create new struct file_multi.
@@ -90,14 +150,29 @@ file_multi_open (const gchar *path)
     fm->ext = NULL;
     fm->uri = NULL;
     fm->dir = NULL;
-    fm->path = g_strdup (path);
+    fm->path = NULL;
     fm->path_tmp = NULL;
+    fm->data = NULL;
+    fm->size = -1;
     fm->mtime = -1;
+    fm->etag = NULL;
+    fm->type = FILE_SNIFF_UNCHECKED;
     fm->method = FILE_MULTI_METHOD_PLAIN;
     fm->need_fetch = FALSE;
-
-    /* Identify method to fetch file with (if needed) */
-    fm->method = file_multi_get_method (fm->path);
+    fm->validate = FALSE;
+    fm->deferred = FILE_MULTI_DEFERRED_NONE;
+    fm->depth = 0;
+
+    /* Identify method to fetch file with (if needed), remote files are
+       identified by their canonical URL. */
+    fm->method = file_multi_get_method (path);
+    if ((fm->method == FILE_MULTI_METHOD_HTTP)
+        || (fm->method == FILE_MULTI_METHOD_FTP)) {
+        fm->path = file_url_canonical (path);
+    }
+    if (! fm->path) {
+        fm->path = g_strdup (path);
+    }
     if (fm->method != FILE_MULTI_METHOD_PLAIN) {
         fm->need_fetch = TRUE;
     }
@@ -118,24 +193,38 @@ file_multi_close (struct file_multi *fm)
     file_multi_free_strings (fm);
     file_multi_close_tmp (fm);
 
+    g_free (fm->etag);
     g_free (fm);
 }
 
 /**
- * Clean up temporary file if any.
+ * Clean up temporary file and fetched data if any.
  *
  * @param fm Pointer to struct file_multi
  */
 void
 file_multi_close_tmp (struct file_multi *fm)
 {
+    gchar *path_tmp;
+    GBytes *data;
+
     g_assert (fm);
 
+    g_mutex_lock (&data_mutex);
+    path_tmp = fm->path_tmp;
+    data = fm->data;
+    fm->path_tmp = NULL;
+    fm->data = NULL;
+    g_mutex_unlock (&data_mutex);
+
     /* Clean up temporary file if any. */
-    if (fm->path_tmp) {
-        g_unlink (fm->path_tmp);
-        g_free (fm->path_tmp);
-        fm->path_tmp = NULL;
+    if (path_tmp) {
+        g_unlink (path_tmp);
+        g_free (path_tmp);
+    }
+    if (data) {
+        file_budget_release (FILE_BUDGET_FETCH, g_bytes_get_size (data));
+        g_bytes_unref (data);
     }
 }
 
@@ -170,7 +259,8 @@ file_multi_free_strings (struct file_multi *fm)
 }
 
 /**
- * Save file (or temporary file) to path.
+ * Save file (or fetched data) to path, fetched files are only written
+ * to disk when saved.
  *
  * @param fm struct file_multi to save.
  * @param path Path to save file to.
@@ -179,36 +269,173 @@ file_multi_free_strings (struct file_multi *fm)
 gboolean
 file_multi_save (struct file_multi *fm, const gchar *path)
 {
-    gchar buf[BUF_SAVE];
-    size_t buf_read;
-    FILE *in, *out;
-
-    /* Open input file */
-    in = g_fopen (file_multi_get_path (fm), "rb");
-    if (! in) {
-        g_log (G_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
-               "Failed to open %s for reading.", file_multi_get_path (fm));
-        return FALSE;
-    }
+    gboolean status;
+    FILE *out;
 
     /* Create output file */
     out = g_fopen (path, "wb");
     if (! out) {
-        fclose (in);
-
         g_log (G_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
                "Failed to open %s for writing.", path);
         return FALSE;
     }
 
-    /* Copy in to out */
-    while ((buf_read = fread (buf, sizeof (gchar), BUF_SAVE, in)) > 0) {
-        fwrite (buf, sizeof (gchar), buf_read, out);
+    /* Copy file to out */
+    status = file_multi_read (fm, &file_multi_save_write, out, NULL);
+    if (! status) {
+        g_log (G_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
+               "Failed to read %s.", file_multi_get_path (fm));
     }
 
     /* Close output */
-    fclose (in);
-    fclose (out);
+    if (fclose (out)) {
+        status = FALSE;
+    }
+
+    return status;
+}
+
+/**
+ * Writes data read from file to output file.
+ *
+ * @param data FILE to write to.
+ * @param buf Data read.
+ * @param len Length of data.
+ * @return TRUE to continue reading, FALSE if writing failed.
+ */
+gboolean
+file_multi_save_write (gpointer data, const guchar *buf, gsize len)
+{
+    return fwrite (buf, 1, len, (FILE*) data) == len;
+}
+
+/**
+ * Reads all of file, passing the data in order to chunk. Fetched data
+ * kept in memory is passed in pieces of FILE_IO_CHUNK bytes like data
+ * read from disk, remote files not fetched are read from the network
+ * without keeping the data. The stop flag is checked between pieces so
+ * that abandoned reads, and the decoding done in chunk, end early.
+ *
+ * @param fm struct file_multi to read.
+ * @param chunk Called with data as it is read, return FALSE to stop.
+ * @param chunk_data Data passed to chunk.
+ * @param stop Pointer to stop flag, NULL if the read is never stopped.
+ * @return TRUE if all of file was read and passed, else FALSE.
+ */
+gboolean
+file_multi_read (struct file_multi *fm,
+                 gboolean (*chunk)(gpointer, const guchar*, gsize),
+                 gpointer chunk_data, gboolean *stop)
+{
+    gboolean status, remote, stop_never = FALSE;
+    gchar *path;
+    gsize off, size;
+    GBytes *data;
+    const guchar *buf;
+    struct file_multi_read_data reader = {chunk, chunk_data,
+                                          stop ? stop : &stop_never};
+
+    g_assert (fm);
+
+    g_mutex_lock (&data_mutex);
+    data = fm->data ? g_bytes_ref (fm->data) : NULL;
+    path = g_strdup (fm->path_tmp ? fm->path_tmp : fm->path);
+    remote = ! data && ! fm->path_tmp
+        && ((fm->method == FILE_MULTI_METHOD_HTTP)
+            || (fm->method == FILE_MULTI_METHOD_FTP));
+    g_mutex_unlock (&data_mutex);
+
+    if (data) {
+        buf = g_bytes_get_data (data, &size);
+        status = TRUE;
+        for (off = 0; status && (off < size); off += FILE_IO_CHUNK) {
+            status = file_multi_read_chunk (&reader, buf + off,
+                                            MIN (size - off, FILE_IO_CHUNK));
+        }
+        g_bytes_unref (data);
+    } else if (remote) {
+        status = file_net_fetch (path, chunk, chunk_data, NULL, reader.stop);
+    } else {
+        status = file_io_read (path, &file_multi_read_chunk, &reader);
+    }
+    g_free (path);
+
+    return status;
+}
+
+/**
+ * Passes data read on unless stopped.
+ *
+ * @param data Pointer to struct file_multi_read_data.
+ * @param buf Data read.
+ * @param len Length of data.
+ * @return TRUE to continue reading, FALSE if stopped or chunk failed.
+ */
+gboolean
+file_multi_read_chunk (gpointer data, const guchar *buf, gsize len)
+{
+    struct file_multi_read_data *reader = (struct file_multi_read_data*) data;
+
+    return ! *reader->stop && reader->chunk (reader->chunk_data, buf, len);
+}
+
+/**
+ * Stores fetched data kept in memory to a temporary file, frees the
+ * memory when reading it again from disk is cheaper than keeping it.
+ *
+ * @param fm struct file_multi to store.
+ * @return TRUE if stored or nothing to store, else FALSE.
+ */
+gboolean
+file_multi_store (struct file_multi *fm)
+{
+    gchar *path_tmp;
+    GBytes *data;
+    GError *err = NULL;
+
+    g_assert (fm);
+
+    data = file_multi_get_data (fm);
+    if (! data) {
+        return TRUE;
+    }
+
+    path_tmp = file_multi_create_tmpname ();
+    if (! path_tmp
+        || ! g_file_set_contents (path_tmp, g_bytes_get_data (data, NULL),
+                                  g_bytes_get_size (data), &err)) {
+        g_warning ("failed to store %s: %s", file_multi_get_uri (fm),
+                   err ? err->message : "no temporary file");
+        if (err) {
+            g_error_free (err);
+        }
+        if (path_tmp) {
+            g_unlink (path_tmp);
+            g_free (path_tmp);
+        }
+        g_bytes_unref (data);
+        return FALSE;
+    }
+
+    /* Readers holding a reference to the data keep it until done. */
+    g_mutex_lock (&data_mutex);
+    if (fm->data == data) {
+        fm->path_tmp = path_tmp;
+        fm->data = NULL;
+        path_tmp = NULL;
+    }
+    g_mutex_unlock (&data_mutex);
+
+    if (path_tmp) {
+        /* Closed while storing */
+        g_unlink (path_tmp);
+        g_free (path_tmp);
+    } else {
+        /* Reference held by fm */
+        file_budget_release (FILE_BUDGET_FETCH, g_bytes_get_size (data));
+        g_bytes_unref (data);
+    }
+    g_bytes_unref (data);
 
     return TRUE;
 }
@@ -283,7 +510,10 @@ file_multi_get_ext (struct file_multi *fm)
     g_assert (fm);
 
     if (! fm->ext) {
-        fm->ext = file_multi_create_ext (fm->path);
+        /* Inline data is named after its type */
+        fm->ext = file_multi_create_ext (fm->method == FILE_MULTI_METHOD_DATA
+                                         ? file_multi_get_name (fm)
+                                         : fm->path);
     }
 
     return fm->ext ? fm->ext : "";
@@ -344,7 +574,106 @@ file_multi_get_path (struct file_multi *fm)
 }
 
 /**
- * Returns the mtime of the file.
+ * Returns content of fetched file kept in memory.
+ *
+ * @param fm Pointer to struct file_multi to get data for.
+ * @return Reference to data, needs unreferencing, NULL if not in memory.
+ */
+GBytes*
+file_multi_get_data (struct file_multi *fm)
+{
+    GBytes *data = NULL;
+
+    g_assert (fm);
+
+    g_mutex_lock (&data_mutex);
+    if (fm->data) {
+        data = g_bytes_ref (fm->data);
+    }
+    g_mutex_unlock (&data_mutex);
+
+    return data;
+}
+
+/**
+ * Returns the type of the file content, detected from the first bytes
+ * of the file on first call.
+ *
+ * @param fm Pointer to struct file_multi to get type for.
+ * @return FILE_SNIFF_ type, FILE_SNIFF_UNCHECKED if not yet fetched.
+ */
+guint
+file_multi_get_type (struct file_multi *fm)
+{
+    GBytes *data;
+
+    g_assert (fm);
+
+    /* Remote files can only be checked once fetched */
+    if ((fm->type == FILE_SNIFF_UNCHECKED)
+        && (! fm->need_fetch || fm->path_tmp)) {
+        data = file_multi_get_data (fm);
+        if (data) {
+            fm->type = file_sniff_data (g_bytes_get_data (data, NULL),
+                                        g_bytes_get_size (data));
+            g_bytes_unref (data);
+        } else {
+            fm->type = file_sniff_path (file_multi_get_path (fm));
+        }
+    }
+
+    return fm->type;
+}
+
+/**
+ * Returns the type of the file content if already known, the file is
+ * not read to check it.
+ *
+ * @param fm Pointer to struct file_multi to get type for.
+ * @return FILE_SNIFF_ type, FILE_SNIFF_UNCHECKED if not yet checked.
+ */
+guint
+file_multi_peek_type (struct file_multi *fm)
+{
+    g_assert (fm);
+
+    return fm->type;
+}
+
+/**
+ * Sets type of the file content, FILE_SNIFF_UNCHECKED makes it checked
+ * again.
+ *
+ * @param fm Pointer to struct file_multi to set type for.
+ * @param type FILE_SNIFF_ type.
+ */
+void
+file_multi_set_type (struct file_multi *fm, guint type)
+{
+    g_assert (fm);
+
+    fm->type = type;
+}
+
+/**
+ * Sets size and mtime of the file when already known, avoids stat'ing
+ * the file again.
+ *
+ * @param fm Pointer to struct file_multi to set size and mtime for.
+ * @param size Size in bytes of file, -1 if not known.
+ * @param mtime Time file was last modified in unix time, -1 if not known.
+ */
+void
+file_multi_set_stat (struct file_multi *fm, off_t size, time_t mtime)
+{
+    g_assert (fm);
+
+    fm->size = size;
+    fm->mtime = mtime;
+}
+
+/**
+ * Returns the size of the file.
  *
  * @param fm Pointer to struct file_multi to get size for.
  * @return Size in bytes of file.
@@ -358,7 +687,7 @@ file_multi_get_size (struct file_multi *fm)
 
     /* size not already set, try get to fetch it */
     if (fm->size == -1) {
-        if (g_stat (file_multi_get_path (fm), &buf)) {
+        if (! g_stat (file_multi_get_path (fm), &buf)) {
             fm->size = buf.st_size;
         }
     }
@@ -369,8 +698,8 @@ file_multi_get_size (struct file_multi *fm)
 /**
  * Returns the mtime of the file.
  *
- * @param fm Pointer to struct file_multi to get size for.
- * @return Time file was last modified in unix time.
+ * @param fm Pointer to struct file_multi to get mtime for.
+ * @return Time file was last modified in unix time, -1 if not known.
  */
 time_t
 file_multi_get_mtime (struct file_multi *fm)
@@ -379,8 +708,11 @@ file_multi_get_mtime (struct file_multi *fm)
 
     g_assert (fm);
 
-    /* mtime not already set, try get to fetch it */
-    if (fm->mtime == -1) {
+    /* mtime not already set, try get to fetch it. Remote files only
+       have the date sent by the server, the temporary file is new. */
+    if ((fm->mtime == -1)
+        && (fm->method != FILE_MULTI_METHOD_HTTP)
+        && (fm->method != FILE_MULTI_METHOD_FTP)) {
         if (! g_stat (file_multi_get_path (fm), &buf)) {
             fm->mtime = buf.st_mtime;
         }
@@ -390,14 +722,55 @@ file_multi_get_mtime (struct file_multi *fm)
 }
 
 /**
- * Fetch file if needed.
+ * Sets validators of remote file seen before, the next fetch only
+ * fetches the file if it changed since. The body is deferred if not.
+ *
+ * @param fm Pointer to struct file_multi to set validators for.
+ * @param etag ETag of file, NULL if none.
+ * @param mtime Last-Modified date in unix time, -1 if none.
+ */
+void
+file_multi_set_validators (struct file_multi *fm, const gchar *etag,
+                           time_t mtime)
+{
+    g_assert (fm);
+
+    g_free (fm->etag);
+    fm->etag = g_strdup (etag);
+    fm->mtime = mtime;
+    fm->validate = (etag != NULL) || (mtime != -1);
+}
+
+/**
+ * Returns the ETag of remote file.
+ *
+ * @param fm Pointer to struct file_multi to get ETag for.
+ * @return ETag, NULL if none or not yet fetched.
+ */
+const gchar*
+file_multi_get_etag (struct file_multi *fm)
+{
+    g_assert (fm);
+
+    return fm->etag;
+}
+
+/**
+ * Fetch file if needed. Remote files are kept in memory, the data is
+ * passed on to chunk as it arrives so it can be used before the fetch
+ * is done.
  *
  * @param fm Pointer to struct file_multi to fetch file for.
+ * @param chunk Called with data as it arrives, return FALSE to stop.
+ *              NULL if not needed.
+ * @param chunk_data Data passed to chunk.
  * @param stop Pointer to stop flag.
  * @return TRUE on success, else FALSE.
  */
 gboolean
-file_multi_fetch (struct file_multi *fm, gboolean *stop)
+file_multi_fetch (struct file_multi *fm,
+                  gboolean (*chunk)(gpointer, const guchar*, gsize),
+                  gpointer chunk_data, gboolean *stop)
 {
     gboolean status;
 
@@ -407,24 +780,17 @@ file_multi_fetch (struct file_multi *fm, gboolean *stop)
         return TRUE;
     }
 
-    /* Get path to temporary file */
-    fm->path_tmp = file_multi_create_tmpname ();
-    if (! fm->path_tmp) {
-        g_warning ("failed to get temporary file for fetching");
-
-        return FALSE;
-    }
-
     /* Fetch based on method */
     switch (fm->method) {
     case FILE_MULTI_METHOD_STDIN:
-        status = file_multi_fetch_stdin (fm, stop);
+        status = file_multi_fetch_stdin (fm, chunk, chunk_data, stop);
         break;
     case FILE_MULTI_METHOD_HTTP:
-        status = file_multi_fetch_http (fm, stop);
-        break;
     case FILE_MULTI_METHOD_FTP:
-        status = file_multi_fetch_ftp (fm, stop);
+        status = file_multi_fetch_net (fm, chunk, chunk_data, stop);
+        break;
+    case FILE_MULTI_METHOD_DATA:
+        status = file_multi_fetch_data (fm, chunk, chunk_data);
         break;
     default:
         /* Unknown method */
@@ -448,6 +814,104 @@ file_multi_need_fetch (struct file_multi *fm)
     return fm->need_fetch;
 }
 
+/**
+ * Returns wheter the body of the file was not fetched as it did not
+ * change since validated.
+ *
+ * @param fm Pointer to struct file_multi to check.
+ * @return TRUE if the body is not fetched, also while loading it.
+ */
+gboolean
+file_multi_is_deferred (struct file_multi *fm)
+{
+    g_assert (fm);
+
+    return g_atomic_int_get (&fm->deferred) != FILE_MULTI_DEFERRED_NONE;
+}
+
+/**
+ * Marks deferred body as being loaded, only the first caller gets to
+ * load it.
+ *
+ * @param fm Pointer to struct file_multi to load.
+ * @return TRUE if the body is to be fetched by the caller, else FALSE.
+ */
+gboolean
+file_multi_load_deferred (struct file_multi *fm)
+{
+    g_assert (fm);
+
+    return g_atomic_int_compare_and_exchange (&fm->deferred,
+                                              FILE_MULTI_DEFERRED_WAITING,
+                                              FILE_MULTI_DEFERRED_LOADING);
+}
+
+/**
+ * Returns the number of links followed to reach the file.
+ *
+ * @param fm Pointer to struct file_multi to get depth for.
+ * @return Depth of file, 0 if given.
+ */
+guint
+file_multi_get_depth (struct file_multi *fm)
+{
+    g_assert (fm);
+
+    return fm->depth;
+}
+
+/**
+ * Sets the number of links followed to reach the file.
+ *
+ * @param fm Pointer to struct file_multi to set depth for.
+ * @param depth Depth of file.
+ */
+void
+file_multi_set_depth (struct file_multi *fm, guint depth)
+{
+    g_assert (fm);
+
+    fm->depth = depth;
+}
+
+/**
+ * Returns wheter the file is read from stdin, it can not be read again
+ * once its data is dropped.
+ *
+ * @param fm Pointer to struct file_multi to check.
+ * @return TRUE if read from stdin, else FALSE.
+ */
+gboolean
+file_multi_is_stream (struct file_multi *fm)
+{
+    g_assert (fm);
+
+    return fm->method == FILE_MULTI_METHOD_STDIN;
+}
+
+/**
+ * Readies fm for fetching the frame following it on stdin, only to be
+ * called once fm is fetched. The data of the last frame is kept until
+ * the next frame replaces it.
+ *
+ * @param fm Pointer to struct file_multi of the last frame fetched.
+ * @return TRUE if a frame follows, FALSE if stdin ended.
+ */
+gboolean
+file_multi_next_frame (struct file_multi *fm)
+{
+    g_assert (fm && (fm->method == FILE_MULTI_METHOD_STDIN));
+
+    if (stdin_eof && (! stdin_rest || ! stdin_rest->len)) {
+        return FALSE;
+    }
+
+    fm->type = FILE_SNIFF_UNCHECKED;
+    fm->need_fetch = TRUE;
+
+    return TRUE;
+}
+
 /**
  * Figures the method needed to fetch the file based on the path.
  *
@@ -462,6 +926,9 @@ file_multi_get_method (const gchar *path)
 
     if ((path[0] == '-') && (path[1] == '\0')) {
         method = FILE_MULTI_METHOD_STDIN;
+    } else if (! g_ascii_strncasecmp (path, "data:", 5)) {
+        /* Checked first, the data can be large */
+        method = FILE_MULTI_METHOD_DATA;
     } else if ((util_stripos (path, "http://") == path)
                || (util_stripos (path, "https://") == path)) {
         method = FILE_MULTI_METHOD_HTTP;
@@ -485,9 +952,18 @@ gchar*
 file_multi_create_name (const gchar *path, guint method)
 {
     gchar *name;
+    gsize len;
 
     if (method == FILE_MULTI_METHOD_STDIN) {
-        name = g_strdup ("stdin");
+        /* Frames after the first are numbered, -#2 is named stdin-2 */
+        name = path[1] ? g_strdup_printf ("stdin-%s", path + 2)
+            : g_strdup ("stdin");
+    } else if (method == FILE_MULTI_METHOD_DATA) {
+        /* data:image/png;base64,... is named inline.png */
+        path = strchr (path, '/');
+        len = path ? strcspn (path + 1, ";,") : 0;
+        name = len ? g_strdup_printf ("inline.%.*s", (gint) len, path + 1)
+            : g_strdup ("inline");
     } else {
         name = g_path_get_basename (path);
     }
@@ -545,7 +1021,7 @@ file_multi_create_uri (const gchar *path, guint method)
 
     if (method == FILE_MULTI_METHOD_STDIN) {
         /* Stdin can not be URIified */
-        uri = g_strdup ("stdin");
+        uri = file_multi_create_name (path, method);
 
     } else if (method == FILE_MULTI_METHOD_PLAIN) {
         /* Standard file, make sure ~ is expanded and path is absolute */
@@ -585,142 +1061,353 @@ file_multi_create_tmpname (void)
         g_free (path);
         return NULL;
     }
+    close (fd);
 
     return path;
 }
 
 /**
- * Fetch stdin, read until end of file and put into tmp file.
+ * Fetch next frame of stdin into memory, data is passed on as it is
+ * read. Concatenated PNG and JPEG images are split into frames, other
+ * input is read until end of file.
  *
  * @param fm Pointer to struct file_multi.
+ * @param chunk Called with data of the frame as it is read, NULL if not
+ *              needed.
+ * @param chunk_data Data passed to chunk.
  * @param stop Pointer to stop flag.
- * @return Always returns TRUE.
+ * @return TRUE on success, FALSE if stopped or no data is left.
  */
 gboolean
-file_multi_fetch_stdin (struct file_multi *fm, gboolean *stop)
+file_multi_fetch_stdin (struct file_multi *fm,
+                        gboolean (*chunk)(gpointer, const guchar*, gsize),
+                        gpointer chunk_data, gboolean *stop)
 {
-    gchar buf[BUF_STDIN];
-    size_t buf_read;
-    FILE *out;
+    guchar buf[BUF_STDIN];
+    gssize buf_read;
+    gsize end, avail, passed = 0;
+    gboolean status = TRUE;
+    GBytes *last;
+    GByteArray *data;
+    struct file_multi_frame frame = {0, FALSE, FALSE};
+
+    /* Continue with data read past the last frame */
+    data = stdin_rest ? stdin_rest : g_byte_array_new ();
+    stdin_rest = NULL;
+
+    for (;;) {
+        end = file_multi_frame_end (&frame, data->data, data->len);
+        if (! end && stdin_eof) {
+            end = data->len;
+        }
 
-    /* Create output file */
-    out = g_fopen (fm->path_tmp, "wb");
-    if (! out) {
-        g_warning ("Unable to write to temporary file %s", fm->path_tmp);
+        /* Pass on data of this frame only */
+        avail = end ? end : data->len;
+        if (avail > passed) {
+            file_budget_charge (FILE_BUDGET_FETCH, avail - passed);
+            status = ! chunk || chunk (chunk_data, data->data + passed,
+                                       avail - passed);
+            passed = avail;
+        }
+        if (end || stdin_eof || ! status) {
+            break;
+        }
 
-        return FALSE;
+        buf_read = file_multi_stdin_read (buf, BUF_STDIN, stop);
+        if (buf_read < 0) {
+            status = FALSE;
+            break;
+        } else if (buf_read == 0) {
+            stdin_eof = TRUE;
+        } else {
+            g_byte_array_append (data, buf, buf_read);
+        }
     }
 
-    /* Read all of stdin and write to out */
-    while ((buf_read = read (0 /* stdin */, buf, BUF_STDIN)) > 0) {
-        fwrite (buf, 1, buf_read, out);
+    /* Keep start of next frame */
+    if (status && (end < data->len)) {
+        stdin_rest = g_byte_array_new ();
+        g_byte_array_append (stdin_rest, data->data + end, data->len - end);
+        g_byte_array_set_size (data, end);
     }
 
-    /* Close file */
-    fclose (out);
+    if (! status || ! data->len) {
+        file_budget_release (FILE_BUDGET_FETCH, passed);
+        g_byte_array_free (data, TRUE);
+        return FALSE;
+    }
+
+    /* Replaces the last frame, shown until now */
+    fm->size = data->len;
+    g_mutex_lock (&data_mutex);
+    last = fm->data;
+    fm->data = g_byte_array_free_to_bytes (data);
+    g_mutex_unlock (&data_mutex);
+    fm->need_fetch = FALSE;
+
+    if (last) {
+        file_budget_release (FILE_BUDGET_FETCH, g_bytes_get_size (last));
+        g_bytes_unref (last);
+    }
 
     return TRUE;
 }
 
 /**
- * Fetch http url pointer to by file_multi to file_tmp.
+ * Reads from stdin, waits for data while checking the stop flag.
  *
- * @param fm Pointer to struct file_multi.
+ * @param buf Buffer to read into.
+ * @param len Size of buf.
  * @param stop Pointer to stop flag.
- * @return TRUE on success, else FALSE.
+ * @return Number of bytes read, 0 at end of file and -1 if stopped or
+ *         failed.
  */
-gboolean
-file_multi_fetch_http (struct file_multi *fm, gboolean *stop)
+gssize
+file_multi_stdin_read (guchar *buf, gsize len, gboolean *stop)
 {
-    return file_multi_fetch_wget (fm, stop);
+    gint ready;
+    gssize buf_read;
+    struct pollfd pfd = {0 /* stdin */, POLLIN, 0};
+
+    while (! *stop) {
+        ready = poll (&pfd, 1, FILE_MULTI_STDIN_POLL);
+        if (ready > 0) {
+            buf_read = read (0 /* stdin */, buf, len);
+            if ((buf_read >= 0) || (errno != EINTR)) {
+                if (buf_read < 0) {
+                    g_warning ("failed to read stdin: %s",
+                               g_strerror (errno));
+                }
+                return buf_read;
+            }
+        } else if ((ready < 0) && (errno != EINTR)) {
+            g_warning ("failed to wait for stdin: %s", g_strerror (errno));
+            return -1;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Finds the end of the frame at the start of buf. PNG images end with
+ * the IEND chunk and JPEG images with the EOI marker after the scans.
+ *
+ * @param frame struct file_multi_frame with the state of the scan.
+ * @param buf Data read of the frame so far.
+ * @param len Length of buf.
+ * @return Length of the frame, 0 if it does not end in buf.
+ */
+gsize
+file_multi_frame_end (struct file_multi_frame *frame, const guchar *buf,
+                      gsize len)
+{
+    guint marker;
+    guint32 chunk_len;
+
+    if (frame->open) {
+        return 0;
+    }
+
+    if (! frame->pos) {
+        /* Check type of frame */
+        if ((len >= 2) && (buf[0] == 0xff) && (buf[1] == 0xd8)) {
+            frame->pos = 2;
+        } else if (len < sizeof (FILE_MULTI_FRAME_SIG_PNG) - 1) {
+            frame->open = (len >= 2) && (buf[0] != 0x89);
+            return 0;
+        } else if (! memcmp (buf, FILE_MULTI_FRAME_SIG_PNG,
+                             sizeof (FILE_MULTI_FRAME_SIG_PNG) - 1)) {
+            frame->pos = sizeof (FILE_MULTI_FRAME_SIG_PNG) - 1;
+        } else {
+            frame->open = TRUE;
+            return 0;
+        }
+    }
+
+    if (buf[0] == 0x89) {
+        /* Length, type, data and CRC of each chunk */
+        while (frame->pos + 8 <= len) {
+            chunk_len = ((guint32) buf[frame->pos] << 24)
+                | (buf[frame->pos + 1] << 16)
+                | (buf[frame->pos + 2] << 8) | buf[frame->pos + 3];
+            if (chunk_len > G_MAXINT32) {
+                frame->open = TRUE;
+                return 0;
+            }
+            if (! memcmp (buf + frame->pos + 4, "IEND", 4)) {
+                return (frame->pos + 12 + chunk_len <= len)
+                    ? frame->pos + 12 + chunk_len : 0;
+            }
+            frame->pos += 12 + (gsize) chunk_len;
+        }
+        return 0;
+    }
+
+    while (frame->pos + 1 < len) {
+        if (frame->entropy) {
+            /* Scan data ends at a marker that is not stuffing, a restart
+               or fill */
+            marker = buf[frame->pos + 1];
+            if ((buf[frame->pos] != 0xff) || (marker == 0x00)
+                || (marker == 0xff)
+                || ((marker >= 0xd0) && (marker <= 0xd7))) {
+                frame->pos++;
+                continue;
+            }
+            frame->entropy = FALSE;
+        }
+
+        marker = buf[frame->pos + 1];
+        if (buf[frame->pos] != 0xff) {
+            frame->open = TRUE;
+            return 0;
+        } else if (marker == 0xd9) {
+            return frame->pos + 2;
+        } else if ((marker == 0xff) || (marker == 0x01)
+                   || ((marker >= 0xd0) && (marker <= 0xd7))) {
+            /* Fill and markers without a segment */
+            frame->pos += (marker == 0xff) ? 1 : 2;
+        } else if (frame->pos + 4 <= len) {
+            frame->pos += 2 + ((buf[frame->pos + 2] << 8)
+                               | buf[frame->pos + 3]);
+            frame->entropy = (marker == 0xda);
+        } else {
+            break;
+        }
+    }
+
+    return 0;
 }
 
 /**
- * Fetch ftp url pointer to by file_multi to file_tmp.
+ * Fetch URL pointed to by file_multi into memory with the built-in
+ * client. Files with validators set are only fetched if changed, the
+ * body is deferred if not.
  *
  * @param fm Pointer to struct file_multi.
+ * @param chunk Called with data as it arrives, NULL if not needed.
+ * @param chunk_data Data passed to chunk.
  * @param stop Pointer to stop flag.
- * @return TRUE on success, else FALSE.
+ * @return TRUE on success or if deferred, else FALSE.
  */
 gboolean
-file_multi_fetch_ftp (struct file_multi *fm, gboolean *stop)
+file_multi_fetch_net (struct file_multi *fm,
+                      gboolean (*chunk)(gpointer, const guchar*, gsize),
+                      gpointer chunk_data, gboolean *stop)
 {
-    return file_multi_fetch_wget (fm, stop);
+    struct file_multi_fetch_data fetch = {g_byte_array_new (),
+                                          chunk, chunk_data};
+    struct file_net_meta meta = {NULL, -1, FALSE};
+
+    /* Validated only once, loading a deferred body fetches it. */
+    if (fm->validate) {
+        meta.etag = g_strdup (fm->etag);
+        meta.last_modified = fm->mtime;
+        fm->validate = FALSE;
+    }
+
+    if (! file_net_fetch (fm->path, &file_multi_fetch_write, &fetch, &meta,
+                          stop)) {
+        /* Failed to fetch file, drop what was received */
+        file_budget_release (FILE_BUDGET_FETCH, fetch.buf->len);
+        g_byte_array_free (fetch.buf, TRUE);
+
+        /* Can be loaded again */
+        g_atomic_int_compare_and_exchange (&fm->deferred,
+                                           FILE_MULTI_DEFERRED_LOADING,
+                                           FILE_MULTI_DEFERRED_WAITING);
+    } else if (meta.unchanged) {
+        /* Thumbnail is still valid, the body is fetched when needed */
+        g_byte_array_free (fetch.buf, TRUE);
+        g_atomic_int_set (&fm->deferred, FILE_MULTI_DEFERRED_WAITING);
+        g_free (meta.etag);
+        return TRUE;
+    } else {
+        /* Succeeded to fetch file, clear need_fetch flag */
+        g_free (fm->etag);
+        fm->etag = meta.etag;
+        meta.etag = NULL;
+        fm->mtime = meta.last_modified;
+        fm->size = fetch.buf->len;
+        g_mutex_lock (&data_mutex);
+        fm->data = g_byte_array_free_to_bytes (fetch.buf);
+        g_mutex_unlock (&data_mutex);
+        fm->need_fetch = FALSE;
+        g_atomic_int_set (&fm->deferred, FILE_MULTI_DEFERRED_NONE);
+    }
+    g_free (meta.etag);
+
+    return ! fm->need_fetch;
 }
 
 /**
- * Fetch path pointed to by file_multi to file_tmp.
+ * Decodes inline data: URI into memory, the data is decoded in place in
+ * a copy of the payload.
  *
  * @param fm Pointer to struct file_multi.
- * @param stop Pointer to stop flag.
+ * @param chunk Called with the data, NULL if not needed.
+ * @param chunk_data Data passed to chunk.
  * @return TRUE on success, else FALSE.
- * @todo Implement configurable user agent string.
  */
 gboolean
-file_multi_fetch_wget (struct file_multi *fm, gboolean *stop)
+file_multi_fetch_data (struct file_multi *fm,
+                       gboolean (*chunk)(gpointer, const guchar*, gsize),
+                       gpointer chunk_data)
 {
-    gchar *argv[5];
-    gint status = 0, child_done = 0, child_status = 1;
-    GPid child_pid;
+    gsize len;
+    gchar *buf;
+    const gchar *payload;
 
-    GError *err = NULL;
-
-    /* Do nothing if stop flag */
-    if (*stop) {
+    payload = strchr (fm->path, ',');
+    if (! payload) {
+        g_warning ("invalid data URI in %s", file_multi_get_name (fm));
         return FALSE;
     }
 
-    /* Build command */
-    argv[0] = "wget";
-    argv[1] = "-O";
-    argv[2] = fm->path_tmp;
-    argv[3] = fm->path;
-    argv[4] = NULL;
-
-    if (g_spawn_async (NULL /* working_directory */, argv,
-                       NULL, WGET_SPAWN_FLAGS,
-                       NULL /* child_setup */, NULL /* user_data */,
-                       &child_pid, &err)) {
-        /* Wait for child to finish */
-        while (! *stop && ! child_done && status != -1) {
-            status = waitpid (child_pid, &child_status, WNOHANG);
-            if (status > 0) {
-                child_done = 1;
-            } else {
-                g_usleep (WGET_CHECK_INTERVAL);
-            }
+    if ((payload - fm->path >= 7)
+        && ! g_ascii_strncasecmp (payload - 7, ";base64", 7)) {
+        buf = g_strdup (payload + 1);
+        g_base64_decode_inplace (buf, &len);
+    } else {
+        buf = g_uri_unescape_string (payload + 1, NULL);
+        if (! buf) {
+            g_warning ("invalid data URI in %s", file_multi_get_name (fm));
+            return FALSE;
         }
+        len = strlen (buf);
+    }
 
-        /* Kill child and wait for it to exit */
-        if (! child_done) {
-            kill (child_pid, WGET_KILL_SIGNAL);
-            g_usleep (WGET_CHECK_INTERVAL);
-            if (waitpid (child_pid, &child_status, WNOHANG) < 1) {
-                /* Failed to stop, really kill */
-                g_usleep (WGET_KILL_WAIT);
-                kill (child_pid, WGET_DIE_SIGNAL);
-                waitpid (child_pid, &child_status, 0);
-            }
-        }
+    file_budget_charge (FILE_BUDGET_FETCH, len);
+    if (chunk) {
+        chunk (chunk_data, (const guchar*) buf, len);
+    }
 
-        if (child_status == 0) {
-            /* Succeeded to fetch file, set need_fetch flag */
-            fm->need_fetch = FALSE;      
-        } else {
-            /* Failed to fetch file, clear the tmp flag */
-            if (child_done) {
-                g_fprintf (stderr, "Unable to fetch %s\n", fm->path);
-            }
-            file_multi_close_tmp (fm);
-        }
+    fm->size = len;
+    g_mutex_lock (&data_mutex);
+    fm->data = g_bytes_new_take (buf, len);
+    g_mutex_unlock (&data_mutex);
+    fm->need_fetch = FALSE;
+
+    return TRUE;
+}
 
-        /* Cleanup */
-        g_spawn_close_pid (child_pid);
+/**
+ * Collects data received and passes it on.
+ *
+ * @param data Pointer to struct file_multi_fetch_data.
+ * @param buf Data received.
+ * @param len Length of data.
+ * @return TRUE to continue fetching, else FALSE.
+ */
+gboolean
+file_multi_fetch_write (gpointer data, const guchar *buf, gsize len)
+{
+    struct file_multi_fetch_data *fetch =
+        (struct file_multi_fetch_data*) data;
 
-    } else if (err) {
-        g_fprintf (stderr, "%s\n", err->message);
-        g_error_free (err);
-    }
+    g_byte_array_append (fetch->buf, buf, len);
+    file_budget_charge (FILE_BUDGET_FETCH, len);
 
-    return ! fm->need_fetch;
+    return ! fetch->chunk || fetch->chunk (fetch->chunk_data, buf, len);
 }
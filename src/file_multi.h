@@ -42,6 +42,11 @@
 #define FILE_MULTI_METHOD_STDIN 2
 #define FILE_MULTI_METHOD_HTTP 3
 #define FILE_MULTI_METHOD_FTP 4
+#define FILE_MULTI_METHOD_DATA 5
+
+#define FILE_MULTI_DEFERRED_NONE 0 /**< Body fetched or not validated. */
+#define FILE_MULTI_DEFERRED_WAITING 1 /**< Unchanged, body not fetched. */
+#define FILE_MULTI_DEFERRED_LOADING 2 /**< Body being fetched. */
 
 /**
  * Main structure describing a multifile.
@@ -53,12 +58,21 @@ struct file_multi {
     gchar *dir; /**< directory of the file. */
     gchar *path; /**< path to the file. */
     gchar *path_tmp; /**< path to the temporary storage of the file if any. */
+    GBytes *data; /**< Content of fetched file kept in memory, NULL if
+                       none. */
 
     off_t size; /**< Size of file, -1 means not yet checked. */
-    time_t mtime; /**< Mtime of file, -1 means not yet checked. */
+    time_t mtime; /**< Mtime of file, -1 means not yet checked. Remote
+                       files use the Last-Modified date, -1 if none. */
+    gchar *etag; /**< ETag of remote file, NULL if none. */
+    guint type; /**< FILE_SNIFF_ type of content, FILE_SNIFF_UNCHECKED means
+                     not yet checked. */
 
     guint method; /**< Method needed for fetching the file. */
     gboolean need_fetch; /**< flag indicating if fetching is needed. */
+    gboolean validate; /**< Fetch only if changed since etag and mtime. */
+    gint deferred; /**< FILE_MULTI_DEFERRED_ state of the body. */
+    guint depth; /**< Links followed to reach the file, 0 if given. */
 };
 
 extern struct file_multi *file_multi_open (const gchar *path);
@@ -66,17 +80,43 @@ extern void file_multi_close (struct file_multi *fm);
 extern void file_multi_close_tmp (struct file_multi *fm);
 extern gboolean file_multi_save (struct file_multi *fm, const gchar *path);
 extern gboolean file_multi_rename (struct file_multi *fm, const gchar *name);
+extern gboolean file_multi_read (struct file_multi *fm,
+                                 gboolean (*chunk)(gpointer, const guchar*,
+                                                   gsize),
+                                 gpointer chunk_data, gboolean *stop);
+extern gboolean file_multi_store (struct file_multi *fm);
 
 extern const gchar *file_multi_get_name (struct file_multi *fm);
 extern const gchar *file_multi_get_ext (struct file_multi *fm);
 extern const gchar *file_multi_get_uri (struct file_multi *fm);
 extern const gchar *file_multi_get_dir (struct file_multi *fm);
 extern const gchar *file_multi_get_path (struct file_multi *fm);
+extern GBytes *file_multi_get_data (struct file_multi *fm);
 
+extern void file_multi_set_stat (struct file_multi *fm, off_t size,
+                                 time_t mtime);
 extern off_t file_multi_get_size (struct file_multi *fm);
 extern time_t file_multi_get_mtime (struct file_multi *fm);
+extern void file_multi_set_validators (struct file_multi *fm,
+                                       const gchar *etag, time_t mtime);
+extern const gchar *file_multi_get_etag (struct file_multi *fm);
+
+extern guint file_multi_get_type (struct file_multi *fm);
+extern guint file_multi_peek_type (struct file_multi *fm);
+extern void file_multi_set_type (struct file_multi *fm, guint type);
 
-extern gboolean file_multi_fetch (struct file_multi *fm, gboolean *stop);
+extern gboolean file_multi_fetch (struct file_multi *fm,
+                                  gboolean (*chunk)(gpointer, const guchar*,
+                                                    gsize),
+                                  gpointer chunk_data, gboolean *stop);
 extern gboolean file_multi_need_fetch (struct file_multi *fm);
+extern gboolean file_multi_is_deferred (struct file_multi *fm);
+extern gboolean file_multi_load_deferred (struct file_multi *fm);
+
+extern gboolean file_multi_is_stream (struct file_multi *fm);
+extern gboolean file_multi_next_frame (struct file_multi *fm);
+
+extern guint file_multi_get_depth (struct file_multi *fm);
+extern void file_multi_set_depth (struct file_multi *fm, guint depth);
 
 #endif /* _FILE_MULTI_H_ */
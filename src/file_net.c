@@ -0,0 +1,2049 @@
+/*
+ * Copyright © 2006-2009 Claes Nästén <me@pekdon.net>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Built-in HTTP(S) and FTP client fetching remote files. Connections are
+ * kept open after a request and reused for the next one to the same
+ * host, FTP control connections stay logged in. Transfers take slots
+ * limited in total and for each host, large files are fetched in
+ * parallel ranges and interrupted ones are resumed where they stopped.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <gio/gio.h>
+#include <glib/gprintf.h>
+#include <glib/gstdio.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "file_cache.h"
+#include "file_net.h"
+#include "file_url.h"
+#include "util.h"
+
+#define FILE_NET_USER_AGENT "geh"
+/** Largest body read to keep the connection when not fetching it. */
+#define FILE_NET_DRAIN 16384
+
+/**
+ * Parsed URL.
+ */
+struct file_net_url {
+    gchar *scheme; /**< Scheme in lower case, http, https or ftp. */
+    gchar *user; /**< User name, NULL if none. */
+    gchar *password; /**< Password, NULL if none. */
+    gchar *host; /**< Host name or address, without brackets. */
+    guint16 port; /**< Port to connect to. */
+    gchar *path; /**< Path and query, starts with /. */
+    gchar *key; /**< Canonical URL without the password, keys the cache
+                     and redirects are resolved against it. */
+};
+
+/**
+ * Open connection.
+ */
+struct file_net_conn {
+    gchar *key; /**< Scheme, user, host and port connected to. */
+    GSocketConnection *conn; /**< Connection. */
+    GDataInputStream *in; /**< Buffered input, kept with the connection
+                               as it can hold data read ahead. */
+    GOutputStream *out; /**< Output. */
+    gboolean reused; /**< Set when taken from the idle connections. */
+};
+
+/**
+ * Receiver of fetched data.
+ */
+struct file_net_sink {
+    gboolean (*chunk)(gpointer, const guchar*, gsize); /**< Called with
+                                                            data. */
+    gpointer chunk_data; /**< Data passed to chunk. */
+    gsize len; /**< Bytes passed to chunk so far. */
+    struct file_cache_store *store; /**< Cache written to, NULL if none. */
+    struct file_net_meta *meta; /**< Validators, NULL if not used. */
+    gboolean abort; /**< Set when chunk aborted the transfer. */
+};
+
+/**
+ * Response headers used.
+ */
+struct file_net_response {
+    gint64 length; /**< Content-Length, -1 if not given. */
+    gboolean chunked; /**< TRUE if the body is chunked. */
+    gboolean keep; /**< TRUE if the connection is kept. */
+    gboolean no_store; /**< TRUE if the response must not be cached. */
+    gboolean ranges; /**< TRUE if byte ranges are accepted. */
+    gint64 range_start; /**< Start of Content-Range, -1 if not given. */
+    gchar *location; /**< Location header, NULL if none. */
+    gchar *etag; /**< ETag header, NULL if none. */
+    gchar *last_modified; /**< Last-Modified header, NULL if none. */
+};
+
+/**
+ * Large file fetched in segments. Threads of their own fetch the
+ * segments following the one passed on, at most FILE_NET_SEGMENTS are
+ * kept in memory.
+ */
+struct file_net_segments {
+    struct file_net_url *url; /**< URL of file. */
+    const gchar *origin; /**< Host the slots were taken for. */
+    const gchar *validator; /**< Validator ranges are requested with. */
+    gint64 next; /**< Offset of next segment to fetch. */
+    gint64 end; /**< Offset after last byte of file. */
+    GQueue window; /**< struct file_net_segment fetched or being fetched,
+                        in order. */
+    GMutex mutex; /**< Mutex for next and window. */
+    GCond cond; /**< Cond for segments done and room in window. */
+    gint abort; /**< Set when the file is given up. */
+    gboolean *stop; /**< Pointer to stop flag. */
+};
+
+/**
+ * Range of file fetched on a connection of its own.
+ */
+struct file_net_segment {
+    struct file_net_segments *segs; /**< File segment belongs to. */
+    gint64 start; /**< Offset of first byte. */
+    gint64 end; /**< Offset after last byte. */
+    GByteArray *buf; /**< Data received, from start on. */
+    gboolean done; /**< Set when the fetch has finished. */
+    gboolean status; /**< TRUE if all of the range was received. */
+};
+
+static gboolean file_net_fetch_http (struct file_net_url *url,
+                                     struct file_net_sink *out,
+                                     gboolean *stop);
+static gint file_net_http_get (struct file_net_url *url,
+                               struct file_net_sink *out,
+                               gboolean *stop, gchar **location);
+static gint file_net_http_send (struct file_net_url *url,
+                                const gchar *request,
+                                struct file_net_conn **conn,
+                                struct file_net_response *resp);
+static gchar *file_net_http_request (struct file_net_url *url,
+                                     const gchar *etag, const gchar *since,
+                                     gint64 start, gint64 end,
+                                     const gchar *validator);
+static gboolean file_net_http_headers (struct file_net_conn *conn,
+                                       struct file_net_response *resp);
+static gboolean file_net_http_body (struct file_net_conn *conn,
+                                    struct file_net_sink *out,
+                                    gint64 length, gboolean chunked,
+                                    gboolean *stop);
+static gboolean file_net_http_transfer (struct file_net_conn *conn,
+                                        struct file_net_url *url,
+                                        struct file_net_sink *out,
+                                        struct file_net_response *resp,
+                                        const gchar *validator,
+                                        gboolean *stop);
+static gboolean file_net_http_segments (struct file_net_conn *conn,
+                                        struct file_net_url *url,
+                                        struct file_net_sink *out,
+                                        gint64 length, guint n,
+                                        const gchar *origin,
+                                        const gchar *validator,
+                                        gboolean *stop);
+static gpointer file_net_segment_run (gpointer data);
+static gboolean file_net_segment_append (gpointer data, const guchar *buf,
+                                         gsize len);
+static gboolean file_net_http_resume (struct file_net_url *url,
+                                      struct file_net_sink *out,
+                                      gint64 end, const gchar *validator,
+                                      gboolean *stop);
+static gboolean file_net_http_range (struct file_net_url *url,
+                                     struct file_net_sink *out,
+                                     gint64 end, const gchar *validator,
+                                     gboolean *stop);
+static const gchar *file_net_validator (const gchar *etag,
+                                        const gchar *last_modified);
+static void file_net_meta_set (struct file_net_meta *meta,
+                               const gchar *etag,
+                               const gchar *last_modified);
+static gchar *file_net_date_format (gint64 time);
+static gint64 file_net_date_parse (const gchar *str);
+
+static gboolean file_net_fetch_ftp (struct file_net_url *url,
+                                    struct file_net_sink *out,
+                                    gboolean *stop);
+static gboolean file_net_ftp_login (struct file_net_conn *conn,
+                                    struct file_net_url *url);
+static gint file_net_ftp_retr (struct file_net_conn *conn,
+                               struct file_net_url *url,
+                               struct file_net_sink *out, gboolean *stop);
+static gint file_net_ftp_reply (struct file_net_conn *conn, gchar **text);
+static gint file_net_ftp_command (struct file_net_conn *conn, gchar **text,
+                                  const gchar *format, ...)
+    G_GNUC_PRINTF (3, 4);
+
+static gboolean file_net_copy (GInputStream *in, struct file_net_sink *out,
+                               gint64 length, gboolean *stop);
+static gboolean file_net_sink_write (gpointer data, const guchar *buf,
+                                     gsize len);
+
+static gboolean file_net_url_parse (const gchar *str,
+                                    struct file_net_url *url);
+static void file_net_url_clear (struct file_net_url *url);
+static gchar *file_net_url_host (struct file_net_url *url);
+static gchar *file_net_url_origin (struct file_net_url *url);
+static gchar *file_net_url_escape (const gchar *str, gsize len);
+
+static struct file_net_conn *file_net_conn_get (struct file_net_url *url,
+                                                gboolean reuse);
+static struct file_net_conn *file_net_conn_open (const gchar *host,
+                                                 guint16 port, gboolean tls,
+                                                 const gchar *key);
+static void file_net_conn_put (struct file_net_conn *conn);
+static void file_net_conn_close (struct file_net_conn *conn);
+static void file_net_conn_close_all (GQueue *conns);
+static gchar *file_net_read_line (struct file_net_conn *conn);
+static gboolean file_net_write (struct file_net_conn *conn,
+                                const gchar *str);
+
+/** Idle connections by key, GQueue of struct file_net_conn. */
+static GHashTable *idle = NULL;
+/** Lock for idle, connections are taken from all fetch threads. */
+static GMutex idle_mutex;
+/** Cancels all network operations when stopping. */
+static GCancellable *cancel = NULL;
+
+/** Names of days in HTTP dates, Monday first. */
+static const gchar *file_net_days[] = {
+    "Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun"
+};
+/** Names of months in HTTP dates. */
+static const gchar *file_net_months[] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+/** Slots taken by host, GUINT_TO_POINTER of count. */
+static GHashTable *slots = NULL;
+/** Slots taken in total. */
+static guint slots_used = 0;
+/** Slots available in total. */
+static guint slots_limit = 1;
+/** Slots available for each host. */
+static guint slots_host_limit = 1;
+/** Called when a slot is given back, NULL if none. */
+static void (*slots_freed)(gpointer) = NULL;
+/** Data passed to slots_freed. */
+static gpointer slots_freed_data = NULL;
+/** Lock for slots, taken and given back from all fetch threads. */
+static GMutex slots_mutex;
+
+/**
+ * Sets up the client, called before fetching starts.
+ *
+ * @param limit Number of transfers running at once.
+ * @param host_limit Number of transfers running at once to each host.
+ */
+void
+file_net_init (guint limit, guint host_limit)
+{
+    idle = g_hash_table_new_full (&g_str_hash, &g_str_equal, &g_free,
+                                  (GDestroyNotify) &file_net_conn_close_all);
+    cancel = g_cancellable_new ();
+
+    slots = g_hash_table_new_full (&g_str_hash, &g_str_equal, &g_free, NULL);
+    slots_limit = MAX (limit, 1);
+    slots_host_limit = MAX (host_limit, 1);
+}
+
+/**
+ * Closes idle connections and frees the client.
+ */
+void
+file_net_free (void)
+{
+    if (idle) {
+        g_hash_table_destroy (idle);
+        g_hash_table_destroy (slots);
+        g_object_unref (cancel);
+        idle = NULL;
+        slots = NULL;
+        cancel = NULL;
+    }
+}
+
+/**
+ * Cancels all transfers, blocked reads and writes return at once.
+ */
+void
+file_net_stop (void)
+{
+    if (cancel) {
+        g_cancellable_cancel (cancel);
+    }
+}
+
+/**
+ * Returns host transfers of URL take slots for.
+ *
+ * @param url_str URL to get host of.
+ * @return Origin as returned by file_net_url_origin, needs freeing. NULL
+ *         if url_str is not a http, https or ftp URL.
+ */
+gchar*
+file_net_host (const gchar *url_str)
+{
+    gchar *host;
+    struct file_net_url url;
+
+    if (! file_net_url_parse (url_str, &url)) {
+        return NULL;
+    }
+    host = file_net_url_origin (&url);
+    file_net_url_clear (&url);
+
+    return host;
+}
+
+/**
+ * Takes transfer slot for host if both the total and the host limits
+ * allow it.
+ *
+ * @param host Host as returned by file_net_host.
+ * @return TRUE if a slot was taken, give it back with file_net_slot_give.
+ */
+gboolean
+file_net_slot_take (const gchar *host)
+{
+    guint count;
+    gboolean status = FALSE;
+
+    g_mutex_lock (&slots_mutex);
+    count = GPOINTER_TO_UINT (g_hash_table_lookup (slots, host));
+    if ((slots_used < slots_limit) && (count < slots_host_limit)) {
+        g_hash_table_replace (slots, g_strdup (host),
+                              GUINT_TO_POINTER (count + 1));
+        slots_used++;
+        status = TRUE;
+    }
+    g_mutex_unlock (&slots_mutex);
+
+    return status;
+}
+
+/**
+ * Gives back transfer slot taken with file_net_slot_take, the callback
+ * set with file_net_slot_notify is called after.
+ *
+ * @param host Host slot was taken for.
+ */
+void
+file_net_slot_give (const gchar *host)
+{
+    guint count;
+    gpointer freed_data;
+    void (*freed)(gpointer);
+
+    g_mutex_lock (&slots_mutex);
+    count = GPOINTER_TO_UINT (g_hash_table_lookup (slots, host));
+    if (count > 1) {
+        g_hash_table_replace (slots, g_strdup (host),
+                              GUINT_TO_POINTER (count - 1));
+    } else {
+        g_hash_table_remove (slots, host);
+    }
+    slots_used--;
+    freed = slots_freed;
+    freed_data = slots_freed_data;
+    g_mutex_unlock (&slots_mutex);
+
+    if (freed) {
+        freed (freed_data);
+    }
+}
+
+/**
+ * Sets callback called when a transfer slot is given back, used to
+ * start transfers waiting for one.
+ *
+ * @param freed Callback, NULL to unset.
+ * @param data Data passed to freed.
+ */
+void
+file_net_slot_notify (void (*freed)(gpointer), gpointer data)
+{
+    g_mutex_lock (&slots_mutex);
+    slots_freed = freed;
+    slots_freed_data = data;
+    g_mutex_unlock (&slots_mutex);
+}
+
+/**
+ * Fetches URL, passing the data to chunk as it is received.
+ *
+ * @param url_str http, https or ftp URL to fetch.
+ * @param chunk Called with data as it is received, return FALSE to stop.
+ * @param chunk_data Data passed to chunk.
+ * @param meta Validators to fetch conditionally on and set to the ones of
+ *             the file fetched, NULL if not used. Only http and https
+ *             files have validators.
+ * @param stop Pointer to stop flag.
+ * @return TRUE on success or if the file did not change, else FALSE.
+ */
+gboolean
+file_net_fetch (const gchar *url_str,
+                gboolean (*chunk)(gpointer, const guchar*, gsize),
+                gpointer chunk_data, struct file_net_meta *meta,
+                gboolean *stop)
+{
+    gboolean status;
+    struct file_net_url url;
+    struct file_net_sink out = {chunk, chunk_data, 0, NULL, meta, FALSE};
+
+    if (*stop) {
+        return FALSE;
+    }
+
+    if (! file_net_url_parse (url_str, &url)) {
+        g_fprintf (stderr, "Unable to parse URL %s\n", url_str);
+        return FALSE;
+    }
+
+    if (! strcmp (url.scheme, "ftp")) {
+        status = file_net_fetch_ftp (&url, &out, stop);
+    } else {
+        status = file_net_fetch_http (&url, &out, stop);
+    }
+    file_net_url_clear (&url);
+
+    if (! status && ! *stop) {
+        g_fprintf (stderr, "Unable to fetch %s\n", url_str);
+    }
+
+    return status;
+}
+
+/**
+ * Fetches http or https URL following redirects.
+ *
+ * @param url URL to fetch, updated when redirected.
+ * @param out Sink to pass body to.
+ * @param stop Pointer to stop flag.
+ * @return TRUE on success, else FALSE.
+ */
+gboolean
+file_net_fetch_http (struct file_net_url *url, struct file_net_sink *out,
+                     gboolean *stop)
+{
+    guint i;
+    gint status;
+    gchar *location, *next;
+
+    for (i = 0; i <= FILE_NET_REDIRECTS && ! *stop; i++) {
+        location = NULL;
+        status = file_net_http_get (url, out, stop, &location);
+        if (! location || ((status != 301) && (status != 302)
+                           && (status != 303) && (status != 307)
+                           && (status != 308))) {
+            g_free (location);
+            return status == 200;
+        }
+
+        /* Canonical, as the linked files are */
+        next = file_url_resolve (url->key, location);
+        g_free (location);
+        file_net_url_clear (url);
+        if (! next || ! file_net_url_parse (next, url)) {
+            g_free (next);
+            return FALSE;
+        }
+        g_free (next);
+
+        /* Redirected off http */
+        if (! strcmp (url->scheme, "ftp")) {
+            return file_net_fetch_ftp (url, out, stop);
+        }
+    }
+
+    return FALSE;
+}
+
+/**
+ * Sends GET request for URL and reads the response, the body is passed
+ * to out only if the request succeeded. Files cached before are
+ * requested conditionally and passed from the cache if not modified,
+ * files partly fetched before are continued where they stopped. Files
+ * with validators set in out are requested conditionally on them and
+ * not passed if not modified.
+ *
+ * @param url URL to get.
+ * @param out Sink to pass body to.
+ * @param stop Pointer to stop flag.
+ * @param location Set to the Location header if any, needs freeing.
+ * @return HTTP status, 0 if no response or the body could not be read.
+ */
+gint
+file_net_http_get (struct file_net_url *url, struct file_net_sink *out,
+                   gboolean *stop, gchar **location)
+{
+    gint status;
+    gboolean cond, resume = FALSE, retry = FALSE;
+    gchar *request, *since = NULL;
+    const gchar *key;
+    const gchar *etag = NULL, *validator = NULL;
+    const gchar *body_etag = NULL, *body_modified = NULL;
+    struct file_net_conn *conn;
+    struct file_cache_hit *hit = NULL, *part = NULL;
+    struct file_net_response resp;
+
+    key = url->key;
+
+    /* Validators of a file seen before, the cached file is not used as
+       the data is not wanted if not modified. */
+    cond = out->meta
+        && (out->meta->etag || (out->meta->last_modified != -1));
+    if (cond) {
+        etag = out->meta->etag;
+        if (out->meta->last_modified != -1) {
+            since = file_net_date_format (out->meta->last_modified);
+        }
+    } else {
+        hit = file_cache_lookup (key);
+    }
+    if (hit) {
+        etag = hit->etag;
+        since = g_strdup (hit->last_modified);
+    } else if (! cond) {
+        part = file_cache_lookup_part (key);
+        if (part) {
+            validator = file_net_validator (part->etag, part->last_modified);
+        }
+        if (part && (! validator || (part->size == 0))) {
+            file_cache_hit_free (part);
+            part = NULL;
+        }
+    }
+
+    request = file_net_http_request (url, etag, since,
+                                     part ? part->size : 0, -1, validator);
+    status = file_net_http_send (url, request, &conn, &resp);
+    g_free (request);
+    g_free (since);
+    if (status == 0) {
+        goto out;
+    }
+
+    if ((status == 204) || (status == 304)) {
+        resp.length = 0;
+        resp.chunked = FALSE;
+    }
+
+    /* Changed since, or the range is not served. The file is fetched
+       from the start, again if the range was refused. */
+    if (part) {
+        resume = (status == 206)
+            && (resp.range_start == (gint64) part->size);
+        if (! resume) {
+            file_cache_forget_part (key);
+            retry = status == 416;
+        }
+    }
+
+    /* Bodies of other responses are only read to keep the connection. */
+    if ((status == 200) || resume) {
+        if (resume) {
+            out->store = file_cache_store_new (key, part->etag,
+                                               part->last_modified);
+            status = (file_cache_hit_read (part, &file_net_sink_write, out)
+                      && (out->len == part->size)) ? 200 : 0;
+            body_etag = part->etag;
+            body_modified = part->last_modified;
+        } else {
+            if (! resp.no_store) {
+                out->store = file_cache_store_new (key, resp.etag,
+                                                   resp.last_modified);
+            }
+            validator = file_net_validator (resp.etag, resp.last_modified);
+            body_etag = resp.etag;
+            body_modified = resp.last_modified;
+        }
+
+        if ((status == 200)
+            && ! file_net_http_transfer (conn, url, out, &resp, validator,
+                                         stop)) {
+            status = 0;
+        } else if (status != 200) {
+            file_net_conn_close (conn);
+        }
+        conn = NULL;
+
+        if (out->store) {
+            file_cache_store_finish (out->store, status == 200);
+            out->store = NULL;
+        }
+    } else if (resp.chunked
+               || ((resp.length >= 0) && (resp.length <= FILE_NET_DRAIN))) {
+        resp.keep = resp.keep
+            && file_net_http_body (conn, NULL, resp.length, resp.chunked,
+                                   stop);
+    } else {
+        resp.keep = FALSE;
+    }
+
+    /* Body ends when the connection is closed. */
+    if ((resp.length < 0) && ! resp.chunked) {
+        resp.keep = FALSE;
+    }
+
+    if (! conn) {
+        /* Passed on with the body */
+    } else if (resp.keep) {
+        file_net_conn_put (conn);
+    } else {
+        file_net_conn_close (conn);
+    }
+
+    /* Not modified, nothing is passed if the data is not wanted or the
+       cached file is passed. */
+    if ((status == 304) && cond) {
+        out->meta->unchanged = TRUE;
+        status = 200;
+    } else if ((status == 304) && hit) {
+        status = file_cache_hit_read (hit, &file_net_sink_write, out)
+            ? 200 : 0;
+        body_etag = hit->etag;
+        body_modified = hit->last_modified;
+    }
+
+    if ((status == 200) && out->meta && ! out->meta->unchanged) {
+        file_net_meta_set (out->meta, body_etag, body_modified);
+    }
+
+out:
+    if (hit) {
+        file_cache_hit_free (hit);
+    }
+    if (part) {
+        file_cache_hit_free (part);
+    }
+    g_free (resp.etag);
+    g_free (resp.last_modified);
+
+    if (retry && ! *stop) {
+        g_free (resp.location);
+        return file_net_http_get (url, out, stop, location);
+    }
+    *location = resp.location;
+
+    return status;
+}
+
+/**
+ * Sends request and reads the status line and headers of the response.
+ *
+ * @param url URL requested, used to get the connection.
+ * @param request Request to send.
+ * @param conn Set to the connection the response is read from, NULL if
+ *             0 is returned. Kept or closed by the caller.
+ * @param resp struct file_net_response to fill in, strings need freeing
+ *             also when 0 is returned.
+ * @return HTTP status, 0 if no response.
+ */
+gint
+file_net_http_send (struct file_net_url *url, const gchar *request,
+                    struct file_net_conn **conn,
+                    struct file_net_response *resp)
+{
+    gint attempt, status = 0;
+    gboolean retry;
+    gchar *line = NULL;
+
+    memset (resp, 0, sizeof (struct file_net_response));
+    resp->length = -1;
+    resp->range_start = -1;
+    *conn = NULL;
+
+    /* An idle connection may have been closed by the server, send the
+       request again on a new one if nothing was received. */
+    for (attempt = 0; ! line && attempt < 2; attempt++) {
+        *conn = file_net_conn_get (url, attempt == 0);
+        if (! *conn) {
+            break;
+        }
+
+        if (file_net_write (*conn, request)) {
+            line = file_net_read_line (*conn);
+        }
+        if (! line) {
+            retry = (*conn)->reused;
+            file_net_conn_close (*conn);
+            *conn = NULL;
+            if (! retry) {
+                break;
+            }
+        }
+    }
+
+    /* Status line and headers, informational responses are followed by
+       the real one. */
+    while (line) {
+        if (! g_str_has_prefix (line, "HTTP/1.") || strlen (line) < 12) {
+            status = 0;
+            g_free (line);
+            break;
+        }
+        status = g_ascii_strtoll (line + 9, NULL, 10);
+        resp->keep = line[7] != '0';
+        g_free (line);
+
+        if (! file_net_http_headers (*conn, resp)) {
+            status = 0;
+            break;
+        }
+        if ((status >= 200) || (status < 100)) {
+            break;
+        }
+        line = file_net_read_line (*conn);
+        if (! line) {
+            status = 0;
+        }
+    }
+
+    if ((status == 0) && *conn) {
+        file_net_conn_close (*conn);
+        *conn = NULL;
+    }
+
+    return status;
+}
+
+/**
+ * Builds GET request for URL.
+ *
+ * @param url URL to get.
+ * @param etag ETag the file is not wanted for if it matches, NULL if
+ *             none.
+ * @param since Date the file is not wanted for if not modified since,
+ *              NULL if none.
+ * @param start Offset of first byte to get.
+ * @param end Offset after last byte to get, -1 gets the rest.
+ * @param validator Validator the range is requested with, NULL if none.
+ * @return Request, needs freeing.
+ */
+gchar*
+file_net_http_request (struct file_net_url *url, const gchar *etag,
+                       const gchar *since, gint64 start, gint64 end,
+                       const gchar *validator)
+{
+    gchar *host;
+    GString *request;
+
+    host = file_net_url_host (url);
+    request = g_string_new (NULL);
+    g_string_printf (request, "GET %s HTTP/1.1\r\n"
+                     "Host: %s\r\n"
+                     "User-Agent: " FILE_NET_USER_AGENT "\r\n"
+                     "Accept: */*\r\n"
+                     "Connection: keep-alive\r\n", url->path, host);
+    g_free (host);
+
+    if (etag) {
+        g_string_append_printf (request, "If-None-Match: %s\r\n", etag);
+    }
+    if (since) {
+        g_string_append_printf (request, "If-Modified-Since: %s\r\n",
+                                since);
+    }
+
+    /* The whole file is sent instead if it changed. */
+    if (end >= 0) {
+        g_string_append_printf (request, "Range: bytes=%" G_GINT64_FORMAT
+                                "-%" G_GINT64_FORMAT "\r\n", start, end - 1);
+    } else if (start > 0) {
+        g_string_append_printf (request, "Range: bytes=%" G_GINT64_FORMAT
+                                "-\r\n", start);
+    }
+    if (validator && ((end >= 0) || (start > 0))) {
+        g_string_append_printf (request, "If-Range: %s\r\n", validator);
+    }
+    g_string_append (request, "\r\n");
+
+    return g_string_free (request, FALSE);
+}
+
+/**
+ * Reads response headers up to the empty line ending them.
+ *
+ * @param conn Connection to read from.
+ * @param resp struct file_net_response to fill in, keep is set to FALSE
+ *             if the connection is closed after the response, or TRUE if
+ *             it is kept. Strings need freeing.
+ * @return TRUE if headers were read, FALSE if the connection failed.
+ */
+gboolean
+file_net_http_headers (struct file_net_conn *conn,
+                       struct file_net_response *resp)
+{
+    gchar *line, *value, *end, **field;
+
+    resp->length = -1;
+    resp->chunked = FALSE;
+    resp->ranges = FALSE;
+    resp->range_start = -1;
+
+    while ((line = file_net_read_line (conn)) != NULL && *line) {
+        value = strchr (line, ':');
+        if (value) {
+            *value++ = '\0';
+            g_strstrip (value);
+
+            field = NULL;
+            if (! g_ascii_strcasecmp (line, "Content-Length")) {
+                resp->length = g_ascii_strtoll (value, NULL, 10);
+            } else if (! g_ascii_strcasecmp (line, "Transfer-Encoding")) {
+                resp->chunked = g_ascii_strcasecmp (value, "identity") != 0;
+            } else if (! g_ascii_strcasecmp (line, "Connection")) {
+                if (! g_ascii_strcasecmp (value, "close")) {
+                    resp->keep = FALSE;
+                } else if (! g_ascii_strcasecmp (value, "keep-alive")) {
+                    resp->keep = TRUE;
+                }
+            } else if (! g_ascii_strcasecmp (line, "Cache-Control")) {
+                if (util_stripos (value, "no-store")) {
+                    resp->no_store = TRUE;
+                }
+            } else if (! g_ascii_strcasecmp (line, "Accept-Ranges")) {
+                resp->ranges = ! g_ascii_strcasecmp (value, "bytes");
+            } else if (! g_ascii_strcasecmp (line, "Content-Range")) {
+                if (! g_ascii_strncasecmp (value, "bytes ", 6)) {
+                    resp->range_start = g_ascii_strtoll (value + 6, &end, 10);
+                    if ((end == value + 6) || (*end != '-')) {
+                        resp->range_start = -1;
+                    }
+                }
+            } else if (! g_ascii_strcasecmp (line, "Location")) {
+                field = &resp->location;
+            } else if (! g_ascii_strcasecmp (line, "ETag")) {
+                field = &resp->etag;
+            } else if (! g_ascii_strcasecmp (line, "Last-Modified")) {
+                field = &resp->last_modified;
+            }
+
+            if (field) {
+                g_free (*field);
+                *field = g_strdup (value);
+            }
+        }
+        g_free (line);
+    }
+
+    if (! line) {
+        return FALSE;
+    }
+    g_free (line);
+
+    return TRUE;
+}
+
+/**
+ * Reads response body.
+ *
+ * @param conn Connection to read from.
+ * @param out Sink to pass body to, NULL to drop it.
+ * @param length Length of body, -1 reads until the connection is closed.
+ * @param chunked TRUE if body is chunked, length is not used.
+ * @param stop Pointer to stop flag.
+ * @return TRUE if the whole body was read.
+ */
+gboolean
+file_net_http_body (struct file_net_conn *conn, struct file_net_sink *out,
+                    gint64 length, gboolean chunked, gboolean *stop)
+{
+    gint64 size;
+    gchar *line;
+
+    if (! chunked) {
+        return file_net_copy (G_INPUT_STREAM (conn->in), out, length, stop);
+    }
+
+    /* Chunks are preceded by their size in hex, ended by a zero size. */
+    for (;;) {
+        line = file_net_read_line (conn);
+        if (! line) {
+            return FALSE;
+        }
+        size = g_ascii_strtoll (line, NULL, 16);
+        g_free (line);
+
+        if (size <= 0) {
+            break;
+        }
+        if (! file_net_copy (G_INPUT_STREAM (conn->in), out, size, stop)) {
+            return FALSE;
+        }
+
+        line = file_net_read_line (conn);
+        if (! line || *line) {
+            g_free (line);
+            return FALSE;
+        }
+        g_free (line);
+    }
+
+    if (size < 0) {
+        return FALSE;
+    }
+
+    /* Trailers end with an empty line */
+    while ((line = file_net_read_line (conn)) != NULL && *line) {
+        g_free (line);
+    }
+    if (! line) {
+        return FALSE;
+    }
+    g_free (line);
+
+    return TRUE;
+}
+
+/**
+ * Reads body of successful response. Large files are split in segments
+ * fetched in parallel if slots are free for the host, transfers failing
+ * part way are resumed where they stopped if the file has a validator.
+ *
+ * @param conn Connection response is read from, kept or closed.
+ * @param url URL requested.
+ * @param out Sink to pass body to.
+ * @param resp Response headers.
+ * @param validator Validator ranges are requested with, NULL if none.
+ * @param stop Pointer to stop flag.
+ * @return TRUE if the whole body was passed.
+ */
+gboolean
+file_net_http_transfer (struct file_net_conn *conn, struct file_net_url *url,
+                        struct file_net_sink *out,
+                        struct file_net_response *resp,
+                        const gchar *validator, gboolean *stop)
+{
+    guint n = 1, max;
+    gint64 end = -1;
+    gchar *origin = NULL;
+    gboolean status;
+
+    if ((resp->length >= 0) && ! resp->chunked) {
+        end = out->len + resp->length;
+    }
+
+    /* A slot is taken for each segment but the first, the response
+       holds the slot of the whole transfer. */
+    if (validator && resp->ranges && (end >= 0)) {
+        max = MIN (resp->length / FILE_NET_SEGMENT, FILE_NET_SEGMENTS);
+        if (max > 1) {
+            origin = file_net_url_origin (url);
+        }
+        while ((n < max) && file_net_slot_take (origin)) {
+            n++;
+        }
+    }
+
+    if (n > 1) {
+        status = file_net_http_segments (conn, url, out, resp->length, n,
+                                         origin, validator, stop);
+        /* Rest of the response is not read. */
+        file_net_conn_close (conn);
+    } else {
+        status = file_net_http_body (conn, out, resp->length, resp->chunked,
+                                     stop);
+        if (status && resp->keep && ((end >= 0) || resp->chunked)) {
+            file_net_conn_put (conn);
+        } else {
+            file_net_conn_close (conn);
+        }
+
+        if (! status && validator
+            && (resp->ranges || (resp->range_start >= 0))) {
+            status = file_net_http_resume (url, out, end, validator, stop);
+        }
+    }
+    g_free (origin);
+
+    return status;
+}
+
+/**
+ * Reads body of large file in segments, the first is read from the
+ * response and the rest are requested as ranges on connections of their
+ * own. Segments are passed to out in order, only a window of
+ * FILE_NET_SEGMENTS segments ahead is fetched so memory used does not
+ * grow with the file.
+ *
+ * @param conn Connection response is read from, not closed.
+ * @param url URL requested.
+ * @param out Sink to pass body to.
+ * @param length Length of body.
+ * @param n Number of connections, a slot is taken for each but the
+ *          first.
+ * @param origin Host the slots were taken for.
+ * @param validator Validator ranges are requested with.
+ * @param stop Pointer to stop flag.
+ * @return TRUE if the whole body was passed.
+ */
+gboolean
+file_net_http_segments (struct file_net_conn *conn, struct file_net_url *url,
+                        struct file_net_sink *out, gint64 length, guint n,
+                        const gchar *origin, const gchar *validator,
+                        gboolean *stop)
+{
+    guint i;
+    gsize off;
+    gint64 start;
+    gboolean status;
+    GThread **threads;
+    struct file_net_segment *seg;
+    struct file_net_segments segs;
+
+    start = out->len;
+
+    segs.url = url;
+    segs.origin = origin;
+    segs.validator = validator;
+    segs.next = start + FILE_NET_SEGMENT;
+    segs.end = start + length;
+    g_queue_init (&segs.window);
+    g_mutex_init (&segs.mutex);
+    g_cond_init (&segs.cond);
+    segs.abort = FALSE;
+    segs.stop = stop;
+
+    threads = g_new (GThread*, n - 1);
+    for (i = 1; i < n; i++) {
+        threads[i - 1] = g_thread_new ("file_net_segment",
+                                       &file_net_segment_run, &segs);
+    }
+
+    status = file_net_copy (G_INPUT_STREAM (conn->in), out,
+                            FILE_NET_SEGMENT, stop);
+    if (! status) {
+        status = file_net_http_resume (url, out, start + FILE_NET_SEGMENT,
+                                       validator, stop);
+    }
+
+    /* Data of failed segments is kept, the rest is fetched here. */
+    g_mutex_lock (&segs.mutex);
+    while (status) {
+        seg = (struct file_net_segment*) g_queue_peek_head (&segs.window);
+        if (! seg && (segs.next >= segs.end)) {
+            break;
+        }
+        if (! seg || ! seg->done) {
+            g_cond_wait (&segs.cond, &segs.mutex);
+            continue;
+        }
+
+        /* Room for the next segment in the window */
+        g_queue_pop_head (&segs.window);
+        g_cond_broadcast (&segs.cond);
+        g_mutex_unlock (&segs.mutex);
+
+        for (off = 0; status && (off < seg->buf->len); off += FILE_NET_BUF) {
+            status = file_net_sink_write (out, seg->buf->data + off,
+                                          MIN (seg->buf->len - off,
+                                               FILE_NET_BUF));
+        }
+        if (status && ! seg->status) {
+            status = file_net_http_resume (url, out, seg->end, validator,
+                                           stop);
+        }
+        g_byte_array_free (seg->buf, TRUE);
+        g_free (seg);
+
+        g_mutex_lock (&segs.mutex);
+    }
+    g_atomic_int_set (&segs.abort, TRUE);
+    g_cond_broadcast (&segs.cond);
+    g_mutex_unlock (&segs.mutex);
+
+    for (i = 1; i < n; i++) {
+        g_thread_join (threads[i - 1]);
+    }
+    g_free (threads);
+
+    /* Segments fetched after the file was given up */
+    while ((seg = (struct file_net_segment*) g_queue_pop_head (&segs.window))
+           != NULL) {
+        g_byte_array_free (seg->buf, TRUE);
+        g_free (seg);
+    }
+    g_mutex_clear (&segs.mutex);
+    g_cond_clear (&segs.cond);
+
+    return status;
+}
+
+/**
+ * Fetches segments into memory while there is room in the window, run
+ * on a thread of its own. The slot of the thread is given back when
+ * done.
+ *
+ * @param data Pointer to struct file_net_segments.
+ * @return NULL.
+ */
+gpointer
+file_net_segment_run (gpointer data)
+{
+    struct file_net_segment *seg;
+    struct file_net_segments *segs = (struct file_net_segments*) data;
+    struct file_net_sink out = {&file_net_segment_append, NULL, 0,
+                                NULL, NULL, FALSE};
+
+    g_mutex_lock (&segs->mutex);
+    for (;;) {
+        while (! segs->abort && (segs->next < segs->end)
+               && (g_queue_get_length (&segs->window) >= FILE_NET_SEGMENTS)) {
+            g_cond_wait (&segs->cond, &segs->mutex);
+        }
+        if (segs->abort || (segs->next >= segs->end)) {
+            break;
+        }
+
+        seg = g_new0 (struct file_net_segment, 1);
+        seg->segs = segs;
+        seg->start = segs->next;
+        seg->end = MIN (seg->start + FILE_NET_SEGMENT, segs->end);
+        seg->buf = g_byte_array_sized_new (seg->end - seg->start);
+        segs->next = seg->end;
+        g_queue_push_tail (&segs->window, seg);
+        g_mutex_unlock (&segs->mutex);
+
+        out.chunk_data = seg;
+        out.len = seg->start;
+        out.abort = FALSE;
+        seg->status = file_net_http_resume (segs->url, &out, seg->end,
+                                            segs->validator, segs->stop);
+
+        g_mutex_lock (&segs->mutex);
+        seg->done = TRUE;
+        g_cond_broadcast (&segs->cond);
+    }
+    g_mutex_unlock (&segs->mutex);
+
+    file_net_slot_give (segs->origin);
+
+    return NULL;
+}
+
+/**
+ * Appends data to segment buffer.
+ *
+ * @param data Pointer to struct file_net_segment.
+ * @param buf Data received.
+ * @param len Length of data.
+ * @return TRUE to continue, FALSE if the file is given up.
+ */
+gboolean
+file_net_segment_append (gpointer data, const guchar *buf, gsize len)
+{
+    struct file_net_segment *seg = (struct file_net_segment*) data;
+
+    if (g_atomic_int_get (&seg->segs->abort)) {
+        return FALSE;
+    }
+    g_byte_array_append (seg->buf, buf, len);
+
+    return TRUE;
+}
+
+/**
+ * Fetches file from where out is up to end, resuming from where the
+ * transfer stopped if it fails part way.
+ *
+ * @param url URL of file.
+ * @param out Sink to pass data to, len is the offset of the next byte.
+ * @param end Offset after last byte to fetch, -1 fetches the rest.
+ * @param validator Validator ranges are requested with.
+ * @param stop Pointer to stop flag.
+ * @return TRUE if all of the range was passed.
+ */
+gboolean
+file_net_http_resume (struct file_net_url *url, struct file_net_sink *out,
+                      gint64 end, const gchar *validator, gboolean *stop)
+{
+    guint i;
+    gboolean status = FALSE;
+
+    for (i = 0; ! status && (i <= FILE_NET_RESUMES); i++) {
+        if (*stop || out->abort) {
+            break;
+        }
+        status = file_net_http_range (url, out, end, validator, stop);
+    }
+
+    return status;
+}
+
+/**
+ * Requests range of file from where out is up to end.
+ *
+ * @param url URL of file.
+ * @param out Sink to pass data to, len is the offset of the next byte.
+ * @param end Offset after last byte to fetch, -1 fetches the rest.
+ * @param validator Validator the range is requested with, the whole file
+ *                  is sent instead if it changed.
+ * @param stop Pointer to stop flag.
+ * @return TRUE if all of the range was passed.
+ */
+gboolean
+file_net_http_range (struct file_net_url *url, struct file_net_sink *out,
+                     gint64 end, const gchar *validator, gboolean *stop)
+{
+    gint status;
+    gint64 start = out->len;
+    gboolean ok = FALSE;
+    gchar *request;
+    struct file_net_conn *conn;
+    struct file_net_response resp;
+
+    if ((end >= 0) && (start >= end)) {
+        return TRUE;
+    }
+
+    request = file_net_http_request (url, NULL, NULL, start, end,
+                                     validator);
+    status = file_net_http_send (url, request, &conn, &resp);
+    g_free (request);
+
+    if ((status == 206) && (resp.range_start == start)
+        && ((end < 0) || resp.chunked || (resp.length == end - start))) {
+        ok = file_net_http_body (conn, out, resp.length, resp.chunked, stop);
+    }
+
+    if (conn) {
+        if (ok && resp.keep && ((resp.length >= 0) || resp.chunked)) {
+            file_net_conn_put (conn);
+        } else {
+            file_net_conn_close (conn);
+        }
+    }
+    g_free (resp.location);
+    g_free (resp.etag);
+    g_free (resp.last_modified);
+
+    return ok;
+}
+
+/**
+ * Returns validator ranges are requested with, weak ETags can not be
+ * used for ranges.
+ *
+ * @param etag ETag, NULL if none.
+ * @param last_modified Last-Modified date, NULL if none.
+ * @return Validator, NULL if none.
+ */
+const gchar*
+file_net_validator (const gchar *etag, const gchar *last_modified)
+{
+    if (etag && ! g_str_has_prefix (etag, "W/")) {
+        return etag;
+    }
+    return last_modified;
+}
+
+/**
+ * Sets validators of file fetched.
+ *
+ * @param meta struct file_net_meta to set.
+ * @param etag ETag, NULL if none.
+ * @param last_modified Last-Modified date, NULL if none.
+ */
+void
+file_net_meta_set (struct file_net_meta *meta, const gchar *etag,
+                   const gchar *last_modified)
+{
+    g_free (meta->etag);
+    meta->etag = g_strdup (etag);
+    meta->last_modified = file_net_date_parse (last_modified);
+}
+
+/**
+ * Formats date as used in HTTP headers.
+ *
+ * @param time Unix time.
+ * @return Date, needs freeing. NULL if time is out of range.
+ */
+gchar*
+file_net_date_format (gint64 time)
+{
+    gchar *str;
+    GDateTime *date;
+
+    date = g_date_time_new_from_unix_utc (time);
+    if (! date) {
+        return NULL;
+    }
+
+    /* Names are in English whatever the locale */
+    str = g_strdup_printf ("%s, %02d %s %04d %02d:%02d:%02d GMT",
+                           file_net_days[g_date_time_get_day_of_week (date)
+                                         - 1],
+                           g_date_time_get_day_of_month (date),
+                           file_net_months[g_date_time_get_month (date) - 1],
+                           g_date_time_get_year (date),
+                           g_date_time_get_hour (date),
+                           g_date_time_get_minute (date),
+                           g_date_time_get_second (date));
+    g_date_time_unref (date);
+
+    return str;
+}
+
+/**
+ * Parses date as used in HTTP headers, only the preferred format is
+ * read as the others are obsolete.
+ *
+ * @param str Date such as "Sun, 06 Nov 1994 08:49:37 GMT", NULL if none.
+ * @return Unix time, -1 if str is not a date.
+ */
+gint64
+file_net_date_parse (const gchar *str)
+{
+    guint month;
+    gint day, year, hour, minute, second;
+    gint64 time;
+    gchar name[4];
+    GDateTime *date;
+
+    if (! str || (sscanf (str, "%*3s, %2d %3s %4d %2d:%2d:%2d GMT",
+                          &day, name, &year, &hour, &minute,
+                          &second) != 6)) {
+        return -1;
+    }
+
+    for (month = 0; month < G_N_ELEMENTS (file_net_months); month++) {
+        if (! strcmp (name, file_net_months[month])) {
+            break;
+        }
+    }
+    if (month == G_N_ELEMENTS (file_net_months)) {
+        return -1;
+    }
+
+    date = g_date_time_new_utc (year, month + 1, day, hour, minute, second);
+    if (! date) {
+        return -1;
+    }
+    time = g_date_time_to_unix (date);
+    g_date_time_unref (date);
+
+    return time;
+}
+
+/**
+ * Fetches ftp URL in passive mode.
+ *
+ * @param url URL to fetch.
+ * @param out Sink to pass file to.
+ * @param stop Pointer to stop flag.
+ * @return TRUE on success, else FALSE.
+ */
+gboolean
+file_net_fetch_ftp (struct file_net_url *url, struct file_net_sink *out,
+                    gboolean *stop)
+{
+    gint attempt, code;
+    gboolean retry;
+    struct file_net_conn *conn;
+
+    /* An idle control connection may have been closed by the server, log
+       in again on a new one if nothing was transferred. */
+    for (attempt = 0; attempt < 2 && ! *stop; attempt++) {
+        conn = file_net_conn_get (url, attempt == 0);
+        if (! conn) {
+            return FALSE;
+        }
+        if (! conn->reused && ! file_net_ftp_login (conn, url)) {
+            file_net_conn_close (conn);
+            return FALSE;
+        }
+
+        code = file_net_ftp_retr (conn, url, out, stop);
+        if (code == 0) {
+            retry = conn->reused && (out->len == 0);
+            file_net_conn_close (conn);
+            if (retry) {
+                continue;
+            }
+            return FALSE;
+        }
+
+        /* Control connection is in sync, keep it. */
+        file_net_conn_put (conn);
+
+        return (code == 226) || (code == 250);
+    }
+
+    return FALSE;
+}
+
+/**
+ * Logs in on new control connection and selects binary transfers.
+ *
+ * @param conn Control connection.
+ * @param url URL with user and password, anonymous if not set.
+ * @return TRUE if logged in, else FALSE.
+ */
+gboolean
+file_net_ftp_login (struct file_net_conn *conn, struct file_net_url *url)
+{
+    gint code;
+
+    code = file_net_ftp_reply (conn, NULL);
+    if (code != 220) {
+        return FALSE;
+    }
+
+    code = file_net_ftp_command (conn, NULL, "USER %s",
+                                 url->user ? url->user : "anonymous");
+    if ((code == 331) || (code == 332)) {
+        code = file_net_ftp_command (conn, NULL, "PASS %s",
+                                     url->password
+                                     ? url->password : FILE_NET_USER_AGENT "@");
+    }
+    if (code != 230) {
+        return FALSE;
+    }
+
+    return file_net_ftp_command (conn, NULL, "TYPE I") == 200;
+}
+
+/**
+ * Retrieves file over a passive data connection.
+ *
+ * @param conn Logged in control connection.
+ * @param url URL of file.
+ * @param out Sink to pass file to.
+ * @param stop Pointer to stop flag.
+ * @return Final reply code, 0 if the control connection can not be used
+ *         any more.
+ */
+gint
+file_net_ftp_retr (struct file_net_conn *conn, struct file_net_url *url,
+                   struct file_net_sink *out, gboolean *stop)
+{
+    gint code;
+    guint h[4], p[2], port = 0;
+    gboolean status;
+    gchar *text, *path, *it;
+    struct file_net_conn *data;
+
+    /* Extended passive mode works with IPv6 as well, the data connection
+       goes to the control connection host in both modes. */
+    code = file_net_ftp_command (conn, &text, "EPSV");
+    if ((code == 229) && (it = strstr (text, "|||")) != NULL) {
+        port = g_ascii_strtoull (it + 3, NULL, 10);
+    } else if (code != 0) {
+        g_free (text);
+        code = file_net_ftp_command (conn, &text, "PASV");
+        if (code == 227) {
+            for (it = text + 3; *it && ! g_ascii_isdigit (*it); it++)
+                ;
+            if (sscanf (it, "%u,%u,%u,%u,%u,%u",
+                        &h[0], &h[1], &h[2], &h[3], &p[0], &p[1]) == 6) {
+                port = p[0] * 256 + p[1];
+            }
+        }
+    }
+    g_free (text);
+
+    if ((port == 0) || (port > G_MAXUINT16)) {
+        return code == 0 ? 0 : 500;
+    }
+
+    /* Paths are relative to the login directory. */
+    path = g_uri_unescape_string (url->path + 1, "\r\n");
+    if (! path) {
+        return 500;
+    }
+
+    data = file_net_conn_open (url->host, port, FALSE, "");
+    if (! data) {
+        g_free (path);
+        return 0;
+    }
+
+    code = file_net_ftp_command (conn, NULL, "RETR %s", path);
+    g_free (path);
+    if ((code != 125) && (code != 150)) {
+        file_net_conn_close (data);
+        return code;
+    }
+
+    status = file_net_copy (G_INPUT_STREAM (data->in), out, -1, stop);
+    file_net_conn_close (data);
+    if (! status) {
+        return 0;
+    }
+
+    return file_net_ftp_reply (conn, NULL);
+}
+
+/**
+ * Reads reply from control connection, multi-line replies are read to
+ * the end.
+ *
+ * @param conn Control connection.
+ * @param text Set to the last line of the reply if not NULL, needs
+ *             freeing.
+ * @return Reply code, 0 if the connection failed.
+ */
+gint
+file_net_ftp_reply (struct file_net_conn *conn, gchar **text)
+{
+    gint code;
+    gchar end[5], *line;
+
+    if (text) {
+        *text = NULL;
+    }
+
+    line = file_net_read_line (conn);
+    if (! line || (strlen (line) < 3)) {
+        g_free (line);
+        return 0;
+    }
+    code = g_ascii_strtoll (line, NULL, 10);
+
+    /* Continues until a line with the code followed by a space */
+    if (line[3] == '-') {
+        g_snprintf (end, sizeof (end), "%.3s ", line);
+        do {
+            g_free (line);
+            line = file_net_read_line (conn);
+        } while (line && ! g_str_has_prefix (line, end));
+        if (! line) {
+            return 0;
+        }
+    }
+
+    if (text) {
+        *text = line;
+    } else {
+        g_free (line);
+    }
+
+    return ((code >= 100) && (code < 600)) ? code : 0;
+}
+
+/**
+ * Sends command on control connection and reads the reply.
+ *
+ * @param conn Control connection.
+ * @param text Set to the last line of the reply if not NULL, needs
+ *             freeing.
+ * @param format printf style format of command.
+ * @return Reply code, 0 if the connection failed.
+ */
+gint
+file_net_ftp_command (struct file_net_conn *conn, gchar **text,
+                      const gchar *format, ...)
+{
+    va_list args;
+    gboolean status;
+    gchar *command, *line;
+
+    if (text) {
+        *text = NULL;
+    }
+
+    va_start (args, format);
+    command = g_strdup_vprintf (format, args);
+    va_end (args);
+
+    line = g_strconcat (command, "\r\n", NULL);
+    status = file_net_write (conn, line);
+    g_free (line);
+    g_free (command);
+
+    if (! status) {
+        return 0;
+    }
+
+    return file_net_ftp_reply (conn, text);
+}
+
+/**
+ * Copies data from stream to sink.
+ *
+ * @param in Stream to read from.
+ * @param out Sink to pass data to, NULL to drop the data.
+ * @param length Number of bytes to copy, -1 copies until end of stream.
+ * @param stop Pointer to stop flag.
+ * @return TRUE if all data was copied.
+ */
+gboolean
+file_net_copy (GInputStream *in, struct file_net_sink *out, gint64 length,
+               gboolean *stop)
+{
+    gssize len;
+    gchar *buf;
+    gboolean status = TRUE;
+
+    buf = g_malloc (FILE_NET_BUF);
+    while (length != 0) {
+        if (*stop) {
+            status = FALSE;
+            break;
+        }
+
+        len = g_input_stream_read (in, buf,
+                                   (length > 0)
+                                   ? MIN (length, FILE_NET_BUF)
+                                   : FILE_NET_BUF,
+                                   cancel, NULL);
+        if (len <= 0) {
+            /* End of stream is only expected when reading all of it. */
+            status = (len == 0) && (length < 0);
+            break;
+        }
+        if (out && ! file_net_sink_write (out, (const guchar*) buf, len)) {
+            status = FALSE;
+            break;
+        }
+        if (length > 0) {
+            length -= len;
+        }
+    }
+    g_free (buf);
+
+    return status;
+}
+
+/**
+ * Passes data to sink, a copy is written to the cache if storing.
+ *
+ * @param data Pointer to struct file_net_sink.
+ * @param buf Data received.
+ * @param len Length of data.
+ * @return TRUE to continue, FALSE to abort the transfer.
+ */
+gboolean
+file_net_sink_write (gpointer data, const guchar *buf, gsize len)
+{
+    struct file_net_sink *out = (struct file_net_sink*) data;
+
+    if (! out->chunk (out->chunk_data, buf, len)) {
+        out->abort = TRUE;
+        return FALSE;
+    }
+    out->len += len;
+
+    if (out->store) {
+        file_cache_store_write (out->store, buf, len);
+    }
+
+    return TRUE;
+}
+
+/**
+ * Parses URL.
+ *
+ * @param str URL to parse.
+ * @param url struct file_net_url to fill in, cleared with
+ *            file_net_url_clear.
+ * @return TRUE if str is a http, https or ftp URL, else FALSE.
+ */
+gboolean
+file_net_url_parse (const gchar *str, struct file_net_url *url)
+{
+    guint64 port;
+    gchar *end_port, *path;
+    const gchar *it, *auth, *end, *at = NULL, *colon;
+
+    memset (url, 0, sizeof (struct file_net_url));
+
+    it = strstr (str, "://");
+    if (! it) {
+        return FALSE;
+    }
+    url->scheme = g_ascii_strdown (str, it - str);
+    if (! strcmp (url->scheme, "http")) {
+        url->port = 80;
+    } else if (! strcmp (url->scheme, "https")) {
+        url->port = 443;
+    } else if (! strcmp (url->scheme, "ftp")) {
+        url->port = 21;
+    } else {
+        goto fail;
+    }
+
+    /* User and password come before the last @ in the authority. */
+    auth = it + 3;
+    end = auth + strcspn (auth, "/?#");
+    for (it = auth; it < end; it++) {
+        if (*it == '@') {
+            at = it;
+        }
+    }
+    if (at) {
+        colon = memchr (auth, ':', at - auth);
+        if (colon) {
+            url->user = g_uri_unescape_segment (auth, colon, NULL);
+            url->password = g_uri_unescape_segment (colon + 1, at, NULL);
+        } else {
+            url->user = g_uri_unescape_segment (auth, at, NULL);
+        }
+        auth = at + 1;
+    }
+
+    /* IPv6 addresses are in brackets */
+    if (*auth == '[') {
+        it = memchr (auth, ']', end - auth);
+        if (! it) {
+            goto fail;
+        }
+        url->host = g_strndup (auth + 1, it - auth - 1);
+        it++;
+    } else {
+        it = memchr (auth, ':', end - auth);
+        if (! it) {
+            it = end;
+        }
+        url->host = g_strndup (auth, it - auth);
+    }
+    if (! *url->host) {
+        goto fail;
+    }
+
+    if ((it < end) && (*it == ':') && (it + 1 < end)) {
+        port = g_ascii_strtoull (it + 1, &end_port, 10);
+        if ((end_port != end) || (port == 0) || (port > G_MAXUINT16)) {
+            goto fail;
+        }
+        url->port = port;
+    } else if ((it < end) && ((*it != ':') || (it + 1 != end))) {
+        goto fail;
+    }
+
+    /* Path and query, the fragment is not sent. */
+    path = file_net_url_escape (end, strcspn (end, "#"));
+    url->path = (*path == '/') ? g_strdup (path) : g_strconcat ("/", path, NULL);
+    g_free (path);
+
+    /* Same key as the fetched files are known by, the password is not
+       kept in the cache. */
+    url->key = file_url_canonical (str);
+    if (! url->key) {
+        goto fail;
+    }
+    if (url->password) {
+        auth = strstr (url->key, "://") + 3;
+        end = auth + strcspn (auth, "/?#");
+        for (at = NULL, it = auth; it < end; it++) {
+            if (*it == '@') {
+                at = it;
+            }
+        }
+        colon = at ? memchr (auth, ':', at - auth) : NULL;
+        if (colon) {
+            memmove ((gchar*) colon, at, strlen (at) + 1);
+        }
+    }
+
+    return TRUE;
+
+fail:
+    file_net_url_clear (url);
+    return FALSE;
+}
+
+/**
+ * Frees strings in url.
+ *
+ * @param url struct file_net_url to clear.
+ */
+void
+file_net_url_clear (struct file_net_url *url)
+{
+    g_free (url->scheme);
+    g_free (url->user);
+    g_free (url->password);
+    g_free (url->host);
+    g_free (url->path);
+    g_free (url->key);
+    memset (url, 0, sizeof (struct file_net_url));
+}
+
+/**
+ * Returns host and port as used in the Host header, the port is left out
+ * if it is the default for the scheme.
+ *
+ * @param url URL to get host of.
+ * @return Host, needs freeing.
+ */
+gchar*
+file_net_url_host (struct file_net_url *url)
+{
+    gboolean port;
+    const gchar *format;
+
+    port = ! ((! strcmp (url->scheme, "http") && (url->port == 80))
+              || (! strcmp (url->scheme, "https") && (url->port == 443))
+              || (! strcmp (url->scheme, "ftp") && (url->port == 21)));
+    if (strchr (url->host, ':')) {
+        format = port ? "[%s]:%u" : "[%s]";
+    } else {
+        format = port ? "%s:%u" : "%s";
+    }
+
+    return g_strdup_printf (format, url->host, url->port);
+}
+
+/**
+ * Returns scheme and host in lower case, with the port if it is not the
+ * default, identifying the host transfer slots are taken for.
+ *
+ * @param url URL to get origin of.
+ * @return Origin, needs freeing.
+ */
+gchar*
+file_net_url_origin (struct file_net_url *url)
+{
+    gchar *host, *lower, *origin;
+
+    host = file_net_url_host (url);
+    lower = g_ascii_strdown (host, -1);
+    origin = g_strconcat (url->scheme, "://", lower, NULL);
+    g_free (lower);
+    g_free (host);
+
+    return origin;
+}
+
+/**
+ * Escapes space, control and non-ASCII characters not allowed in a
+ * request line.
+ *
+ * @param str String to escape.
+ * @param len Length of str.
+ * @return Escaped string, needs freeing.
+ */
+gchar*
+file_net_url_escape (const gchar *str, gsize len)
+{
+    gsize i;
+    guchar c;
+    GString *escaped;
+
+    escaped = g_string_sized_new (len);
+    for (i = 0; i < len; i++) {
+        c = str[i];
+        if ((c <= 0x20) || (c >= 0x7f)) {
+            g_string_append_printf (escaped, "%%%02X", c);
+        } else {
+            g_string_append_c (escaped, c);
+        }
+    }
+
+    return g_string_free (escaped, FALSE);
+}
+
+/**
+ * Gets connection for URL, an idle one if any and reuse is set.
+ *
+ * @param url URL to connect to.
+ * @param reuse TRUE to take an idle connection.
+ * @return Pointer to struct file_net_conn, NULL on error.
+ */
+struct file_net_conn*
+file_net_conn_get (struct file_net_url *url, gboolean reuse)
+{
+    gchar *key;
+    GQueue *conns;
+    struct file_net_conn *conn = NULL;
+
+    key = g_strdup_printf ("%s://%s@%s:%u", url->scheme,
+                           url->user ? url->user : "", url->host, url->port);
+
+    if (reuse) {
+        g_mutex_lock (&idle_mutex);
+        conns = g_hash_table_lookup (idle, key);
+        if (conns) {
+            conn = g_queue_pop_head (conns);
+        }
+        g_mutex_unlock (&idle_mutex);
+    }
+
+    if (conn) {
+        conn->reused = TRUE;
+    } else {
+        conn = file_net_conn_open (url->host, url->port,
+                                   ! strcmp (url->scheme, "https"), key);
+    }
+    g_free (key);
+
+    return conn;
+}
+
+/**
+ * Opens new connection.
+ *
+ * @param host Host to connect to.
+ * @param port Port to connect to.
+ * @param tls TRUE to use TLS.
+ * @param key Key connection is kept idle by.
+ * @return Pointer to struct file_net_conn, NULL on error.
+ */
+struct file_net_conn*
+file_net_conn_open (const gchar *host, guint16 port, gboolean tls,
+                    const gchar *key)
+{
+    GError *err = NULL;
+    GSocketClient *client;
+    GSocketConnectable *addr;
+    GSocketConnection *sconn;
+    struct file_net_conn *conn;
+
+    /* The timeout covers reads and writes on the connection as well. */
+    client = g_socket_client_new ();
+    g_socket_client_set_timeout (client, FILE_NET_TIMEOUT);
+    g_socket_client_set_tls (client, tls);
+
+    addr = g_network_address_new (host, port);
+    sconn = g_socket_client_connect (client, addr, cancel, &err);
+    g_object_unref (addr);
+    g_object_unref (client);
+
+    if (! sconn) {
+        if (! g_error_matches (err, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_fprintf (stderr, "%s:%u: %s\n", host, port, err->message);
+        }
+        g_error_free (err);
+        return NULL;
+    }
+
+    conn = g_malloc (sizeof (struct file_net_conn));
+    conn->key = g_strdup (key);
+    conn->conn = sconn;
+    conn->in = g_data_input_stream_new (
+        g_io_stream_get_input_stream (G_IO_STREAM (sconn)));
+    g_filter_input_stream_set_close_base_stream (
+        G_FILTER_INPUT_STREAM (conn->in), FALSE);
+    g_data_input_stream_set_newline_type (conn->in,
+                                          G_DATA_STREAM_NEWLINE_TYPE_LF);
+    conn->out = g_io_stream_get_output_stream (G_IO_STREAM (sconn));
+    conn->reused = FALSE;
+
+    return conn;
+}
+
+/**
+ * Puts connection back to be reused, it is closed if enough connections
+ * to the host are idle.
+ *
+ * @param conn Connection to put back.
+ */
+void
+file_net_conn_put (struct file_net_conn *conn)
+{
+    GQueue *conns;
+
+    g_mutex_lock (&idle_mutex);
+    conns = g_hash_table_lookup (idle, conn->key);
+    if (! conns) {
+        conns = g_queue_new ();
+        g_hash_table_insert (idle, g_strdup (conn->key), conns);
+    }
+    /* Most recently used first, least likely to have timed out. */
+    if (g_queue_get_length (conns) < FILE_NET_IDLE) {
+        g_queue_push_head (conns, conn);
+        conn = NULL;
+    }
+    g_mutex_unlock (&idle_mutex);
+
+    if (conn) {
+        file_net_conn_close (conn);
+    }
+}
+
+/**
+ * Closes connection.
+ *
+ * @param conn Connection to close.
+ */
+void
+file_net_conn_close (struct file_net_conn *conn)
+{
+    g_object_unref (conn->in);
+    g_io_stream_close (G_IO_STREAM (conn->conn), NULL, NULL);
+    g_object_unref (conn->conn);
+    g_free (conn->key);
+    g_free (conn);
+}
+
+/**
+ * Closes idle connections to host.
+ *
+ * @param conns GQueue of struct file_net_conn, freed.
+ */
+void
+file_net_conn_close_all (GQueue *conns)
+{
+    struct file_net_conn *conn;
+
+    while ((conn = g_queue_pop_head (conns)) != NULL) {
+        file_net_conn_close (conn);
+    }
+    g_queue_free (conns);
+}
+
+/**
+ * Reads line, the line ending is stripped.
+ *
+ * @param conn Connection to read from.
+ * @return Line, NULL at end of stream or on error, needs freeing.
+ */
+gchar*
+file_net_read_line (struct file_net_conn *conn)
+{
+    gsize len;
+    gchar *line;
+
+    line = g_data_input_stream_read_line (conn->in, &len, cancel, NULL);
+    if (line && (len > 0) && (line[len - 1] == '\r')) {
+        line[len - 1] = '\0';
+    }
+
+    return line;
+}
+
+/**
+ * Writes all of string.
+ *
+ * @param conn Connection to write to.
+ * @param str String to write.
+ * @return TRUE on success, else FALSE.
+ */
+gboolean
+file_net_write (struct file_net_conn *conn, const gchar *str)
+{
+    return g_output_stream_write_all (conn->out, str, strlen (str), NULL,
+                                      cancel, NULL);
+}
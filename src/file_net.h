@@ -0,0 +1,81 @@
+/*
+ * Copyright © 2006-2009 Claes Nästén <me@pekdon.net>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Built-in HTTP(S) and FTP client fetching remote files.
+ */
+
+#ifndef _FILE_NET_H_
+#define _FILE_NET_H_
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <glib.h>
+
+/** Idle connections kept open for each host. */
+#define FILE_NET_IDLE 4
+/** Seconds to wait for a connection or data before giving up. */
+#define FILE_NET_TIMEOUT 30
+/** Number of redirects followed before giving up. */
+#define FILE_NET_REDIRECTS 8
+/** Size of buffer used when reading response bodies. */
+#define FILE_NET_BUF 65536
+/** Size of segments large files are fetched in parallel in. */
+#define FILE_NET_SEGMENT (2 * 1024 * 1024)
+/** Number of connections a file is fetched on at most, also the number
+    of segments kept in memory ahead of the one passed on. */
+#define FILE_NET_SEGMENTS 4
+/** Number of times a transfer failing part way is resumed. */
+#define FILE_NET_RESUMES 3
+
+/**
+ * Validators of remote file. When set before fetching, the file is only
+ * fetched if it changed since, they are replaced by the ones of the file
+ * fetched.
+ */
+struct file_net_meta {
+    gchar *etag; /**< ETag, NULL if none. */
+    gint64 last_modified; /**< Last-Modified as unix time, -1 if none. */
+    gboolean unchanged; /**< Set if the file did not change since, no
+                             data is passed then. */
+};
+
+extern void file_net_init (guint limit, guint host_limit);
+extern void file_net_free (void);
+extern void file_net_stop (void);
+
+extern gchar *file_net_host (const gchar *url);
+extern gboolean file_net_slot_take (const gchar *host);
+extern void file_net_slot_give (const gchar *host);
+extern void file_net_slot_notify (void (*freed)(gpointer), gpointer data);
+
+extern gboolean file_net_fetch (const gchar *url,
+                                gboolean (*chunk)(gpointer, const guchar*,
+                                                  gsize),
+                                gpointer chunk_data,
+                                struct file_net_meta *meta, gboolean *stop);
+
+#endif /* _FILE_NET_H_ */
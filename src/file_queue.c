@@ -34,6 +34,15 @@
 
 #include "file_queue.h"
 
+/** Ring positions wrap around, do the arithmetic unsigned. */
+#define FILE_QUEUE_ADD(a, n) ((gint) ((guint) (a) + (guint) (n)))
+#define FILE_QUEUE_DIFF(a, b) ((gint) ((guint) (a) - (guint) (b)))
+
+static gboolean file_queue_ring_push (struct file_queue *queue,
+                                      struct file_multi *file);
+static struct file_multi *file_queue_ring_pop (struct file_queue *queue);
+static void file_queue_wake (struct file_queue *queue);
+
 /**
  * Creates new struct file_queue.
  *
@@ -43,17 +52,27 @@
 struct file_queue*
 file_queue_new (guint refs)
 {
+    gint i;
     struct file_queue *queue;
 
     queue = g_malloc (sizeof (struct file_queue));
 
-    queue->list = NULL;
-    g_mutex_init (&queue->list_mutex);
-    queue->queue = g_async_queue_new ();
+    queue->table = file_table_new ();
+
+    /* Each slot starts out free for the push at its own position. */
+    queue->ring = g_malloc (sizeof (struct file_queue_slot) * FILE_QUEUE_SIZE);
+    for (i = 0; i < FILE_QUEUE_SIZE; i++) {
+        queue->ring[i].seq = i;
+        queue->ring[i].file = NULL;
+    }
+    queue->ring_push = 0;
+    queue->ring_pop = 0;
 
     queue->active = refs;
-    g_mutex_init (&queue->active_mutex);
-    g_cond_init (&queue->active_cond);
+
+    queue->waiting = 0;
+    g_mutex_init (&queue->wait_mutex);
+    g_cond_init (&queue->wait_cond);
 
     queue->stop = FALSE;
 
@@ -70,20 +89,17 @@ file_queue_free (struct file_queue *queue)
 {
     g_assert (queue);
 
-    if (queue->list) {
-        g_list_free (queue->list);
-    }
-    g_mutex_clear (&queue->list_mutex);
-    g_async_queue_unref (queue->queue);
+    file_table_free (queue->table);
+    g_free (queue->ring);
 
-    g_mutex_clear (&queue->active_mutex);
-    g_cond_clear (&queue->active_cond);
+    g_mutex_clear (&queue->wait_mutex);
+    g_cond_clear (&queue->wait_cond);
 
     g_free (queue);
 }
 
 /**
- * Pushes file onto queue.
+ * Pushes file onto queue, waits for a free slot if the queue is full.
  *
  * @param queue struct file_queue to push file to.
  * @param file struct file_multi to push onto queue.
@@ -93,18 +109,24 @@ file_queue_push (struct file_queue *queue, struct file_multi *file)
 {
     g_assert (queue);
 
-    /* Add file to list of known files */
-    g_mutex_lock (&queue->list_mutex);
-    queue->list = g_list_append (queue->list, file);
-    g_mutex_unlock (&queue->list_mutex);
+    /* Add file to table of known files */
+    file_table_append (queue->table, file);
 
     /* Add active */
-    g_mutex_lock (&queue->active_mutex);
-    queue->active++;
-    g_mutex_unlock (&queue->active_mutex);
+    g_atomic_int_inc (&queue->active);
 
     /* Push to work queue */
-    g_async_queue_push (queue->queue, file);
+    if (! file_queue_ring_push (queue, file)) {
+        g_mutex_lock (&queue->wait_mutex);
+        g_atomic_int_inc (&queue->waiting);
+        while (! file_queue_ring_push (queue, file)) {
+            g_cond_wait (&queue->wait_cond, &queue->wait_mutex);
+        }
+        g_atomic_int_add (&queue->waiting, -1);
+        g_mutex_unlock (&queue->wait_mutex);
+    }
+
+    file_queue_wake (queue);
 }
 
 /**
@@ -112,7 +134,6 @@ file_queue_push (struct file_queue *queue, struct file_multi *file)
  *
  * @param queue struct file_queue to pop file from.
  * @return Pointer to struct file_multi or NULL if no item left.
- * @todo Proper end of queue detection.
  */
 struct file_multi*
 file_queue_pop (struct file_queue *queue)
@@ -121,28 +142,41 @@ file_queue_pop (struct file_queue *queue)
 
     g_assert (queue);
 
-    g_mutex_lock (&queue->active_mutex);
-    file = (struct file_multi*) g_async_queue_try_pop (queue->queue);
-    while (!file && queue->active) {
-        g_cond_wait (&queue->active_cond, &queue->active_mutex);
-        file = (struct file_multi*) g_async_queue_try_pop (queue->queue);
+    file = file_queue_ring_pop (queue);
+    if (! file && g_atomic_int_get (&queue->active)) {
+        /* Register as waiting before checking again, pushers and done
+           check the waiting count after changing the queue. */
+        g_mutex_lock (&queue->wait_mutex);
+        g_atomic_int_inc (&queue->waiting);
+        file = file_queue_ring_pop (queue);
+        while (! file && g_atomic_int_get (&queue->active)) {
+            g_cond_wait (&queue->wait_cond, &queue->wait_mutex);
+            file = file_queue_ring_pop (queue);
+        }
+        g_atomic_int_add (&queue->waiting, -1);
+        g_mutex_unlock (&queue->wait_mutex);
+    }
+
+    /* A slot got free, wake pushers waiting for one. */
+    if (file) {
+        file_queue_wake (queue);
     }
-    g_mutex_unlock (&queue->active_mutex);
 
     return file;
 }
 
 /**
- * Returns the list of files that has been in the queue.
+ * Returns the table of files that has been in the queue.
  *
- * @return GList of struct file_multi that has been in the queue.
+ * @return struct file_table of struct file_multi that has been in the
+ *         queue, in push order.
  */
-GList*
-file_queue_get_list (struct file_queue *queue)
+struct file_table*
+file_queue_get_table (struct file_queue *queue)
 {
     g_assert (queue);
 
-    return queue->list;
+    return queue->table;
 }
 
 /**
@@ -153,12 +187,114 @@ file_queue_get_list (struct file_queue *queue)
 void
 file_queue_done (struct file_queue *queue)
 {
+    gint active;
+
     g_assert (queue);
 
-    g_mutex_lock (&queue->active_mutex);
-    if (queue->active > 0) {
-        queue->active--;
+    do {
+        active = g_atomic_int_get (&queue->active);
+    } while (active > 0
+             && ! g_atomic_int_compare_and_exchange (&queue->active,
+                                                     active, active - 1));
+
+    file_queue_wake (queue);
+}
+
+/**
+ * Pushes file onto the ring without waiting.
+ *
+ * @param queue struct file_queue to push file to.
+ * @param file struct file_multi to push.
+ * @return TRUE if pushed, FALSE if the ring is full.
+ */
+gboolean
+file_queue_ring_push (struct file_queue *queue, struct file_multi *file)
+{
+    gint pos, seq, diff;
+    struct file_queue_slot *slot;
+
+    pos = g_atomic_int_get (&queue->ring_push);
+    for (;;) {
+        slot = &queue->ring[pos & (FILE_QUEUE_SIZE - 1)];
+        seq = g_atomic_int_get (&slot->seq);
+        diff = FILE_QUEUE_DIFF (seq, pos);
+
+        if (diff == 0) {
+            /* Slot is free, claim position */
+            if (g_atomic_int_compare_and_exchange (&queue->ring_push, pos,
+                                                   FILE_QUEUE_ADD (pos, 1))) {
+                break;
+            }
+            pos = g_atomic_int_get (&queue->ring_push);
+        } else if (diff < 0) {
+            /* Slot still filled from the previous lap, ring is full */
+            return FALSE;
+        } else {
+            /* Other pusher claimed position */
+            pos = g_atomic_int_get (&queue->ring_push);
+        }
+    }
+
+    /* Fill slot and publish it to poppers */
+    slot->file = file;
+    g_atomic_int_set (&slot->seq, FILE_QUEUE_ADD (pos, 1));
+
+    return TRUE;
+}
+
+/**
+ * Pops file from the ring without waiting.
+ *
+ * @param queue struct file_queue to pop file from.
+ * @return Pointer to struct file_multi or NULL if the ring is empty.
+ */
+struct file_multi*
+file_queue_ring_pop (struct file_queue *queue)
+{
+    gint pos, seq, diff;
+    struct file_multi *file;
+    struct file_queue_slot *slot;
+
+    pos = g_atomic_int_get (&queue->ring_pop);
+    for (;;) {
+        slot = &queue->ring[pos & (FILE_QUEUE_SIZE - 1)];
+        seq = g_atomic_int_get (&slot->seq);
+        diff = FILE_QUEUE_DIFF (seq, FILE_QUEUE_ADD (pos, 1));
+
+        if (diff == 0) {
+            /* Slot is filled, claim position */
+            if (g_atomic_int_compare_and_exchange (&queue->ring_pop, pos,
+                                                   FILE_QUEUE_ADD (pos, 1))) {
+                break;
+            }
+            pos = g_atomic_int_get (&queue->ring_pop);
+        } else if (diff < 0) {
+            /* Slot not yet filled, ring is empty */
+            return NULL;
+        } else {
+            /* Other popper claimed position */
+            pos = g_atomic_int_get (&queue->ring_pop);
+        }
+    }
+
+    /* Take file and free slot for the push one lap ahead */
+    file = slot->file;
+    g_atomic_int_set (&slot->seq, FILE_QUEUE_ADD (pos, FILE_QUEUE_SIZE));
+
+    return file;
+}
+
+/**
+ * Wakes threads waiting for the queue, if any.
+ *
+ * @param queue struct file_queue that changed.
+ */
+void
+file_queue_wake (struct file_queue *queue)
+{
+    if (g_atomic_int_get (&queue->waiting) > 0) {
+        g_mutex_lock (&queue->wait_mutex);
+        g_cond_broadcast (&queue->wait_cond);
+        g_mutex_unlock (&queue->wait_mutex);
     }
-    g_cond_signal (&queue->active_cond);
-    g_mutex_unlock (&queue->active_mutex);
 }
@@ -36,19 +36,37 @@
 #include <glib.h>
 
 #include "file_multi.h"
+#include "file_table.h"
+
+/** Number of slots in the work ring, must be a power of two. */
+#define FILE_QUEUE_SIZE 4096
+
+/**
+ * Slot in the work ring.
+ */
+struct file_queue_slot {
+    gint seq; /**< Sequence number, tells if slot is free or filled. */
+    struct file_multi *file; /**< File in slot. */
+};
 
 /**
  * Structure holding a thread safe file queue.
+ *
+ * Work is passed in a bounded lock-free ring, pushing onto a full ring
+ * and popping from an empty one waits on the condition.
  */
 struct file_queue {
-    GList *list; /**< List of files */
-    GMutex list_mutex; /**< Lock for list of files */
+    struct file_table *table; /**< Table of files, in push order. */
 
-    GAsyncQueue *queue; /**< Queue containing active files. */
+    struct file_queue_slot *ring; /**< Ring containing active files. */
+    gint ring_push; /**< Position of next push. */
+    gint ring_pop; /**< Position of next pop. */
 
     gint active; /**< Count of active objects. */
-    GMutex active_mutex; /**< Lock for active count. */
-    GCond active_cond; /**< Cond for active cout. */
+
+    gint waiting; /**< Count of threads waiting on wait_cond. */
+    GMutex wait_mutex; /**< Lock for waiting on ring or active count. */
+    GCond wait_cond; /**< Cond for ring and active count changes. */
 
     gboolean stop; /**< Stop flag */
 };
@@ -60,6 +78,6 @@ extern void file_queue_push (struct file_queue *queue, struct file_multi *file);
 extern struct file_multi *file_queue_pop (struct file_queue *queue);
 extern void file_queue_done (struct file_queue *queue);
 
-extern GList *file_queue_get_list (struct file_queue *queue);
+extern struct file_table *file_queue_get_table (struct file_queue *queue);
 
 #endif /* _FILE_QUEUE_H_ */
@@ -0,0 +1,398 @@
+/*
+ * Copyright © 2006-2009 Claes Nästén <me@pekdon.net>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/**
+ * Contention benchmark of the file queue.
+ *
+ * Runs the GAsyncQueue and GList queue file_queue used to be built on
+ * and the current ring with 1, 4 and 32 pushing threads, each with the
+ * same number of popping threads.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <glib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "file_queue.h"
+
+/** Number of entries pushed in each run unless given. */
+#define BENCH_COUNT 20000
+
+/**
+ * The queue before the ring, kept as baseline.
+ */
+struct bench_list_queue {
+    GList *list; /**< List of all files, appended to. */
+    GMutex list_mutex; /**< Lock for list. */
+    GAsyncQueue *queue; /**< Work queue. */
+
+    guint active; /**< Count of active objects. */
+    GMutex active_mutex; /**< Lock for active. */
+    GCond active_cond; /**< Cond for active changes. */
+};
+
+/**
+ * Queue operations run by the benchmark threads.
+ */
+struct bench_ops {
+    const gchar *name; /**< Name in output. */
+    gpointer (*new) (guint refs); /**< Creates queue. */
+    void (*free) (gpointer queue); /**< Frees queue. */
+    void (*push) (gpointer queue, struct file_multi *file); /**< Push. */
+    struct file_multi *(*pop) (gpointer queue); /**< Pop, NULL at end. */
+    void (*done) (gpointer queue); /**< Signal entry finished. */
+};
+
+/**
+ * State shared by the threads of a run.
+ */
+struct bench_run {
+    const struct bench_ops *ops; /**< Queue operations. */
+    gpointer queue; /**< Queue under test. */
+    guint per_thread; /**< Entries pushed by each pushing thread. */
+    gint popped; /**< Entries popped by all threads. */
+};
+
+static gpointer bench_list_new (guint refs);
+static void bench_list_free (gpointer data);
+static void bench_list_push (gpointer data, struct file_multi *file);
+static struct file_multi *bench_list_pop (gpointer data);
+static void bench_list_done (gpointer data);
+
+static gpointer bench_ring_new (guint refs);
+static void bench_ring_free (gpointer data);
+static void bench_ring_push (gpointer data, struct file_multi *file);
+static struct file_multi *bench_ring_pop (gpointer data);
+static void bench_ring_done (gpointer data);
+
+static gpointer bench_pusher (gpointer data);
+static gpointer bench_popper (gpointer data);
+static gdouble bench_run (const struct bench_ops *ops, guint threads,
+                          guint count);
+
+static const struct bench_ops BENCH_LIST = {
+    "list", bench_list_new, bench_list_free,
+    bench_list_push, bench_list_pop, bench_list_done
+};
+static const struct bench_ops BENCH_RING = {
+    "ring", bench_ring_new, bench_ring_free,
+    bench_ring_push, bench_ring_pop, bench_ring_done
+};
+
+/**
+ * Runs both queues with each thread count and prints the time and
+ * throughput. Count of entries per run can be given as argument.
+ */
+int
+main (int argc, char *argv[])
+{
+    static const guint threads[] = { 1, 4, 32 };
+    static const struct bench_ops *ops[] = { &BENCH_LIST, &BENCH_RING };
+    guint i, j, count = BENCH_COUNT;
+    gdouble secs;
+
+    if (argc > 1) {
+        count = strtoul (argv[1], NULL, 10);
+    }
+    if (count == 0) {
+        fprintf (stderr, "usage: %s [count]\n", argv[0]);
+        return 1;
+    }
+
+    printf ("%-6s %8s %10s %12s\n", "queue", "threads", "seconds", "ops/s");
+    for (i = 0; i < G_N_ELEMENTS (threads); i++) {
+        for (j = 0; j < G_N_ELEMENTS (ops); j++) {
+            secs = bench_run (ops[j], threads[i], count);
+            printf ("%-6s %8u %10.3f %12.0f\n", ops[j]->name, threads[i],
+                    secs, (count / threads[i]) * threads[i] / secs);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Runs threads pushing and popping through the queue until it is done.
+ *
+ * @param ops Queue to run.
+ * @param threads Number of pushing threads, as many are popping.
+ * @param count Number of entries to push, divided between threads.
+ * @return Seconds from the first push until the last popper returned.
+ */
+gdouble
+bench_run (const struct bench_ops *ops, guint threads, guint count)
+{
+    guint i;
+    gint64 start;
+    GThread **pushers, **poppers;
+    struct bench_run run;
+
+    run.ops = ops;
+    /* Each pusher holds a reference until it has pushed its entries. */
+    run.queue = ops->new (threads);
+    run.per_thread = count / threads;
+    run.popped = 0;
+
+    pushers = g_malloc (sizeof (GThread*) * threads);
+    poppers = g_malloc (sizeof (GThread*) * threads);
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < threads; i++) {
+        poppers[i] = g_thread_new ("bench_popper", &bench_popper, &run);
+        pushers[i] = g_thread_new ("bench_pusher", &bench_pusher, &run);
+    }
+    for (i = 0; i < threads; i++) {
+        g_thread_join (pushers[i]);
+        g_thread_join (poppers[i]);
+    }
+    start = g_get_monotonic_time () - start;
+
+    if ((guint) run.popped != run.per_thread * threads) {
+        g_error ("%s popped %d of %u", ops->name, run.popped,
+                 run.per_thread * threads);
+    }
+
+    ops->free (run.queue);
+    g_free (pushers);
+    g_free (poppers);
+
+    return start / (gdouble) G_USEC_PER_SEC;
+}
+
+/**
+ * Pushes the thread's share of entries then releases its reference.
+ *
+ * @param data struct bench_run.
+ */
+gpointer
+bench_pusher (gpointer data)
+{
+    guint i;
+    struct bench_run *run = (struct bench_run*) data;
+
+    /* Entries are never dereferenced, any non NULL pointer will do. */
+    for (i = 1; i <= run->per_thread; i++) {
+        run->ops->push (run->queue, GUINT_TO_POINTER (i));
+    }
+    run->ops->done (run->queue);
+
+    return NULL;
+}
+
+/**
+ * Pops entries, marking each done, until the queue is finished.
+ *
+ * @param data struct bench_run.
+ */
+gpointer
+bench_popper (gpointer data)
+{
+    gint popped = 0;
+    struct bench_run *run = (struct bench_run*) data;
+
+    while (run->ops->pop (run->queue)) {
+        popped++;
+        run->ops->done (run->queue);
+    }
+    g_atomic_int_add (&run->popped, popped);
+
+    return NULL;
+}
+
+/**
+ * Creates baseline queue.
+ *
+ * @param refs Number of references before done.
+ * @return struct bench_list_queue.
+ */
+gpointer
+bench_list_new (guint refs)
+{
+    struct bench_list_queue *queue;
+
+    queue = g_malloc (sizeof (struct bench_list_queue));
+
+    queue->list = NULL;
+    g_mutex_init (&queue->list_mutex);
+    queue->queue = g_async_queue_new ();
+
+    queue->active = refs;
+    g_mutex_init (&queue->active_mutex);
+    g_cond_init (&queue->active_cond);
+
+    return queue;
+}
+
+/**
+ * Frees baseline queue.
+ *
+ * @param data struct bench_list_queue.
+ */
+void
+bench_list_free (gpointer data)
+{
+    struct bench_list_queue *queue = (struct bench_list_queue*) data;
+
+    g_list_free (queue->list);
+    g_mutex_clear (&queue->list_mutex);
+    g_async_queue_unref (queue->queue);
+
+    g_mutex_clear (&queue->active_mutex);
+    g_cond_clear (&queue->active_cond);
+
+    g_free (queue);
+}
+
+/**
+ * Pushes onto baseline queue.
+ *
+ * @param data struct bench_list_queue.
+ * @param file Entry to push.
+ */
+void
+bench_list_push (gpointer data, struct file_multi *file)
+{
+    struct bench_list_queue *queue = (struct bench_list_queue*) data;
+
+    g_mutex_lock (&queue->list_mutex);
+    queue->list = g_list_append (queue->list, file);
+    g_mutex_unlock (&queue->list_mutex);
+
+    g_mutex_lock (&queue->active_mutex);
+    queue->active++;
+    g_mutex_unlock (&queue->active_mutex);
+
+    g_async_queue_push (queue->queue, file);
+}
+
+/**
+ * Pops from baseline queue.
+ *
+ * @param data struct bench_list_queue.
+ * @return Entry or NULL if no entry left.
+ */
+struct file_multi*
+bench_list_pop (gpointer data)
+{
+    struct file_multi *file;
+    struct bench_list_queue *queue = (struct bench_list_queue*) data;
+
+    g_mutex_lock (&queue->active_mutex);
+    file = (struct file_multi*) g_async_queue_try_pop (queue->queue);
+    while (! file && queue->active) {
+        g_cond_wait (&queue->active_cond, &queue->active_mutex);
+        file = (struct file_multi*) g_async_queue_try_pop (queue->queue);
+    }
+    g_mutex_unlock (&queue->active_mutex);
+
+    return file;
+}
+
+/**
+ * Signals entry finished in baseline queue.
+ *
+ * @param data struct bench_list_queue.
+ */
+void
+bench_list_done (gpointer data)
+{
+    struct bench_list_queue *queue = (struct bench_list_queue*) data;
+
+    g_mutex_lock (&queue->active_mutex);
+    if (queue->active > 0) {
+        queue->active--;
+    }
+    /* Only one popper was ever run on it, wake all at the end so the
+       others see it is done. */
+    if (queue->active == 0) {
+        g_cond_broadcast (&queue->active_cond);
+    } else {
+        g_cond_signal (&queue->active_cond);
+    }
+    g_mutex_unlock (&queue->active_mutex);
+}
+
+/**
+ * Creates ring queue.
+ *
+ * @param refs Number of references before done.
+ * @return struct file_queue.
+ */
+gpointer
+bench_ring_new (guint refs)
+{
+    return file_queue_new (refs);
+}
+
+/**
+ * Frees ring queue.
+ *
+ * @param data struct file_queue.
+ */
+void
+bench_ring_free (gpointer data)
+{
+    file_queue_free ((struct file_queue*) data);
+}
+
+/**
+ * Pushes onto ring queue.
+ *
+ * @param data struct file_queue.
+ * @param file Entry to push.
+ */
+void
+bench_ring_push (gpointer data, struct file_multi *file)
+{
+    file_queue_push ((struct file_queue*) data, file);
+}
+
+/**
+ * Pops from ring queue.
+ *
+ * @param data struct file_queue.
+ * @return Entry or NULL if no entry left.
+ */
+struct file_multi*
+bench_ring_pop (gpointer data)
+{
+    return file_queue_pop ((struct file_queue*) data);
+}
+
+/**
+ * Signals entry finished in ring queue.
+ *
+ * @param data struct file_queue.
+ */
+void
+bench_ring_done (gpointer data)
+{
+    file_queue_done ((struct file_queue*) data);
+}
@@ -0,0 +1,309 @@
+/*
+ * Copyright © 2006-2009 Claes Nästén <me@pekdon.net>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Content type detection from the first bytes of a file, used to skip
+ * files that are not images without decoding them.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "file_sniff.h"
+
+/**
+ * Magic number at the start of a file.
+ */
+struct file_sniff_magic {
+    guint type; /**< FILE_SNIFF_ type. */
+    gsize offset; /**< Offset of magic in file. */
+    const gchar *magic; /**< Magic bytes. */
+    gsize len; /**< Length of magic. */
+};
+
+/** Magic numbers of binary formats, checked in order. */
+static const struct file_sniff_magic file_sniff_magics[] = {
+    {FILE_SNIFF_JPEG, 0, "\xff\xd8\xff", 3},
+    {FILE_SNIFF_PNG, 0, "\x89PNG\r\n\x1a\n", 8},
+    {FILE_SNIFF_GIF, 0, "GIF87a", 6},
+    {FILE_SNIFF_GIF, 0, "GIF89a", 6},
+    {FILE_SNIFF_BMP, 0, "BM", 2},
+    {FILE_SNIFF_TIFF, 0, "II*\0", 4},
+    {FILE_SNIFF_TIFF, 0, "MM\0*", 4},
+    {FILE_SNIFF_WEBP, 8, "WEBP", 4},
+    {FILE_SNIFF_ICO, 0, "\0\0\1\0", 4},
+    {FILE_SNIFF_ICO, 0, "\0\0\2\0", 4},
+    {FILE_SNIFF_JXL, 0, "\xff\x0a", 2},
+    {FILE_SNIFF_JXL, 0, "\0\0\0\x0cJXL \r\n\x87\n", 12},
+    {FILE_SNIFF_HEIF, 8, "heic", 4},
+    {FILE_SNIFF_HEIF, 8, "heix", 4},
+    {FILE_SNIFF_HEIF, 8, "mif1", 4},
+    {FILE_SNIFF_HEIF, 8, "avif", 4},
+    {FILE_SNIFF_OTHER, 4, "ftyp", 4}, /* MP4, MOV and other video */
+    {FILE_SNIFF_ANI, 8, "ACON", 4}, /* RIFF animated cursor */
+    {FILE_SNIFF_OTHER, 0, "RIFF", 4}, /* AVI, WAV, not WEBP or ANI */
+    {FILE_SNIFF_OTHER, 0, "%PDF-", 5},
+    {FILE_SNIFF_OTHER, 0, "PK\3\4", 4},
+    {FILE_SNIFF_OTHER, 0, "\x1f\x8b", 2},
+    {FILE_SNIFF_OTHER, 0, "\x7f" "ELF", 4},
+    {FILE_SNIFF_OTHER, 0, "ID3", 3},
+    {FILE_SNIFF_OTHER, 0, "OggS", 4},
+    {FILE_SNIFF_OTHER, 0, "fLaC", 4},
+    {FILE_SNIFF_OTHER, 0, "\x1a\x45\xdf\xa3", 4}, /* Matroska, WebM */
+    {FILE_SNIFF_OTHER, 0, "7z\xbc\xaf\x27\x1c", 6},
+    {FILE_SNIFF_OTHER, 0, "Rar!", 4},
+    {FILE_SNIFF_UNKNOWN, 0, NULL, 0}
+};
+
+static guint file_sniff_text (const guchar *data, gsize len);
+static const guchar *file_sniff_find (const guchar *data, gsize len,
+                                      const gchar *needle);
+
+/**
+ * Detects type of data.
+ *
+ * @param data Data from the start of a file.
+ * @param len Length of data, at most FILE_SNIFF_SIZE is used.
+ * @return FILE_SNIFF_ type.
+ */
+guint
+file_sniff_data (const guchar *data, gsize len)
+{
+    const struct file_sniff_magic *m;
+
+    g_assert (data || ! len);
+
+    if (len == 0) {
+        return FILE_SNIFF_OTHER;
+    }
+    len = MIN (len, FILE_SNIFF_SIZE);
+
+    for (m = file_sniff_magics; m->magic; m++) {
+        if ((m->offset + m->len <= len)
+            && ! memcmp (data + m->offset, m->magic, m->len)) {
+            return m->type;
+        }
+    }
+
+    /* PNM, P1 to P7 followed by white space */
+    if ((len >= 3) && (data[0] == 'P') && (data[1] >= '1')
+        && (data[1] <= '7') && g_ascii_isspace (data[2])) {
+        return FILE_SNIFF_PNM;
+    }
+
+    return file_sniff_text (data, len);
+}
+
+/**
+ * Detects type of file reading only the first FILE_SNIFF_SIZE bytes.
+ *
+ * @param path Path to file.
+ * @return FILE_SNIFF_ type, FILE_SNIFF_UNKNOWN if it can not be read.
+ */
+guint
+file_sniff_path (const gchar *path)
+{
+    int fd;
+    ssize_t len;
+    guchar buf[FILE_SNIFF_SIZE];
+
+    g_assert (path);
+
+    fd = g_open (path, O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1) {
+        return FILE_SNIFF_UNKNOWN;
+    }
+    len = read (fd, buf, sizeof (buf));
+    close (fd);
+
+    if (len == -1) {
+        return FILE_SNIFF_UNKNOWN;
+    }
+
+    return file_sniff_data (buf, len);
+}
+
+/**
+ * Checks if type is a recognised image format.
+ *
+ * @param type FILE_SNIFF_ type.
+ * @return TRUE if an image.
+ */
+gboolean
+file_sniff_is_image (guint type)
+{
+    return type >= FILE_SNIFF_JPEG;
+}
+
+/**
+ * Checks if type can be an image, unrecognised binary data is left to
+ * the image loaders as they might know the format.
+ *
+ * @param type FILE_SNIFF_ type.
+ * @return TRUE if worth decoding.
+ */
+gboolean
+file_sniff_maybe_image (guint type)
+{
+    return (type == FILE_SNIFF_UNCHECKED) || (type == FILE_SNIFF_UNKNOWN)
+        || file_sniff_is_image (type);
+}
+
+/**
+ * Gets name of GdkPixbuf loader for type.
+ *
+ * @param type FILE_SNIFF_ type.
+ * @return Name of loader, NULL if not known.
+ */
+const gchar*
+file_sniff_loader (guint type)
+{
+    switch (type) {
+    case FILE_SNIFF_JPEG:
+        return "jpeg";
+    case FILE_SNIFF_PNG:
+        return "png";
+    case FILE_SNIFF_GIF:
+        return "gif";
+    case FILE_SNIFF_BMP:
+        return "bmp";
+    case FILE_SNIFF_TIFF:
+        return "tiff";
+    case FILE_SNIFF_WEBP:
+        return "webp";
+    case FILE_SNIFF_ICO:
+        return "ico";
+    case FILE_SNIFF_PNM:
+        return "pnm";
+    case FILE_SNIFF_XPM:
+        return "xpm";
+    case FILE_SNIFF_SVG:
+        return "svg";
+    case FILE_SNIFF_XBM:
+        return "xbm";
+    case FILE_SNIFF_ANI:
+        return "ani";
+    default:
+        return NULL;
+    }
+}
+
+/**
+ * Detects type of data not matching any binary magic.
+ *
+ * @param data Data from the start of a file.
+ * @param len Length of data.
+ * @return FILE_SNIFF_ type.
+ */
+guint
+file_sniff_text (const guchar *data, gsize len)
+{
+    gsize i;
+
+    /* Control characters other than white space means binary */
+    for (i = 0; i < len; i++) {
+        if ((data[i] < 0x20) && ! g_ascii_isspace (data[i])
+            && (data[i] != 0x1b)) {
+            return FILE_SNIFF_UNKNOWN;
+        }
+    }
+
+    /* Skip UTF-8 BOM and leading white space */
+    i = 0;
+    if ((len >= 3) && ! memcmp (data, "\xef\xbb\xbf", 3)) {
+        i = 3;
+    }
+    while ((i < len) && g_ascii_isspace (data[i])) {
+        i++;
+    }
+
+    if (file_sniff_find (data + i, len - i, "/* XPM */") == data + i) {
+        return FILE_SNIFF_XPM;
+    }
+    /* XBM is C source, #define name_width first */
+    if ((file_sniff_find (data + i, len - i, "#define") == data + i)
+        && file_sniff_find (data + i, len - i, "_width")) {
+        return FILE_SNIFF_XBM;
+    }
+    if ((i < len) && (data[i] == '<')) {
+        /* SVG starts with <svg, possibly after a prolog, while HTML can
+           have inline SVG further down. */
+        if (file_sniff_find (data + i, len - i, "<html")
+            || file_sniff_find (data + i, len - i, "<!doctype html")) {
+            return FILE_SNIFF_HTML;
+        }
+        if (file_sniff_find (data + i, len - i, "<svg")
+            || file_sniff_find (data + i, len - i, "<!doctype svg")) {
+            return FILE_SNIFF_SVG;
+        }
+
+        /* A long prolog, comment or DOCTYPE can push the <svg past the
+           head, XML that is not HTML is left to the loaders. */
+        if ((file_sniff_find (data + i, len - i, "<?xml") == data + i)
+            || (file_sniff_find (data + i, len - i, "<!--") == data + i)
+            || (file_sniff_find (data + i, len - i, "<!doctype")
+                == data + i)) {
+            return FILE_SNIFF_UNKNOWN;
+        }
+        return FILE_SNIFF_HTML;
+    }
+
+    return FILE_SNIFF_TEXT;
+}
+
+/**
+ * Finds needle in data, ignoring ASCII case.
+ *
+ * @param data Data to search.
+ * @param len Length of data.
+ * @param needle NUL terminated string to find.
+ * @return Pointer to needle in data, NULL if not found.
+ */
+const guchar*
+file_sniff_find (const guchar *data, gsize len, const gchar *needle)
+{
+    gsize i, j, needle_len = strlen (needle);
+
+    for (i = 0; i + needle_len <= len; i++) {
+        for (j = 0; j < needle_len; j++) {
+            if (g_ascii_tolower (data[i + j])
+                != g_ascii_tolower (needle[j])) {
+                break;
+            }
+        }
+        if (j == needle_len) {
+            return data + i;
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright © 2006-2009 Claes Nästén <me@pekdon.net>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/**
+ * Content type detection from the first bytes of a file.
+ */
+
+#ifndef _FILE_SNIFF_H_
+#define _FILE_SNIFF_H_
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <glib.h>
+
+/** Number of bytes read from the start of a file to detect type. */
+#define FILE_SNIFF_SIZE 512
+
+#define FILE_SNIFF_UNCHECKED 0 /**< Not sniffed yet. */
+#define FILE_SNIFF_UNKNOWN 1 /**< Binary data not recognised. */
+#define FILE_SNIFF_OTHER 2 /**< Recognised, not an image. */
+#define FILE_SNIFF_TEXT 3 /**< Plain text. */
+#define FILE_SNIFF_HTML 4 /**< HTML or other markup. */
+#define FILE_SNIFF_JPEG 5
+#define FILE_SNIFF_PNG 6
+#define FILE_SNIFF_GIF 7
+#define FILE_SNIFF_BMP 8
+#define FILE_SNIFF_TIFF 9
+#define FILE_SNIFF_WEBP 10
+#define FILE_SNIFF_ICO 11
+#define FILE_SNIFF_PNM 12
+#define FILE_SNIFF_XPM 13
+#define FILE_SNIFF_SVG 14
+#define FILE_SNIFF_HEIF 15
+#define FILE_SNIFF_JXL 16
+#define FILE_SNIFF_XBM 17
+#define FILE_SNIFF_ANI 18
+
+extern guint file_sniff_data (const guchar *data, gsize len);
+extern guint file_sniff_path (const gchar *path);
+
+extern gboolean file_sniff_is_image (guint type);
+extern gboolean file_sniff_maybe_image (guint type);
+extern const gchar *file_sniff_loader (guint type);
+
+#endif /* _FILE_SNIFF_H_ */
@@ -0,0 +1,246 @@
+/*
+ * Copyright © 2006-2009 Claes Nästén <me@pekdon.net>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Append-only indexed file table.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <glib.h>
+
+#include "file_table.h"
+
+static struct file_table_entry *file_table_entry (struct file_table *table,
+                                                  guint index);
+
+/**
+ * Creates new empty struct file_table.
+ *
+ * @return Pointer to struct file_table.
+ */
+struct file_table*
+file_table_new (void)
+{
+    struct file_table *table;
+
+    table = g_malloc0 (sizeof (struct file_table));
+    g_mutex_init (&table->mutex);
+
+    return table;
+}
+
+/**
+ * Frees table, files in it are not closed.
+ *
+ * @param table struct file_table to free.
+ */
+void
+file_table_free (struct file_table *table)
+{
+    guint i;
+
+    g_assert (table);
+
+    for (i = 0; i < FILE_TABLE_CHUNKS && table->chunks[i]; i++) {
+        g_free (table->chunks[i]);
+    }
+    g_mutex_clear (&table->mutex);
+    g_free (table);
+}
+
+/**
+ * Appends file to table.
+ *
+ * @param table struct file_table to append to.
+ * @param file struct file_multi to append.
+ * @return Index of file in table.
+ */
+guint
+file_table_append (struct file_table *table, struct file_multi *file)
+{
+    guint index;
+    struct file_table_entry *entry;
+
+    g_assert (table);
+
+    g_mutex_lock (&table->mutex);
+
+    index = table->len;
+    if (index / FILE_TABLE_CHUNK >= FILE_TABLE_CHUNKS) {
+        g_error ("more than %u files", FILE_TABLE_CHUNK * FILE_TABLE_CHUNKS);
+    }
+    if (! table->chunks[index / FILE_TABLE_CHUNK]) {
+        table->chunks[index / FILE_TABLE_CHUNK] =
+            g_malloc (sizeof (struct file_table_entry) * FILE_TABLE_CHUNK);
+    }
+
+    entry = &table->chunks[index / FILE_TABLE_CHUNK][index
+                                                     % FILE_TABLE_CHUNK];
+    entry->file = file;
+    entry->removed = FALSE;
+
+    /* Publish entry, readers check the length before reading it. */
+    g_atomic_int_set (&table->len, index + 1);
+
+    g_mutex_unlock (&table->mutex);
+
+    return index;
+}
+
+/**
+ * Marks entry as removed, it keeps its index and file.
+ *
+ * @param table struct file_table to remove from.
+ * @param index Index of entry.
+ */
+void
+file_table_remove (struct file_table *table, guint index)
+{
+    g_atomic_int_set (&file_table_entry (table, index)->removed, TRUE);
+}
+
+/**
+ * Returns number of entries, entries below it do not change so the
+ * length is a snapshot of the table.
+ *
+ * @param table struct file_table to get length of.
+ * @return Number of entries.
+ */
+guint
+file_table_len (struct file_table *table)
+{
+    g_assert (table);
+
+    return g_atomic_int_get (&table->len);
+}
+
+/**
+ * Returns file at index.
+ *
+ * @param table struct file_table to get file from.
+ * @param index Index below file_table_len.
+ * @return Pointer to struct file_multi.
+ */
+struct file_multi*
+file_table_get (struct file_table *table, guint index)
+{
+    return file_table_entry (table, index)->file;
+}
+
+/**
+ * Checks if entry at index has been removed.
+ *
+ * @param table struct file_table to check.
+ * @param index Index below file_table_len.
+ * @return TRUE if removed.
+ */
+gboolean
+file_table_is_removed (struct file_table *table, guint index)
+{
+    return g_atomic_int_get (&file_table_entry (table, index)->removed);
+}
+
+/**
+ * Steps to the next entry not removed, wrapping around at the ends.
+ *
+ * @param table struct file_table to step in.
+ * @param index Index to step from, FILE_TABLE_NONE starts at the first
+ *              entry stepping forward and the last stepping back. Set to
+ *              the new index.
+ * @param step 1 to step forward, -1 to step back.
+ * @return TRUE if an entry was found, FALSE if all are removed.
+ */
+gboolean
+file_table_step (struct file_table *table, guint *index, gint step)
+{
+    guint i, pos, len;
+
+    g_assert (table);
+    g_assert (index);
+
+    len = file_table_len (table);
+    pos = *index;
+    for (i = 0; i < len; i++) {
+        if (pos >= len) {
+            pos = (step > 0) ? 0 : len - 1;
+        } else if (step > 0) {
+            pos = (pos + 1 == len) ? 0 : pos + 1;
+        } else {
+            pos = (pos == 0) ? len - 1 : pos - 1;
+        }
+
+        if (! file_table_is_removed (table, pos)) {
+            *index = pos;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/**
+ * Seeks to entry at target, or the first entry not removed after it.
+ *
+ * @param table struct file_table to seek in.
+ * @param index Set to the new index.
+ * @param target Index to seek to, clamped to the last entry.
+ * @return TRUE if an entry was found, FALSE if all are removed.
+ */
+gboolean
+file_table_seek (struct file_table *table, guint *index, guint target)
+{
+    guint len;
+
+    g_assert (table);
+    g_assert (index);
+
+    len = file_table_len (table);
+    if (len == 0) {
+        return FALSE;
+    }
+
+    target = MIN (target, len - 1);
+    *index = (target == 0) ? FILE_TABLE_NONE : target - 1;
+
+    return file_table_step (table, index, 1);
+}
+
+/**
+ * Returns entry at index.
+ *
+ * @param table struct file_table to get entry from.
+ * @param index Index below file_table_len.
+ * @return Pointer to struct file_table_entry.
+ */
+struct file_table_entry*
+file_table_entry (struct file_table *table, guint index)
+{
+    g_assert (table);
+    g_assert (index < file_table_len (table));
+
+    return &table->chunks[index / FILE_TABLE_CHUNK][index % FILE_TABLE_CHUNK];
+}
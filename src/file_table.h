@@ -0,0 +1,85 @@
+/*
+ * Copyright © 2006-2009 Claes Nästén <me@pekdon.net>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Append-only indexed file table, filled by workers and read without
+ * locking.
+ */
+
+#ifndef _FILE_TABLE_H_
+#define _FILE_TABLE_H_
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <glib.h>
+
+#include "file_multi.h"
+
+/** Number of entries in a chunk, must be a power of two. */
+#define FILE_TABLE_CHUNK 4096
+/** Maximum number of chunks, a table holds FILE_TABLE_CHUNK times this. */
+#define FILE_TABLE_CHUNKS 16384
+/** Index meaning no entry. */
+#define FILE_TABLE_NONE G_MAXUINT
+
+/**
+ * Entry in the table.
+ */
+struct file_table_entry {
+    struct file_multi *file; /**< File at index. */
+    gint removed; /**< Set when file is no longer shown. */
+};
+
+/**
+ * File table. Entries live in chunks that are never moved, so an entry
+ * below the published length can be read without locking and a length
+ * read once is a stable snapshot.
+ */
+struct file_table {
+    struct file_table_entry *chunks[FILE_TABLE_CHUNKS]; /**< Chunks of
+                                                             entries. */
+    gint len; /**< Number of published entries. */
+    GMutex mutex; /**< Serialises appends. */
+};
+
+extern struct file_table *file_table_new (void);
+extern void file_table_free (struct file_table *table);
+
+extern guint file_table_append (struct file_table *table,
+                                struct file_multi *file);
+extern void file_table_remove (struct file_table *table, guint index);
+
+extern guint file_table_len (struct file_table *table);
+extern struct file_multi *file_table_get (struct file_table *table,
+                                          guint index);
+extern gboolean file_table_is_removed (struct file_table *table,
+                                       guint index);
+extern gboolean file_table_step (struct file_table *table, guint *index,
+                                 gint step);
+extern gboolean file_table_seek (struct file_table *table, guint *index,
+                                 guint target);
+
+#endif /* _FILE_TABLE_H_ */
@@ -0,0 +1,498 @@
+/*
+ * Copyright © 2006-2009 Claes Nästén <me@pekdon.net>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/**
+ * Canonical form of URLs, used as the key when checking if a file was
+ * fetched already. The form follows RFC 3986: relative references are
+ * resolved against the base, scheme and host are lower-cased, the
+ * default port and dot segments are removed, escapes are upper-cased
+ * and unreserved characters unescaped. On top of that the fragment and
+ * query parameters matching the strip rules, tracking parameters by
+ * default, are dropped.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <glib.h>
+#include <string.h>
+
+#include "file_url.h"
+
+/**
+ * Components of a URL reference, pointing into the reference.
+ */
+struct file_url_ref {
+    const gchar *scheme; /**< Scheme, NULL if relative. */
+    gsize scheme_len; /**< Length of scheme. */
+    const gchar *auth; /**< Authority after //, NULL if none. */
+    gsize auth_len; /**< Length of authority. */
+    const gchar *path; /**< Path, may be empty. */
+    gsize path_len; /**< Length of path. */
+    const gchar *query; /**< Query after ?, NULL if none. */
+    gsize query_len; /**< Length of query. */
+};
+
+static void file_url_parse (const gchar *str, struct file_url_ref *ref);
+static gboolean file_url_is_supported (struct file_url_ref *ref);
+static void file_url_append_auth (GString *url, struct file_url_ref *ref);
+static void file_url_append_path (GString *url, const gchar *dir,
+                                  gsize dir_len, const gchar *path,
+                                  gsize path_len);
+static void file_url_append_query (GString *url, const gchar *query,
+                                   gsize len);
+static void file_url_append_escaped (GString *url, const gchar *str,
+                                     gsize len);
+static gboolean file_url_is_default_port (struct file_url_ref *ref,
+                                          const gchar *port, gsize len);
+static gboolean file_url_strip (const gchar *name, gsize len);
+static gboolean file_url_is (const gchar *str, gsize len,
+                             const gchar *name);
+
+/** Query parameters stripped unless other rules are given. */
+static const gchar *strip_default[] = { "utm_*", "fbclid", "gclid", NULL };
+
+/** Patterns of query parameter names to strip, NULL if none. */
+static GPtrArray *strip = NULL;
+
+/**
+ * Sets up the query strip rules.
+ *
+ * @param patterns NULL terminated list of patterns query parameter names
+ *                 are stripped if matching, NULL for the default rules.
+ *                 Empty patterns are skipped so that giving only an empty
+ *                 pattern strips nothing.
+ */
+void
+file_url_init (gchar **patterns)
+{
+    guint i;
+
+    if (! patterns) {
+        patterns = (gchar**) strip_default;
+    }
+
+    strip = g_ptr_array_new_with_free_func (
+        (GDestroyNotify) &g_pattern_spec_free);
+    for (i = 0; patterns[i] != NULL; i++) {
+        if (*patterns[i]) {
+            g_ptr_array_add (strip, g_pattern_spec_new (patterns[i]));
+        }
+    }
+}
+
+/**
+ * Frees the query strip rules.
+ */
+void
+file_url_free (void)
+{
+    if (strip) {
+        g_ptr_array_free (strip, TRUE);
+        strip = NULL;
+    }
+}
+
+/**
+ * Resolves reference against base and returns it in canonical form.
+ * Only http, https, ftp and file URLs are resolved.
+ *
+ * @param base Absolute URL of the document the reference is in, NULL if
+ *             the reference must be absolute.
+ * @param ref Absolute or relative reference.
+ * @return Canonical URL, needs freeing. NULL if ref does not resolve to
+ *         a supported URL.
+ */
+gchar*
+file_url_resolve (const gchar *base, const gchar *ref)
+{
+    GString *url;
+    gsize i, dir_len = 0;
+    const gchar *dir = NULL;
+    struct file_url_ref r, b;
+
+    file_url_parse (ref, &r);
+
+    /* RFC 3986 section 5.2.2, the base fills in what the reference
+       leaves out. */
+    if (! r.scheme) {
+        if (! base) {
+            return NULL;
+        }
+        file_url_parse (base, &b);
+        r.scheme = b.scheme;
+        r.scheme_len = b.scheme_len;
+        if (! r.auth) {
+            r.auth = b.auth;
+            r.auth_len = b.auth_len;
+            if (r.path_len == 0) {
+                r.path = b.path;
+                r.path_len = b.path_len;
+                if (! r.query) {
+                    r.query = b.query;
+                    r.query_len = b.query_len;
+                }
+            } else if (r.path[0] != '/') {
+                /* Relative to the directory of the base path */
+                dir = b.path;
+                for (dir_len = b.path_len;
+                     (dir_len > 0) && (dir[dir_len - 1] != '/'); dir_len--)
+                    ;
+                if ((dir_len == 0) && b.auth) {
+                    dir = "/";
+                    dir_len = 1;
+                }
+            }
+        }
+    }
+
+    if (! r.scheme || ! r.auth || ! file_url_is_supported (&r)) {
+        return NULL;
+    }
+
+    url = g_string_sized_new (r.scheme_len + r.auth_len + dir_len
+                              + r.path_len + r.query_len + 8);
+    for (i = 0; i < r.scheme_len; i++) {
+        g_string_append_c (url, g_ascii_tolower (r.scheme[i]));
+    }
+    g_string_append (url, "://");
+    file_url_append_auth (url, &r);
+    file_url_append_path (url, dir, dir_len, r.path, r.path_len);
+    if (r.query) {
+        file_url_append_query (url, r.query, r.query_len);
+    }
+
+    return g_string_free (url, FALSE);
+}
+
+/**
+ * Returns absolute URL in canonical form.
+ *
+ * @param url Absolute URL.
+ * @return Canonical URL, needs freeing. NULL if url is not a supported
+ *         absolute URL.
+ */
+gchar*
+file_url_canonical (const gchar *url)
+{
+    return file_url_resolve (NULL, url);
+}
+
+/**
+ * Splits reference into its components, RFC 3986 appendix B. Splitting
+ * stops after a scheme that is not supported, the rest of a data: URI
+ * can be large.
+ *
+ * @param str Reference to split.
+ * @param ref Set to the components of str.
+ */
+void
+file_url_parse (const gchar *str, struct file_url_ref *ref)
+{
+    const gchar *it;
+
+    memset (ref, 0, sizeof (struct file_url_ref));
+
+    /* Scheme is a letter followed by letters, digits, +, - and . */
+    if (g_ascii_isalpha (*str)) {
+        for (it = str + 1; g_ascii_isalnum (*it) || (*it == '+')
+                 || (*it == '-') || (*it == '.'); it++)
+            ;
+        if (*it == ':') {
+            ref->scheme = str;
+            ref->scheme_len = it - str;
+            str = it + 1;
+            if (! file_url_is_supported (ref)) {
+                return;
+            }
+        }
+    }
+
+    if ((str[0] == '/') && (str[1] == '/')) {
+        ref->auth = str + 2;
+        ref->auth_len = strcspn (ref->auth, "/?#");
+        str = ref->auth + ref->auth_len;
+    }
+
+    ref->path = str;
+    ref->path_len = strcspn (str, "?#");
+    str += ref->path_len;
+
+    if (*str == '?') {
+        ref->query = str + 1;
+        ref->query_len = strcspn (ref->query, "#");
+    }
+}
+
+/**
+ * Checks if the scheme of reference is one URLs are resolved for.
+ *
+ * @param ref Reference with scheme.
+ * @return TRUE if scheme is http, https, ftp or file, else FALSE.
+ */
+gboolean
+file_url_is_supported (struct file_url_ref *ref)
+{
+    return file_url_is (ref->scheme, ref->scheme_len, "http")
+        || file_url_is (ref->scheme, ref->scheme_len, "https")
+        || file_url_is (ref->scheme, ref->scheme_len, "ftp")
+        || file_url_is (ref->scheme, ref->scheme_len, "file");
+}
+
+/**
+ * Appends authority with the host in lower case and the port left out if
+ * it is the default for the scheme. User information is kept as is.
+ *
+ * @param url URL being built.
+ * @param ref Reference holding the authority.
+ */
+void
+file_url_append_auth (GString *url, struct file_url_ref *ref)
+{
+    const gchar *it, *host, *host_end, *port, *end;
+
+    end = ref->auth + ref->auth_len;
+
+    /* Host follows the last @ */
+    for (host = end; (host > ref->auth) && (host[-1] != '@'); host--)
+        ;
+    g_string_append_len (url, ref->auth, host - ref->auth);
+
+    /* Port follows the last colon, unless in IPv6 brackets */
+    for (port = end; (port > host) && (port[-1] != ':')
+             && (port[-1] != ']'); port--)
+        ;
+    if ((port > host) && (port[-1] == ':')) {
+        host_end = port - 1;
+    } else {
+        host_end = port = end;
+    }
+
+    for (it = host; it < host_end; it++) {
+        g_string_append_c (url, g_ascii_tolower (*it));
+    }
+    if ((port < end) && ! file_url_is_default_port (ref, port, end - port)) {
+        g_string_append_c (url, ':');
+        g_string_append_len (url, port, end - port);
+    }
+}
+
+/**
+ * Appends path with dot segments removed, RFC 3986 section 5.2.4.
+ *
+ * @param url URL being built.
+ * @param dir Directory path is relative to, NULL if none.
+ * @param dir_len Length of dir.
+ * @param path Path.
+ * @param path_len Length of path.
+ */
+void
+file_url_append_path (GString *url, const gchar *dir, gsize dir_len,
+                      const gchar *path, gsize path_len)
+{
+    gsize start, len;
+    gchar *merged, *in;
+
+    merged = g_malloc (dir_len + path_len + 1);
+    if (dir_len > 0) {
+        memcpy (merged, dir, dir_len);
+    }
+    memcpy (merged + dir_len, path, path_len);
+    merged[dir_len + path_len] = '\0';
+
+    start = url->len;
+    for (in = merged; *in; ) {
+        if (! strncmp (in, "../", 3)) {
+            in += 3;
+        } else if (! strncmp (in, "./", 2) || ! strncmp (in, "/./", 3)) {
+            in += 2;
+        } else if (! strcmp (in, "/.")) {
+            *++in = '/';
+        } else if (! strncmp (in, "/../", 4) || ! strcmp (in, "/..")) {
+            if (in[3] == '/') {
+                in += 3;
+            } else {
+                in += 2;
+                *in = '/';
+            }
+
+            /* Drop last segment of output and its / */
+            for (len = url->len; (len > start) && (url->str[len] != '/');
+                 len--)
+                ;
+            g_string_truncate (url, len);
+        } else if (! strcmp (in, ".") || ! strcmp (in, "..")) {
+            break;
+        } else {
+            len = (*in == '/') ? 1 + strcspn (in + 1, "/") : strcspn (in, "/");
+            file_url_append_escaped (url, in, len);
+            in += len;
+        }
+    }
+
+    if (url->len == start) {
+        g_string_append_c (url, '/');
+    }
+    g_free (merged);
+}
+
+/**
+ * Appends query without the parameters matching the strip rules and
+ * without empty parameters, nothing is appended if none is left.
+ *
+ * @param url URL being built.
+ * @param query Query, without ?.
+ * @param len Length of query.
+ */
+void
+file_url_append_query (GString *url, const gchar *query, gsize len)
+{
+    gboolean first = TRUE;
+    const gchar *it, *next, *eq, *end = query + len;
+
+    for (it = query; ; it = next + 1) {
+        next = memchr (it, '&', end - it);
+        if (! next) {
+            next = end;
+        }
+        eq = memchr (it, '=', next - it);
+        if ((next > it) && ! file_url_strip (it, (eq ? eq : next) - it)) {
+            g_string_append_c (url, first ? '?' : '&');
+            file_url_append_escaped (url, it, next - it);
+            first = FALSE;
+        }
+        if (next == end) {
+            break;
+        }
+    }
+}
+
+/**
+ * Appends str with escapes upper-cased, escaped unreserved characters
+ * unescaped and space, control and non-ASCII characters escaped.
+ *
+ * @param url URL being built.
+ * @param str String to append.
+ * @param len Length of str.
+ */
+void
+file_url_append_escaped (GString *url, const gchar *str, gsize len)
+{
+    gsize i;
+    guchar c;
+
+    for (i = 0; i < len; i++) {
+        c = str[i];
+        if ((c == '%') && (i + 2 < len)
+            && g_ascii_isxdigit (str[i + 1])
+            && g_ascii_isxdigit (str[i + 2])) {
+            c = (g_ascii_xdigit_value (str[i + 1]) << 4)
+                | g_ascii_xdigit_value (str[i + 2]);
+            i += 2;
+            if (g_ascii_isalnum (c) || (c == '-') || (c == '.')
+                || (c == '_') || (c == '~')) {
+                g_string_append_c (url, c);
+            } else {
+                g_string_append_printf (url, "%%%02X", c);
+            }
+        } else if ((c <= 0x20) || (c >= 0x7f)) {
+            g_string_append_printf (url, "%%%02X", c);
+        } else {
+            g_string_append_c (url, c);
+        }
+    }
+}
+
+/**
+ * Checks if port is the default port of the scheme.
+ *
+ * @param ref Reference the port is in.
+ * @param port Port, decimal digits.
+ * @param len Length of port.
+ * @return TRUE if port is the default, else FALSE.
+ */
+gboolean
+file_url_is_default_port (struct file_url_ref *ref, const gchar *port,
+                          gsize len)
+{
+    gsize i;
+    guint value = 0;
+
+    for (i = 0; i < len; i++) {
+        if (! g_ascii_isdigit (port[i]) || (value > G_MAXUINT16)) {
+            return FALSE;
+        }
+        value = value * 10 + (port[i] - '0');
+    }
+
+    return (file_url_is (ref->scheme, ref->scheme_len, "http")
+            && (value == 80))
+        || (file_url_is (ref->scheme, ref->scheme_len, "https")
+            && (value == 443))
+        || (file_url_is (ref->scheme, ref->scheme_len, "ftp")
+            && (value == 21));
+}
+
+/**
+ * Checks query parameter name against the strip rules.
+ *
+ * @param name Parameter name, not terminated.
+ * @param len Length of name.
+ * @return TRUE if the parameter is stripped, else FALSE.
+ */
+gboolean
+file_url_strip (const gchar *name, gsize len)
+{
+    guint i;
+    gchar *str;
+    gboolean match = FALSE;
+
+    if (! strip || (strip->len == 0)) {
+        return FALSE;
+    }
+
+    str = g_strndup (name, len);
+    for (i = 0; ! match && (i < strip->len); i++) {
+        match = g_pattern_match_string (g_ptr_array_index (strip, i), str);
+    }
+    g_free (str);
+
+    return match;
+}
+
+/**
+ * Checks string, not terminated, against name ignoring case.
+ *
+ * @param str String to check.
+ * @param len Length of str.
+ * @param name Lower case name.
+ * @return TRUE if str is name, else FALSE.
+ */
+gboolean
+file_url_is (const gchar *str, gsize len, const gchar *name)
+{
+    return (strlen (name) == len) && ! g_ascii_strncasecmp (str, name, len);
+}
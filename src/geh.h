@@ -54,7 +54,26 @@ struct _options {
     guint thumb_side; /**< Backward compatability: --thumbsize had a typo. */
 
     gboolean recursive; /**< Recursive directory scanning. */
-    guint levels; /**< Level of recursion. */
+    gint levels; /**< Level of recursion, -1 is limitless. */
+    gboolean breadth_first; /**< Scan directories breadth first. */
+    gboolean rescan; /**< Ignore directory index, read all directories. */
+    gboolean watch; /**< Watch scanned directories for changes. */
+    gboolean plain_io; /**< Use plain system calls instead of io_uring. */
+    gint memory; /**< Memory budget for the pipeline in MB, 0 is limitless. */
+    gint cache; /**< Size of cache for fetched files in MB, 0 disables it. */
+    gint connections; /**< Transfers running at once. */
+    gint host_connections; /**< Transfers running at once to each host. */
+    gint crawl_depth; /**< Levels of links to pages followed. */
+    gboolean crawl_any_host; /**< Follow links to pages on other hosts. */
+    gchar **strip_query; /**< Query parameters stripped from URLs. */
+
+    gchar **filter_names; /**< Name patterns files must match one of. */
+    gchar *filter_size_min; /**< Minimum file size. */
+    gchar *filter_size_max; /**< Maximum file size. */
+    gchar *filter_newer; /**< Oldest mtime, date or age. */
+    gchar *filter_older; /**< Newest mtime, date or age. */
+    gchar *filter_dim_min; /**< Minimum image dimensions, WxH. */
+    gchar *filter_dim_max; /**< Maximum image dimensions, WxH. */
 
     gboolean version;
     gboolean about;
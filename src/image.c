@@ -34,39 +34,94 @@
 #include <gtk/gtk.h>
 #include <glib/gstdio.h>
 
+#include "file_multi.h"
+#include "file_sniff.h"
 #include "image.h"
 #include "orientation.h"
 
+/**
+ * Loader being fed with data read from file.
+ */
+struct image_load {
+    GdkPixbufLoader *loader; /**< Loader to write to. */
+    GError *err; /**< Error from loader, NULL if none. */
+};
+
+static gboolean image_load_write (gpointer data, const guchar *buf,
+                                  gsize len);
 static void image_update (struct image *im);
+static GdkPixbuf *image_scale (GdkPixbuf *pix, guint width, guint height,
+                               gboolean *stop);
 
 /**
- * Creates new struct image populated with image from file.
+ * Creates new struct image populated with image from file, fetched
+ * files are loaded from memory.
  *
- * @param path Path to image.
+ * @param file File with image.
+ * @param stop Pointer to stop flag, checked between chunks read and
+ *             decoded and kept for scaling the image. NULL if never
+ *             stopped.
  * @return struct image on success, else NULL.
  */
 struct image*
-image_open (const gchar *path)
+image_open (struct file_multi *file, gboolean *stop)
 {
+    guint type;
     struct image *im;
-    GError *err = NULL;
-
-    im = g_malloc (sizeof (struct image));
+    GdkPixbuf *pix = NULL;
+    struct image_load load = {NULL, NULL};
+
+    /* Use the loader for the detected format if installed */
+    type = file_multi_get_type (file);
+    if (file_sniff_loader (type)) {
+        load.loader = gdk_pixbuf_loader_new_with_type (file_sniff_loader (type),
+                                                       NULL);
+    }
+    if (! load.loader) {
+        load.loader = gdk_pixbuf_loader_new ();
+    }
 
     /* Load original file */
-    im->pix_orig = gdk_pixbuf_new_from_file (path, &err);
-    if (err || !im->pix_orig) {
+    if (file_multi_read (file, &image_load_write, &load, stop)
+        && gdk_pixbuf_loader_close (load.loader, &load.err)) {
+        pix = gdk_pixbuf_loader_get_pixbuf (load.loader);
+    } else {
+        gdk_pixbuf_loader_close (load.loader, NULL);
+    }
+    if (pix) {
+        g_object_ref (pix);
+    }
+    g_object_unref (load.loader);
+
+    if (! pix) {
         /* Print error message */
-        if (err) {
-            g_fprintf (stderr, "%s\n", err->message);
-            g_error_free (err);
+        if (load.err) {
+            g_fprintf (stderr, "%s\n", load.err->message);
+            g_error_free (load.err);
         }
 
-        /* Free image resources */
-        g_free (im);
         return NULL;
     }
-    
+
+    im = image_new (pix);
+    im->stop = stop;
+
+    return im;
+}
+
+/**
+ * Creates new struct image from already loaded image.
+ *
+ * @param pix Pointer to GdkPixbuf, reference is taken over.
+ * @return struct image.
+ */
+struct image*
+image_new (GdkPixbuf *pix)
+{
+    struct image *im;
+
+    im = g_malloc (sizeof (struct image));
+    im->pix_orig = pix;
     im->width_orig = im->width_r_orig = gdk_pixbuf_get_width (im->pix_orig);
     im->height_orig = im->height_r_orig = gdk_pixbuf_get_height (im->pix_orig);
 
@@ -77,16 +132,33 @@ image_open (const gchar *path)
                                orientation);
     }
 
-    /* Setup current representation */
-    im->pix_curr = gdk_pixbuf_copy (im->pix_orig);
+    /* Setup current representation, shared until modified */
+    im->pix_curr = g_object_ref (im->pix_orig);
     im->width_curr = im->width_orig;
     im->height_curr = im->height_orig;
     im->zoom = 100;
     im->rotation = 0;
-    
+    im->stop = NULL;
+
     return im;
 }
 
+/**
+ * Writes data read from file to loader.
+ *
+ * @param data Pointer to struct image_load.
+ * @param buf Data read.
+ * @param len Length of data.
+ * @return TRUE to continue reading, FALSE if the loader failed.
+ */
+gboolean
+image_load_write (gpointer data, const guchar *buf, gsize len)
+{
+    struct image_load *load = (struct image_load*) data;
+
+    return gdk_pixbuf_loader_write (load->loader, buf, len, &load->err);
+}
+
 /**
  * Frees resources used by struct image.
  *
@@ -254,54 +326,84 @@ image_rotate_set (struct image *im, guint rotation)
 }
 
 /**
- * Updates current image by scaling and rotating.
+ * Updates current image by scaling and rotating. Nothing is done if the
+ * stop flag of the image is set, the current image is kept unscaled if
+ * it is set while scaling.
  *
  * @param im Pointer to struct image to update.
  */
 void
 image_update (struct image *im)
 {
-    GdkPixbuf *pix_tmp;
+    GdkPixbuf *pix, *pix_zoom;
     guint width, height;
 
-    /* Clean old resources */
-    g_object_unref (im->pix_curr);
-
-    if (!im->rotation && (im->zoom == 100)) {
-        /* No modifications, use original */
-        im->pix_curr = gdk_pixbuf_copy (im->pix_orig);
+    if (im->stop && *im->stop) {
+        return;
+    }
 
+    /* Rotate, the original is shared if not rotated */
+    if (im->rotation != 0) {
+        pix = gdk_pixbuf_rotate_simple (im->pix_orig, im->rotation);
     } else {
-        /* Rotate */
-        if (im->rotation != 0) {
-            im->pix_curr = gdk_pixbuf_rotate_simple (im->pix_orig, 
-                                                     im->rotation);
-        } else {
-            im->pix_curr = im->pix_orig;
-        }
+        pix = g_object_ref (im->pix_orig);
+    }
 
-        /* Zoom */
-        if (im->zoom != 100) {
-            width = gdk_pixbuf_get_width (im->pix_curr);
-            height = gdk_pixbuf_get_height (im->pix_curr);
-            im->width_curr =  width * (im->zoom * 0.01);
-            im->height_curr = height * (im->zoom * 0.01);
-
-            /* Scale */
-            pix_tmp = im->pix_curr;
-            im->pix_curr = gdk_pixbuf_scale_simple (im->pix_curr,
-                                                    im->width_curr,
-                                                    im->height_curr,
-                                                    GDK_INTERP_BILINEAR);
-
-            /* Clean resources */
-            if (pix_tmp != im->pix_orig) {
-                g_object_unref (pix_tmp);
-            }
+    /* Zoom */
+    if (im->zoom != 100) {
+        width = gdk_pixbuf_get_width (pix) * (im->zoom * 0.01);
+        height = gdk_pixbuf_get_height (pix) * (im->zoom * 0.01);
+        pix_zoom = image_scale (pix, MAX (width, 1), MAX (height, 1),
+                                im->stop);
+        if (pix_zoom) {
+            g_object_unref (pix);
+            pix = pix_zoom;
         }
     }
 
-    /* Update size */
+    /* Replace current image and update size */
+    g_object_unref (im->pix_curr);
+    im->pix_curr = pix;
     im->width_curr = gdk_pixbuf_get_width (im->pix_curr);
     im->height_curr = gdk_pixbuf_get_height (im->pix_curr);
 }
+
+/**
+ * Scales image in bands of IMAGE_SCALE_BAND rows so that scaling large
+ * images can be stopped in between.
+ *
+ * @param pix Image to scale.
+ * @param width Width to scale to.
+ * @param height Height to scale to.
+ * @param stop Pointer to stop flag, NULL if never stopped.
+ * @return Scaled image, NULL if stopped or out of memory.
+ */
+GdkPixbuf*
+image_scale (GdkPixbuf *pix, guint width, guint height, gboolean *stop)
+{
+    guint y;
+    gdouble scale_x, scale_y;
+    GdkPixbuf *scaled;
+
+    scaled = gdk_pixbuf_new (gdk_pixbuf_get_colorspace (pix),
+                             gdk_pixbuf_get_has_alpha (pix),
+                             gdk_pixbuf_get_bits_per_sample (pix),
+                             width, height);
+    if (! scaled) {
+        return NULL;
+    }
+
+    scale_x = (gdouble) width / gdk_pixbuf_get_width (pix);
+    scale_y = (gdouble) height / gdk_pixbuf_get_height (pix);
+    for (y = 0; y < height; y += IMAGE_SCALE_BAND) {
+        if (stop && *stop) {
+            g_object_unref (scaled);
+            return NULL;
+        }
+        gdk_pixbuf_scale (pix, scaled, 0, y, width,
+                          MIN (IMAGE_SCALE_BAND, height - y),
+                          0.0, 0.0, scale_x, scale_y, GDK_INTERP_BILINEAR);
+    }
+
+    return scaled;
+}
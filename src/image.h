@@ -34,6 +34,11 @@
 #include "config.h"
 #endif /* HAVE_CONFIG_H */
 
+#include "file_multi.h"
+
+/** Rows scaled at a time, the stop flag is checked in between. */
+#define IMAGE_SCALE_BAND 64
+
 /**
  * Main structure reprsenting modifiable image.
  */
@@ -50,9 +55,13 @@ struct image {
 
     guint zoom; /**< Zoom percentage. */
     guint rotation; /**< Rotation degrees. */
+
+    gboolean *stop; /**< Stop flag checked while scaling, NULL if never
+                         stopped. */
 };
 
-struct image *image_open (const gchar *path);
+struct image *image_open (struct file_multi *file, gboolean *stop);
+struct image *image_new (GdkPixbuf *pix);
 void image_close (struct image *im);
 
 GdkPixbuf *image_get_curr (struct image *im);
@@ -39,9 +39,18 @@
 
 #include "about.h"
 #include "dir.h"
+#include "dir_watch.h"
+#include "file_budget.h"
+#include "file_cache.h"
+#include "file_crawl.h"
 #include "file_fetch.h"
+#include "file_filter.h"
+#include "file_ident.h"
+#include "file_io.h"
 #include "file_multi.h"
+#include "file_net.h"
 #include "file_queue.h"
+#include "file_url.h"
 #include "ui_window.h"
 
 /* Initialize options */
@@ -58,6 +67,24 @@ struct _options options = {
     0 /* thumb_side */,
     FALSE /* recursive */,
     -1 /* levels */,
+    FALSE /* breadth_first */,
+    FALSE /* rescan */,
+    FALSE /* watch */,
+    FALSE /* plain_io */,
+    512 /* memory */,
+    256 /* cache */,
+    8 /* connections */,
+    4 /* host_connections */,
+    0 /* crawl_depth */,
+    FALSE /* crawl_any_host */,
+    NULL /* strip_query */,
+    NULL /* filter_names */,
+    NULL /* filter_size_min */,
+    NULL /* filter_size_max */,
+    NULL /* filter_newer */,
+    NULL /* filter_older */,
+    NULL /* filter_dim_min */,
+    NULL /* filter_dim_max */,
     FALSE /* version */,
     FALSE /* about */,
     NULL /* files */
@@ -67,16 +94,34 @@ struct _options options = {
  * Command line parsing structure.
  */
 static GOptionEntry cmdopt[] = {
+    {"breadth", 'b', 0, G_OPTION_ARG_NONE, &options.breadth_first, "Breadth first recursive directory scanning"},
+    {"cache", 'C', 0, G_OPTION_ARG_INT, &options.cache, "Size of cache for fetched files in MB, 0 disables it", "MB"},
+    {"connections", 'c', 0, G_OPTION_ARG_INT, &options.connections, "Number of transfers running at once", "N"},
+    {"host-connections", 0, 0, G_OPTION_ARG_INT, &options.host_connections, "Number of transfers running at once to each host", "N"},
+    {"depth", 'd', 0, G_OPTION_ARG_INT, &options.crawl_depth, "Levels of links to pages followed from fetched pages", "N"},
+    {"any-host", 0, 0, G_OPTION_ARG_NONE, &options.crawl_any_host, "Follow links to pages on other hosts"},
+    {"strip-query", 0, 0, G_OPTION_ARG_STRING_ARRAY, &options.strip_query, "Drop query parameters matching pattern from URLs, replaces the default utm_*, fbclid and gclid, empty strips none (repeatable)", "PATTERN"},
     {"height", 'H', 0, G_OPTION_ARG_INT, &options.win_height, "Window height"},
     {"levels", 'l', 0, G_OPTION_ARG_INT, &options.levels, "Levels of recursion"},
+    {"memory", 'M', 0, G_OPTION_ARG_INT, &options.memory, "Memory budget for loading in MB, 0 is limitless", "MB"},
     {"mode", 'm', 0, G_OPTION_ARG_STRING, &options.mode_str, "Image display mode (thumb, slide, full)"},
     {"nodecor", 'n', 0, G_OPTION_ARG_NONE, &options.win_nodecor, "No decor for window"},
+    {"plain-io", 0, 0, G_OPTION_ARG_NONE, &options.plain_io, "Use plain system calls instead of io_uring for file I/O"},
+    {"rescan", 'R', 0, G_OPTION_ARG_NONE, &options.rescan, "Rescan directories ignoring the directory index"},
     {"recursive", 'r', 0, G_OPTION_ARG_NONE, &options.recursive, "Recursive directory scanning"},
     {"keep", 'k', 0, G_OPTION_ARG_NONE, &options.keep_size, "Keep image size"},
     {"thumbsize", 't', 0, G_OPTION_ARG_INT, &options.thumb_size, "Thumbnail size in pixels"},
     {"thumbside", 't', 0, G_OPTION_ARG_INT, &options.thumb_side, "Just a synonym of --thumbsize for backward compatibility with the older versions, as there was a typo in the option name."},
     {"timeout", 'T', 0, G_OPTION_ARG_INT, &options.timeout, "Display window for seconds"},
+    {"watch", 'w', 0, G_OPTION_ARG_NONE, &options.watch, "Watch scanned directories for changes"},
     {"width", 'W', 0, G_OPTION_ARG_INT, &options.win_width, "Window width"},
+    {"name", 0, 0, G_OPTION_ARG_STRING_ARRAY, &options.filter_names, "Only files with name matching pattern, ignoring case (repeatable)", "PATTERN"},
+    {"min-size", 0, 0, G_OPTION_ARG_STRING, &options.filter_size_min, "Only files of at least size, k, M and G suffix allowed", "SIZE"},
+    {"max-size", 0, 0, G_OPTION_ARG_STRING, &options.filter_size_max, "Only files of at most size, k, M and G suffix allowed", "SIZE"},
+    {"newer", 0, 0, G_OPTION_ARG_STRING, &options.filter_newer, "Only files modified after YYYY-MM-DD or age such as 7d", "TIME"},
+    {"older", 0, 0, G_OPTION_ARG_STRING, &options.filter_older, "Only files modified before YYYY-MM-DD or age such as 7d", "TIME"},
+    {"min-dim", 0, 0, G_OPTION_ARG_STRING, &options.filter_dim_min, "Only images of at least WIDTHxHEIGHT pixels", "WxH"},
+    {"max-dim", 0, 0, G_OPTION_ARG_STRING, &options.filter_dim_max, "Only images of at most WIDTHxHEIGHT pixels", "WxH"},
     {"version", 'v', G_OPTION_FLAG_IN_MAIN, G_OPTION_ARG_NONE, &options.version,
         "Print version information and exit", NULL },
     {"about",   'V', G_OPTION_FLAG_IN_MAIN, G_OPTION_ARG_NONE, &options.about,
@@ -108,6 +153,11 @@ parse_str_options (void)
         }
     }
 
+    /* Filters are parsed once, before scanning starts */
+    if (! file_filter_init ()) {
+        return 1;
+    }
+
     return 0;
 }
 
@@ -143,11 +193,13 @@ main (int argc, char *argv[])
 {
     gint file_count = 0;
 
-    GList *it;
+    guint i, len;
+    struct file_table *file_table;
     GOptionContext *context;
 
     struct ui_window *ui;
     struct dir_scan *dir_scan;
+    struct dir_watch *dir_watch = NULL;
     struct file_fetch *file_fetch;
     struct file_queue *file_queue;
 
@@ -181,6 +233,9 @@ main (int argc, char *argv[])
         options.thumb_size = options.thumb_side;
     }
 
+    /* Select I/O engine before any scanning or loading starts */
+    file_io_init (! options.plain_io);
+
     /* Make sure there is something to do (need input files) */
     if (options.files) {
         /* Count entries in order to determine mode */
@@ -212,11 +267,21 @@ main (int argc, char *argv[])
 
     /* Scan dirs and fetch files that is added to the thumbnail view.
        The file queue is created with one reference owned by the dir
-       scanner. */
-    file_queue = file_queue_new (1);
-    dir_scan = dir_scan_start (file_queue, options.files,
-                               &ui_window_progress_add, (gpointer) ui);
+       scanner and one by the watch if watching. */
+    file_ident_init ();
+    file_budget_init ((gsize) MAX (options.memory, 0) * 1024 * 1024);
+    file_cache_init ((gsize) MAX (options.cache, 0) * 1024 * 1024);
+    file_url_init (options.strip_query);
+    file_crawl_init (options.cache > 0);
+    file_net_init (MAX (options.connections, 1),
+                   MAX (options.host_connections, 1));
+    file_queue = file_queue_new (options.watch ? 2 : 1);
     file_fetch = file_fetch_start (file_queue, options.file_list, ui);
+    if (options.watch) {
+        dir_watch = dir_watch_start (file_queue, file_fetch);
+    }
+    dir_scan = dir_scan_start (file_queue, options.files, dir_watch,
+                               &ui_window_progress_add, (gpointer) ui);
 
     if (options.timeout > 0) {
         g_timeout_add (options.timeout * 1000, main_timeout_quit, NULL);
@@ -227,17 +292,31 @@ main (int argc, char *argv[])
     gtk_main ();
     gdk_threads_leave ();
 
-    /* Cleanup after fetching of files */
+    /* Cleanup after fetching of files, stages waiting for memory are let
+       through so the scanner can finish pushing. */
+    file_budget_stop ();
     dir_scan_stop (dir_scan);
+    if (dir_watch) {
+        dir_watch_stop (dir_watch);
+    }
     file_fetch_stop (file_fetch);
+    file_net_free ();
 
     /* Free UI after stopping of scanning as it uses UI */
     ui_window_free (ui);
 
-    for (it = file_queue_get_list (file_queue); it; it = g_list_next (it)) {
-        file_multi_close ((struct file_multi*) it->data);
+    file_table = file_queue_get_table (file_queue);
+    len = file_table_len (file_table);
+    for (i = 0; i < len; i++) {
+        file_multi_close (file_table_get (file_table, i));
     }
     file_queue_free (file_queue);
+    file_filter_free ();
+    file_ident_free ();
+    file_budget_free ();
+    file_cache_free ();
+    file_crawl_free ();
+    file_url_free ();
 
     return 0;
 }
@@ -30,8 +30,6 @@
 #include "config.h"
 #endif /* HAVE_CONFIG_H */
 
-#define THUMB_LOAD_CHUNK_SIZE 8192
-
 #include <gtk/gtk.h>
 #include <glib/gstdio.h>
 
@@ -42,7 +40,10 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#include "file_budget.h"
+#include "file_io.h"
 #include "file_multi.h"
+#include "file_sniff.h"
 #include "md5.h"
 #include "thumb.h"
 #include "orientation.h"
@@ -54,10 +55,48 @@ struct thumb_image_info {
     guint side; /**< Side size to generate */
     gint width; /**< Original image width */
     gint height; /**< Original image height */
+    gsize decode; /**< Bytes acquired from the budget for decoding. */
+    gboolean wait; /**< Wait for room in the budget, else charge it. */
 };
 
-static GdkPixbuf *thumb_load (const gchar *path,
-                              struct thumb_image_info *info);
+/**
+ * Loader being fed with data read from file.
+ */
+struct thumb_load_data {
+    GdkPixbufLoader *loader; /**< Loader to write to. */
+    GError *err; /**< Error from loader, NULL if none. */
+};
+
+/**
+ * Image being loaded at thumbnail size as its data arrives.
+ */
+struct thumb_stream {
+    struct thumb_load_data load; /**< Loader and its error. */
+    struct thumb_image_info info; /**< Size of image and thumbnail. */
+};
+
+/**
+ * File read to generate its thumbnail, the type is detected from the
+ * start of the file when not known yet.
+ */
+struct thumb_read {
+    struct file_multi *file; /**< File being read. */
+    guint side; /**< Side size to generate. */
+    guchar head[FILE_SNIFF_SIZE]; /**< Start of file, used to detect
+                                       type. */
+    gsize head_len; /**< Bytes in head. */
+    struct thumb_stream *stream; /**< Thumbnail being decoded, NULL until
+                                      the file is known to be an image. */
+};
+
+static gboolean thumb_read_write (gpointer data, const guchar *buf,
+                                  gsize len);
+static gboolean thumb_read_start (struct thumb_read *reader);
+
+static GdkPixbuf *thumb_load_pixbuf (const gchar *path,
+                                     GdkPixbufLoader *loader, gboolean warn);
+static gboolean thumb_load_write (gpointer data, const guchar *buf,
+                                  gsize len);
 
 static GdkPixbuf *thumb_cache_load (struct file_multi *file);
 static void thumb_cache_save (struct file_multi *file, GdkPixbuf *thumb,
@@ -77,117 +116,387 @@ static void thumb_callback_size_prepared (GdkPixbufLoader *loader,
  * @param file struct file_multi to create thumbnail for.
  * @param side Maximum side in pixels for thumbnail
  * @param cache TRUE means cache generated thumbnail on disk.
- * @return Pointer to GdkPixbuf with thumbnail version of image.
+ * @param stop Pointer to stop flag, checked between chunks read and
+ *             decoded. NULL if never stopped.
+ * @return Pointer to GdkPixbuf with thumbnail version of image, NULL if
+ *         it fails or is stopped.
  */
 GdkPixbuf*
-thumb_get (struct file_multi *file, guint side, gboolean cache)
+thumb_get (struct file_multi *file, guint side, gboolean cache,
+           gboolean *stop)
 {
+    gboolean status;
     GdkPixbuf *thumb = NULL;
-    gboolean cache_ok = ((side == THUMB_DEFAULT_SIDE)
-                         || (side == THUMB_LARGE_SIDE));
-    struct thumb_image_info info = {0 /* Side */,
-                                    0 /* Width */, 0 /* Height */};
+    struct thumb_read reader;
 
-    /* Try load cached version */
-    if (cache_ok) {
+    /* Try load cached version, stdin has no name to cache it by */
+    if (((side == THUMB_DEFAULT_SIDE) || (side == THUMB_LARGE_SIDE))
+        && ! file_multi_is_stream (file)) {
         thumb = thumb_cache_load (file);
     }
+    if (thumb) {
+        return thumb;
+    }
 
-    /* Generate thumbnail */
-    if (! thumb) {
-        info.side = side;
+    reader.file = file;
+    reader.side = side;
+    reader.head_len = 0;
+    reader.stream = NULL;
+
+    /* Generate thumbnail, files not known to be images are detected from
+       the data read for decoding and the ones that are not images by
+       content are skipped without reading them fully. */
+    if (file_multi_peek_type (file) != FILE_SNIFF_UNCHECKED) {
+        if (! file_sniff_maybe_image (file_multi_peek_type (file))) {
+            return NULL;
+        }
+        reader.stream = thumb_stream_new (file_multi_peek_type (file), side,
+                                          TRUE /* wait */);
+    }
 
-        thumb = thumb_load (file_multi_get_path (file), &info);
-        if (thumb && cache && cache_ok) {
-            thumb_cache_save (file, thumb, &info);
+    status = file_multi_read (file, &thumb_read_write, &reader, stop);
+
+    /* Shorter than the head */
+    if (status && ! reader.stream) {
+        status = thumb_read_start (&reader);
+    }
+
+    if (! reader.stream) {
+        /* Not an image or read failed before the type was known */
+        if (! status && ! (stop && *stop)
+            && (file_multi_peek_type (file) == FILE_SNIFF_UNCHECKED)) {
+            g_warning ("failed to read %s", file_multi_get_path (file));
         }
+    } else if (status) {
+        thumb = thumb_stream_finish (reader.stream, file, cache);
+    } else {
+        if (! reader.stream->load.err && ! (stop && *stop)) {
+            g_warning ("failed to read %s", file_multi_get_path (file));
+        }
+        thumb_stream_finish (reader.stream, NULL, FALSE);
     }
 
     return thumb;
 }
 
 /**
- * Loads file at size.
+ * Passes data read to the thumbnail loader, collects the start of the
+ * file first if its type is not known.
  *
- * @param path File to load.
- * @param side Size in pixels max size of thumbnail.
- * @return Pointer to GdkPixbuf or NULL if fails.
+ * @param data Pointer to struct thumb_read.
+ * @param buf Data read.
+ * @param len Length of data.
+ * @return TRUE to continue reading, FALSE if not an image or the loader
+ *         failed.
  */
-GdkPixbuf*
-thumb_load (const gchar *path, struct thumb_image_info *info)
+gboolean
+thumb_read_write (gpointer data, const guchar *buf, gsize len)
 {
-    GdkPixbuf *thumb;
-    GdkPixbufLoader *loader;
-    GError *err = NULL;
+    gsize head;
+    struct thumb_read *reader = (struct thumb_read*) data;
+
+    if (! reader->stream) {
+        head = MIN (len, FILE_SNIFF_SIZE - reader->head_len);
+        memcpy (reader->head + reader->head_len, buf, head);
+        reader->head_len += head;
+        buf += head;
+        len -= head;
+
+        if (reader->head_len < FILE_SNIFF_SIZE) {
+            return TRUE;
+        }
+        if (! thumb_read_start (reader)) {
+            return FALSE;
+        }
+    }
 
-    int fd;
-    guchar buf[THUMB_LOAD_CHUNK_SIZE];
-    size_t buf_read;
+    return (len == 0) || thumb_stream_write (reader->stream, buf, len);
+}
+
+/**
+ * Detects type of file from the head read, images get a loader fed
+ * with the head.
+ *
+ * @param reader struct thumb_read with head filled in.
+ * @return TRUE if the file may be an image and the loader took the
+ *         head, else FALSE.
+ */
+gboolean
+thumb_read_start (struct thumb_read *reader)
+{
+    guint type;
 
-    /* Create pixbuf loader */
-    loader = gdk_pixbuf_loader_new ();
+    type = file_sniff_data (reader->head, reader->head_len);
+    file_multi_set_type (reader->file, type);
+    if (! file_sniff_maybe_image (type)) {
+        return FALSE;
+    }
+
+    reader->stream = thumb_stream_new (type, reader->side, TRUE /* wait */);
+
+    return thumb_stream_write (reader->stream, reader->head,
+                               reader->head_len);
+}
+
+/**
+ * Starts loading image of type at size, the data is written with
+ * thumb_stream_write as it arrives.
+ *
+ * @param type FILE_SNIFF_ type of image, picks the loader if known.
+ * @param side Maximum side in pixels, 0 loads the image at full size.
+ * @param wait TRUE to wait for room for the decoded image. FALSE charges
+ *             it without waiting, for loaders fed by a thread that
+ *             already holds budget for another loader of the image.
+ * @return New struct thumb_stream, freed by thumb_stream_finish.
+ */
+struct thumb_stream*
+thumb_stream_new (guint type, guint side, gboolean wait)
+{
+    struct thumb_stream *stream;
+
+    stream = g_malloc0 (sizeof (struct thumb_stream));
+    stream->info.side = side;
+    stream->info.wait = wait;
+
+    /* Create pixbuf loader, use the loader for the detected format and
+       let gdk-pixbuf detect it if that loader is not installed. */
+    if (file_sniff_loader (type)) {
+        stream->load.loader =
+            gdk_pixbuf_loader_new_with_type (file_sniff_loader (type), NULL);
+    }
+    if (! stream->load.loader) {
+        stream->load.loader = gdk_pixbuf_loader_new ();
+    }
 
     /* Set callback so the image can be loaded at prefered size with
        aspect preserved. */
-    g_signal_connect (G_OBJECT (loader), "size-prepared",
-                      G_CALLBACK (thumb_callback_size_prepared), info);
+    g_signal_connect (G_OBJECT (stream->load.loader), "size-prepared",
+                      G_CALLBACK (thumb_callback_size_prepared),
+                      &stream->info);
 
-    /* Open file for reading */
-    fd = open (path, O_RDONLY);
-    if (fd == -1) {
-        g_warning ("failed to open %s for reading", path);
-        return NULL;
+    return stream;
+}
+
+/**
+ * Writes more of the image to the loader.
+ *
+ * @param stream struct thumb_stream to write to.
+ * @param buf Data of image.
+ * @param len Length of data.
+ * @return TRUE if the data was accepted, FALSE if the loader failed.
+ */
+gboolean
+thumb_stream_write (struct thumb_stream *stream, const guchar *buf, gsize len)
+{
+    if (stream->load.err) {
+        return FALSE;
     }
 
-    /* Read all of file and write to loader */
-    while ((buf_read = read (fd, buf, THUMB_LOAD_CHUNK_SIZE)) > 0) {
-        if (! gdk_pixbuf_loader_write (loader, buf, buf_read, &err)) {
-            /* Clean resources */
-            gdk_pixbuf_loader_close (loader, NULL);
-            g_object_unref (loader);
-            close (fd);
-
-            if (err) {
-                g_fprintf (stderr, "%s\n", err->message);
-                g_error_free (err);
-            }
+    return thumb_load_write (&stream->load, buf, len);
+}
 
-            return NULL;
+/**
+ * Gets a copy of the image loaded so far, parts not yet loaded are
+ * left blank.
+ *
+ * @param stream struct thumb_stream to get image from.
+ * @return Pointer to new GdkPixbuf, NULL if the size is not known yet.
+ */
+GdkPixbuf*
+thumb_stream_peek (struct thumb_stream *stream)
+{
+    GdkPixbuf *pix;
+
+    pix = gdk_pixbuf_loader_get_pixbuf (stream->load.loader);
+
+    return pix ? gdk_pixbuf_copy (pix) : NULL;
+}
+
+/**
+ * Finishes loading and frees the stream.
+ *
+ * @param stream struct thumb_stream to finish.
+ * @param file File the image was loaded from, NULL to abort loading.
+ * @param cache TRUE means cache generated thumbnail on disk.
+ * @return Pointer to GdkPixbuf or NULL if aborted or fails.
+ */
+GdkPixbuf*
+thumb_stream_finish (struct thumb_stream *stream, struct file_multi *file,
+                     gboolean cache)
+{
+    guint width, height;
+    GdkPixbuf *thumb = NULL;
+    const gchar *orientation;
+    GdkPixbufLoader *loader = stream->load.loader;
+
+    /* Finalize loading of image, aborted loaders are closed as well */
+    if (file && ! stream->load.err
+        && gdk_pixbuf_loader_close (loader, &stream->load.err)) {
+        thumb = gdk_pixbuf_loader_get_pixbuf (loader);
+    } else {
+        gdk_pixbuf_loader_close (loader, NULL);
+    }
+
+    if (stream->load.err) {
+        g_fprintf (stderr, "%s\n", stream->load.err->message);
+        g_error_free (stream->load.err);
+    }
+
+    if (thumb) {
+        g_object_ref (thumb);
+
+        orientation = gdk_pixbuf_get_option (thumb, "orientation");
+        if (orientation != NULL) {
+            width = gdk_pixbuf_get_width (thumb);
+            height = gdk_pixbuf_get_height (thumb);
+            orientation_transform (&thumb, &width, &height, orientation);
         }
     }
 
-    /* Close file after reading */
-    close (fd);
+    /* Clean resources */
+    g_object_unref (loader);
+    file_budget_release (FILE_BUDGET_DECODE, stream->info.decode);
+
+    if (thumb && cache && ! file_multi_is_stream (file)
+        && ((stream->info.side == THUMB_DEFAULT_SIDE)
+            || (stream->info.side == THUMB_LARGE_SIDE))) {
+        thumb_cache_save (file, thumb, &stream->info);
+    }
+
+    g_free (stream);
+
+    return thumb;
+}
+
+/**
+ * Reads all of file into loader, the data is passed to the loader as
+ * it is read.
+ *
+ * @param path File to load.
+ * @param loader Loader to write to, unreferenced when done.
+ * @param warn TRUE to warn if the file can not be read.
+ * @return Pointer to GdkPixbuf or NULL if fails.
+ */
+GdkPixbuf*
+thumb_load_pixbuf (const gchar *path, GdkPixbufLoader *loader,
+                   gboolean warn)
+{
+    GdkPixbuf *thumb;
+    struct thumb_load_data data = {loader, NULL};
+
+    /* Read all of file and write to loader */
+    if (! file_io_read (path, &thumb_load_write, &data)) {
+        /* Clean resources */
+        gdk_pixbuf_loader_close (loader, NULL);
+        g_object_unref (loader);
+
+        if (data.err) {
+            g_fprintf (stderr, "%s\n", data.err->message);
+            g_error_free (data.err);
+        } else if (warn) {
+            g_warning ("failed to read %s", path);
+        }
+
+        return NULL;
+    }
 
     /* Finalize loading of image */
-    if (! gdk_pixbuf_loader_close (loader, &err)) {
+    if (! gdk_pixbuf_loader_close (loader, &data.err)) {
         g_object_unref (loader);
 
-        if (err) {
-            g_fprintf (stderr, "%s\n", err->message);
-            g_error_free (err);
+        if (data.err) {
+            g_fprintf (stderr, "%s\n", data.err->message);
+            g_error_free (data.err);
         }
 
         return NULL;
     }
-    
+
     /* Get thumbnail */
     thumb = gdk_pixbuf_loader_get_pixbuf (loader);
     g_object_ref (thumb);
 
-    const gchar *orientation = gdk_pixbuf_get_option(thumb, "orientation");
-    if (orientation != NULL) {
-        guint width = gdk_pixbuf_get_width (thumb);
-        guint height = gdk_pixbuf_get_height (thumb);
-        orientation_transform (&thumb, &width, &height, orientation);
-    }
-
     /* Clean resources */
     g_object_unref (loader);
 
     return thumb;
 }
 
+/**
+ * Writes data read from file to loader.
+ *
+ * @param data Pointer to struct thumb_load_data.
+ * @param buf Data read.
+ * @param len Length of data.
+ * @return TRUE to continue reading, FALSE if the loader failed.
+ */
+gboolean
+thumb_load_write (gpointer data, const guchar *buf, gsize len)
+{
+    struct thumb_load_data *load = (struct thumb_load_data*) data;
+
+    return gdk_pixbuf_loader_write (load->loader, buf, len, &load->err);
+}
+
+/**
+ * Looks up cached thumbnail of remote file not fetched yet, the
+ * validators it was saved with are set on file so that the file is only
+ * fetched if it changed since.
+ *
+ * @param file Remote file.
+ * @param side Maximum side in pixels for thumbnail.
+ * @param width Set to width of the image, -1 if not known.
+ * @param height Set to height of the image, -1 if not known.
+ * @return TRUE if a thumbnail with validators is cached, else FALSE.
+ */
+gboolean
+thumb_cache_lookup (struct file_multi *file, guint side,
+                    gint *width, gint *height)
+{
+    gchar *thumb_path;
+    const gchar *etag, *mtime, *size, *str;
+    GdkPixbuf *thumb;
+
+    if ((side != THUMB_DEFAULT_SIDE) && (side != THUMB_LARGE_SIDE)) {
+        return FALSE;
+    }
+
+    thumb_path = thumb_cache_path (file);
+    thumb = thumb_load_pixbuf (thumb_path, gdk_pixbuf_loader_new (), FALSE);
+    g_free (thumb_path);
+    if (! thumb) {
+        return FALSE;
+    }
+
+    /* Thumbnails saved without validators can not be checked */
+    etag = gdk_pixbuf_get_option (thumb, THUMB_CACHE_ETAG);
+    mtime = gdk_pixbuf_get_option (thumb, "tEXt::Thumb::MTime");
+    if (mtime && (strtol (mtime, NULL, 10) == -1)) {
+        mtime = NULL;
+    }
+    if (! etag && ! mtime) {
+        g_object_unref (thumb);
+        return FALSE;
+    }
+
+    file_multi_set_validators (file, etag,
+                               mtime ? strtol (mtime, NULL, 10) : -1);
+    size = gdk_pixbuf_get_option (thumb, "tEXt::Thumb::Size");
+    if (size) {
+        file_multi_set_stat (file, strtol (size, NULL, 10),
+                             file_multi_get_mtime (file));
+    }
+
+    str = gdk_pixbuf_get_option (thumb, "tEXt::Thumb::Image::Width");
+    *width = str ? strtol (str, NULL, 10) : -1;
+    str = gdk_pixbuf_get_option (thumb, "tEXt::Thumb::Image::Height");
+    *height = str ? strtol (str, NULL, 10) : -1;
+
+    g_object_unref (thumb);
+
+    return TRUE;
+}
+
 /**
  * Load thumbnail from cache.
  *
@@ -199,20 +508,22 @@ thumb_cache_load (struct file_multi *file)
 {
     time_t mtime;
     gchar *thumb_path;
-    const gchar *mtime_str;
-    GdkPixbuf *thumb = NULL;
+    const gchar *mtime_str, *etag;
+    GdkPixbuf *thumb;
 
-    /* Get thumbnail file */
+    /* Get thumbnail file, most often missing so no existence check
+       before reading it. */
     thumb_path = thumb_cache_path (file);
-    if (g_file_test (thumb_path, G_FILE_TEST_IS_REGULAR)) {
-        thumb = gdk_pixbuf_new_from_file (thumb_path, NULL);
-
+    thumb = thumb_load_pixbuf (thumb_path, gdk_pixbuf_loader_new (), FALSE);
+    if (thumb) {
         /* Check mtime */
         mtime_str = gdk_pixbuf_get_option (thumb, "tEXt::Thumb::MTime");
         if (mtime_str) {
             mtime = strtol (mtime_str, NULL, 10);
-            if (mtime != file_multi_get_mtime (file)) {
-                /* mtime does not match, treat as invalid */
+            etag = gdk_pixbuf_get_option (thumb, THUMB_CACHE_ETAG);
+            if ((mtime != file_multi_get_mtime (file))
+                || g_strcmp0 (etag, file_multi_get_etag (file))) {
+                /* mtime or ETag does not match, treat as invalid */
                 g_object_unref (thumb);
                 thumb = NULL;
             }
@@ -230,7 +541,9 @@ thumb_cache_load (struct file_multi *file)
 }
 
 /**
- * Save thumbnail to cache.
+ * Save thumbnail to cache. Remote files are saved with the
+ * Last-Modified date as mtime and their ETag, not at all if they have
+ * neither.
  *
  * @param file Original file.
  * @param thumb Pointer GdkPixbuf thumbnail to save.
@@ -240,8 +553,15 @@ void
 thumb_cache_save (struct file_multi *file, GdkPixbuf *thumb,
                   struct thumb_image_info *info)
 {
+    gint n = 5;
     gchar *thumb_path;
     gchar *size, *mtime, *width, *height;
+    gchar *keys[7], *values[7];
+
+    /* Nothing to tell if the thumbnail is still valid */
+    if ((file_multi_get_mtime (file) == -1) && ! file_multi_get_etag (file)) {
+        return;
+    }
 
     /* Make sure directory for saving exists */
     if (! thumb_cache_save_create_directory ()) {
@@ -257,13 +577,24 @@ thumb_cache_save (struct file_multi *file, GdkPixbuf *thumb,
     /* Get thumbnail file */
     thumb_path = thumb_cache_path (file);
 
-    if (!  gdk_pixbuf_save (thumb, thumb_path, "png", NULL,
-                            "tEXt::Thumb::URI", file_multi_get_uri (file),
-                            "tEXt::Thumb::Size", size,
-                            "tEXt::Thumb::MTime", mtime,
-                            "tEXt::Thumb::Image::Width", width,
-                            "tEXt::Thumb::Image::Height", height,
-                            NULL)) {
+    keys[0] = "tEXt::Thumb::URI";
+    values[0] = (gchar*) file_multi_get_uri (file);
+    keys[1] = "tEXt::Thumb::Size";
+    values[1] = size;
+    keys[2] = "tEXt::Thumb::MTime";
+    values[2] = mtime;
+    keys[3] = "tEXt::Thumb::Image::Width";
+    values[3] = width;
+    keys[4] = "tEXt::Thumb::Image::Height";
+    values[4] = height;
+    if (file_multi_get_etag (file)) {
+        keys[n] = THUMB_CACHE_ETAG;
+        values[n++] = (gchar*) file_multi_get_etag (file);
+    }
+    keys[n] = NULL;
+    values[n] = NULL;
+
+    if (! gdk_pixbuf_savev (thumb, thumb_path, "png", keys, values, NULL)) {
         g_warning ("failed to save thumbnail for %s",
                    file_multi_get_path (file));
     }
@@ -284,15 +615,13 @@ thumb_cache_save (struct file_multi *file, GdkPixbuf *thumb,
 gboolean
 thumb_cache_save_create_directory (void)
 {
-    static gboolean tried = FALSE;
+    static gsize tried = 0;
     static gboolean status = FALSE;
 
     gchar *path, *path_base;
 
-    if (! tried ) {
-        /* Set tried flag */
-        tried = TRUE;
-
+    /* Thumbnails are saved from multiple threads, only try once. */
+    if (g_once_init_enter (&tried)) {
         /* Check base thumbnail dir */
         path_base = g_strjoin (NULL, g_get_home_dir (),
                                THUMB_CACHE_PATH_BASE, NULL);
@@ -311,6 +640,9 @@ thumb_cache_save_create_directory (void)
         }
 
         g_free (path_base);
+
+        /* Set tried flag */
+        g_once_init_leave (&tried, 1);
     }
 
     return status;
@@ -381,18 +713,34 @@ thumb_cache_md5_uri (const gchar *uri)
  * @param loader Loader used to signal.
  * @param width Width of image being loaded.
  * @param height Height of image being loaded.
- * @param user_data User supplied data (pointer to side size)
+ * @param user_data Pointer to struct thumb_image_info.
  */
 void
 thumb_callback_size_prepared (GdkPixbufLoader *loader,
                               gint width, gint height, gpointer user_data)
 {
     /* Get side and calculate ratio */
-    guint side = *((guint*) user_data);
+    struct thumb_image_info *info = (struct thumb_image_info*) user_data;
+    guint side = info->side;
     gfloat ratio;
 
-    /* Nothing to do, image fits in thumbnail size */
-    if ((width <= side) && (height <= side)) {
+    info->width = width;
+    info->height = height;
+
+    /* Wait for room for the decoded image, loaders not able to scale
+       while decoding hold it at full size. Waiting on memory held by
+       the same thread would never end. */
+    file_budget_release (FILE_BUDGET_DECODE, info->decode);
+    info->decode = (gsize) width * height * 4;
+    if (info->wait) {
+        file_budget_acquire (FILE_BUDGET_DECODE, info->decode);
+    } else {
+        file_budget_charge (FILE_BUDGET_DECODE, info->decode);
+    }
+
+    /* Nothing to do, loading at full size or image fits in thumbnail
+       size */
+    if ((side == 0) || ((width <= side) && (height <= side))) {
         return;
     }
 
@@ -43,7 +43,23 @@
 #define THUMB_DEFAULT_SIDE 128
 #define THUMB_LARGE_SIDE 256
 
+/** Key of the ETag of remote files in cached thumbnails. */
+#define THUMB_CACHE_ETAG "tEXt::X-GEH::ETag"
+
+struct thumb_stream;
+
 extern GdkPixbuf *thumb_get (struct file_multi *file,
-                             guint side, gboolean cache);
+                             guint side, gboolean cache, gboolean *stop);
+extern gboolean thumb_cache_lookup (struct file_multi *file, guint side,
+                                    gint *width, gint *height);
+
+extern struct thumb_stream *thumb_stream_new (guint type, guint side,
+                                              gboolean wait);
+extern gboolean thumb_stream_write (struct thumb_stream *stream,
+                                    const guchar *buf, gsize len);
+extern GdkPixbuf *thumb_stream_peek (struct thumb_stream *stream);
+extern GdkPixbuf *thumb_stream_finish (struct thumb_stream *stream,
+                                       struct file_multi *file,
+                                       gboolean cache);
 
 #endif /* _THUMB_H_ */
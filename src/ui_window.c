@@ -39,13 +39,33 @@
 #include <stdlib.h>
 
 #include "about.h"
+#include "file_budget.h"
 #include "geh.h"
 #include "info-window.h"
 #include "ui_window.h"
 
+/**
+ * Image being opened on the open thread pool. Once abandoned the UI
+ * forgets it and it is freed by the thread or idle callback that sees
+ * the stop flag.
+ */
+struct ui_window_open {
+    struct ui_window *ui; /**< Window to show the image in. */
+    struct file_multi *file; /**< File to open. */
+    gboolean zoom_fit; /**< Zoom image to fit when displaying. */
+    gint width; /**< Width to fit, 0 if not known when opening. */
+    gint height; /**< Height to fit, 0 if not known when opening. */
+    gboolean stop; /**< Set when abandoned. */
+    struct image *image; /**< Opened image, NULL if none. */
+};
+
 
 static GtkWidget *ui_window_create_menu (struct ui_window *ui);
 static void ui_window_update_image (struct ui_window *ui);
+static void ui_window_priority_update (struct ui_window *ui);
+static void ui_window_open_abandon (struct ui_window *ui);
+static void ui_window_open_image (gpointer data, gpointer user_data);
+static void ui_window_open_free (struct ui_window_open *open);
 
 /* Callbacks */
 static gboolean callback_key_press (GtkWidget *widget,
@@ -55,8 +75,11 @@ static void callback_zoom (GtkWidget *widget, GdkEventScroll *event, gpointer us
 static void callback_icon_edited (GtkCellRendererText *cell,
                                   gchar *path_string, gchar *text,
                                   gpointer data);
+static void callback_icon_scroll (GtkAdjustment *adjustment, gpointer data);
 
 static gboolean idle_zoom_fit (gpointer data);
+static gboolean idle_open_done (gpointer data);
+static gboolean timeout_priority (gpointer data);
 
 static gboolean callback_menu (GtkWidget *widget, GdkEvent *event);
 static void callback_menu_zoom_orig (GtkMenuItem *item, gpointer data);
@@ -73,8 +96,12 @@ static void callback_menu_view_thumbnail_mode (GtkMenuItem *item, gpointer data)
 static void callback_menu_help_key_bindings (GtkMenuItem *item, gpointer data);
 static void callback_menu_help_about (GtkMenuItem *item, gpointer data);
 
+static void ui_window_progress_text (struct ui_window *ui);
+
 static void slide_next (struct ui_window *ui);
 static void slide_prev (struct ui_window *ui);
+static void slide_skip (struct ui_window *ui, gint percent);
+static void slide_jump (struct ui_window *ui, guint index);
 
 /**
  * Create new ui_window.
@@ -93,9 +120,27 @@ ui_window_new (void)
     ui->thumbnails = 0;
     ui->file = NULL;
     ui->image_data = NULL;
+    ui->open_pool = g_thread_pool_new (&ui_window_open_image, NULL,
+                                       1 /* max threads */,
+                                       FALSE /* exclusive */, NULL);
+    ui->opening = NULL;
+    ui->priority = NULL;
+    ui->priority_data = NULL;
+    ui->priority_source = 0;
+    ui->load = NULL;
+    ui->load_data = NULL;
     ui->progress_total = 0;
     ui->progress_step = 0.0;
     ui->icon_iter.stamp = 0;
+    ui->files = file_table_new ();
+    ui->rows = g_array_new (FALSE, FALSE, sizeof (GtkTreeIter));
+    ui->index = FILE_TABLE_NONE;
+
+    /* Transparent thumbnail shown while the real one is generated */
+    ui->icon_placeholder = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8,
+                                           options.thumb_size,
+                                           options.thumb_size);
+    gdk_pixbuf_fill (ui->icon_placeholder, 0x00000000);
 
     /* Create main UI window */
     ui->window = GTK_WINDOW (gtk_window_new (GTK_WINDOW_TOPLEVEL));
@@ -139,7 +184,8 @@ ui_window_new (void)
     ui->icon_store = gtk_list_store_new (UI_ICON_STORE_FIELDS,
                                          G_TYPE_POINTER, /* struct file */
                                          G_TYPE_STRING, /* Display name */
-                                         GDK_TYPE_PIXBUF); /* Thumbnail */
+                                         GDK_TYPE_PIXBUF, /* Thumbnail */
+                                         G_TYPE_UINT); /* Index in files */
 
     /* Create thumbnail area */
     ui->icon_view_window = GTK_SCROLLED_WINDOW (gtk_scrolled_window_new (NULL, NULL));
@@ -167,6 +213,12 @@ ui_window_new (void)
     gtk_container_add (GTK_CONTAINER (ui->icon_view_window),
                        GTK_WIDGET (ui->icon_view));
 
+    /* Re-rank thumbnail generation when the visible items change */
+    g_signal_connect (gtk_scrolled_window_get_vadjustment (ui->icon_view_window),
+                      "value-changed", G_CALLBACK (callback_icon_scroll), ui);
+    g_signal_connect (gtk_scrolled_window_get_hadjustment (ui->icon_view_window),
+                      "value-changed", G_CALLBACK (callback_icon_scroll), ui);
+
     /* Fill pane */
     gtk_paned_pack1 (ui->pane, GTK_WIDGET (ui->image_window),
                      TRUE /* resize */, TRUE /* shrink */);
@@ -176,6 +228,9 @@ ui_window_new (void)
 
     /* Create progress */
     ui->progress = GTK_PROGRESS_BAR (gtk_progress_bar_new ());
+#if GTK_CHECK_VERSION(3, 0, 0)
+    gtk_progress_bar_set_show_text (ui->progress, TRUE);
+#endif
     g_object_ref (ui->progress);
 
     /* Fill vbox */
@@ -206,10 +261,23 @@ ui_window_free (struct ui_window *ui)
 {
     g_assert (ui);
 
+    /* Opening stops within a chunk or band, wait for it */
+    ui_window_open_abandon (ui);
+    g_thread_pool_free (ui->open_pool, FALSE /* immediate */,
+                        TRUE /* wait */);
+
+    if (ui->priority_source) {
+        g_source_remove (ui->priority_source);
+    }
+
     /* Unref explicitly ref widgets */
     g_object_unref (ui->icon_store);
+    g_object_unref (ui->icon_placeholder);
     g_object_unref (ui->progress);
 
+    file_table_free (ui->files);
+    g_array_free (ui->rows, TRUE);
+
     if (ui->image_data) {
         image_close (ui->image_data);
     }
@@ -296,10 +364,15 @@ ui_window_set_mode (struct ui_window *ui, guint mode)
 
     /* Store mode */
     ui->mode = mode;
+
+    ui_window_priority_update (ui);
 }
 
 /**
- * Sets the file to be used as the current image.
+ * Sets the file to be used as the current image. The image is opened
+ * on the open thread pool and shown once opened, an image still being
+ * opened is abandoned. Remote files with the body not fetched are
+ * handed to the load callback and shown once loaded.
  *
  * @param ui Pointer to struct ui_window.
  * @param file Struct file_multi to get image data from.
@@ -311,7 +384,8 @@ ui_window_set_image (struct ui_window *ui, struct file_multi *file,
                      gboolean zoom_fit, gboolean lock)
 {
     gchar *title;
-    struct image *image_old = ui->image_data;
+    GtkAllocation allocation;
+    struct ui_window_open *open;
 
     g_assert (ui);
 
@@ -325,31 +399,125 @@ ui_window_set_image (struct ui_window *ui, struct file_multi *file,
     gtk_window_set_title (ui->window, title);
     g_free (title);
 
-    /* Open new image */
+    /* Open new image, the current one is shown until it is opened */
+    ui_window_open_abandon (ui);
     ui->file = file;
-    ui->image_data = image_open (file_multi_get_path (file));
-    if (ui->image_data) {
+    if (ui->load && file_multi_is_deferred (file)) {
+        if (ui->image_data) {
+            image_close (ui->image_data);
+            ui->image_data = NULL;
+        }
+        gtk_image_clear (ui->image);
+        ui->load (ui->load_data, file);
+    } else {
+        open = g_malloc (sizeof (struct ui_window_open));
+        open->ui = ui;
+        open->file = file;
+        open->zoom_fit = zoom_fit;
+        open->width = 0;
+        open->height = 0;
+        open->stop = FALSE;
+        open->image = NULL;
+
+        /* Scaled to fit when opened if the size is known already */
         if (zoom_fit) {
-            /* Use an idle function so that the UI gets to update
-               its size before zooming to fit. */
-            g_idle_add (&idle_zoom_fit, (void*) ui);
-        } else {
-            /* Display file */
-            ui_window_update_image (ui);
+            gtk_widget_get_allocation (GTK_WIDGET (ui->image_window),
+                                       &allocation);
+            if ((allocation.width > 16) && (allocation.height > 16)) {
+                open->width = allocation.width - 16;
+                open->height = allocation.height - 16;
+            }
         }
+
+        ui->opening = open;
+        g_thread_pool_push (ui->open_pool, open, NULL);
+    }
+
+    if (lock) {
+        gdk_threads_leave ();
+    }
+}
+
+/**
+ * Opens the current image again if it is file, used when the file has
+ * changed on disk.
+ *
+ * @param ui Pointer to struct ui_window.
+ * @param file Struct file_multi that changed.
+ */
+void
+ui_window_reload_image (struct ui_window *ui, struct file_multi *file)
+{
+    g_assert (ui);
+
+    gdk_threads_enter ();
+    if (ui->file == file) {
+        ui_window_set_image (ui, file, ui->zoom_fit, FALSE /* lock */);
+    }
+    gdk_threads_leave ();
+}
+
+/**
+ * Shows image decoded while its file is still being fetched, updates
+ * of the same file keep the zoom and rotation. Nothing is done if
+ * another image is shown since.
+ *
+ * @param ui Pointer to struct ui_window.
+ * @param file Struct file_multi being fetched.
+ * @param replace Struct file_multi the image follows, its zoom and
+ *                rotation are kept if it is shown. NULL if none.
+ * @param pix Pointer to GdkPixbuf with the image loaded so far,
+ *            reference is taken over.
+ * @return TRUE if the image is shown, else FALSE.
+ */
+gboolean
+ui_window_set_preview (struct ui_window *ui, struct file_multi *file,
+                       struct file_multi *replace, GdkPixbuf *pix)
+{
+    gchar *title;
+    gboolean keep;
+    struct image *image_old;
+
+    g_assert (ui);
+
+    gdk_threads_enter ();
+
+    if (ui->file && (ui->file != file) && (ui->file != replace)) {
+        g_object_unref (pix);
+        gdk_threads_leave ();
+        return FALSE;
+    }
+
+    image_old = ui->image_data;
+    ui->image_data = image_new (pix);
+    keep = image_old && ui->file;
+
+    if (ui->file != file) {
+        /* Update title */
+        title = g_strdup_printf ("geh: %s", file_multi_get_name (file));
+        gtk_window_set_title (ui->window, title);
+        g_free (title);
+
+        ui->file = file;
+    }
+
+    if (keep) {
+        image_zoom_set (ui->image_data, image_old->zoom);
+        image_rotate_set (ui->image_data, image_old->rotation);
+        ui_window_update_image (ui);
+    } else if (ui->zoom_fit) {
+        g_idle_add (&idle_zoom_fit, (void*) ui);
     } else {
-        g_log (G_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
-               "Failed to activate image %s", file_multi_get_path (file));
+        ui_window_update_image (ui);
     }
 
-    /* Clean up resources */
     if (image_old) {
         image_close (image_old);
     }
 
-    if (lock) {
-        gdk_threads_leave ();
-    }
+    gdk_threads_leave ();
+
+    return TRUE;
 }
 
 /**
@@ -357,11 +525,16 @@ ui_window_set_image (struct ui_window *ui, struct file_multi *file,
  *
  * @param ui Pointer to struct ui_window.
  * @param path Pointer to original file.
- * @param pix Pointer to GdkPixbuf to add.
+ * @param pix Pointer to GdkPixbuf to add, NULL adds a placeholder.
+ * @param iter Set to the added row if not NULL.
  */
 void
-ui_window_add_thumbnail (struct ui_window *ui, struct file_multi *file, GdkPixbuf *pix)
+ui_window_add_thumbnail (struct ui_window *ui, struct file_multi *file,
+                         GdkPixbuf *pix, GtkTreeIter *iter)
 {
+    guint index;
+    GtkTreeIter iter_add;
+
     g_assert (ui);
 
     /* Thread safety */
@@ -389,18 +562,161 @@ ui_window_add_thumbnail (struct ui_window *ui, struct file_multi *file, GdkPixbu
         g_sprintf (name + UI_THUMB_CHARS - 4, "...");
     }
 
-    /* Add thumbnail */
-    gtk_list_store_append (ui->icon_store, &ui->icon_iter_add);
-    gtk_list_store_set (ui->icon_store, &ui->icon_iter_add,
+    /* Add thumbnail, rows are appended so the store and files share
+       order. */
+    gtk_list_store_append (ui->icon_store, &iter_add);
+    index = file_table_append (ui->files, file);
+    g_array_append_val (ui->rows, iter_add);
+    gtk_list_store_set (ui->icon_store, &iter_add,
                         UI_ICON_STORE_FILE, file,
                         UI_ICON_STORE_NAME, name,
-                        UI_ICON_STORE_THUMB, pix, -1);
+                        UI_ICON_STORE_THUMB,
+                        pix ? pix : ui->icon_placeholder,
+                        UI_ICON_STORE_INDEX, index, -1);
 
     gdk_threads_leave ();
 
+    /* List store iterators persist as long as the row exists. */
+    if (iter) {
+        *iter = iter_add;
+    }
+
     free (name);
 }
 
+/**
+ * Sets thumbnail on row previously added with ui_window_add_thumbnail.
+ *
+ * @param ui Pointer to struct ui_window.
+ * @param iter Row to update.
+ * @param pix Pointer to GdkPixbuf to set.
+ */
+void
+ui_window_set_thumbnail (struct ui_window *ui, GtkTreeIter *iter,
+                         GdkPixbuf *pix)
+{
+    g_assert (ui);
+
+    gdk_threads_enter ();
+    gtk_list_store_set (ui->icon_store, iter, UI_ICON_STORE_THUMB, pix, -1);
+    gdk_threads_leave ();
+}
+
+/**
+ * Replaces thumbnail with the placeholder to free its memory, the row
+ * is left alone if it has been given another thumbnail since.
+ *
+ * @param ui Pointer to struct ui_window.
+ * @param iter Row to update.
+ * @param pix Pointer to GdkPixbuf to replace.
+ */
+void
+ui_window_spill_thumbnail (struct ui_window *ui, GtkTreeIter *iter,
+                           GdkPixbuf *pix)
+{
+    GdkPixbuf *shown;
+
+    g_assert (ui);
+
+    gdk_threads_enter ();
+    gtk_tree_model_get (GTK_TREE_MODEL (ui->icon_store), iter,
+                        UI_ICON_STORE_THUMB, &shown, -1);
+    if (shown == pix) {
+        gtk_list_store_set (ui->icon_store, iter,
+                            UI_ICON_STORE_THUMB, ui->icon_placeholder, -1);
+    }
+    if (shown) {
+        g_object_unref (shown);
+    }
+    gdk_threads_leave ();
+}
+
+/**
+ * Removes row previously added with ui_window_add_thumbnail.
+ *
+ * @param ui Pointer to struct ui_window.
+ * @param iter Row to remove.
+ */
+void
+ui_window_remove_thumbnail (struct ui_window *ui, GtkTreeIter *iter)
+{
+    guint index;
+
+    g_assert (ui);
+
+    gdk_threads_enter ();
+
+    /* Entry keeps its index, next/prev continue from its position. */
+    gtk_tree_model_get (GTK_TREE_MODEL (ui->icon_store), iter,
+                        UI_ICON_STORE_INDEX, &index, -1);
+    file_table_remove (ui->files, index);
+    if (index == ui->index) {
+        ui->icon_iter.stamp = 0;
+    }
+
+    gtk_list_store_remove (ui->icon_store, iter);
+
+    ui->thumbnails--;
+    if (ui->mode != UI_WINDOW_MODE_THUMB) {
+        gtk_icon_view_set_columns (ui->icon_view, ui->thumbnails);
+    }
+
+    gdk_threads_leave ();
+}
+
+/**
+ * Sets callback receiving the files to generate thumbnails for first,
+ * the current image and its neighbours followed by the visible items.
+ *
+ * @param ui Pointer to struct ui_window.
+ * @param priority Callback, NULL to unset.
+ * @param priority_data Data for callback.
+ */
+void
+ui_window_set_priority_callback (struct ui_window *ui,
+                                 void (*priority) (gpointer, GList*),
+                                 gpointer priority_data)
+{
+    g_assert (ui);
+
+    ui->priority = priority;
+    ui->priority_data = priority_data;
+}
+
+/**
+ * Sets callback loading remote files shown before their body is
+ * fetched, called with GDK locked. The image is set again once loaded.
+ *
+ * @param ui Pointer to struct ui_window.
+ * @param load Callback, NULL to unset.
+ * @param load_data Data for callback.
+ */
+void
+ui_window_set_load_callback (struct ui_window *ui,
+                             void (*load) (gpointer, struct file_multi*),
+                             gpointer load_data)
+{
+    g_assert (ui);
+
+    ui->load = load;
+    ui->load_data = load_data;
+}
+
+/**
+ * Schedules re-ranking of thumbnail generation, delayed so that
+ * scrolling does not re-rank on every step.
+ *
+ * @param ui Pointer to struct ui_window.
+ */
+void
+ui_window_priority_update (struct ui_window *ui)
+{
+    if (ui->priority && ! ui->priority_source) {
+        ui->priority_source =
+            gdk_threads_add_timeout (UI_PRIORITY_DELAY, &timeout_priority, ui);
+    }
+}
+
 /**
  * Builds main menu for geh.
  *
@@ -566,6 +882,180 @@ idle_zoom_fit (gpointer data)
     return FALSE;
 }
 
+/**
+ * Abandons the image being opened, if any. It stops reading, decoding
+ * and scaling at the next chunk or band.
+ *
+ * @param ui Pointer to struct ui_window.
+ */
+void
+ui_window_open_abandon (struct ui_window *ui)
+{
+    if (ui->opening) {
+        ui->opening->stop = TRUE;
+        ui->opening = NULL;
+    }
+}
+
+/**
+ * Opens image, run on the open thread pool. The image is handed to the
+ * UI in an idle callback unless abandoned.
+ *
+ * @param data Pointer to struct ui_window_open.
+ * @param user_data Not used.
+ */
+void
+ui_window_open_image (gpointer data, gpointer user_data)
+{
+    struct ui_window_open *open = (struct ui_window_open*) data;
+
+    if (! open->stop) {
+        open->image = image_open (open->file, &open->stop);
+    }
+    if (open->image && (open->width > 0)) {
+        image_zoom_fit (open->image, open->width, open->height);
+    }
+
+    if (open->stop) {
+        ui_window_open_free (open);
+    } else {
+        gdk_threads_add_idle (&idle_open_done, open);
+    }
+}
+
+/**
+ * Shows image opened on the open thread pool, replacing the current
+ * image. Nothing is done if it was abandoned since.
+ *
+ * @param data Pointer to struct ui_window_open.
+ * @return FALSE
+ */
+gboolean
+idle_open_done (gpointer data)
+{
+    struct image *image_old;
+    struct ui_window_open *open = (struct ui_window_open*) data;
+    struct ui_window *ui = open->ui;
+
+    if (open->stop) {
+        ui_window_open_free (open);
+        return FALSE;
+    }
+
+    ui->opening = NULL;
+    image_old = ui->image_data;
+    ui->image_data = open->image;
+    open->image = NULL;
+
+    if (ui->image_data) {
+        /* Freed with the open, later updates are not stopped */
+        ui->image_data->stop = NULL;
+        if (open->zoom_fit) {
+            /* Use an idle function so that the UI gets to update
+               its size before zooming to fit. */
+            g_idle_add (&idle_zoom_fit, (void*) ui);
+        } else {
+            /* Display file */
+            ui_window_update_image (ui);
+        }
+    } else {
+        g_log (G_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
+               "Failed to activate image %s",
+               file_multi_get_path (open->file));
+    }
+
+    /* Clean up resources */
+    if (image_old) {
+        image_close (image_old);
+    }
+    ui_window_open_free (open);
+
+    return FALSE;
+}
+
+/**
+ * Frees image being opened.
+ *
+ * @param open Pointer to struct ui_window_open to free.
+ */
+void
+ui_window_open_free (struct ui_window_open *open)
+{
+    if (open->image) {
+        image_close (open->image);
+    }
+    g_free (open);
+}
+
+/**
+ * Collects the current image, its slide neighbours and the visible
+ * items and passes them to the priority callback.
+ *
+ * @param data Pointer to struct ui_window.
+ * @return FALSE
+ */
+gboolean
+timeout_priority (gpointer data)
+{
+    gint i, count;
+    GList *files = NULL;
+    GtkTreeIter iter;
+    GtkTreePath *path, *start, *end;
+    GtkTreeModel *model;
+    struct file_multi *file;
+    struct ui_window *ui = (struct ui_window*) data;
+
+    ui->priority_source = 0;
+    if (! ui->priority) {
+        return FALSE;
+    }
+
+    model = GTK_TREE_MODEL (ui->icon_store);
+
+    /* Current image and its neighbours in both directions */
+    if (ui->icon_iter.stamp != 0) {
+        gtk_tree_model_get (model, &ui->icon_iter,
+                            UI_ICON_STORE_FILE, &file, -1);
+        files = g_list_prepend (files, file);
+
+        iter = ui->icon_iter;
+        for (i = 0; i < UI_PRIORITY_NEIGHBOURS
+                 && gtk_tree_model_iter_next (model, &iter); i++) {
+            gtk_tree_model_get (model, &iter, UI_ICON_STORE_FILE, &file, -1);
+            files = g_list_prepend (files, file);
+        }
+
+        path = gtk_tree_model_get_path (model, &ui->icon_iter);
+        for (i = 0; i < UI_PRIORITY_NEIGHBOURS && gtk_tree_path_prev (path)
+                 && gtk_tree_model_get_iter (model, &iter, path); i++) {
+            gtk_tree_model_get (model, &iter, UI_ICON_STORE_FILE, &file, -1);
+            files = g_list_prepend (files, file);
+        }
+        gtk_tree_path_free (path);
+    }
+
+    /* Visible items in the thumbnail view */
+    if (gtk_icon_view_get_visible_range (ui->icon_view, &start, &end)) {
+        count = gtk_tree_path_get_indices (end)[0]
+            - gtk_tree_path_get_indices (start)[0] + 1;
+        if (gtk_tree_model_get_iter (model, &iter, start)) {
+            do {
+                gtk_tree_model_get (model, &iter,
+                                    UI_ICON_STORE_FILE, &file, -1);
+                files = g_list_prepend (files, file);
+            } while (--count > 0 && gtk_tree_model_iter_next (model, &iter));
+        }
+        gtk_tree_path_free (start);
+        gtk_tree_path_free (end);
+    }
+
+    files = g_list_reverse (files);
+    ui->priority (ui->priority_data, files);
+    g_list_free (files);
+
+    return FALSE;
+}
+
 /**
  * Callback to handle key press events.
  *
@@ -615,13 +1105,36 @@ callback_key_press (GtkWidget *widget, GdkEventKey *key, gpointer data)
         /* Prev image (if in slideshow/full mode). */
         slide_prev (ui);      
         break;
+    case GDK_KEY_Home:
+    case GDK_KEY_End:
+    case GDK_KEY_Page_Up:
+    case GDK_KEY_Page_Down:
+        /* Thumbnail view scrolls itself in thumb mode. */
+        if (ui->mode == UI_WINDOW_MODE_THUMB) {
+            return FALSE;
+        }
+
+        if (key->keyval == GDK_KEY_Home) {
+            slide_skip (ui, -100);
+        } else if (key->keyval == GDK_KEY_End) {
+            slide_skip (ui, 100);
+        } else if (key->keyval == GDK_KEY_Page_Up) {
+            slide_skip (ui, -UI_JUMP_PERCENT);
+        } else {
+            slide_skip (ui, UI_JUMP_PERCENT);
+        }
+        break;
     case GDK_KEY_minus:
-        image_zoom (ui->image_data, -10);
-        ui_window_update_image (ui);
+        if (ui->image_data) {
+            image_zoom (ui->image_data, -10);
+            ui_window_update_image (ui);
+        }
         break;
     case GDK_KEY_plus:
-        image_zoom (ui->image_data, 10);
-        ui_window_update_image (ui);
+        if (ui->image_data) {
+            image_zoom (ui->image_data, 10);
+            ui_window_update_image (ui);
+        }
         break;
     case GDK_KEY_F11:
         if (ui->is_fullscreen) {
@@ -661,11 +1174,13 @@ callback_image (GtkIconView *icon_view, GtkTreePath *tree_path, gpointer data)
     gtk_tree_model_get_iter (GTK_TREE_MODEL (ui->icon_store),
                              &ui->icon_iter, tree_path);
     gtk_tree_model_get (GTK_TREE_MODEL (ui->icon_store), &ui->icon_iter,
-                        UI_ICON_STORE_FILE, &file, -1);
+                        UI_ICON_STORE_FILE, &file,
+                        UI_ICON_STORE_INDEX, &ui->index, -1);
     gtk_icon_view_scroll_to_path (ui->icon_view, tree_path, FALSE, 0, 0);
 
     /* Activate image and ensure that thumbnail being visible */
     ui_window_set_image (ui, file, ui->zoom_fit, FALSE);
+    ui_window_priority_update (ui);
 }
 
 /**
@@ -738,6 +1253,18 @@ callback_icon_edited (GtkCellRendererText *cell,
     }
 }
 
+/**
+ * Callback when the thumbnail view is scrolled.
+ *
+ * @param adjustment Adjustment that changed.
+ * @param data Pointer to struct ui_window.
+ */
+void
+callback_icon_scroll (GtkAdjustment *adjustment, gpointer data)
+{
+    ui_window_priority_update ((struct ui_window*) data);
+}
+
 /**
  * Handles callbacks for displaying the menu.
  *
@@ -1107,6 +1634,7 @@ ui_window_progress_progress (struct ui_window *ui, gint count, gboolean lock)
     fraction = ui->progress_curr * ui->progress_step;
 
     gtk_progress_bar_set_fraction (ui->progress, fraction);
+    ui_window_progress_text (ui);
 
     if (lock) {
         gdk_threads_leave ();
@@ -1167,37 +1695,42 @@ ui_window_progress_add (gpointer data, gint count)
 }
 
 /**
- * Show the next image in the set.
+ * Shows loaded count and memory used by the pipeline on the progress bar.
+ *
+ * @param ui Pointer to struct ui_window.
  */
 void
-slide_next (struct ui_window *ui)
+ui_window_progress_text (struct ui_window *ui)
 {
-    gboolean set_image = TRUE;
-    struct file_multi *file;
-
-    if (ui->icon_iter.stamp == 0) {
-        set_image = FALSE;
+    gchar *used, *limit, *text;
+
+    used = g_format_size (file_budget_get_used ());
+    if (file_budget_get_limit () > 0) {
+        limit = g_format_size (file_budget_get_limit ());
+        text = g_strdup_printf ("%d / %d, %s of %s", ui->progress_curr,
+                                ui->progress_total, used, limit);
+        g_free (limit);
     } else {
-        set_image = gtk_tree_model_iter_next (
-            GTK_TREE_MODEL (ui->icon_store), &ui->icon_iter);
+        text = g_strdup_printf ("%d / %d, %s", ui->progress_curr,
+                                ui->progress_total, used);
     }
 
-    if (! set_image) {
-        set_image = gtk_tree_model_get_iter_first(
-            GTK_TREE_MODEL (ui->icon_store), &ui->icon_iter);
-    }
+    gtk_progress_bar_set_text (ui->progress, text);
 
-    if (set_image) {
-        gtk_tree_model_get (GTK_TREE_MODEL (ui->icon_store), &ui->icon_iter,
-                            UI_ICON_STORE_FILE, &file, -1);
+    g_free (text);
+    g_free (used);
+}
 
-        /* Update selected item. */
-        GtkTreePath *path = gtk_tree_model_get_path (GTK_TREE_MODEL (ui->icon_store), &ui->icon_iter);
-        gtk_icon_view_select_path (ui->icon_view, path);
-        gtk_icon_view_scroll_to_path (ui->icon_view, path, FALSE, 0, 0);
-        gtk_tree_path_free (path);
+/**
+ * Show the next image in the set.
+ */
+void
+slide_next (struct ui_window *ui)
+{
+    guint index = ui->index;
 
-        ui_window_set_image (ui, file, ui->zoom_fit, FALSE);        
+    if (file_table_step (ui->files, &index, 1)) {
+        slide_jump (ui, index);
     }
 }
 
@@ -1207,42 +1740,79 @@ slide_next (struct ui_window *ui)
 void
 slide_prev (struct ui_window *ui)
 {
-    int i;
-    gboolean set_image;
-    struct file_multi *file;
-    GtkTreePath *path;
+    guint index = ui->index;
 
-    if (ui->icon_iter.stamp == 0) {
-        set_image = FALSE;
-    } else {
-        path = gtk_tree_model_get_path (GTK_TREE_MODEL (ui->icon_store), 
-                                        &ui->icon_iter);
-        set_image = gtk_tree_path_prev (path)
-            && gtk_tree_model_get_iter (GTK_TREE_MODEL (ui->icon_store), 
-                                        &ui->icon_iter, path);
-        gtk_tree_path_free(path);
+    if (file_table_step (ui->files, &index, -1)) {
+        slide_jump (ui, index);
     }
+}
+
+/**
+ * Skips forward or back a percentage of the set, stopping at the first
+ * and last image.
+ *
+ * @param ui Pointer to struct ui_window.
+ * @param percent Percent of images to skip, negative skips back.
+ */
+void
+slide_skip (struct ui_window *ui, gint percent)
+{
+    guint index, len;
+    gint64 target;
 
-    if (! set_image) {
-        set_image = gtk_tree_model_get_iter_first(
-            GTK_TREE_MODEL (ui->icon_store), &ui->icon_iter);        
+    len = file_table_len (ui->files);
+    if (len == 0) {
+        return;
+    }
 
-        for (i = 1; i < ui->thumbnails && set_image; i++ ) {
-            set_image = gtk_tree_model_iter_next (
-                GTK_TREE_MODEL (ui->icon_store), &ui->icon_iter);
+    /* Skipping back lands on the last image not removed at or before
+       target, skipping forward on the first at or after it. */
+    target = (ui->index == FILE_TABLE_NONE) ? 0 : ui->index;
+    target += (gint64) len * percent / 100;
+    if (percent < 0) {
+        if (target <= 0) {
+            index = FILE_TABLE_NONE;
+            if (file_table_step (ui->files, &index, 1)) {
+                slide_jump (ui, index);
+            }
+        } else {
+            index = target + 1;
+            if (file_table_step (ui->files, &index, -1)) {
+                slide_jump (ui, index);
+            }
+        }
+    } else if (target >= len - 1) {
+        index = FILE_TABLE_NONE;
+        if (file_table_step (ui->files, &index, -1)) {
+            slide_jump (ui, index);
         }
+    } else if (file_table_seek (ui->files, &index, target)) {
+        slide_jump (ui, index);
     }
+}
 
-    if (set_image) {
-        gtk_tree_model_get (GTK_TREE_MODEL (ui->icon_store), &ui->icon_iter,
-                            UI_ICON_STORE_FILE, &file, -1);
+/**
+ * Shows image at index in the set.
+ *
+ * @param ui Pointer to struct ui_window.
+ * @param index Index in files of an entry not removed.
+ */
+void
+slide_jump (struct ui_window *ui, guint index)
+{
+    GtkTreePath *path;
 
-        /* Update selected item. */
-        GtkTreePath *path = gtk_tree_model_get_path (GTK_TREE_MODEL (ui->icon_store), &ui->icon_iter);
-        gtk_icon_view_select_path (ui->icon_view, path);
-        gtk_icon_view_scroll_to_path (ui->icon_view, path, FALSE, 0, 0);
-        gtk_tree_path_free (path);
+    ui->index = index;
+    ui->icon_iter = g_array_index (ui->rows, GtkTreeIter, index);
 
-        ui_window_set_image (ui, file, ui->zoom_fit, FALSE);        
-    }
+    /* Update selected item. */
+    path = gtk_tree_model_get_path (GTK_TREE_MODEL (ui->icon_store),
+                                    &ui->icon_iter);
+    gtk_icon_view_select_path (ui->icon_view, path);
+    gtk_icon_view_scroll_to_path (ui->icon_view, path, FALSE, 0, 0);
+    gtk_tree_path_free (path);
+
+    ui_window_set_image (ui, file_table_get (ui->files, index),
+                         ui->zoom_fit, FALSE);
+    ui_window_priority_update (ui);
 }
@@ -36,12 +36,14 @@
 #include <gtk/gtk.h>
 
 #include "file_multi.h"
+#include "file_table.h"
 #include "image.h"
 
 #define UI_ICON_STORE_FILE 0
 #define UI_ICON_STORE_NAME 1
 #define UI_ICON_STORE_THUMB 2
-#define UI_ICON_STORE_FIELDS 3
+#define UI_ICON_STORE_INDEX 3
+#define UI_ICON_STORE_FIELDS 4
 
 #define UI_WINDOW_MODE_FULL 0
 #define UI_WINDOW_MODE_SLIDE 1
@@ -51,6 +53,12 @@
 #define UI_THUMB_CHARS 14
 #define UI_SLIDE_PADDING 84
 
+#define UI_PRIORITY_DELAY 100 /**< Milliseconds to wait before re-ranking. */
+#define UI_PRIORITY_NEIGHBOURS 4 /**< Slide neighbours ranked each way. */
+#define UI_JUMP_PERCENT 10 /**< Percent of files skipped by page up/down. */
+
+struct ui_window_open;
+
 /**
  * Struct defining UI window.
  */
@@ -71,12 +79,25 @@ struct ui_window {
   GtkScrolledWindow *icon_view_window; /** Thumbnail Area */
   GtkListStore *icon_store; /**< Thumbnail Store */
   GtkTreeIter icon_iter; /**< Thumbnail Store Iterator */
-  GtkTreeIter icon_iter_add; /**< Thumbnail Store Iterator for adding data */
+  struct file_table *files; /**< Files in thumbnail order. */
+  GArray *rows; /**< Thumbnail Store Iterator for each entry in files. */
+  guint index; /**< Index of active file in files. */
+  GdkPixbuf *icon_placeholder; /**< Thumbnail shown until generated. */
   guint thumbnails; /**< Number of thumbnails */
 
   guint mode; /**< Current mode of window. */
   struct file_multi *file; /**< Active file. */
   struct image *image_data; /**< Image wrapper for scaling/rotating. */
+  GThreadPool *open_pool; /**< Opens images off the UI thread. */
+  struct ui_window_open *opening; /**< Image being opened, NULL if none. */
+
+  void (*priority)(gpointer, GList*); /**< Thumbnail priority callback. */
+  gpointer priority_data; /**< Data for priority callback. */
+  guint priority_source; /**< Pending re-ranking timeout, 0 if none. */
+
+  void (*load)(gpointer, struct file_multi*); /**< Deferred file loading
+                                                   callback. */
+  gpointer load_data; /**< Data for load callback. */
 
   GtkProgressBar *progress; /**< Progress bar for loading. */
   gint progress_total; /**< Total number to load. */
@@ -96,9 +117,31 @@ extern void ui_window_set_mode (struct ui_window *ui, guint mode);
 extern void ui_window_set_image (struct ui_window *ui, struct file_multi *file,
                                  gboolean zoom_fit, gboolean lock);
 
+extern void ui_window_reload_image (struct ui_window *ui,
+                                   struct file_multi *file);
+extern gboolean ui_window_set_preview (struct ui_window *ui,
+                                      struct file_multi *file,
+                                      struct file_multi *replace,
+                                      GdkPixbuf *pix);
+
 extern void ui_window_add_thumbnail (struct ui_window *ui,
-                                     struct file_multi *file, GdkPixbuf *pix);
+                                     struct file_multi *file, GdkPixbuf *pix,
+                                     GtkTreeIter *iter);
+extern void ui_window_set_thumbnail (struct ui_window *ui, GtkTreeIter *iter,
+                                     GdkPixbuf *pix);
+extern void ui_window_spill_thumbnail (struct ui_window *ui,
+                                       GtkTreeIter *iter, GdkPixbuf *pix);
+extern void ui_window_remove_thumbnail (struct ui_window *ui,
+                                        GtkTreeIter *iter);
 extern void ui_window_clear_thumbnails (struct ui_window *ui);
+extern void ui_window_set_priority_callback (struct ui_window *ui,
+                                             void (*priority) (gpointer,
+                                                               GList*),
+                                             gpointer priority_data);
+extern void ui_window_set_load_callback (struct ui_window *ui,
+                                         void (*load) (gpointer,
+                                                       struct file_multi*),
+                                         gpointer load_data);
 
 extern void ui_window_progress_show (struct ui_window *ui, gboolean lock);
 extern void ui_window_progress_hide (struct ui_window *ui, gboolean lock);
@@ -36,7 +36,7 @@
 #include "util.h"
 
 /**
- * Lazy case insensitive strpos.
+ * Case insensitive strpos, compares in place without copying.
  *
  * @param haystack String to search in.
  * @param needle String to find.
@@ -45,23 +45,21 @@
 const gchar*
 util_stripos (const gchar *haystack, const gchar *needle)
 {
-    gchar *haystack_up = g_ascii_strup (g_strdup (haystack), strlen (haystack));
-    gchar *needle_up = g_ascii_strup (g_strdup (needle), strlen (needle));
+    gsize len = strlen (needle);
+    gchar first = g_ascii_tolower (needle[0]);
 
-    const gchar *pos;
-
-    /* Find needle in haystack */ 
-    pos = strstr (haystack_up, needle_up);
-    if (pos) {
-        /* Get position in original stack */
-        pos = haystack + ((pos - haystack_up) / sizeof (pos[0]));
+    if (len == 0) {
+        return haystack;
     }
 
-    /* Clean resources */
-    g_free (haystack_up);
-    g_free (needle_up);
+    for (; *haystack; haystack++) {
+        if ((g_ascii_tolower (*haystack) == first)
+            && ! g_ascii_strncasecmp (haystack, needle, len)) {
+            return haystack;
+        }
+    }
 
-    return pos;
+    return NULL;
 }
 
 /**